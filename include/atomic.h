@@ -0,0 +1,196 @@
+/*
+ * ARM64 Atomic Operations
+ * Plain loads/stores with ordering use the compiler builtins (LDAR/STLR);
+ * read-modify-write operations are written out here so the freestanding
+ * kernel never depends on libgcc atomic helpers. Each one uses a single
+ * ARMv8.1 LSE instruction (CAS, LDADD, SWP) when atomic_init() found the
+ * extension, and an LDAXR/STLXR loop otherwise.
+ */
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "memory.h"
+
+// Set by atomic_init() when ID_AA64ISAR0_EL1 reports LSE atomics
+extern int atomic_lse;
+
+// Detect LSE on the boot CPU (call before starting secondaries)
+void atomic_init(void);
+
+// Ordered loads and stores
+#define atomic_load_relaxed(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define atomic_load_acquire(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_relaxed(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define atomic_store_release(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// Full barrier between the caller's earlier and later memory accesses
+static inline void atomic_fence(void)
+{
+    __asm__ volatile("dmb ish" ::: "memory");
+}
+
+/*
+ * Compare-and-swap with acquire/release semantics
+ * Returns 1 if *ptr was 'expected' and now holds 'desired'
+ */
+static inline int atomic_cas64(volatile uint64_t* ptr, uint64_t expected, uint64_t desired)
+{
+    uint64_t old;
+
+    if (atomic_lse) {
+        old = expected;
+        __asm__ volatile(
+            ".arch_extension lse\n"
+            "casal   %0, %2, [%1]\n"
+            : "+r"(old)
+            : "r"(ptr), "r"(desired)
+            : "memory");
+        return old == expected;
+    }
+
+    uint32_t failed;
+    __asm__ volatile(
+        "1: ldaxr   %0, [%2]\n"
+        "   cmp     %0, %3\n"
+        "   b.ne    2f\n"
+        "   stlxr   %w1, %4, [%2]\n"
+        "   cbnz    %w1, 1b\n"
+        "2:\n"
+        : "=&r"(old), "=&r"(failed)
+        : "r"(ptr), "r"(expected), "r"(desired)
+        : "cc", "memory");
+
+    return old == expected;
+}
+
+// Atomically add and return the previous value
+static inline uint64_t atomic_fetch_add64(volatile uint64_t* ptr, uint64_t value)
+{
+    uint64_t old;
+
+    if (atomic_lse) {
+        __asm__ volatile(
+            ".arch_extension lse\n"
+            "ldaddal %2, %0, [%1]\n"
+            : "=r"(old)
+            : "r"(ptr), "r"(value)
+            : "memory");
+        return old;
+    }
+
+    uint64_t sum;
+    uint32_t failed;
+    __asm__ volatile(
+        "1: ldaxr   %0, [%3]\n"
+        "   add     %1, %0, %4\n"
+        "   stlxr   %w2, %1, [%3]\n"
+        "   cbnz    %w2, 1b\n"
+        : "=&r"(old), "=&r"(sum), "=&r"(failed)
+        : "r"(ptr), "r"(value)
+        : "memory");
+
+    return old;
+}
+
+static inline uint32_t atomic_fetch_add32(volatile uint32_t* ptr, uint32_t value)
+{
+    uint32_t old;
+
+    if (atomic_lse) {
+        __asm__ volatile(
+            ".arch_extension lse\n"
+            "ldaddal %w2, %w0, [%1]\n"
+            : "=r"(old)
+            : "r"(ptr), "r"(value)
+            : "memory");
+        return old;
+    }
+
+    uint32_t sum, failed;
+    __asm__ volatile(
+        "1: ldaxr   %w0, [%3]\n"
+        "   add     %w1, %w0, %w4\n"
+        "   stlxr   %w2, %w1, [%3]\n"
+        "   cbnz    %w2, 1b\n"
+        : "=&r"(old), "=&r"(sum), "=&r"(failed)
+        : "r"(ptr), "r"(value)
+        : "memory");
+
+    return old;
+}
+
+// Atomically store a value and return the previous one
+static inline uint32_t atomic_swap32(volatile uint32_t* ptr, uint32_t value)
+{
+    uint32_t old;
+
+    if (atomic_lse) {
+        __asm__ volatile(
+            ".arch_extension lse\n"
+            "swpal   %w2, %w0, [%1]\n"
+            : "=r"(old)
+            : "r"(ptr), "r"(value)
+            : "memory");
+        return old;
+    }
+
+    uint32_t failed;
+    __asm__ volatile(
+        "1: ldaxr   %w0, [%2]\n"
+        "   stlxr   %w1, %w3, [%2]\n"
+        "   cbnz    %w1, 1b\n"
+        : "=&r"(old), "=&r"(failed)
+        : "r"(ptr), "r"(value)
+        : "memory");
+
+    return old;
+}
+
+static inline uint64_t atomic_swap64(volatile uint64_t* ptr, uint64_t value)
+{
+    uint64_t old;
+
+    if (atomic_lse) {
+        __asm__ volatile(
+            ".arch_extension lse\n"
+            "swpal   %2, %0, [%1]\n"
+            : "=r"(old)
+            : "r"(ptr), "r"(value)
+            : "memory");
+        return old;
+    }
+
+    uint32_t failed;
+    __asm__ volatile(
+        "1: ldaxr   %0, [%2]\n"
+        "   stlxr   %w1, %3, [%2]\n"
+        "   cbnz    %w1, 1b\n"
+        : "=&r"(old), "=&r"(failed)
+        : "r"(ptr), "r"(value)
+        : "memory");
+
+    return old;
+}
+
+/*
+ * Wait until the 32-bit word at 'ptr' differs from 'value'
+ * The exclusive load arms the monitor, so the store that changes the
+ * word wakes this CPU from WFE without an explicit SEV
+ */
+static inline void atomic_wait32(volatile uint32_t* ptr, uint32_t value)
+{
+    uint32_t seen;
+
+    __asm__ volatile(
+        "   sevl\n"
+        "1: wfe\n"
+        "   ldaxr   %w0, [%1]\n"
+        "   cmp     %w0, %w2\n"
+        "   b.eq    1b\n"
+        : "=&r"(seen)
+        : "r"(ptr), "r"(value)
+        : "cc", "memory");
+}
+
+#endif // ATOMIC_H
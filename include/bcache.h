@@ -0,0 +1,91 @@
+/*
+ * Buffer Cache
+ * 4KB disk blocks cached by (device, block) in a hash table. Eviction is
+ * CLOCK-Pro: hot and cold resident blocks plus non-resident "test"
+ * entries that remember recently evicted cold blocks, with the cold
+ * share adapting to how often they come back. Writes are delayed and
+ * written back in batches that the I/O scheduler sorts and merges;
+ * sequential reads trigger asynchronous readahead.
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "memory.h"
+#include "iosched.h"
+
+#define BCACHE_BLOCK_SIZE       4096
+#define BCACHE_DEV_DISK         0           // The virtio-blk disk (only device so far)
+
+#define BCACHE_MIN_BUFFERS      64
+#define BCACHE_MAX_BUFFERS      4096        // 16MB
+#define BCACHE_RAM_SHARE        8           // Use 1/8 of the free pages at boot
+#define BCACHE_WRITEBACK_MS     5000        // Dirty blocks reach the disk within this
+#define BCACHE_RA_MIN           4           // Readahead window, blocks
+#define BCACHE_RA_MAX           32
+
+// Buffer flags
+#define BUF_VALID               0x01        // Data matches the disk (or newer)
+#define BUF_DIRTY               0x02        // Newer than the disk
+#define BUF_IO                  0x04        // Read or write in flight
+#define BUF_HOT                 0x08        // CLOCK-Pro hot block
+#define BUF_TEST                0x10        // Cold block in its test period
+#define BUF_REF                 0x20        // Referenced since the clock last passed
+#define BUF_READAHEAD           0x40        // Read ahead, not yet used
+
+typedef struct buf {
+    int dev;
+    uint64_t block;
+    uint8_t* data;                          // NULL for non-resident test entries
+    volatile uint32_t flags;
+    int refcount;
+    struct buf* hash_next;
+    struct buf* clock_prev;
+    struct buf* clock_next;
+    io_t io;                                // Read or write of the whole block
+} buf_t;
+
+typedef struct {
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long test_hits;                // Misses on a remembered cold block
+    unsigned long readahead;                // Blocks read ahead
+    unsigned long readahead_used;
+    unsigned long evictions;
+    unsigned long promotions;               // Cold to hot
+    unsigned long demotions;                // Hot to cold
+    unsigned long written;                  // Blocks written back
+    unsigned long errors;
+} bcache_stats_t;
+
+// Boot CPU, after blk_init(): size the cache from free memory
+void bcache_init(void);
+
+// Blocks on a device, 0 if it does not exist
+uint64_t bcache_blocks(int dev);
+
+/*
+ * Referenced buffer holding the block's data (read from the disk on a
+ * miss), or NULL on an I/O error. bcache_get() skips the read for
+ * blocks about to be overwritten whole (a missing block is zeroed).
+ */
+buf_t* bcache_read(int dev, uint64_t block);
+buf_t* bcache_get(int dev, uint64_t block);
+
+// After changing a buffer's data: write it back later
+void bcache_dirty(buf_t* buf);
+
+void bcache_release(buf_t* buf);
+
+// Write every dirty block and flush the disk; 0, or -1 on an I/O error
+int bcache_sync(void);
+
+// Sync, then forget every unreferenced block (cold-cache measurements)
+void bcache_drop(void);
+
+const bcache_stats_t* bcache_stats(void);
+void bcache_print(void);
+void bcache_reset_stats(void);
+
+#endif // BCACHE_H
@@ -0,0 +1,24 @@
+/*
+ * Command Cancellation
+ * Ctrl-C typed while a shell command runs sets a flag instead of entering
+ * the input ring. Long-running loops poll it between chunks and stop
+ * early, reporting whatever they finished.
+ */
+
+#ifndef CANCEL_H
+#define CANCEL_H
+
+// Shell: a command is starting (clears any earlier request) / has ended
+void cancel_arm(void);
+void cancel_disarm(void);
+int cancel_armed(void);
+
+// UART receive path: Ctrl-C arrived while armed
+void cancel_request(void);
+
+// Long-running loops: has the running command been cancelled? In a
+// background job this reads the job's own flag instead.
+// (stays set after the command ends until the next cancel_arm())
+int cancel_requested(void);
+
+#endif // CANCEL_H
@@ -0,0 +1,75 @@
+/*
+ * Persistent Configuration Store
+ * A log-structured key-value store in the pflash bank for the shell's
+ * settings (aliases, command history, colors). Each change appends a
+ * record, and the newest record for a key wins; a tombstone deletes the
+ * key. All keys and values are also kept in RAM. The in-RAM index is
+ * rebuilt at boot with one sequential scan of the log, so reads never
+ * touch the flash. Changes only mark a key dirty. A worker writes each
+ * dirty key once, CFGSTORE_FLUSH_MS after the first change, or at once
+ * when CFGSTORE_BATCH_BYTES are waiting. Each segment is one erase
+ * block. When free segments run low, the worker copies the live
+ * records out of the emptiest segment and erases it.
+ */
+
+#ifndef CFGSTORE_H
+#define CFGSTORE_H
+
+#include "memory.h"
+
+#define CFGSTORE_SEGMENTS_MAX   16          // Erase blocks used, from the start of the bank
+#define CFGSTORE_RESERVE        2           // Free segments kept back for compaction
+#define CFGSTORE_KEY_MAX        64
+#define CFGSTORE_VALUE_MAX      1024
+#define CFGSTORE_BUCKETS        256         // Index hash buckets (power of two)
+#define CFGSTORE_FLUSH_MS       2000        // Changes reach the flash within this
+#define CFGSTORE_BATCH_BYTES    4096        // ... or as soon as this much is waiting
+
+typedef struct {
+    unsigned long puts;
+    unsigned long deletes;
+    unsigned long unchanged;                // Puts of the value a key already had
+    unsigned long coalesced;                // Changes to a key already waiting to be written
+    unsigned long flushes;                  // Batches written
+    unsigned long records;                  // Records written (compaction copies included)
+    unsigned long bytes;
+    unsigned long compactions;
+    unsigned long copied;                   // Live records moved by compaction
+    unsigned long tombstones_dropped;
+    unsigned long errors;
+    unsigned long scan_records;             // Replayed at boot
+    unsigned long scan_us;
+} cfgstore_stats_t;
+
+// Called for each key by cfgstore_list(); must not call the store
+typedef void (*cfgstore_list_fn)(const char* key, const char* value, size_t len, void* arg);
+
+// Boot CPU, after pflash_init() and workqueue_init(): scan the log
+void cfgstore_init(void);
+int cfgstore_ready(void);
+
+// 0, or -1 (no store, bad key or value length, out of memory)
+int cfgstore_put(const char* key, const void* value, size_t len);
+int cfgstore_delete(const char* key);
+
+// Copy at most 'max' bytes of the value; its full length, or -1 if absent
+int cfgstore_get(const char* key, void* buf, size_t max);
+
+// Keys starting with 'prefix', in no particular order; returns the count
+int cfgstore_list(const char* prefix, cfgstore_list_fn fn, void* arg);
+
+// Write every dirty key now; 0, or -1 after a flash error
+int cfgstore_sync(void);
+
+// Compact the emptiest segment now; 0, or -1 if there is none to compact
+int cfgstore_compact(void);
+
+// Erase the store's segments and forget every key
+int cfgstore_clear(void);
+
+const cfgstore_stats_t* cfgstore_stats(void);
+
+// Segments, then counters; with 'keys' set, every key and value too
+void cfgstore_print(int keys);
+
+#endif // CFGSTORE_H
@@ -0,0 +1,48 @@
+/*
+ * Tab Completion
+ * Shared prefix trie holding every completable word set (commands,
+ * aliases, files and per-command argument keywords)
+ */
+
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include "memory.h"
+
+// Trie node pool shared by all word sets
+#define COMPLETE_MAX_NODES 1024
+#define COMPLETE_MAX_SETS  16
+
+// Longest completable word
+#define COMPLETE_WORD_MAX  32
+
+// Result of a prefix lookup
+typedef struct {
+    int matches;                        // Words starting with the prefix
+    int exact;                          // Prefix itself is a word
+    int extension_len;                  // Length of the longest common extension
+    char extension[COMPLETE_WORD_MAX];  // Characters shared by every match past the prefix
+} complete_result_t;
+
+// Called for each word by complete_list(), in sorted order
+typedef void (*complete_visit_t)(const char* word, void* ctx);
+
+// Word sets - returns a set id or -1 when out of sets
+void complete_init(void);
+int complete_set_create(void);
+
+// Words are reference counted, so a word inserted twice needs two removals
+int complete_insert(int set, const char* word);
+int complete_remove(int set, const char* word);
+
+// O(prefix) lookup; returns the number of matches (0 if none)
+int complete_lookup(int set, const char* prefix, int prefix_len, complete_result_t* result);
+
+// Enumerate up to 'max' matching words; returns how many were visited
+int complete_list(int set, const char* prefix, int prefix_len, int max,
+                  complete_visit_t visit, void* ctx);
+
+// Pool usage for diagnostics
+int complete_nodes_used(void);
+
+#endif // COMPLETE_H
@@ -0,0 +1,50 @@
+/*
+ * Flattened Device Tree (DTB) Reader
+ * Read-only access to the blob QEMU passes in x0 at boot
+ */
+
+#ifndef FDT_H
+#define FDT_H
+
+#include "memory.h"
+
+// DTB header magic (big-endian 0xd00dfeed)
+#define FDT_MAGIC 0xd00dfeed
+
+// Structure block tokens
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE   0x2
+#define FDT_PROP       0x3
+#define FDT_NOP        0x4
+#define FDT_END        0x9
+
+// Initialization - returns 0 if a valid blob was found at the address
+int fdt_init(uintptr_t blob);
+int fdt_present(void);
+uintptr_t fdt_address(void);
+uint32_t fdt_total_size(void);
+
+// Byte order helpers (DTB is big-endian, ARM64 runs little-endian)
+uint32_t fdt32_to_cpu(uint32_t value);
+uint64_t fdt_read_cells(const void* cells, int count);
+
+// Node traversal - node handles are offsets into the structure block
+int fdt_root_node(void);
+int fdt_next_node(int node, int* depth);
+int fdt_path_offset(const char* path);
+const char* fdt_node_name(int node);
+
+// Property access
+const void* fdt_getprop(int node, const char* name, int* len);
+int fdt_node_is_compatible(int node, const char* compatible);
+int fdt_find_compatible(int after, const char* compatible);
+
+// Address decoding using the root #address-cells / #size-cells
+int fdt_address_cells(void);
+int fdt_size_cells(void);
+int fdt_get_reg(int node, int index, uint64_t* base, uint64_t* size);
+
+// Boot loader information from /chosen
+int fdt_initrd(uint64_t* start, uint64_t* end);
+
+#endif // FDT_H
@@ -0,0 +1,77 @@
+/*
+ * Filesystem
+ * Extent-based files in one hashed root directory on the virtio-blk
+ * disk, all I/O through the buffer cache. Blocks come from a bitmap,
+ * first fit from the end of the file so it stays contiguous, with
+ * preallocation growing as a file does. Format a disk image with the
+ * host tool: make mkfs && build/mkfs disk.img 64 [files...]
+ */
+
+#ifndef FS_H
+#define FS_H
+
+#include "memory.h"
+#include "fs_format.h"
+
+#define FS_PREALLOC_MAX         16          // Blocks allocated ahead of a growing file
+
+// Errors (negative)
+#define FS_OK                   0
+#define FS_ERR_NOT_FOUND        (-1)
+#define FS_ERR_NO_SPACE         (-2)
+#define FS_ERR_IO               (-3)
+#define FS_ERR_NAME             (-4)        // Too long, or has '/'
+#define FS_ERR_NOT_MOUNTED      (-5)
+#define FS_ERR_IS_DIR           (-6)
+#define FS_ERR_TOO_BIG          (-7)        // Out of extents
+#define FS_ERR_NO_MEMORY        (-8)
+
+// fs_write() flags
+#define FS_CREATE               0x1
+#define FS_TRUNCATE             0x2
+#define FS_APPEND               0x4         // Write at the end; 'offset' is ignored
+
+typedef struct {
+    uint32_t inode;
+    int type;                               // FS_TYPE_FILE or FS_TYPE_DIR
+    uint64_t size;
+    uint32_t blocks;                        // Allocated
+    uint32_t extent_count;
+    uint32_t entries;                       // Directories
+    uint64_t mtime;                         // Milliseconds since boot
+} fs_stat_t;
+
+typedef void (*fs_list_fn_t)(const char* name, const fs_stat_t* st, void* arg);
+
+// Boot CPU, after bcache_init(): mount the disk if it holds a filesystem
+void fs_init(void);
+int fs_mounted(void);
+
+/*
+ * Names live in the root directory; a leading '/' is allowed and "/" or
+ * "" is the root itself. Reads return the bytes read and writes the
+ * bytes written, or an FS_ERR_* code.
+ */
+int fs_stat(const char* name, fs_stat_t* st);
+long fs_read(const char* name, uint64_t offset, void* buf, size_t len);
+long fs_write(const char* name, uint64_t offset, const void* buf, size_t len, int flags);
+int fs_remove(const char* name);
+
+// Call 'fn' for every file in the root directory; returns how many
+int fs_list(fs_list_fn_t fn, void* arg);
+
+// Write everything to the disk
+int fs_sync(void);
+
+// ls: one line per file; returns the file count or an error
+int fs_print_dir(void);
+
+// stat <file>: inode fields and every extent
+int fs_print_file(const char* name);
+
+// stat: layout, free blocks and inodes
+void fs_print(void);
+
+const char* fs_error(int err);
+
+#endif // FS_H
@@ -0,0 +1,103 @@
+/*
+ * Filesystem On-Disk Format
+ * Shared by the kernel and the host mkfs tool (built with FS_HOST).
+ *
+ * Block 0 is the superblock, followed by the block bitmap (a set bit is
+ * a used block), the inode table and data. Files are lists of extents
+ * (runs of contiguous blocks). A directory is a hash table: its blocks
+ * are buckets, a name goes to bucket hash & (blocks - 1), and a full
+ * bucket marks itself overflowed and spills into the next one.
+ */
+
+#ifndef FS_FORMAT_H
+#define FS_FORMAT_H
+
+#ifdef FS_HOST
+#include <stdint.h>
+#else
+#include "memory.h"
+#endif
+
+#define FS_MAGIC                0x5346534F4941UL    // "AIOSFS" as little-endian bytes
+#define FS_VERSION              1
+#define FS_BLOCK_SIZE           4096
+#define FS_BITS_PER_BLOCK       (FS_BLOCK_SIZE * 8)
+
+#define FS_INODE_SIZE           128
+#define FS_INODES_PER_BLOCK     (FS_BLOCK_SIZE / FS_INODE_SIZE)
+#define FS_ROOT_INODE           1               // Inode 0 is never used
+
+#define FS_DIRECT_EXTENTS       10
+#define FS_EXTENTS_PER_BLOCK    (FS_BLOCK_SIZE / 8)
+#define FS_MAX_EXTENTS          (FS_DIRECT_EXTENTS + FS_EXTENTS_PER_BLOCK)
+
+#define FS_NAME_MAX             54
+#define FS_DIRENT_SIZE          64
+#define FS_DIRENTS_PER_BLOCK    (FS_BLOCK_SIZE / FS_DIRENT_SIZE - 1)    // Slot 0 is the header
+
+// Inode types
+#define FS_TYPE_FREE            0
+#define FS_TYPE_FILE            1
+#define FS_TYPE_DIR             2
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t blocks;                // Whole filesystem
+    uint64_t free_blocks;
+    uint32_t inodes;
+    uint32_t free_inodes;
+    uint32_t bitmap_start;
+    uint32_t bitmap_blocks;
+    uint32_t inode_start;
+    uint32_t inode_blocks;
+    uint32_t data_start;            // First block not holding metadata
+    uint32_t root;
+} fs_super_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t length;                // Blocks
+} fs_extent_t;
+
+typedef struct {
+    uint16_t type;
+    uint16_t links;
+    uint32_t extent_count;
+    uint64_t size;                  // Bytes
+    uint64_t mtime;                 // Milliseconds since boot at the last change (no RTC)
+    uint32_t blocks;                // Allocated; beyond 'size' when preallocated
+    uint32_t extent_block;          // Extents past the direct ones, 0 if none
+    uint32_t entries;               // Directories: names stored
+    uint32_t reserved[3];
+    fs_extent_t extents[FS_DIRECT_EXTENTS];
+} fs_inode_t;
+
+typedef struct {
+    uint32_t inode;                 // 0 = free slot
+    uint32_t hash;
+    uint8_t type;
+    uint8_t name_len;
+    char name[FS_NAME_MAX];         // Not NUL terminated
+} fs_dirent_t;
+
+// Slot 0 of every directory block
+typedef struct {
+    uint32_t count;                 // Entries in this block
+    uint32_t overflow;              // Was full once: lookups continue to the next block
+    uint8_t reserved[FS_DIRENT_SIZE - 8];
+} fs_dirhead_t;
+
+// FNV-1a, the directory hash
+static inline uint32_t fs_name_hash(const char* name, int len)
+{
+    uint32_t hash = 2166136261U;
+    for (int i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+#endif // FS_FORMAT_H
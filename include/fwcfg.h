@@ -0,0 +1,56 @@
+/*
+ * QEMU Firmware Configuration (fw_cfg)
+ * Host files passed with -fw_cfg name=opt/<name>,file=<path> appear in
+ * the fw_cfg file directory. Items are copied into guest memory with
+ * the DMA interface (one request per item) when the device offers it,
+ * else read through the data register eight bytes at a time.
+ */
+
+#ifndef FWCFG_H
+#define FWCFG_H
+
+#include "memory.h"
+
+#define FWCFG_DEFAULT_BASE      0x09020000UL    // QEMU virt, when there is no DTB
+#define FWCFG_MAX_FILES         128
+#define FWCFG_NAME_MAX          56
+
+// Fixed items
+#define FWCFG_SIGNATURE         0x0000
+#define FWCFG_ID                0x0001
+#define FWCFG_FILE_DIR          0x0019
+
+typedef struct {
+    char name[FWCFG_NAME_MAX];              // NUL terminated
+    uint16_t select;
+    uint32_t size;
+    void* data;                             // Loaded copy, or NULL
+} fwcfg_file_t;
+
+typedef struct {
+    unsigned long dma_requests;
+    unsigned long dma_bytes;
+    unsigned long pio_bytes;                // Read through the data register
+    unsigned long errors;
+} fwcfg_stats_t;
+
+// Boot CPU, after page_init(): find the device and read its file directory
+void fwcfg_init(void);
+int fwcfg_present(void);
+int fwcfg_has_dma(void);
+
+int fwcfg_count(void);
+const fwcfg_file_t* fwcfg_file(int index);
+const fwcfg_file_t* fwcfg_find(const char* name);
+
+// Copy an item into 'buf'; 'dma' 0 forces the data register. 0, or -1
+int fwcfg_read(uint16_t select, void* buf, uint32_t len, int dma);
+
+// Load a file into pages of its own (kept until unloaded); NULL on error
+const fwcfg_file_t* fwcfg_load(const char* name);
+void fwcfg_unload(const char* name);
+
+const fwcfg_stats_t* fwcfg_stats(void);
+void fwcfg_print(void);
+
+#endif // FWCFG_H
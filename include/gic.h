@@ -0,0 +1,40 @@
+/*
+ * ARM Generic Interrupt Controller (GICv2)
+ * Distributor and CPU interface as found on QEMU virt
+ */
+
+#ifndef GIC_H
+#define GIC_H
+
+#include "memory.h"
+
+// Interrupt acknowledge decoding
+#define GIC_IAR_ID_MASK 0x3FF
+#define GIC_SPURIOUS    1020        // IDs 1020-1023 are special/spurious
+
+// Interrupt ID ranges
+#define GIC_PPI_BASE    16
+#define GIC_SPI_BASE    32
+
+// Boot CPU: distributor and own CPU interface. Returns 0 on success,
+// -1 if no GICv2 was found (interrupts stay unavailable)
+int gic_init(void);
+
+// Secondary CPUs: banked CPU interface and private interrupts
+void gic_cpu_init(void);
+
+int gic_present(void);
+
+// Per-interrupt control (PPIs are banked - enable on every CPU)
+void gic_enable(unsigned int irq);
+void gic_disable(unsigned int irq);
+
+// Software-generated interrupt to the CPUs in 'cpu_mask' (bit n = CPU
+// interface n, which is MPIDR Aff0 on QEMU virt)
+void gic_send_sgi(unsigned int sgi, uint32_t cpu_mask);
+
+// Interrupt handling
+unsigned int gic_acknowledge(void);
+void gic_end_of_interrupt(unsigned int iar);
+
+#endif // GIC_H
@@ -0,0 +1,59 @@
+/*
+ * Command History
+ * Variable-length records in a byte ring with incremental reverse search
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "memory.h"
+
+// Storage sizing (both powers of two): 512KB in all, taken from the page
+// pool by history_init(). Typical 8-16 byte commands cost 2 header bytes
+// each, so the ring holds twenty thousand or more of them
+#define HISTORY_RING_SIZE   (256 * 1024)
+#define HISTORY_MAX_ENTRIES 32768
+
+// Longest single entry kept (matches the shell line limit)
+#define HISTORY_ENTRY_MAX   4096
+
+// Reverse search state (one search at a time, driven by Ctrl-R)
+#define HISTORY_SEARCH_QUERY_MAX 64
+#define HISTORY_SEARCH_MAX_MATCHES 256
+
+typedef struct {
+    char query[HISTORY_SEARCH_QUERY_MAX];
+    int query_len;
+    uint32_t query_sig;                         // Trigram signature of query
+    uint32_t matches[HISTORY_SEARCH_MAX_MATCHES]; // Matching entry numbers, newest first
+    int match_count;
+    int current;                                // Index of displayed match
+    uint32_t scan_next;                         // Next older entry not yet examined
+    int scan_done;                              // No older entries left to examine
+} history_search_t;
+
+// Boot CPU, after page_init() and before the shell reads its first line
+void history_init(void);
+
+// Recording and navigation
+void history_add_command(const char* command);
+const char* history_get_previous(void);
+const char* history_get_next(void);
+void history_reset_navigation(void);
+void history_clear(void);
+
+// Entry access - entries are numbered with increasing sequence numbers
+uint32_t history_first(void);
+uint32_t history_end(void);
+int history_count(void);
+unsigned long history_bytes_used(void);
+int history_get(uint32_t seq, char* dest, int max_size);
+
+// Incremental reverse search
+void history_search_begin(history_search_t* search);
+int history_search_push(history_search_t* search, char c);
+int history_search_pop(history_search_t* search);
+int history_search_older(history_search_t* search);
+int history_search_result(const history_search_t* search, char* dest, int max_size);
+
+#endif // HISTORY_H
@@ -0,0 +1,45 @@
+/*
+ * Initial Ramdisk
+ * The newc cpio archive QEMU loads with -initrd, used in place. A hash
+ * index over the archive's paths points straight at each file's data,
+ * so reading a file copies nothing. The shell shows the archive under
+ * /initrd: ls /initrd, cat /initrd/<path>.
+ */
+
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "memory.h"
+
+#define INITRD_PREFIX           "/initrd"
+
+// cpio mode file types
+#define INITRD_MODE_TYPE        0170000
+#define INITRD_MODE_DIR         0040000
+#define INITRD_MODE_FILE        0100000
+
+typedef struct {
+    const char* path;                       // In the archive; "./" stripped
+    uint32_t path_len;
+    uint32_t mode;
+    const uint8_t* data;                    // In the archive
+    size_t size;
+    uint32_t hash;
+    int next;                               // Hash chain, -1 ends it
+} initrd_file_t;
+
+// Boot CPU, after page_init(): index the archive named in /chosen
+void initrd_init(void);
+int initrd_present(void);
+
+// Path within the archive ("a/b", "/a/b" and "./a/b" are the same), or NULL
+const initrd_file_t* initrd_lookup(const char* path);
+
+// Files in archive order
+int initrd_count(void);
+const initrd_file_t* initrd_file(int index);
+
+// Archive address and size, index shape, then every file
+void initrd_print(void);
+
+#endif // INITRD_H
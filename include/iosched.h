@@ -0,0 +1,73 @@
+/*
+ * I/O Scheduler
+ * Request queue between the buffer cache and the virtio-blk driver.
+ * Callers queue small I/Os; adjacent ones are merged (at either end)
+ * into one device request of up to IOSCHED_MAX_BYTES. Queued requests
+ * go out in ascending LBA order (one-way elevator) unless the oldest has
+ * passed its deadline. While plugged, nothing is dispatched, so a burst
+ * is merged and sorted before the device sees any of it.
+ */
+
+#ifndef IOSCHED_H
+#define IOSCHED_H
+
+#include "memory.h"
+
+#define IOSCHED_REQUESTS        64          // Device requests queued or in flight
+#define IOSCHED_MAX_BYTES       (128 * 1024)
+#define IOSCHED_READ_EXPIRE_MS  50
+#define IOSCHED_WRITE_EXPIRE_MS 500
+#define IOSCHED_HIST_BUCKETS    16          // Latency histogram: <16us, then doubling
+
+struct io;
+typedef void (*io_done_fn_t)(struct io* io);
+
+// One caller I/O: a contiguous buffer at a sector
+typedef struct io {
+    // Filled in by the caller
+    int type;                               // BLK_READ or BLK_WRITE
+    uint64_t sector;
+    void* buf;
+    uint32_t len;                           // Bytes, a multiple of the sector size
+    io_done_fn_t done;                      // Optional; runs in completion context
+    void* priv;
+
+    // Scheduler state
+    volatile int status;                    // BLK_PENDING until complete
+    uint64_t queued;                        // Counter value at io_submit()
+    struct io* next;                        // Within its device request
+} io_t;
+
+typedef struct {
+    unsigned long ios;                      // io_submit() calls
+    unsigned long requests;                 // Device requests dispatched
+    unsigned long back_merges;              // I/O appended to a queued request
+    unsigned long front_merges;             // I/O prepended
+    unsigned long request_merges;           // Two queued requests became adjacent and joined
+    unsigned long expired;                  // Dispatched out of LBA order by deadline
+    unsigned long plugs;
+    unsigned long max_queued;               // Most requests waiting at once
+    unsigned long errors;
+    unsigned long read_hist[IOSCHED_HIST_BUCKETS];
+    unsigned long write_hist[IOSCHED_HIST_BUCKETS];
+} iosched_stats_t;
+
+// Boot CPU, after blk_init()
+void iosched_init(void);
+
+// Queue an I/O (dispatched at once unless plugged); 0, or -1 if malformed
+int io_submit(io_t* io);
+
+// Wait by the disk's completion mode; returns the I/O's status
+int io_wait(io_t* io);
+
+// Hold back dispatch while queuing a batch (never wait on an I/O while
+// holding it); nests
+void iosched_plug(void);
+void iosched_unplug(void);
+
+const iosched_stats_t* iosched_stats(void);
+void iosched_print(void);
+void iosched_reset_stats(void);
+
+#endif // IOSCHED_H
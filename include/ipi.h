@@ -0,0 +1,48 @@
+/*
+ * Inter-Processor Interrupts
+ * GICv2 software-generated interrupts (SGIs) between CPUs, and remote
+ * function calls built on them
+ */
+
+#ifndef IPI_H
+#define IPI_H
+
+#include "memory.h"
+
+// IPI kinds - each is the SGI with the same number
+#define IPI_RESCHEDULE  0       // Run the scheduler (work was queued for you)
+#define IPI_CALL_FUNC   1       // Run the functions queued for you
+#define IPI_COUNT       2
+
+typedef void (*smp_call_func_t)(void* arg);
+
+// Boot CPU: register the handlers. Every CPU: enable its banked SGIs.
+void ipi_init(void);
+void ipi_cpu_init(void);
+
+// Raise an IPI on one CPU or on every CPU in a mask
+void ipi_send(int cpu, int ipi);
+void ipi_send_mask(uint32_t cpu_mask, int ipi);
+
+/*
+ * Run func(arg) on other CPUs
+ * wait = 1: return once every target has finished (the caller keeps
+ * serving calls aimed at its own CPU meanwhile, so two CPUs calling
+ * each other cannot deadlock). wait = 0: queue and return at once.
+ * A target equal to the calling CPU runs the function directly.
+ * Returns 0, or -1 if a target is offline or no IPIs are available.
+ */
+int smp_call_function(int cpu, smp_call_func_t func, void* arg, int wait);
+int smp_call_function_many(uint32_t cpu_mask, smp_call_func_t func, void* arg, int wait);
+
+// Run the calls queued for the calling CPU (IPI handler; IRQs masked)
+void smp_call_process(void);
+
+// Invalidate TLBs / instruction caches on every online CPU and wait
+void smp_tlb_shootdown(void);
+void smp_icache_shootdown(void);
+
+// Round-trip latency and throughput of remote calls from CPU 0
+void ipi_bench(unsigned long count);
+
+#endif // IPI_H
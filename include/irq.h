@@ -0,0 +1,48 @@
+/*
+ * Exceptions and Interrupts
+ * EL1 vector table (boot/vectors.S), IRQ dispatch and DAIF helpers
+ */
+
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "memory.h"
+
+// Interrupt IDs handled by the GIC (SGIs 0-15, PPIs 16-31, SPIs 32+)
+#define IRQ_MAX 256
+
+typedef void (*irq_handler_t)(unsigned int irq);
+
+// Install the vector table on the calling CPU
+void irq_init(void);
+
+// Route an interrupt ID to a handler (the GIC line is enabled separately)
+int irq_register(unsigned int irq, irq_handler_t handler);
+
+// Interrupts taken and spurious acknowledgements, for diagnostics
+unsigned long irq_count(unsigned int irq);
+
+// Mask/unmask IRQs on the calling CPU
+static inline unsigned long irq_save(void)
+{
+    unsigned long flags;
+    __asm__ volatile("mrs %0, daif\n msr daifset, #2" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned long flags)
+{
+    __asm__ volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
+
+static inline void irq_enable(void)
+{
+    __asm__ volatile("msr daifclr, #2" ::: "memory");
+}
+
+static inline void irq_disable(void)
+{
+    __asm__ volatile("msr daifset, #2" ::: "memory");
+}
+
+#endif // IRQ_H
@@ -0,0 +1,46 @@
+/*
+ * Background Jobs
+ * "cmd args &" runs a shell command on its own kernel thread while the
+ * prompt comes back at once. The job's console output goes to a private
+ * ring buffer until fg or wait prints it.
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "shell.h"
+
+#define JOB_MAX           8
+#define JOB_OUTPUT_SIZE   8192      // Per-job output ring; oldest bytes are dropped
+#define JOB_STACK_PAGES   16        // Same as the shell thread
+#define JOB_LINE_MAX      128       // Command line kept for jobs/fg
+
+void jobs_init(void);
+
+/*
+ * Run 'handler' on a copy of 'tokens' in a new thread. Returns the job
+ * number (1..JOB_MAX), or -1 when every job slot is taken or no thread
+ * could be created.
+ */
+int job_start(command_handler_t handler, const token_result_t* tokens);
+
+// Most recently / least recently started job still held, 0 if none
+int job_latest(void);
+int job_oldest(void);
+
+/*
+ * Print the job's buffered output, then follow it live until the command
+ * returns, and release the job. With 'forward_cancel' Ctrl-C cancels the
+ * job and keeps waiting for it to stop; otherwise Ctrl-C only stops the
+ * waiting. Returns 1 with the command's result in '*status' once the job
+ * is released, 0 if waiting was interrupted, -1 if there is no such job.
+ */
+int job_follow(int number, int forward_cancel, int* status);
+
+// Job table (jobs command)
+void jobs_print(void);
+
+// Before each prompt: announce jobs that finished since the last call
+void jobs_notify(void);
+
+#endif // JOBS_H
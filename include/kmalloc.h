@@ -0,0 +1,36 @@
+/*
+ * Kernel Object Allocator
+ * Power-of-two size classes backed by the page allocator, with a
+ * per-CPU magazine cache in front of each class
+ */
+
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include "memory.h"
+
+// Size classes: 16, 32, ... 2048 bytes; larger requests take whole pages
+#define KMALLOC_MIN_SHIFT   4
+#define KMALLOC_CLASSES     8
+#define KMALLOC_MAX_SIZE    (1UL << (KMALLOC_MIN_SHIFT + KMALLOC_CLASSES - 1))
+
+// Objects per magazine (a magazine is 256 bytes)
+#define KMALLOC_MAG_ROUNDS  30
+
+// Boot CPU, after page_init(): take the page tag array from the pool
+void kmalloc_init(void);
+
+// Allocation (16-byte aligned; NULL when out of memory) and release
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+
+// Usable size of an allocation (its size class or page run)
+size_t kmalloc_size(const void* ptr);
+
+// Merged per-CPU statistics - shown by meminfo
+void kmalloc_print(void);
+
+// Multi-core alloc/free churn with and without the magazine layer
+void kmalloc_bench(int threads, unsigned long ops);
+
+#endif // KMALLOC_H
@@ -0,0 +1,60 @@
+/*
+ * Kernel Timers
+ * One-shot callbacks on a per-CPU hierarchical timer wheel advanced by
+ * the scheduler tick: O(1) to arm and cancel, and expiry only touches
+ * the slot for the current tick (plus an occasional cascade).
+ */
+
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include "memory.h"
+
+// Four levels of 64 slots: 1, 64, 4096 and 262144 ticks per slot
+#define KTIMER_LEVELS     4
+#define KTIMER_SLOT_BITS  6
+#define KTIMER_SLOTS      (1 << KTIMER_SLOT_BITS)
+
+typedef void (*ktimer_fn_t)(void* arg);
+
+typedef struct ktimer {
+    struct ktimer* next;
+    struct ktimer** pprev;      // NULL when not armed
+    struct ktimer* expired_next; // Expired list of the CPU that fired it
+    volatile uint32_t running;  // Expired, callback not yet returned
+    uint64_t expires;           // Tick number
+    ktimer_fn_t fn;
+    void* arg;
+    int cpu;                    // Wheel it is on
+} ktimer_t;
+
+// Boot CPU, after timer_init()
+void ktimer_init(void);
+
+void ktimer_setup(ktimer_t* timer, ktimer_fn_t fn, void* arg);
+
+/*
+ * Arm (or re-arm) to fire after at least 'ms' milliseconds, rounded up to
+ * whole ticks, on the calling CPU. The callback runs in interrupt context
+ * with IRQs masked. A timer re-armed while its callback is still due to run
+ * on another CPU fires only after that callback returns. Returns -1 when
+ * the tick is not running.
+ */
+int ktimer_add(ktimer_t* timer, unsigned int ms);
+
+// Disarm; returns 1 if it was armed (a callback already started still runs)
+int ktimer_cancel(ktimer_t* timer);
+
+static inline int ktimer_pending(const ktimer_t* timer)
+{
+    return timer->pprev != NULL;
+}
+
+// Scheduler tick (IRQ context): run everything that has expired on this CPU
+void ktimer_tick(void);
+
+// Per-CPU wheel statistics - shown by the work command
+void ktimer_print(void);
+void ktimer_reset_stats(void);
+
+#endif // KTIMER_H
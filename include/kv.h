@@ -0,0 +1,101 @@
+/*
+ * Key-Value Store
+ * A log-structured merge tree in files of the extent filesystem. A put
+ * is appended to a write-ahead log and inserted into a skiplist
+ * memtable. A full memtable is frozen, and a background thread writes
+ * it out as an immutable sorted run: 4KB data blocks, then an index of
+ * each block's first key and a bloom filter. Level 0 holds whole
+ * memtables, which may overlap; every deeper level holds runs with
+ * disjoint key ranges and may grow KV_LEVEL_RATIO times larger than the
+ * one above it. When a level passes its size (level 0: its run count),
+ * the thread merges one of its runs into the overlapping runs of the
+ * next level. Run files are written sequentially through the buffer
+ * cache, so their blocks go to the I/O scheduler in batches it merges
+ * into large requests.
+ */
+
+#ifndef KV_H
+#define KV_H
+
+#include "memory.h"
+
+#define KV_KEY_MAX              64
+#define KV_VALUE_MAX            1024
+#define KV_MEMTABLE_BYTES       (256 * 1024)    // Log bytes behind a memtable before it is frozen
+#define KV_LEVELS               4
+#define KV_L0_COMPACT           4               // Level-0 runs that start a compaction
+#define KV_L0_STOP              12              // ... and that stall puts until it catches up
+#define KV_L1_BYTES             (1024 * 1024)   // Level n: KV_L1_BYTES * KV_LEVEL_RATIO^(n-1)
+#define KV_LEVEL_RATIO          10
+#define KV_RUN_BYTES            (256 * 1024)    // Compaction starts a new output run past this
+#define KV_RUNS_MAX             128             // Per level
+#define KV_BLOOM_BITS           10              // Filter bits per key: about 1% false positives
+#define KV_LOG_FLUSH_MS         1000            // Buffered log records reach the cache within this
+
+// Errors (negative)
+#define KV_OK                   0
+#define KV_ERR_NOT_FOUND        (-1)
+#define KV_ERR_NOT_READY        (-2)            // No filesystem
+#define KV_ERR_INVALID          (-3)            // Key or value length
+#define KV_ERR_IO               (-4)
+#define KV_ERR_NO_MEMORY        (-5)
+
+typedef struct {
+    unsigned long puts;
+    unsigned long deletes;
+    unsigned long gets;
+    unsigned long memtable_hits;
+    unsigned long run_probes;               // Runs whose key range held a looked up key
+    unsigned long bloom_skips;              // ... ruled out by their filter
+    unsigned long bloom_false;              // ... passed by the filter without the key
+    unsigned long blocks_read;              // Data blocks read by lookups and scans
+    unsigned long scans;
+    unsigned long stalls;                   // Puts that waited for the background thread
+    unsigned long flushes;                  // Memtables written as level-0 runs
+    unsigned long compactions;
+    unsigned long moves;                    // Runs moved down a level without a rewrite
+    unsigned long tombstones_dropped;
+    unsigned long user_bytes;               // Keys and values put
+    unsigned long log_bytes;
+    unsigned long flush_bytes;              // Run bytes written by memtable flushes
+    unsigned long compact_read;             // Run bytes merged by compactions
+    unsigned long compact_bytes;            // ... and written by them
+    unsigned long recovered;                // Log records replayed at boot
+    unsigned long errors;
+} kv_stats_t;
+
+// Called for each key by kv_scan(); must not call the store
+typedef void (*kv_scan_fn)(const char* key, const void* value, size_t len, void* arg);
+
+// Boot CPU, after fs_init(): open (or create) the store and start its thread
+void kv_init(void);
+int kv_ready(void);
+
+// KV_OK or KV_ERR_*; keys are 1..KV_KEY_MAX bytes
+int kv_put(const char* key, const void* value, size_t len);
+int kv_delete(const char* key);
+
+// Copy at most 'max' bytes of the value; its full length, or KV_ERR_*
+int kv_get(const char* key, void* buf, size_t max);
+
+// Up to 'limit' live keys >= 'start' (NULL: all) in order; returns the count
+int kv_scan(const char* start, int limit, kv_scan_fn fn, void* arg);
+
+// Write the buffered log through the cache to the disk
+int kv_sync(void);
+
+// Flush the memtable and wait until every level is within its size
+int kv_compact(void);
+
+const kv_stats_t* kv_stats(void);
+void kv_reset_stats(void);
+
+// Memtables, levels and runs, then the counters and write amplification
+void kv_print(void);
+
+// Fill 'ops' keys in random order, read them back, miss, then scan
+void kv_bench(unsigned long ops, size_t value_size);
+
+const char* kv_error(int err);
+
+#endif // KV_H
@@ -0,0 +1,59 @@
+/*
+ * Line Editor
+ * Gap buffer line model with a minimal-diff terminal renderer
+ */
+
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+// Longest editable line (far beyond one terminal row)
+#define LINEEDIT_MAX 4096
+
+// Terminal width the renderer wraps long lines at
+#define LINEEDIT_COLUMNS 80
+
+// Editor state: logical text lives in a gap buffer, 'shown' mirrors
+// what is currently on the terminal after the prompt. Screen positions
+// are counted from the prompt's row: position i sits at row
+// (origin + i) / LINEEDIT_COLUMNS, column (origin + i) % LINEEDIT_COLUMNS
+typedef struct {
+    char text[LINEEDIT_MAX];    // Gap buffer storage
+    int limit;                  // Max characters accepted for this line
+    int origin;                 // Terminal column the line starts at (prompt width)
+    int gap_start;              // Cursor position == start of the gap
+    int gap_end;                // First character after the gap
+    char shown[LINEEDIT_MAX];   // Characters currently displayed
+    int shown_len;              // Number of displayed characters
+    int shown_cursor;           // Line position the terminal cursor is at
+} line_editor_t;
+
+// Lifecycle
+void lineedit_begin(line_editor_t* le, int limit, int origin);
+void lineedit_invalidate(line_editor_t* le);
+int lineedit_copy(const line_editor_t* le, char* dest, int max_size);
+
+// Queries
+int lineedit_length(const line_editor_t* le);
+int lineedit_cursor(const line_editor_t* le);
+char lineedit_char_at(const line_editor_t* le, int index);
+
+// Editing operations - O(1) except when the cursor jumps
+int lineedit_insert(line_editor_t* le, char c);
+int lineedit_insert_string(line_editor_t* le, const char* str);
+int lineedit_backspace(line_editor_t* le);
+int lineedit_delete(line_editor_t* le);
+void lineedit_move_to(line_editor_t* le, int position);
+void lineedit_set_text(line_editor_t* le, const char* str);
+
+// Bring the terminal in sync with the logical line using minimal output
+void lineedit_refresh(line_editor_t* le);
+
+// Put the terminal cursor after the shown line, so output that follows
+// a newline starts below every row it wrapped onto
+void lineedit_finish(line_editor_t* le);
+
+// Erase the prompt row and every row the line wrapped onto, leaving the
+// cursor at the start of the prompt row (the caller reprints the prompt)
+void lineedit_erase(line_editor_t* le);
+
+#endif // LINEEDIT_H
@@ -0,0 +1,52 @@
+/*
+ * ARM64 OS Physical Memory Map
+ * Sorted region table used for all address safety checks
+ */
+
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include "memory.h"
+
+// Region types - later additions override earlier ones where they overlap
+typedef enum {
+    MEMMAP_UNMAPPED = 0,        // Hole in the map (never accessible)
+    MEMMAP_RAM,                 // Free system RAM
+    MEMMAP_DEVICE,              // MMIO registers (reads may have side effects)
+    MEMMAP_FIRMWARE,            // Device tree blob and other boot data
+    MEMMAP_KERNEL_TEXT,         // Kernel code and read-only data
+    MEMMAP_KERNEL_DATA,         // Kernel .data and .bss
+    MEMMAP_HEAP,                // Kernel heap
+    MEMMAP_STACK,               // Boot stack
+    MEMMAP_TYPE_COUNT
+} memmap_type_t;
+
+// Access rights checked by memmap_check_range()
+#define MEMMAP_ACCESS_READ  (1 << 0)
+#define MEMMAP_ACCESS_WRITE (1 << 1)
+
+// One contiguous region [base, end)
+typedef struct {
+    uintptr_t base;
+    uintptr_t end;
+    memmap_type_t type;
+    unsigned int access;        // MEMMAP_ACCESS_* rights for shell commands
+    const char* name;
+} memmap_region_t;
+
+// Maximum number of regions (QEMU virt exposes ~40 devices)
+#define MEMMAP_MAX_REGIONS 96
+
+// Initialization - call after memory_init()
+void memmap_init(uintptr_t dtb_addr);
+
+// Region table management
+int memmap_add(uintptr_t base, size_t size, memmap_type_t type, const char* name);
+const memmap_region_t* memmap_lookup(uintptr_t addr);
+int memmap_check_range(uintptr_t addr, size_t len, unsigned int access);
+
+// Display
+const char* memmap_type_name(memmap_type_t type);
+void memmap_print(void);
+
+#endif // MEMMAP_H
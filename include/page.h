@@ -0,0 +1,28 @@
+/*
+ * Physical Page Allocator
+ * Bitmap over the free RAM above the kernel heap
+ */
+
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "memory.h"
+
+#define PAGE_SIZE 4096
+
+// Largest pool tracked by the bitmap (256MB)
+#define PAGE_MAX_PAGES 65536
+
+// Initialization - call after memmap_init()
+void page_init(void);
+
+// Contiguous page runs, page aligned; NULL when no run is large enough
+void* page_alloc(size_t count);
+void page_free(void* addr, size_t count);
+
+// Statistics
+uintptr_t page_pool_start(void);
+size_t page_total_count(void);
+size_t page_free_count(void);
+
+#endif // PAGE_H
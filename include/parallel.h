@@ -0,0 +1,66 @@
+/*
+ * Parallel Memory Kernels
+ * parallel_for() splits a byte range into cache-line aligned chunks that
+ * the caller and one helper thread per extra CPU claim dynamically; each
+ * chunk can return a value that the caller combines in chunk order.
+ * Fill, zero, copy, compare and CRC-32 are built on it.
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "memory.h"
+
+#define PARALLEL_LINE        64         // Chunk boundaries fall on cache lines
+#define PARALLEL_MIN_CHUNK   (16 * 1024)
+#define PARALLEL_MAX_CHUNKS  256        // Bounds the per-chunk result array
+
+// Result of a chunk skipped after Ctrl-C; parallel_compare() return when
+// it stopped before finding a difference
+#define PARALLEL_SKIPPED     ((uint64_t)-2)
+#define PARALLEL_CANCELLED   (-2L)
+
+// Result of one chunk: 'offset' is relative to the start of the range
+typedef uint64_t (*parallel_fn_t)(size_t offset, size_t length, void* ctx);
+
+// Detect the CRC32 instructions and build the fallback table (boot CPU)
+void parallel_init(void);
+
+// Chunk size and count used for a range of 'length' bytes
+int parallel_chunks(size_t length, size_t* chunk_size);
+
+// CPUs a call with this length and 'jobs' would use
+int parallel_cpus(size_t length, int jobs);
+
+/*
+ * Run 'fn' over [0, length) on up to 'jobs' CPUs (0 = every online CPU).
+ * 'results', if not NULL, receives parallel_chunks(length) values in
+ * chunk order. Chunks not yet started when the running command is
+ * cancelled are skipped (result PARALLEL_SKIPPED). Returns the number of
+ * bytes in chunks that ran.
+ */
+size_t parallel_for(size_t length, int jobs, parallel_fn_t fn, void* ctx, uint64_t* results);
+
+// Kernels; 'jobs' and cancellation as above. Return bytes processed.
+size_t parallel_fill(void* dst, uint8_t value, size_t length, int jobs);
+size_t parallel_zero(void* dst, size_t length, int jobs);
+size_t parallel_copy(void* dst, const void* src, size_t length, int jobs);   // No overlap
+
+// Offset of the first differing byte, -1 if the ranges are equal, or
+// PARALLEL_CANCELLED
+long parallel_compare(const void* a, const void* b, size_t length, int jobs);
+
+// CRC-32 (IEEE 802.3, as zlib) of the range, or of the leading part that
+// finished before a cancel; returns the number of bytes it covers
+size_t parallel_crc32(const void* buf, size_t length, int jobs, uint32_t* crc);
+
+// CRC-32 of A followed by B, from crc(A), crc(B) and B's length
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b);
+
+// Zeroed page run (page_alloc + parallel zeroing that is never cancelled)
+void* parallel_page_alloc_zeroed(size_t count, int jobs);
+
+// Throughput of each kernel on 1..max_jobs CPUs over a 'length' byte buffer
+void parallel_bench(size_t length, int max_jobs);
+
+#endif // PARALLEL_H
@@ -0,0 +1,46 @@
+/*
+ * Per-CPU Data
+ * One cache-line aligned area per CPU; TPIDR_EL1 holds the address of
+ * the running CPU's area, so reaching it costs a single register read
+ */
+
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include "memory.h"
+#include "ipi.h"
+#include "ring.h"
+
+// Pending remote calls a CPU can hold before senders have to wait
+#define PERCPU_CALL_QUEUE 64
+
+typedef struct percpu {
+    struct percpu* self;
+    int cpu;
+
+    // Remote calls waiting for this CPU (smp_call_function)
+    mpmc_queue_t call_queue;
+    mpmc_cell_t call_cells[PERCPU_CALL_QUEUE];
+
+    // Statistics
+    unsigned long ipi_received[IPI_COUNT];
+    unsigned long ipi_sent;
+    unsigned long calls_run;
+} __attribute__((aligned(64))) percpu_t;
+
+// Calling CPU: set up its area and point TPIDR_EL1 at it (first thing
+// each CPU does, before interrupts are enabled)
+void percpu_init(void);
+
+// Area of any CPU
+percpu_t* percpu_of(int cpu);
+
+// Area of the calling CPU (stable while IRQs are masked)
+static inline percpu_t* percpu_this(void)
+{
+    percpu_t* area;
+    __asm__ volatile("mrs %0, tpidr_el1" : "=r"(area));
+    return area;
+}
+
+#endif // PERCPU_H
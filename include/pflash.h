@@ -0,0 +1,43 @@
+/*
+ * CFI Parallel Flash (pflash)
+ * The second flash bank of QEMU virt (pflash1; pflash0 holds firmware),
+ * an Intel/Sharp command set device: reads are plain memory reads in
+ * read-array mode, programming clears bits of erased (all ones) words,
+ * and only a whole erase block can be set back to ones. Geometry comes
+ * from the CFI query. Contents persist with
+ *   -drive if=pflash,unit=1,file=flash.img,format=raw   (a 64MB image)
+ */
+
+#ifndef PFLASH_H
+#define PFLASH_H
+
+#include "memory.h"
+
+#define PFLASH_DEFAULT_BASE     0x04000000UL    // QEMU virt, when there is no DTB
+#define PFLASH_DEFAULT_SIZE     (64UL << 20)
+#define PFLASH_WIDTH            4               // Bank width: program unit and alignment
+#define PFLASH_TIMEOUT_MS       5000            // Longest erase or program we wait for
+
+typedef struct {
+    unsigned long erases;
+    unsigned long programs;                     // Buffered (or word) program commands
+    unsigned long bytes_programmed;
+    unsigned long bytes_read;
+    unsigned long errors;
+} pflash_stats_t;
+
+// Boot CPU: find the bank and read its geometry
+void pflash_init(void);
+int pflash_present(void);
+size_t pflash_size(void);
+size_t pflash_block_size(void);                 // Erase block
+
+// All return 0, or -1 (out of range, misaligned, device error or timeout)
+int pflash_read(size_t offset, void* buf, size_t len);
+int pflash_erase(size_t offset);                // The erase block at 'offset'
+// 'offset' and 'len' multiples of PFLASH_WIDTH, into erased words
+int pflash_program(size_t offset, const void* buf, size_t len);
+
+const pflash_stats_t* pflash_stats(void);
+
+#endif // PFLASH_H
@@ -0,0 +1,81 @@
+/*
+ * Lock-Free Ring Queues
+ * Bounded queues of 64-bit items (values or pointers) for passing work
+ * between CPUs. The caller supplies the slot storage; capacities must be
+ * powers of two.
+ *   spsc_ring_t   one producer, one consumer; each side caches the
+ *                 other's index so most operations touch no shared line
+ *   mpmc_queue_t  any number of producers and consumers (Vyukov's
+ *                 bounded queue: a sequence number per cell)
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include "memory.h"
+
+#define RING_CACHE_LINE 64
+
+// --- Single producer, single consumer ---
+
+typedef struct {
+    // Producer's line
+    volatile uint64_t head;         // Next slot to write
+    uint64_t tail_cache;            // Last tail the producer saw
+    uint8_t pad0[RING_CACHE_LINE - 16];
+
+    // Consumer's line
+    volatile uint64_t tail;         // Next slot to read
+    uint64_t head_cache;            // Last head the consumer saw
+    uint8_t pad1[RING_CACHE_LINE - 16];
+
+    // Read-only after init
+    uint64_t* slots;
+    uint64_t mask;
+} __attribute__((aligned(RING_CACHE_LINE))) spsc_ring_t;
+
+// Returns 0, or -1 if capacity is not a power of two
+int spsc_init(spsc_ring_t* ring, uint64_t* slots, uint64_t capacity);
+
+// Producer side: returns 0 / -1 when full; batch returns items written
+int spsc_push(spsc_ring_t* ring, uint64_t item);
+int spsc_push_batch(spsc_ring_t* ring, const uint64_t* items, int count);
+
+// Consumer side: returns 0 / -1 when empty; batch returns items read
+int spsc_pop(spsc_ring_t* ring, uint64_t* item);
+int spsc_pop_batch(spsc_ring_t* ring, uint64_t* items, int max);
+
+// Approximate fill level (either side)
+uint64_t spsc_count(const spsc_ring_t* ring);
+
+// --- Multi producer, multi consumer ---
+
+typedef struct {
+    volatile uint64_t sequence;     // Turn number of this cell
+    uint64_t data;
+} mpmc_cell_t;
+
+typedef struct {
+    volatile uint64_t enqueue_pos;
+    uint8_t pad0[RING_CACHE_LINE - 8];
+    volatile uint64_t dequeue_pos;
+    uint8_t pad1[RING_CACHE_LINE - 8];
+    mpmc_cell_t* cells;
+    uint64_t mask;
+} __attribute__((aligned(RING_CACHE_LINE))) mpmc_queue_t;
+
+// 'cells' holds 'capacity' entries (power of two, at least 2)
+int mpmc_init(mpmc_queue_t* queue, mpmc_cell_t* cells, uint64_t capacity);
+
+// Returns 0, or -1 when full / empty
+int mpmc_enqueue(mpmc_queue_t* queue, uint64_t item);
+int mpmc_dequeue(mpmc_queue_t* queue, uint64_t* item);
+
+// Claim up to 'count' consecutive cells with one CAS; returns items moved
+int mpmc_enqueue_batch(mpmc_queue_t* queue, const uint64_t* items, int count);
+int mpmc_dequeue_batch(mpmc_queue_t* queue, uint64_t* items, int max);
+
+// Throughput and latency between every pair of online CPUs
+void ring_bench(unsigned long items);
+
+#endif // RING_H
@@ -0,0 +1,38 @@
+/*
+ * ARM Semihosting
+ * Calls into the host through HLT #0xF000 when QEMU runs with
+ * -semihosting: open, write and close host files (relative to QEMU's
+ * working directory) and exit QEMU with a status code. Without
+ * -semihosting the HLT is undefined; the exception handler skips it and
+ * the call fails with -1, so every function is safe to call regardless.
+ */
+
+#ifndef SEMIHOST_H
+#define SEMIHOST_H
+
+#include "memory.h"
+
+// Operation numbers
+#define SEMIHOST_SYS_OPEN       0x01
+#define SEMIHOST_SYS_CLOSE      0x02
+#define SEMIHOST_SYS_WRITE      0x05
+#define SEMIHOST_SYS_TIME       0x11
+#define SEMIHOST_SYS_EXIT       0x18
+
+// The HLT instruction a semihosting call executes
+#define SEMIHOST_HLT_INSN       0xd45e0000  // hlt #0xf000
+
+// Boot CPU, after irq_init(): probe whether the host answers
+void semihost_init(void);
+int semihost_present(void);
+
+// Host file handle, or -1; 'append' adds to an existing file
+long semihost_open(const char* path, int append);
+// 0 once all 'len' bytes are written, else -1
+int semihost_write(long handle, const void* buf, size_t len);
+int semihost_close(long handle);
+
+// Exit QEMU with 'status'; returns only without semihosting
+void semihost_exit(int status);
+
+#endif // SEMIHOST_H
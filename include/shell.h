@@ -10,6 +10,13 @@
 #define MAX_INPUT_SIZE 128
 #define MAX_TOKEN_SIZE 32
 
+// Longest command line accepted by the line editor
+#define SHELL_LINE_MAX 4096
+
+// shell_tokenize() results for lines past MAX_ARGS or MAX_TOKEN_SIZE
+#define SHELL_TOKEN_TOO_LONG  -2    // A word of MAX_TOKEN_SIZE characters or more
+#define SHELL_TOO_MANY_ARGS   -3    // More than MAX_ARGS words
+
 // Command handler function pointer type
 // Takes argc (argument count) and argv (argument array)
 // Returns 0 on success, non-zero on error
@@ -56,5 +63,30 @@ int cmd_history(int argc, char* argv[]);
 int cmd_errors(int argc, char* argv[]);
 int cmd_stats(int argc, char* argv[]);
 int cmd_alias(int argc, char* argv[]);
+int cmd_memmap(int argc, char* argv[]);
+int cmd_batch_mode(int argc, char* argv[]);
+int cmd_ps(int argc, char* argv[]);
+int cmd_bench(int argc, char* argv[]);
+int cmd_cpus(int argc, char* argv[]);
+int cmd_locks(int argc, char* argv[]);
+int cmd_pmem(int argc, char* argv[]);
+int cmd_work(int argc, char* argv[]);
+int cmd_jobs(int argc, char* argv[]);
+int cmd_fg(int argc, char* argv[]);
+int cmd_wait(int argc, char* argv[]);
+int cmd_virtio(int argc, char* argv[]);
+int cmd_blkbench(int argc, char* argv[]);
+int cmd_cache(int argc, char* argv[]);
+int cmd_iosched(int argc, char* argv[]);
+int cmd_ls(int argc, char* argv[]);
+int cmd_cat(int argc, char* argv[]);
+int cmd_write(int argc, char* argv[]);
+int cmd_rm(int argc, char* argv[]);
+int cmd_stat(int argc, char* argv[]);
+int cmd_fwcfg(int argc, char* argv[]);
+int cmd_export(int argc, char* argv[]);
+int cmd_exit(int argc, char* argv[]);
+int cmd_config(int argc, char* argv[]);
+int cmd_kv(int argc, char* argv[]);
 
 #endif // SHELL_H
\ No newline at end of file
@@ -0,0 +1,33 @@
+/*
+ * Symmetric Multiprocessing
+ * CPU discovery from the device tree and PSCI bring-up of secondaries
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "memory.h"
+
+// GICv2 targets at most 8 CPUs; CPU numbers are MPIDR Aff0
+#define SMP_MAX_CPUS 8
+
+// Boot stack for each secondary (becomes its idle thread stack)
+#define SMP_BOOT_STACK_PAGES 4
+
+// Boot CPU: find CPUs and start them. Call after thread_init()
+// and timer_tick_init().
+void smp_init(void);
+
+// Calling CPU's number (0 .. SMP_MAX_CPUS-1)
+static inline int smp_cpu_id(void)
+{
+    uint64_t mpidr;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return (int)(mpidr & 0xFF);
+}
+
+int smp_cpu_online(int cpu);
+int smp_cpus_online(void);
+int smp_cpus_present(void);
+
+#endif // SMP_H
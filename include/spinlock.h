@@ -0,0 +1,198 @@
+/*
+ * Spinlocks
+ * Three busy-wait locks for short critical sections:
+ *   spinlock_t    test-and-set; waiters sleep in WFE until the word changes
+ *   ticket_lock_t FIFO fairness with one shared counter pair
+ *   mcs_lock_t    FIFO queue where each waiter spins on its own node,
+ *                 so a handover touches one remote cache line
+ * Every lock carries its own statistics (acquisitions, contended
+ * acquisitions, time spent waiting) and joins the list shown by the
+ * locks command on its first acquisition. Locks must therefore have
+ * static storage duration. Zeroed storage is an unlocked lock; its init
+ * function names it, at run time, before its first use.
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "atomic.h"
+#include "irq.h"
+
+#define LOCK_NAME_MAX 16
+
+// Lock kinds shown by the locks command
+#define LOCK_KIND_NONE      0           // Never initialized
+#define LOCK_KIND_TAS       1
+#define LOCK_KIND_TICKET    2
+#define LOCK_KIND_MCS       3
+
+// Per-lock counters - updated only by the holder, so no atomics needed
+typedef struct lock_stats {
+    char name[LOCK_NAME_MAX];       // Copied in by the init function
+    int kind;                       // LOCK_KIND_*
+    unsigned long acquisitions;
+    unsigned long contended;        // Acquisitions that had to wait
+    uint64_t wait_ticks;            // Counter ticks spent waiting
+    uint64_t max_wait_ticks;
+    struct lock_stats* next;        // Registry link
+    int registered;
+} lock_stats_t;
+
+// Add a lock to the registry (called once from its first acquisition)
+void lock_stats_register(lock_stats_t* stats);
+
+// Virtual counter for wait times (no ISB - a few ticks of skew is fine)
+static inline uint64_t lock_clock(void)
+{
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+}
+
+// Holder-side bookkeeping; wait_start is 0 for an uncontended acquisition
+static inline void lock_account(lock_stats_t* stats, uint64_t wait_start)
+{
+    stats->acquisitions++;
+    if (wait_start) {
+        uint64_t waited = lock_clock() - wait_start;
+        stats->contended++;
+        stats->wait_ticks += waited;
+        if (waited > stats->max_wait_ticks) stats->max_wait_ticks = waited;
+    }
+    if (!stats->registered) lock_stats_register(stats);
+}
+
+// --- Test-and-set lock ---
+
+typedef struct {
+    volatile uint32_t locked;
+    lock_stats_t stats;
+} spinlock_t;
+
+// Unlocked, named 'name' or 'prefix/index'; the name is copied
+void spin_lock_init(spinlock_t* lock, const char* name);
+void spin_lock_init_indexed(spinlock_t* lock, const char* prefix, int index);
+
+static inline void spin_lock(spinlock_t* lock)
+{
+    uint64_t wait_start = 0;
+
+    while (atomic_swap32(&lock->locked, 1) != 0) {
+        if (!wait_start) wait_start = lock_clock();
+        atomic_wait32(&lock->locked, 1);
+    }
+    lock_account(&lock->stats, wait_start);
+}
+
+// Returns 1 if the lock was taken
+static inline int spin_trylock(spinlock_t* lock)
+{
+    if (atomic_load_relaxed(&lock->locked) != 0 || atomic_swap32(&lock->locked, 1) != 0) {
+        return 0;
+    }
+    lock_account(&lock->stats, 0);
+    return 1;
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+    atomic_store_release(&lock->locked, 0);
+}
+
+// --- Ticket lock ---
+
+typedef struct {
+    volatile uint32_t next;         // Next ticket to hand out
+    volatile uint32_t serving;      // Ticket allowed in
+    lock_stats_t stats;
+} ticket_lock_t;
+
+void ticket_lock_init(ticket_lock_t* lock, const char* name);
+
+static inline void ticket_lock(ticket_lock_t* lock)
+{
+    uint32_t ticket = atomic_fetch_add32(&lock->next, 1);
+    uint64_t wait_start = 0;
+    uint32_t serving;
+
+    while ((serving = atomic_load_acquire(&lock->serving)) != ticket) {
+        if (!wait_start) wait_start = lock_clock();
+        atomic_wait32(&lock->serving, serving);
+    }
+    lock_account(&lock->stats, wait_start);
+}
+
+static inline void ticket_unlock(ticket_lock_t* lock)
+{
+    // Only the holder writes 'serving'
+    atomic_store_release(&lock->serving, lock->serving + 1);
+}
+
+// --- MCS queue lock ---
+
+// One per acquisition, owned by the acquirer until it unlocks
+// (a local variable in the locking function is the usual home)
+typedef struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile uint32_t waiting;
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t* volatile tail;
+    lock_stats_t stats;
+} mcs_lock_t;
+
+void mcs_lock_init(mcs_lock_t* lock, const char* name);
+void mcs_lock(mcs_lock_t* lock, mcs_node_t* node);
+void mcs_unlock(mcs_lock_t* lock, mcs_node_t* node);
+
+// --- Interrupt-safe variants ---
+// Locks also taken from interrupt handlers must mask IRQs while held;
+// masking also keeps the holder from being preempted mid-section
+
+static inline unsigned long spin_lock_irqsave(spinlock_t* lock)
+{
+    unsigned long flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, unsigned long flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline unsigned long ticket_lock_irqsave(ticket_lock_t* lock)
+{
+    unsigned long flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t* lock, unsigned long flags)
+{
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline unsigned long mcs_lock_irqsave(mcs_lock_t* lock, mcs_node_t* node)
+{
+    unsigned long flags = irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, mcs_node_t* node, unsigned long flags)
+{
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+}
+
+// Registry walk and display (locks command)
+lock_stats_t* lock_stats_first(void);
+void lock_print(int max);
+void lock_reset_stats(void);
+void lock_bench(int threads, unsigned long iterations);
+
+#endif // SPINLOCK_H
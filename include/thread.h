@@ -0,0 +1,127 @@
+/*
+ * Kernel Threads
+ * Preemptive SMP scheduler with per-CPU run queues and work stealing;
+ * the context switch itself is in boot/switch.S
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "memory.h"
+#include "spinlock.h"
+
+#define THREAD_MAX          32
+#define THREAD_NAME_MAX     16
+#define THREAD_STACK_PAGES  4       // Default stack: 16KB from the page allocator
+
+// Affinity mask allowing every CPU
+#define THREAD_AFFINITY_ALL 0xFFFFFFFFU
+
+typedef enum {
+    THREAD_UNUSED = 0,          // Free slot
+    THREAD_READY,               // On a run queue
+    THREAD_RUNNING,             // Currently executing
+    THREAD_SLEEPING,            // Waiting for a timer deadline
+    THREAD_BLOCKED,             // Waiting in thread_join()
+    THREAD_EXITED               // Finished, waiting to be joined
+} thread_state_t;
+
+// Callee-saved registers - layout shared with boot/switch.S
+// (the kernel is built with -mgeneral-regs-only, so no FP/SIMD state)
+typedef struct {
+    uint64_t x19, x20, x21, x22, x23, x24, x25, x26, x27, x28;
+    uint64_t fp;                // x29
+    uint64_t lr;                // x30 - where context_switch returns to
+    uint64_t sp;
+} thread_context_t;
+
+typedef void (*thread_entry_t)(void* arg);
+
+// Console output sink for a redirected thread (background shell jobs)
+typedef void (*thread_output_t)(void* arg, char c);
+
+typedef struct thread {
+    thread_context_t context;
+    int id;
+    char name[THREAD_NAME_MAX];
+    volatile thread_state_t state;
+    void* stack;                // Page allocator run (NULL for boot/idle stacks)
+    size_t stack_pages;
+    uint32_t affinity;          // Bit n set = may run on CPU n
+    int cpu;                    // CPU it last ran on
+    volatile uint32_t on_cpu;   // Set until its registers are fully saved
+    int is_idle;                // Per-CPU idle thread (never queued)
+    int parked;                 // Blocked in thread_block()
+    uint64_t wake_tick;         // Deadline while sleeping
+    struct thread* next;        // Sleep list / inbox link
+    struct thread* joiner;      // Thread blocked in thread_join() on us
+    unsigned long switches;     // Times switched in
+    unsigned long migrations;   // Times taken by another CPU's steal
+    uint64_t run_ticks;         // Accumulated CPU time
+    uint64_t last_start;        // Counter value when last switched in
+    thread_output_t output;     // Console redirection (NULL = the UART)
+    void* output_arg;
+    volatile uint32_t* cancel;  // Own Ctrl-C flag (NULL = the shell's)
+} thread_t;
+
+// Boot CPU: adopt the boot flow of control as thread 0 (its idle thread)
+void thread_init(void);
+
+// Secondary CPUs: adopt the calling boot stack as this CPU's idle thread
+void thread_init_cpu(void);
+
+// Returns the new thread id, or -1 when out of slots or stack pages
+// stack_pages = 0 selects THREAD_STACK_PAGES
+int thread_create(const char* name, thread_entry_t entry, void* arg, size_t stack_pages);
+
+// Scheduling points
+void thread_yield(void);
+void thread_sleep(unsigned int ms);
+int thread_join(int id);
+void thread_exit(void);
+
+// Wait/wake for other subsystems: call thread_block() with IRQs masked
+// and 'lock' held after finding nothing to do; a waker that changes the
+// condition under the same lock then calls thread_wake()
+void thread_block(spinlock_t* lock);
+void thread_wake(int id);
+
+// Restrict a thread to the CPUs in 'mask' (must include an online CPU)
+int thread_set_affinity(int id, uint32_t mask);
+
+// Interrupt hooks (timer tick, reschedule IPI, end of irq_handle)
+void thread_tick(void);
+void thread_need_resched(void);
+void thread_irq_exit(void);
+
+// Send the calling thread's console output to 'fn' and give it its own
+// cancel flag; threads it creates afterwards inherit both
+void thread_redirect(thread_output_t fn, void* arg, volatile uint32_t* cancel);
+
+// The calling thread's sink (NULL = the UART) and its argument, so a
+// temporary redirect can put it back
+thread_output_t thread_output_sink(void** arg);
+
+// putchar hook: returns 1 if the calling thread's output is redirected
+// (and 'c' has been handed to its sink)
+int thread_output(char c);
+
+// Cancel flag of the calling thread, NULL if it follows the shell's
+volatile uint32_t* thread_cancel_flag(void);
+
+// Queries
+int thread_self(void);
+int thread_scheduler_running(void);
+unsigned long thread_switch_count(void);
+
+// Idle loop for every CPU - never returns
+void thread_idle(void);
+
+// Display and benchmarks (ps, cpus, bench switch/sched)
+void thread_print(void);
+void thread_print_cpus(void);
+void thread_reset_cpu_stats(void);
+void thread_bench_switch(unsigned long iterations);
+void thread_bench_sched(int threads, unsigned long work);
+
+#endif // THREAD_H
@@ -0,0 +1,34 @@
+/*
+ * ARM Generic Timer
+ * Free-running virtual counter used for uptime, sleeps and benchmarks
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "memory.h"
+
+// Scheduler tick rate (EL1 virtual timer interrupt)
+#define TIMER_TICK_HZ 100
+
+void timer_init(void);
+
+// Periodic tick: timer_tick_init() on the boot CPU once the GIC is up,
+// then timer_tick_start() on every CPU. Returns -1 without a GIC.
+int timer_tick_init(void);
+void timer_tick_start(void);
+int timer_tick_running(void);
+
+// Raw counter access
+uint64_t timer_ticks(void);
+uint64_t timer_frequency(void);
+
+// Conversions
+uint64_t timer_ticks_to_ns(uint64_t ticks);
+uint64_t timer_ticks_to_us(uint64_t ticks);
+uint64_t timer_ms_to_ticks(uint64_t ms);
+
+// Time since timer_init()
+uint64_t timer_uptime_ms(void);
+
+#endif // TIMER_H
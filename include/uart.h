@@ -9,8 +9,20 @@
 void uart_init(void);
 void putchar(char c);
 void puts(const char* str);
+void uart_write(const char* buf, unsigned long len);
 void printf(const char* format, ...);
+void print_uint_padded(unsigned long value, int width);
 char getchar(void);
 void gets(char* buffer, int max_size);
 
+// Buffered receive (software RX ring)
+int uart_rx_available(void);
+int uart_read_bulk(char* buffer, int max);
+unsigned long uart_rx_dropped(void);
+
+// Receive interrupt (after gic_init): input is buffered as it arrives and
+// Ctrl-C reaches running commands without polling
+void uart_irq_init(void);
+int uart_rx_irq_enabled(void);
+
 #endif
\ No newline at end of file
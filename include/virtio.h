@@ -0,0 +1,113 @@
+/*
+ * Virtio over MMIO
+ * Transport for the virtio-mmio slots QEMU virt lists in the device tree:
+ * probing, status and feature negotiation, device configuration space,
+ * queue registration and interrupt dispatch. Both the modern (version 2)
+ * and the legacy (version 1) register layouts are driven.
+ */
+
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include "memory.h"
+#include "virtqueue.h"
+
+#define VIRTIO_MAX_DEVICES  32          // QEMU virt has 32 slots
+#define VIRTIO_MAX_QUEUES   4           // Per device
+
+// Device IDs
+#define VIRTIO_ID_NET       1
+#define VIRTIO_ID_BLOCK     2
+#define VIRTIO_ID_CONSOLE   3
+#define VIRTIO_ID_RNG       4
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FEATURES_OK   0x08
+#define VIRTIO_STATUS_NEEDS_RESET   0x40
+#define VIRTIO_STATUS_FAILED        0x80
+
+// Transport feature bits (device-specific ones are below 24)
+#define VIRTIO_F_INDIRECT_DESC      28
+#define VIRTIO_F_EVENT_IDX          29
+#define VIRTIO_F_VERSION_1          32
+#define VIRTIO_F_RING_PACKED        34
+
+#define VIRTIO_FEATURE(bit)         (1UL << (bit))
+
+// Interrupt status bits passed to the handler
+#define VIRTIO_INT_USED             0x1
+#define VIRTIO_INT_CONFIG           0x2
+
+struct virtio_device;
+typedef void (*virtio_irq_fn_t)(struct virtio_device* dev, uint32_t status);
+
+typedef struct virtio_device {
+    uintptr_t base;
+    unsigned int irq;               // GIC interrupt ID, 0 if unknown
+    uint32_t version;               // 1 = legacy, 2 = modern
+    uint32_t device_id;
+    uint32_t vendor_id;
+    uint64_t device_features;       // Offered
+    uint64_t features;              // Negotiated
+    const char* driver;             // Claiming driver, NULL if free
+
+    virtqueue_t* queues[VIRTIO_MAX_QUEUES];
+    int queue_count;
+
+    virtio_irq_fn_t handler;
+    unsigned long interrupts;
+} virtio_device_t;
+
+// Boot CPU, after gic_init(): find and reset every populated slot
+void virtio_init(void);
+
+int virtio_device_count(void);
+virtio_device_t* virtio_device(int index);
+
+// First unclaimed device with this ID, now owned by 'driver'; NULL if none
+virtio_device_t* virtio_claim(uint32_t device_id, const char* driver);
+
+/*
+ * Reset the device and negotiate: accept the offered features in
+ * 'wanted' (plus VERSION_1 on modern devices) and set FEATURES_OK.
+ * Returns 0, or -1 if the device refused; dev->features holds the result.
+ */
+int virtio_negotiate(virtio_device_t* dev, uint64_t wanted);
+
+static inline int virtio_has_feature(const virtio_device_t* dev, int bit)
+{
+    return (dev->features & VIRTIO_FEATURE(bit)) != 0;
+}
+
+/*
+ * Create queue 'index' with up to 'size' entries (rounded down to the
+ * device maximum and a power of two), packed if RING_PACKED was
+ * negotiated and split otherwise, and hand it to the device.
+ */
+virtqueue_t* virtio_queue_setup(virtio_device_t* dev, int index, uint16_t size);
+
+// Route the device interrupt to 'fn' (IRQ context, acknowledged already)
+int virtio_set_handler(virtio_device_t* dev, virtio_irq_fn_t fn);
+
+// Setup finished: the device may start using its queues
+void virtio_driver_ok(virtio_device_t* dev);
+
+// Mark the device failed (driver gives up on it)
+void virtio_fail(virtio_device_t* dev);
+
+// Device-specific configuration space
+uint8_t virtio_config_read8(virtio_device_t* dev, unsigned int offset);
+uint16_t virtio_config_read16(virtio_device_t* dev, unsigned int offset);
+uint32_t virtio_config_read32(virtio_device_t* dev, unsigned int offset);
+uint64_t virtio_config_read64(virtio_device_t* dev, unsigned int offset);
+
+const char* virtio_device_name(uint32_t device_id);
+
+// Devices, negotiated features and per-queue statistics (virtio command)
+void virtio_print(void);
+void virtio_reset_stats(void);
+
+#endif // VIRTIO_H
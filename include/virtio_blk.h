@@ -0,0 +1,124 @@
+/*
+ * Virtio Block Driver
+ * The first virtio-blk device becomes the kernel's disk. Requests carry
+ * scatter-gather lists, any number can be outstanding, and a batch is
+ * published with a single doorbell. Completions are reaped from the
+ * interrupt, by polling, or adaptively (spin briefly, then sleep).
+ */
+
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "memory.h"
+#include "virtqueue.h"
+
+#define BLK_SECTOR_SIZE     512
+#define BLK_MAX_SEGMENTS    16
+#define BLK_QUEUE_SIZE      256         // Descriptors; 2 + segments per request
+#define BLK_BENCH_MS        250         // blkbench time per queue depth
+
+// Request types
+#define BLK_READ            0
+#define BLK_WRITE           1
+#define BLK_FLUSH           4
+
+// Request status
+#define BLK_OK              0
+#define BLK_PENDING         1
+#define BLK_ERROR           (-1)        // Device reported an I/O error
+#define BLK_UNSUPPORTED     (-2)
+
+typedef enum {
+    BLK_MODE_IRQ = 0,                   // Sleep until the interrupt reaps it
+    BLK_MODE_POLL,                      // Spin on the used ring, interrupts off
+    BLK_MODE_ADAPTIVE                   // Spin up to ~2x the recent latency, then sleep
+} blk_mode_t;
+
+struct blk_request;
+typedef void (*blk_done_fn_t)(struct blk_request* req);
+typedef int (*blk_cond_fn_t)(void* arg);
+
+// Device header and status byte sent with every request
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} blk_header_t;
+
+typedef struct blk_request {
+    // Filled in by the caller
+    int type;                           // BLK_READ, BLK_WRITE or BLK_FLUSH
+    uint64_t sector;
+    vq_buf_t segments[BLK_MAX_SEGMENTS];
+    int segment_count;
+    blk_done_fn_t done;                 // Optional; runs where the completion is reaped
+    void* priv;
+
+    // Driver state
+    volatile int status;
+    uint64_t submitted;                 // Counter values for latency
+    uint64_t completed;
+    struct blk_request* next;           // Free for the submitter's lists
+    blk_header_t header;
+    volatile uint8_t device_status;
+} blk_request_t;
+
+typedef struct {
+    unsigned long requests;
+    unsigned long batches;              // blk_submit() calls that queued something
+    unsigned long sectors_read;
+    unsigned long sectors_written;
+    unsigned long errors;
+    unsigned long polled;               // Completions reaped by a spinning waiter
+    unsigned long interrupt_reaped;     // Completions reaped by the interrupt
+    unsigned long sleeps;               // Waits that went to sleep
+    uint64_t latency_ticks;             // Sum over completed requests
+} blk_stats_t;
+
+// Boot CPU, after virtio_init(): claim the first virtio-blk device
+void blk_init(void);
+
+int blk_present(void);
+uint64_t blk_capacity(void);            // Sectors
+int blk_read_only(void);
+int blk_max_depth(int segments);        // Requests that fit the queue at once
+int blk_max_segments(void);             // Per request (device SEG_MAX, at most 16)
+uint32_t blk_max_segment_size(void);    // Bytes
+
+blk_mode_t blk_get_mode(void);
+void blk_set_mode(blk_mode_t mode);
+const char* blk_mode_name(blk_mode_t mode);
+
+/*
+ * Queue up to 'count' requests with one doorbell. Returns how many were
+ * accepted (the rest did not fit the queue), or -1 if a request is
+ * malformed or there is no disk.
+ */
+int blk_submit(blk_request_t** reqs, int count);
+
+// Reap whatever has completed; returns the number of requests finished
+int blk_poll(void);
+
+// Wait for one request according to the completion mode; returns its status
+int blk_wait(blk_request_t* req);
+
+/*
+ * The same wait for any condition that a completion callback makes
+ * true, such as a request of a layer above finishing: done(arg) is
+ * checked again after every batch of completions.
+ */
+void blk_wait_event(blk_cond_fn_t done, void* arg);
+
+// Synchronous helpers (any length; split into requests as needed)
+int blk_read(uint64_t sector, void* buf, size_t sectors);
+int blk_write(uint64_t sector, const void* buf, size_t sectors);
+int blk_flush(void);
+
+const blk_stats_t* blk_stats(void);
+void blk_print(void);
+void blk_reset_stats(void);
+
+// IOPS, MB/s and latency at queue depths 1..64 (blkbench command)
+void blk_bench(int write, size_t io_bytes, unsigned int ms_per_depth);
+
+#endif // VIRTIO_BLK_H
@@ -0,0 +1,114 @@
+/*
+ * Virtqueues
+ * Split and packed virtio rings behind one interface. Drivers add any
+ * number of descriptor chains and then kick once: the device only sees a
+ * doorbell when its event suppression settings ask for one, and with
+ * EVENT_IDX the driver likewise tells the device when to interrupt.
+ */
+
+#ifndef VIRTQUEUE_H
+#define VIRTQUEUE_H
+
+#include "memory.h"
+#include "spinlock.h"
+
+#define VIRTQUEUE_MAX_SIZE  256
+
+// One buffer of a chain: device-readable ("out") or device-writable ("in")
+typedef struct {
+    void* addr;
+    uint32_t len;
+} vq_buf_t;
+
+typedef struct virtqueue virtqueue_t;
+
+// Doorbell supplied by the transport
+typedef void (*vq_notify_fn_t)(virtqueue_t* vq);
+
+typedef struct {
+    unsigned long chains;           // Chains added
+    unsigned long kicks;            // virtqueue_kick() calls with work queued
+    unsigned long notifies;         // Doorbells actually rung
+    unsigned long suppressed;       // Kicks the device said it did not need
+    unsigned long used;             // Chains returned by the device
+    unsigned long full;             // virtqueue_add() refused: no room
+} vq_stats_t;
+
+struct virtqueue {
+    spinlock_t lock;                // For drivers; the calls below do not take it
+    int index;
+    uint16_t size;
+    int packed;
+    int event_idx;                  // VIRTIO_F_EVENT_IDX negotiated
+    uint16_t num_free;              // Free descriptors
+    uint16_t num_added;             // Ring entries added since the last kick
+    int cb_disabled;                // Used-buffer interrupts turned off
+
+    // Ring memory (page run) and the three areas the transport registers
+    void* pages;
+    size_t page_count;
+    uintptr_t desc_addr;
+    uintptr_t driver_addr;          // Split: avail ring; packed: driver event
+    uintptr_t device_addr;          // Split: used ring; packed: device event
+
+    // Split ring state
+    uint16_t free_head;             // Free descriptor list
+    uint16_t avail_idx;             // Shadow of avail->idx
+    uint16_t last_used;
+
+    // Packed ring state
+    uint16_t next_avail;
+    uint16_t next_used;
+    int avail_wrap;
+    int used_wrap;
+    uint16_t free_id;               // Free buffer id list
+    uint16_t* id_next;
+    uint16_t* id_count;             // Descriptors in the chain using an id
+    uint16_t avail_flags;           // AVAIL/USED bits for the current lap
+
+    void** tokens;                  // Per head (split) or id (packed)
+    vq_notify_fn_t notify;
+    void* priv;                     // Transport data
+    vq_stats_t stats;
+};
+
+/*
+ * Allocate a ring of 'size' entries (a power of two). 'legacy' lays a
+ * split ring out in the single page-aligned block that version 1
+ * devices expect.
+ */
+virtqueue_t* virtqueue_create(int index, uint16_t size, int packed, int event_idx, int legacy,
+                              vq_notify_fn_t notify, void* priv);
+void virtqueue_destroy(virtqueue_t* vq);
+
+/*
+ * Queue one chain: 'out' device-readable buffers then 'in' writable ones.
+ * 'token' comes back from virtqueue_get(). Not visible to a split-ring
+ * device until the next kick. Returns 0, or -1 if there is no room.
+ */
+int virtqueue_add(virtqueue_t* vq, const vq_buf_t* bufs, int out, int in, void* token);
+
+// Publish everything added since the last kick and ring the doorbell
+// if the device asked for it; returns 1 if it was rung
+int virtqueue_kick(virtqueue_t* vq);
+
+// Next completed chain's token and the bytes the device wrote; NULL if none
+void* virtqueue_get(virtqueue_t* vq, uint32_t* len);
+int virtqueue_has_used(virtqueue_t* vq);
+
+/*
+ * Used-buffer interrupts. enable returns 1 if completions arrived while
+ * they were off (poll again before sleeping). enable_delayed asks for an
+ * interrupt only after about 3/4 of the outstanding chains complete
+ * (EVENT_IDX; otherwise the same as enable).
+ */
+void virtqueue_disable_cb(virtqueue_t* vq);
+int virtqueue_enable_cb(virtqueue_t* vq);
+int virtqueue_enable_cb_delayed(virtqueue_t* vq);
+
+static inline int virtqueue_free(const virtqueue_t* vq)
+{
+    return vq->num_free;
+}
+
+#endif // VIRTQUEUE_H
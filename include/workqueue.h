@@ -0,0 +1,51 @@
+/*
+ * Work Queues
+ * Deferred calls run in thread context by one worker thread per CPU, so
+ * long jobs leave the shell and interrupt handlers. Delayed work rides on
+ * a kernel timer and is queued when it fires.
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "memory.h"
+#include "ktimer.h"
+
+typedef void (*work_fn_t)(void* arg);
+
+typedef struct work {
+    work_fn_t fn;
+    void* arg;
+    struct work* next;
+    volatile uint32_t pending;  // Queued or waiting on its timer
+    int cpu;                    // Worker it is (or will be) queued on
+    uint64_t queued_at;         // Counter value when it reached the queue
+    ktimer_t timer;             // Delay for work_queue_delayed()
+} work_t;
+
+// Boot CPU, after smp_init(): start a worker on every online CPU
+void workqueue_init(void);
+
+void work_init(work_t* work, work_fn_t fn, void* arg);
+
+/*
+ * Queue on the calling CPU's worker, a given CPU's worker, or the calling
+ * CPU's after 'ms' milliseconds. The item may be queued again as soon as
+ * it starts running. Return 0, or -1 if it is already pending or there is
+ * no worker (or, for delayed work, no tick).
+ */
+int work_queue(work_t* work);
+int work_queue_on(int cpu, work_t* work);
+int work_queue_delayed(work_t* work, unsigned int ms);
+
+// Remove a pending item before it starts; returns 1 if it was removed
+int work_cancel(work_t* work);
+
+// Per-CPU queue and timer wheel statistics (work command)
+void workqueue_print(void);
+void workqueue_reset_stats(void);
+
+// Queue-to-start latency and throughput, and delayed work accuracy
+void workqueue_bench(unsigned long items);
+
+#endif // WORKQUEUE_H
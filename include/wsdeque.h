@@ -0,0 +1,41 @@
+/*
+ * Work-Stealing Deque (Chase-Lev)
+ * The owning CPU pushes at the bottom; any CPU (the owner included)
+ * takes from the top with a CAS, so items leave in FIFO order
+ */
+
+#ifndef WSDEQUE_H
+#define WSDEQUE_H
+
+#include "memory.h"
+
+// Fixed capacity (power of two) - callers bound the number of items
+#define WSDEQUE_SIZE 64
+#define WSDEQUE_MASK (WSDEQUE_SIZE - 1)
+
+// Result of wsdeque_steal()
+#define WSDEQUE_OK     0
+#define WSDEQUE_EMPTY  1
+#define WSDEQUE_ABORT  2        // Lost a race with another taker - retry
+
+// top and bottom live on separate cache lines: thieves write top,
+// the owner writes bottom
+typedef struct {
+    volatile uint64_t top;
+    uint8_t pad0[56];
+    volatile uint64_t bottom;
+    uint8_t pad1[56];
+    void* volatile items[WSDEQUE_SIZE];
+} __attribute__((aligned(64))) wsdeque_t;
+
+void wsdeque_init(wsdeque_t* q);
+
+// Owner only
+int wsdeque_push(wsdeque_t* q, void* item);
+void* wsdeque_pop(wsdeque_t* q);
+
+// Any CPU
+int wsdeque_steal(wsdeque_t* q, void** item);
+int wsdeque_size(const wsdeque_t* q);
+
+#endif // WSDEQUE_H
@@ -5,6 +5,24 @@
 
 KERNEL_IMG="build/kernel.img"
 
+# CPU count (override with SMP=n ./run.sh)
+SMP="${SMP:-4}"
+
+# CPU model (CPU=max enables ARMv8.1 LSE atomics)
+CPU="${CPU:-cortex-a57}"
+
+# Extra QEMU arguments (e.g. virtio devices) are passed through:
+#   ./run.sh -drive file=disk.img,if=none,format=raw,id=hd0 -device virtio-blk-device,drive=hd0
+# A disk with a filesystem comes from the host tool: make mkfs && build/mkfs disk.img 64 [files...]
+# Files for /initrd come from a newc cpio archive: (cd dir && find . | cpio -o -H newc) > rd.cpio
+#   ./run.sh -initrd rd.cpio
+# Single files without an image go through fw_cfg (see the fwcfg command):
+#   ./run.sh -fw_cfg name=opt/setup.sh,file=setup.sh
+# Semihosting lets 'export' write host files and 'exit' stop QEMU with a status:
+#   ./run.sh -semihosting
+# Aliases, history and colors persist in the second flash bank given an image:
+#   truncate -s 64M flash.img && ./run.sh -drive if=pflash,unit=1,file=flash.img,format=raw
+
 # Check if kernel image exists
 if [ ! -f "$KERNEL_IMG" ]; then
     echo "Error: Kernel image not found at $KERNEL_IMG"
@@ -19,8 +37,11 @@ echo
 
 qemu-system-aarch64 \
     -machine virt \
-    -cpu cortex-a57 \
+    -cpu "$CPU" \
+    -smp "$SMP" \
     -kernel "$KERNEL_IMG" \
     -m 128M \
     -nographic \
-    -serial mon:stdio
\ No newline at end of file
+    -serial mon:stdio \
+    -global virtio-mmio.force-legacy=false \
+    "$@"
\ No newline at end of file
@@ -0,0 +1,19 @@
+/*
+ * ARM64 Atomic Operations Implementation
+ * Runtime selection between LSE instructions and exclusive-access loops
+ */
+
+#include "atomic.h"
+
+// ID_AA64ISAR0_EL1.Atomic (bits 23:20): 2 = LDADD/CAS/SWP and friends
+#define ISAR0_ATOMIC_SHIFT 20
+#define ISAR0_ATOMIC_LSE   2
+
+int atomic_lse = 0;
+
+void atomic_init(void)
+{
+    uint64_t isar0;
+    __asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+    atomic_lse = ((isar0 >> ISAR0_ATOMIC_SHIFT) & 0xF) >= ISAR0_ATOMIC_LSE;
+}
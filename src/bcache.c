@@ -0,0 +1,752 @@
+/*
+ * Buffer Cache Implementation
+ * One lock covers the hash table, the CLOCK-Pro list and the counters.
+ * Disk I/O is never started with it held: request completions take it
+ * (possibly from the interrupt), so buffers being read or written are
+ * marked BUF_IO under the lock and the requests are submitted after.
+ */
+
+#include "bcache.h"
+#include "iosched.h"
+#include "page.h"
+#include "parallel.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "uart.h"
+#include "virtio_blk.h"
+#include "workqueue.h"
+
+#define SECTORS_PER_BLOCK   (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define DATA_RUN_PAGES      64              // Buffer pages are allocated in runs
+#define WB_MAX              256             // Blocks per write-back round
+
+static spinlock_t bcache_lock;
+static int ready = 0;
+
+static size_t capacity = 0;                 // Resident buffers
+static buf_t* entries = NULL;               // Resident blocks and test entries
+static size_t entry_count = 0;
+static buf_t* free_entries = NULL;
+static uint8_t** free_slots = NULL;         // Unused data pages
+static size_t free_slot_count = 0;
+static buf_t** hash_table = NULL;
+static int hash_bits = 0;
+
+// CLOCK-Pro: one circular list, three hands
+static buf_t* hand_hot = NULL;
+static buf_t* hand_cold = NULL;
+static buf_t* hand_test = NULL;
+static size_t nr_hot = 0;
+static size_t nr_cold = 0;                  // Resident cold blocks
+static size_t nr_test = 0;                  // Non-resident blocks in their test period
+static size_t cold_target = 0;              // Adaptive share of cold blocks
+static size_t nr_dirty = 0;
+
+// Sequential stream detection (one stream)
+static uint64_t ra_last = ~0UL;
+static uint64_t ra_next = 0;                // First block not read ahead yet
+static uint64_t ra_window = BCACHE_RA_MIN;
+static int ra_sequential = 0;
+
+static buf_t* wb_bufs[WB_MAX];
+static int writeback_busy = 0;
+static work_t writeback_work;
+
+static bcache_stats_t stats;
+
+static int writeback(void);
+
+// --- Hash table ---
+
+static uint32_t hash_index(int dev, uint64_t block)
+{
+    uint64_t key = block ^ ((uint64_t)dev << 48);
+    return (uint32_t)((key * 0x9E3779B97F4A7C15UL) >> (64 - hash_bits));
+}
+
+static buf_t* hash_find(int dev, uint64_t block)
+{
+    buf_t* b = hash_table[hash_index(dev, block)];
+    while (b && (b->block != block || b->dev != dev)) {
+        b = b->hash_next;
+    }
+    return b;
+}
+
+static void hash_insert(buf_t* b)
+{
+    uint32_t i = hash_index(b->dev, b->block);
+    b->hash_next = hash_table[i];
+    hash_table[i] = b;
+}
+
+static void hash_remove(buf_t* b)
+{
+    buf_t** link = &hash_table[hash_index(b->dev, b->block)];
+    while (*link != b) {
+        link = &(*link)->hash_next;
+    }
+    *link = b->hash_next;
+}
+
+// --- CLOCK-Pro ---
+
+// Insert just behind the hot hand: the last place any hand reaches
+static void clock_insert(buf_t* b)
+{
+    if (!hand_hot) {
+        b->clock_next = b->clock_prev = b;
+        hand_hot = hand_cold = hand_test = b;
+        return;
+    }
+    b->clock_next = hand_hot;
+    b->clock_prev = hand_hot->clock_prev;
+    hand_hot->clock_prev->clock_next = b;
+    hand_hot->clock_prev = b;
+}
+
+static void clock_remove(buf_t* b)
+{
+    if (b->clock_next == b) {
+        hand_hot = hand_cold = hand_test = NULL;
+        return;
+    }
+    if (hand_hot == b) hand_hot = b->clock_next;
+    if (hand_cold == b) hand_cold = b->clock_next;
+    if (hand_test == b) hand_test = b->clock_next;
+    b->clock_prev->clock_next = b->clock_next;
+    b->clock_next->clock_prev = b->clock_prev;
+}
+
+static void clock_move_to_head(buf_t* b)
+{
+    clock_remove(b);
+    clock_insert(b);
+}
+
+// Forget a block altogether
+static void entry_free(buf_t* b)
+{
+    hash_remove(b);
+    clock_remove(b);
+    b->hash_next = free_entries;
+    free_entries = b;
+}
+
+// A cold block's test period ran out without it being used again
+static void end_test(buf_t* b)
+{
+    b->flags &= ~BUF_TEST;
+    if (!b->data) {
+        nr_test--;
+        entry_free(b);
+    }
+    if (cold_target > 1) cold_target--;
+}
+
+// Demote hot blocks until they are within their share (and some are cold)
+static void run_hand_hot(void)
+{
+    while (nr_hot > 0 && (nr_hot > capacity - cold_target || nr_cold == 0)) {
+        buf_t* b = hand_hot;
+        hand_hot = b->clock_next;
+
+        if (b->flags & BUF_HOT) {
+            if (b->flags & BUF_REF) {
+                b->flags &= ~BUF_REF;
+            } else {
+                b->flags &= ~BUF_HOT;
+                nr_hot--;
+                nr_cold++;
+                stats.demotions++;
+            }
+        } else if (b->flags & BUF_TEST) {
+            end_test(b);
+        }
+    }
+}
+
+// Keep at most 'capacity' remembered blocks
+static void run_hand_test(void)
+{
+    while (nr_test > capacity) {
+        buf_t* b = hand_test;
+        hand_test = b->clock_next;
+        if (!(b->flags & BUF_HOT) && (b->flags & BUF_TEST)) {
+            end_test(b);
+        }
+    }
+}
+
+/*
+ * Advance the cold hand to a block that can go and take its data page.
+ * Referenced cold blocks in their test period turn hot; other referenced
+ * ones start a new test period. Dirty blocks are passed over and '*dirty'
+ * set so the caller can write them back; NULL if nothing could go.
+ */
+static uint8_t* run_hand_cold(int* dirty)
+{
+    size_t steps = 2 * (nr_hot + nr_cold + nr_test) + 1;
+
+    *dirty = 0;
+    while (steps-- > 0) {
+        if (nr_cold == 0) {
+            run_hand_hot();
+            if (nr_cold == 0) return NULL;
+        }
+
+        buf_t* b = hand_cold;
+        hand_cold = b->clock_next;
+        if ((b->flags & BUF_HOT) || !b->data) continue;
+        if (b->refcount > 0 || (b->flags & BUF_IO)) continue;
+
+        if (b->flags & BUF_REF) {
+            b->flags &= ~BUF_REF;
+            if (b->flags & BUF_TEST) {
+                b->flags = (b->flags & ~BUF_TEST) | BUF_HOT;
+                nr_cold--;
+                nr_hot++;
+                stats.promotions++;
+                clock_move_to_head(b);
+                run_hand_hot();
+            } else {
+                b->flags |= BUF_TEST;
+                clock_move_to_head(b);
+            }
+            continue;
+        }
+        if (b->flags & BUF_DIRTY) {
+            *dirty = 1;
+            continue;
+        }
+
+        uint8_t* data = b->data;
+        b->data = NULL;
+        b->flags &= ~(BUF_VALID | BUF_READAHEAD);
+        nr_cold--;
+        stats.evictions++;
+        if (b->flags & BUF_TEST) {
+            nr_test++;
+            run_hand_test();
+        } else {
+            entry_free(b);
+        }
+        return data;
+    }
+    return NULL;
+}
+
+static uint8_t* slot_take(int* dirty)
+{
+    *dirty = 0;
+    if (free_slot_count > 0) return free_slots[--free_slot_count];
+    return run_hand_cold(dirty);
+}
+
+/*
+ * Give (dev, block), which is not resident, the data page 'data': a new
+ * cold block in its test period, or a remembered one. An access to a
+ * block still in its test period makes it hot and grows the cold share,
+ * which was evidently too small to keep it. Returns the entry unreferenced.
+ */
+static buf_t* install(int dev, uint64_t block, uint8_t* data, int access)
+{
+    buf_t* b = hash_find(dev, block);
+    if (b) {
+        nr_test--;
+        b->data = data;
+        b->refcount = 0;
+        if (access) {
+            if (cold_target < capacity - 1) cold_target++;
+            b->flags = BUF_HOT;
+            nr_hot++;
+            stats.test_hits++;
+            stats.promotions++;
+            clock_move_to_head(b);
+            run_hand_hot();
+        } else {
+            b->flags = BUF_TEST;
+            nr_cold++;
+        }
+        return b;
+    }
+
+    b = free_entries;
+    free_entries = b->hash_next;
+    b->dev = dev;
+    b->block = block;
+    b->data = data;
+    b->flags = BUF_TEST;
+    b->refcount = 0;
+    hash_insert(b);
+    clock_insert(b);
+    nr_cold++;
+    return b;
+}
+
+// --- I/O ---
+
+// Queue a whole-block read or write of a buffer (its BUF_IO is set)
+static void submit_block(buf_t* b, int type, io_done_fn_t done)
+{
+    io_t* io = &b->io;
+    io->type = type;
+    io->sector = b->block * SECTORS_PER_BLOCK;
+    io->buf = b->data;
+    io->len = BCACHE_BLOCK_SIZE;
+    io->done = done;
+    io->priv = b;
+
+    if (io_submit(io) != 0) {
+        io->status = BLK_ERROR;
+        if (done) done(io);
+    }
+}
+
+// Readahead completion (interrupt or polling context)
+static void readahead_done(io_t* io)
+{
+    buf_t* b = io->priv;
+
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    b->flags &= ~BUF_IO;
+    if (io->status == BLK_OK) {
+        b->flags |= BUF_VALID;
+    } else {
+        b->flags &= ~BUF_READAHEAD;         // A reader will retry it
+        stats.errors++;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/*
+ * Called on every read with the lock held. A read of the block after the
+ * previous one makes the stream sequential; once the reader is within
+ * half a window of the readahead point, the next window is read
+ * asynchronously and the window doubles up to BCACHE_RA_MAX. Fills 'out'
+ * with the buffers to read and returns their number.
+ */
+static int readahead(int dev, uint64_t block, buf_t** out)
+{
+    if (block == ra_last + 1) {
+        ra_sequential = 1;
+    } else if (block != ra_last) {
+        ra_sequential = 0;
+        ra_window = BCACHE_RA_MIN;
+        ra_next = 0;
+    }
+    ra_last = block;
+
+    if (!ra_sequential) return 0;
+    if (ra_next <= block) ra_next = block + 1;
+    if (ra_next - block > ra_window / 2) return 0;
+
+    uint64_t end = ra_next + ra_window;
+    uint64_t blocks = blk_capacity() / SECTORS_PER_BLOCK;
+    if (end > blocks) end = blocks;
+
+    int count = 0;
+    uint64_t next;
+    for (next = ra_next; next < end; next++) {
+        buf_t* b = hash_find(dev, next);
+        if (b && b->data) continue;
+
+        // Readahead only takes free or clean pages
+        int dirty;
+        uint8_t* data = slot_take(&dirty);
+        if (!data) break;
+
+        b = install(dev, next, data, 0);
+        b->flags |= BUF_IO | BUF_READAHEAD;
+        out[count++] = b;
+        stats.readahead++;
+    }
+
+    ra_next = next;
+    if (ra_window < BCACHE_RA_MAX) ra_window *= 2;
+    return count;
+}
+
+// Wait for a read started by bcache_access() and publish the result
+static int read_finish(buf_t* b)
+{
+    int status = io_wait(&b->io);
+
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    b->flags &= ~BUF_IO;
+    if (status == BLK_OK) {
+        b->flags |= BUF_VALID;
+    } else {
+        stats.errors++;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return status == BLK_OK ? 0 : -1;
+}
+
+static buf_t* bcache_access(int dev, uint64_t block, int read)
+{
+    if (block >= bcache_blocks(dev)) return NULL;
+
+    buf_t* ahead[BCACHE_RA_MAX];
+    int count = 0;
+    int own_read = 0;
+    buf_t* b;
+
+    for (int attempt = 0;; attempt++) {
+        int dirty;
+        unsigned long flags = spin_lock_irqsave(&bcache_lock);
+
+        b = hash_find(dev, block);
+        if (b && b->data) {
+            stats.lookups++;
+            stats.hits++;
+            b->flags |= BUF_REF;
+            if (b->flags & BUF_READAHEAD) {
+                b->flags &= ~BUF_READAHEAD;
+                stats.readahead_used++;
+            }
+            b->refcount++;
+            if (read) count = readahead(dev, block, ahead);
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            break;
+        }
+
+        uint8_t* data = slot_take(&dirty);
+        if (data) {
+            stats.lookups++;
+            stats.misses++;
+            b = install(dev, block, data, 1);
+            b->refcount = 1;
+            if (read) {
+                b->flags |= BUF_IO;
+                own_read = 1;
+                count = readahead(dev, block, ahead);
+            } else {
+                memset(b->data, 0, BCACHE_BLOCK_SIZE);
+                b->flags |= BUF_VALID;
+            }
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            break;
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        // Every cold block is dirty, referenced or busy
+        if (dirty) {
+            writeback();
+        } else if (attempt < 100) {
+            blk_poll();
+            thread_yield();
+        } else {
+            return NULL;
+        }
+    }
+
+    // The missing block and its readahead go out as one merged request
+    if (own_read || count > 0) {
+        iosched_plug();
+        if (own_read) submit_block(b, BLK_READ, NULL);
+        for (int i = 0; i < count; i++) {
+            submit_block(ahead[i], BLK_READ, readahead_done);
+        }
+        iosched_unplug();
+    }
+    if (own_read && read_finish(b) != 0) {
+        bcache_release(b);
+        return NULL;
+    }
+
+    // A hit may still be arriving, or be a readahead that failed
+    while (!(b->flags & BUF_VALID)) {
+        if (b->flags & BUF_IO) {
+            io_wait(&b->io);
+            continue;
+        }
+
+        unsigned long flags = spin_lock_irqsave(&bcache_lock);
+        if (b->flags & (BUF_VALID | BUF_IO)) {
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            continue;
+        }
+        if (!read) {
+            memset(b->data, 0, BCACHE_BLOCK_SIZE);
+            b->flags |= BUF_VALID;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            break;
+        }
+        b->flags |= BUF_IO;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        submit_block(b, BLK_READ, NULL);
+        if (read_finish(b) != 0) {
+            bcache_release(b);
+            return NULL;
+        }
+    }
+    return b;
+}
+
+// --- Write-back ---
+
+/*
+ * Write every dirty block: queue a round of them under one plug, so the
+ * I/O scheduler sorts them and merges neighbours before dispatch. One
+ * caller at a time; returns 0, or -1 after an I/O error.
+ */
+static int writeback(void)
+{
+    int errors = 0;
+
+    while (!errors) {
+        unsigned long flags = spin_lock_irqsave(&bcache_lock);
+        while (writeback_busy) {
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            blk_poll();
+            thread_yield();
+            flags = spin_lock_irqsave(&bcache_lock);
+        }
+
+        int n = 0;
+        buf_t* b = hand_hot;
+        if (b) {
+            do {
+                if ((b->flags & (BUF_DIRTY | BUF_IO)) == BUF_DIRTY) {
+                    b->flags = (b->flags & ~BUF_DIRTY) | BUF_IO;
+                    wb_bufs[n++] = b;
+                }
+                b = b->clock_next;
+            } while (b != hand_hot && n < WB_MAX);
+        }
+        nr_dirty -= n;
+        if (n == 0) {
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            break;
+        }
+        writeback_busy = 1;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        iosched_plug();
+        for (int i = 0; i < n; i++) {
+            submit_block(wb_bufs[i], BLK_WRITE, NULL);
+        }
+        iosched_unplug();
+        for (int i = 0; i < n; i++) {
+            io_wait(&wb_bufs[i]->io);
+        }
+
+        flags = spin_lock_irqsave(&bcache_lock);
+        for (int i = 0; i < n; i++) {
+            b = wb_bufs[i];
+            b->flags &= ~BUF_IO;
+            if (b->io.status == BLK_OK) {
+                stats.written++;
+                continue;
+            }
+            if (!(b->flags & BUF_DIRTY)) {
+                b->flags |= BUF_DIRTY;
+                nr_dirty++;
+            }
+            stats.errors++;
+            errors++;
+        }
+        writeback_busy = 0;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+    }
+    return errors ? -1 : 0;
+}
+
+// Periodic write-back on a worker while anything is dirty
+static void writeback_work_fn(void* arg)
+{
+    (void)arg;
+    writeback();
+
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    int more = nr_dirty > 0;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    if (more) work_queue_delayed(&writeback_work, BCACHE_WRITEBACK_MS);
+}
+
+// --- Interface ---
+
+void bcache_init(void)
+{
+    spin_lock_init(&bcache_lock, "bcache");
+
+    if (!blk_present()) return;
+
+    size_t buffers = page_free_count() / BCACHE_RAM_SHARE;
+    if (buffers < BCACHE_MIN_BUFFERS) buffers = BCACHE_MIN_BUFFERS;
+    if (buffers > BCACHE_MAX_BUFFERS) buffers = BCACHE_MAX_BUFFERS;
+
+    // Metadata for every resident block and as many remembered ones
+    entry_count = 2 * buffers + 1;
+    hash_bits = 1;
+    while ((1UL << hash_bits) < 2 * buffers) hash_bits++;
+
+    size_t entry_pages = (entry_count * sizeof(buf_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t hash_pages = ((sizeof(buf_t*) << hash_bits) + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t slot_pages = (buffers * sizeof(uint8_t*) + PAGE_SIZE - 1) / PAGE_SIZE;
+    entries = parallel_page_alloc_zeroed(entry_pages, 0);
+    hash_table = parallel_page_alloc_zeroed(hash_pages, 0);
+    free_slots = page_alloc(slot_pages);
+    if (!entries || !hash_table || !free_slots) {
+        puts("Buffer cache: not enough memory");
+        return;
+    }
+    for (size_t i = 0; i < entry_count; i++) {
+        entries[i].hash_next = free_entries;
+        free_entries = &entries[i];
+    }
+
+    // Data pages in runs; settle for fewer if memory is fragmented
+    while (free_slot_count < buffers) {
+        size_t run = buffers - free_slot_count;
+        if (run > DATA_RUN_PAGES) run = DATA_RUN_PAGES;
+        uint8_t* pages = page_alloc(run);
+        if (!pages) break;
+        for (size_t i = 0; i < run; i++) {
+            free_slots[free_slot_count++] = pages + i * PAGE_SIZE;
+        }
+    }
+    if (free_slot_count == 0) {
+        puts("Buffer cache: not enough memory");
+        return;
+    }
+
+    capacity = free_slot_count;
+    cold_target = capacity / 4;
+    work_init(&writeback_work, writeback_work_fn, NULL);
+    ready = 1;
+
+    printf("Buffer cache: %lu buffers (%lu KB), %lu hash buckets\n",
+           (unsigned long)capacity, (unsigned long)(capacity * BCACHE_BLOCK_SIZE / 1024),
+           1UL << hash_bits);
+}
+
+uint64_t bcache_blocks(int dev)
+{
+    if (!ready || dev != BCACHE_DEV_DISK) return 0;
+    return blk_capacity() / SECTORS_PER_BLOCK;
+}
+
+buf_t* bcache_read(int dev, uint64_t block)
+{
+    return bcache_access(dev, block, 1);
+}
+
+buf_t* bcache_get(int dev, uint64_t block)
+{
+    return bcache_access(dev, block, 0);
+}
+
+void bcache_dirty(buf_t* buf)
+{
+    int now = 0;
+    int later = 0;
+
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    if (!(buf->flags & BUF_DIRTY)) {
+        buf->flags |= BUF_DIRTY | BUF_VALID;
+        nr_dirty++;
+        later = nr_dirty == 1;
+        now = nr_dirty == capacity / 4;     // Keep clean blocks to evict
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (later) work_queue_delayed(&writeback_work, BCACHE_WRITEBACK_MS);
+    if (now) {
+        work_cancel(&writeback_work);
+        work_queue(&writeback_work);
+    }
+}
+
+void bcache_release(buf_t* buf)
+{
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    buf->refcount--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+int bcache_sync(void)
+{
+    if (!ready) return -1;
+
+    int result = writeback();
+    if (blk_flush() != 0) result = -1;
+    return result;
+}
+
+void bcache_drop(void)
+{
+    if (!ready) return;
+    bcache_sync();
+
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    size_t total = nr_hot + nr_cold + nr_test;
+    buf_t* b = hand_hot;
+    for (size_t i = 0; i < total; i++) {
+        buf_t* next = b->clock_next;
+        if (!b->data) {
+            nr_test--;
+            entry_free(b);
+        } else if (b->refcount == 0 && !(b->flags & (BUF_IO | BUF_DIRTY))) {
+            if (b->flags & BUF_HOT) {
+                nr_hot--;
+            } else {
+                nr_cold--;
+            }
+            free_slots[free_slot_count++] = b->data;
+            b->data = NULL;
+            entry_free(b);
+        }
+        b = next;
+    }
+    ra_last = ~0UL;
+    ra_sequential = 0;
+    ra_window = BCACHE_RA_MIN;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+const bcache_stats_t* bcache_stats(void)
+{
+    return &stats;
+}
+
+void bcache_print(void)
+{
+    if (!ready) {
+        puts("No buffer cache (no virtio-blk disk)");
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    bcache_stats_t s = stats;
+    unsigned long hot = nr_hot, cold = nr_cold, test = nr_test, target = cold_target;
+    unsigned long unused = free_slot_count, dirty = nr_dirty, window = ra_window;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    unsigned long permille = s.lookups ? s.hits * 1000 / s.lookups : 0;
+    unsigned long ra_permille = s.readahead ? s.readahead_used * 1000 / s.readahead : 0;
+
+    printf("Buffer cache: %lu x 4 KB buffers (%lu KB), %lu hash buckets\n",
+           (unsigned long)capacity, (unsigned long)(capacity * BCACHE_BLOCK_SIZE / 1024),
+           1UL << hash_bits);
+    printf("  Resident: %lu hot, %lu cold (target %lu), %lu free; %lu evicted blocks in test\n",
+           hot, cold, target, unused, test);
+    printf("  Dirty: %lu (written back within %d ms)\n", dirty, BCACHE_WRITEBACK_MS);
+    printf("  Lookups %lu: %lu hits (%lu.%lu%%), %lu misses, %lu test hits\n",
+           s.lookups, s.hits, permille / 10, permille % 10, s.misses, s.test_hits);
+    printf("  Readahead: %lu blocks, %lu used (%lu.%lu%%), window %lu blocks\n",
+           s.readahead, s.readahead_used, ra_permille / 10, ra_permille % 10, window);
+    printf("  Evictions %lu, promotions %lu, demotions %lu\n",
+           s.evictions, s.promotions, s.demotions);
+    printf("  Write-back: %lu blocks, %lu I/O errors (merging: see 'iosched')\n",
+           s.written, s.errors);
+}
+
+void bcache_reset_stats(void)
+{
+    unsigned long flags = spin_lock_irqsave(&bcache_lock);
+    memset(&stats, 0, sizeof(stats));
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
@@ -0,0 +1,49 @@
+/*
+ * Command Cancellation Implementation
+ * The flag is normally set from the UART receive interrupt. Without one
+ * (no GIC) cancel_requested() drains the receive FIFO itself, so a
+ * loop that prints nothing can still be stopped. Background jobs have
+ * their own flag (set by fg) and never see the shell's.
+ */
+
+#include "cancel.h"
+#include "atomic.h"
+#include "thread.h"
+#include "uart.h"
+
+static volatile uint32_t armed = 0;
+static volatile uint32_t requested = 0;
+
+void cancel_arm(void)
+{
+    if (thread_cancel_flag()) return;       // Jobs are cancelled through fg
+    atomic_store_relaxed(&requested, 0);
+    atomic_store_release(&armed, 1);
+}
+
+void cancel_disarm(void)
+{
+    if (thread_cancel_flag()) return;
+    atomic_store_release(&armed, 0);
+}
+
+int cancel_armed(void)
+{
+    return atomic_load_acquire(&armed);
+}
+
+void cancel_request(void)
+{
+    atomic_store_release(&requested, 1);
+}
+
+int cancel_requested(void)
+{
+    volatile uint32_t* own = thread_cancel_flag();
+    if (own) return atomic_load_acquire(own);
+
+    if (!atomic_load_acquire(&requested) && !uart_rx_irq_enabled()) {
+        uart_rx_available();
+    }
+    return atomic_load_acquire(&requested);
+}
@@ -0,0 +1,756 @@
+/*
+ * Persistent Configuration Store Implementation
+ * A segment starts with a header (magic and a sequence number; higher
+ * is newer) followed by records packed to 4 bytes, up to the first
+ * erased (all ones) word. A record is a header (magic, key and value
+ * lengths, an FNV-1a check over them) then the key and the value. Boot
+ * replays the segments oldest first. A record that fails its check is
+ * a torn write: its segment is sealed, so it is never appended to.
+ *
+ * One sleeping lock covers the index and the flash log. Each index
+ * entry remembers where its newest record is and how big it is. From
+ * that each segment keeps a count of live bytes, which tells compaction
+ * which segment is cheapest to empty. A tombstone stays live until its
+ * segment is the oldest one, because before that an older segment may
+ * still hold a value it hides.
+ */
+
+#include "cfgstore.h"
+#include "kmalloc.h"
+#include "page.h"
+#include "pflash.h"
+#include "spinlock.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+#include "workqueue.h"
+
+#define SEGMENT_MAGIC           0x47464353  // "SCFG"
+#define RECORD_MAGIC            0x52474643  // "CFGR"
+#define ERASED                  0xffffffffU
+#define TOMBSTONE               0xffff      // value_len of a deletion
+
+#define STAGE_SIZE              PAGE_SIZE   // Records programmed per flash command run
+#define STAGE_RECORDS_MAX       (STAGE_SIZE / sizeof(record_head_t))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} segment_head_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t key_len;
+    uint16_t value_len;                     // TOMBSTONE for a deletion
+    uint32_t check;                         // FNV-1a of lengths, key and value
+} record_head_t;
+
+typedef struct {
+    uint32_t seq;                           // 0 = free
+    uint32_t used;                          // Log bytes, header included; full when sealed
+    uint32_t live;                          // Bytes of records that are still the newest
+    int erased;                             // Known to be all ones
+} segment_t;
+
+typedef struct entry {
+    struct entry* next;                     // Hash chain
+    uint32_t hash;
+    uint16_t key_len;
+    uint16_t value_len;
+    char key[CFGSTORE_KEY_MAX + 1];
+    char* value;                            // NULL when deleted or empty
+    uint8_t deleted;
+    uint8_t dirty;                          // Newer than the flash
+    uint8_t persisted;                      // Some record of the key may be on the flash
+    uint8_t moving;                         // Dirty because compaction is emptying its segment
+    int segment;                            // Newest record on the flash, -1 if none
+    uint32_t offset;
+    uint32_t flash_size;
+} entry_t;
+
+static spinlock_t store_lock;
+static int store_busy = 0;
+static int ready = 0;
+
+static segment_t segments[CFGSTORE_SEGMENTS_MAX];
+static int segment_count = 0;
+static uint32_t segment_size = 0;
+static int active = -1;                     // Segment being appended to
+static uint32_t next_seq = 1;
+
+static entry_t* buckets[CFGSTORE_BUCKETS];
+static int key_count = 0;
+static int dirty_count = 0;
+static uint32_t dirty_bytes = 0;
+
+static uint8_t* stage = NULL;               // Batch being built for the flash
+static entry_t* staged[STAGE_RECORDS_MAX];
+static work_t flush_work;
+
+static cfgstore_stats_t stats;
+
+static void store_enter(void)
+{
+    unsigned long flags = spin_lock_irqsave(&store_lock);
+    while (store_busy) {
+        spin_unlock_irqrestore(&store_lock, flags);
+        thread_yield();
+        flags = spin_lock_irqsave(&store_lock);
+    }
+    store_busy = 1;
+    spin_unlock_irqrestore(&store_lock, flags);
+}
+
+static void store_leave(void)
+{
+    unsigned long flags = spin_lock_irqsave(&store_lock);
+    store_busy = 0;
+    spin_unlock_irqrestore(&store_lock, flags);
+}
+
+// --- Index ---
+
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static uint32_t key_hash(const char* key, size_t len)
+{
+    return fnv1a(2166136261U, key, len);
+}
+
+static int same_bytes(const void* a, const void* b, size_t len)
+{
+    const uint8_t* x = a;
+    const uint8_t* y = b;
+    for (size_t i = 0; i < len; i++) {
+        if (x[i] != y[i]) return 0;
+    }
+    return 1;
+}
+
+static uint32_t record_size(uint32_t key_len, uint32_t value_len)
+{
+    return (sizeof(record_head_t) + key_len + value_len + 3) & ~3U;
+}
+
+static uint32_t entry_record_size(const entry_t* e)
+{
+    return record_size(e->key_len, e->deleted ? 0 : e->value_len);
+}
+
+static entry_t* lookup(const char* key, size_t len, uint32_t hash)
+{
+    for (entry_t* e = buckets[hash & (CFGSTORE_BUCKETS - 1)]; e; e = e->next) {
+        if (e->hash == hash && e->key_len == len && strncmp(e->key, key, len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static entry_t* insert(const char* key, size_t len, uint32_t hash)
+{
+    entry_t* e = kmalloc(sizeof(entry_t));
+    if (!e) return NULL;
+    memset(e, 0, sizeof(entry_t));
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+    e->key_len = len;
+    e->hash = hash;
+    e->segment = -1;
+    e->next = buckets[hash & (CFGSTORE_BUCKETS - 1)];
+    buckets[hash & (CFGSTORE_BUCKETS - 1)] = e;
+    key_count++;
+    return e;
+}
+
+static void unlink_entry(entry_t* e)
+{
+    entry_t** link = &buckets[e->hash & (CFGSTORE_BUCKETS - 1)];
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    kfree(e->value);
+    kfree(e);
+    key_count--;
+}
+
+// The entry's flash record is no longer its newest
+static void drop_location(entry_t* e)
+{
+    if (e->segment >= 0) {
+        segments[e->segment].live -= e->flash_size;
+        e->segment = -1;
+    }
+}
+
+static void set_location(entry_t* e, int segment, uint32_t offset, uint32_t size)
+{
+    drop_location(e);
+    e->segment = segment;
+    e->offset = offset;
+    e->flash_size = size;
+    e->persisted = 1;
+    segments[segment].live += size;
+}
+
+// Replace the value in RAM; NULL 'value' deletes. 0, or -1 out of memory
+static int set_value(entry_t* e, const void* value, size_t len)
+{
+    char* copy = NULL;
+    if (value && len > 0) {
+        copy = kmalloc(len);
+        if (!copy) return -1;
+        memcpy(copy, value, len);
+    }
+    kfree(e->value);
+    e->value = copy;
+    e->value_len = value ? len : 0;
+    e->deleted = value == NULL;
+    return 0;
+}
+
+static void mark_dirty(entry_t* e)
+{
+    if (e->dirty) {
+        stats.coalesced++;
+        return;
+    }
+    e->dirty = 1;
+    dirty_count++;
+    dirty_bytes += entry_record_size(e);
+}
+
+// --- Log ---
+
+static size_t segment_offset(int segment)
+{
+    return (size_t)segment * segment_size;
+}
+
+static int free_segments(void)
+{
+    int n = 0;
+    for (int i = 0; i < segment_count; i++) {
+        if (segments[i].seq == 0) n++;
+    }
+    return n;
+}
+
+// Start appending to a free segment; 'reserve' free ones are left alone
+static int open_segment(int reserve)
+{
+    if (free_segments() <= reserve) return -1;
+
+    int s = 0;
+    while (segments[s].seq != 0) {
+        s++;
+    }
+    if (!segments[s].erased && pflash_erase(segment_offset(s)) != 0) {
+        stats.errors++;
+        return -1;
+    }
+    segments[s].erased = 0;
+
+    segment_head_t head = { SEGMENT_MAGIC, next_seq };
+    if (pflash_program(segment_offset(s), &head, sizeof(head)) != 0) {
+        stats.errors++;
+        segments[s].seq = next_seq++;       // Unusable until compacted away
+        segments[s].used = segment_size;
+        return -1;
+    }
+    segments[s].seq = next_seq++;
+    segments[s].used = sizeof(head);
+    segments[s].live = 0;
+    active = s;
+    return 0;
+}
+
+// Program the staged records; on failure they stay dirty and the segment is sealed
+static int stage_write(int count, uint32_t offset, uint32_t bytes)
+{
+    if (count == 0) return 0;
+
+    if (pflash_program(segment_offset(active) + offset, stage, bytes) != 0) {
+        for (int i = 0; i < count; i++) {
+            drop_location(staged[i]);
+            mark_dirty(staged[i]);
+        }
+        segments[active].used = segment_size;
+        active = -1;
+        stats.errors++;
+        return -1;
+    }
+    stats.records += count;
+    stats.bytes += bytes;
+    return 0;
+}
+
+static void record_build(uint8_t* out, const entry_t* e)
+{
+    record_head_t head;
+    head.magic = RECORD_MAGIC;
+    head.key_len = e->key_len;
+    head.value_len = e->deleted ? TOMBSTONE : e->value_len;
+    uint32_t value_len = e->deleted ? 0 : e->value_len;
+    head.check = fnv1a(fnv1a(fnv1a(2166136261U, &head.key_len, 4), e->key, e->key_len), e->value, value_len);
+
+    uint32_t size = record_size(e->key_len, value_len);
+    memset(out, 0xff, size);                // Padding stays erased
+    memcpy(out, &head, sizeof(head));
+    memcpy(out + sizeof(head), e->key, e->key_len);
+    if (value_len) {
+        memcpy(out + sizeof(head) + e->key_len, e->value, value_len);
+    }
+}
+
+/*
+ * Called with the store lock held: append every dirty key (or with
+ * 'moving', only those compaction is moving), packing the records into
+ * the stage so each run is one pflash_program() call. 'reserve' free
+ * segments are kept back for compaction.
+ */
+static int flush(int reserve, int moving)
+{
+    int count = 0;
+    uint32_t stage_offset = 0;
+    uint32_t stage_bytes = 0;
+    int result = 0;
+
+    if (dirty_count == 0) return 0;
+    stats.flushes++;
+
+    for (int b = 0; b < CFGSTORE_BUCKETS && result == 0; b++) {
+        for (entry_t* e = buckets[b]; e && result == 0; e = e->next) {
+            if (!e->dirty || (moving && !e->moving)) continue;
+            uint32_t size = entry_record_size(e);
+
+            // A new segment or a full stage ends the run
+            int new_segment = active < 0 || segments[active].used + size > segment_size;
+            if (new_segment || stage_bytes + size > STAGE_SIZE) {
+                result = stage_write(count, stage_offset, stage_bytes);
+                count = 0;
+                stage_bytes = 0;
+            }
+            if (result == 0 && (active < 0 || segments[active].used + size > segment_size)) {
+                result = open_segment(reserve);
+            }
+            if (result != 0) break;
+
+            if (count == 0) stage_offset = segments[active].used;
+            record_build(stage + stage_bytes, e);
+            set_location(e, active, segments[active].used, size);
+            segments[active].used += size;
+            staged[count++] = e;
+            stage_bytes += size;
+            e->dirty = 0;
+            e->moving = 0;
+            dirty_count--;
+            dirty_bytes -= size;
+        }
+    }
+    if (result == 0) {
+        result = stage_write(count, stage_offset, stage_bytes);
+    }
+    return result;
+}
+
+/*
+ * Called with the store lock held: empty the used segment (other than
+ * the active one) with the fewest live bytes by rewriting its live
+ * records, then erase it
+ */
+static int compact(void)
+{
+    int victim = -1;
+    int oldest = -1;
+    for (int i = 0; i < segment_count; i++) {
+        if (segments[i].seq == 0) continue;
+        if (oldest < 0 || segments[i].seq < segments[oldest].seq) oldest = i;
+        if (i != active && (victim < 0 || segments[i].live < segments[victim].live)) victim = i;
+    }
+    if (victim < 0) return -1;
+
+    // Its keys go back through the write path (with any newer value they
+    // are waiting to write); a tombstone in the oldest segment hides nothing
+    for (int b = 0; b < CFGSTORE_BUCKETS; b++) {
+        entry_t* e = buckets[b];
+        while (e) {
+            entry_t* next = e->next;
+            if (e->segment == victim) {
+                drop_location(e);
+                if (e->deleted && !e->dirty && victim == oldest) {
+                    unlink_entry(e);
+                    stats.tombstones_dropped++;
+                } else {
+                    if (!e->dirty) mark_dirty(e);
+                    e->moving = 1;
+                    stats.copied++;
+                }
+            }
+            e = next;
+        }
+    }
+    if (flush(0, 1) != 0) return -1;
+
+    segments[victim].seq = 0;
+    segments[victim].used = 0;
+    segments[victim].live = 0;
+    segments[victim].erased = pflash_erase(segment_offset(victim)) == 0;
+    if (!segments[victim].erased) stats.errors++;
+    stats.compactions++;
+    return 0;
+}
+
+/*
+ * Called with the store lock held: write the batch, keeping a segment
+ * back for compaction, then compact while free segments are short and
+ * retry what did not fit
+ */
+static int flush_and_compact(void)
+{
+    int result = flush(1, 0);
+    for (int i = 0; i < segment_count && free_segments() < CFGSTORE_RESERVE; i++) {
+        if (compact() != 0) break;
+    }
+    if (result != 0 && dirty_count > 0) {
+        result = flush(1, 0);
+    }
+    return result;
+}
+
+static void flush_work_fn(void* arg)
+{
+    (void)arg;
+    store_enter();
+    flush_and_compact();
+    store_leave();
+}
+
+// After a change, with the store lock released
+static void schedule_flush(int first, int full)
+{
+    if (first) work_queue_delayed(&flush_work, CFGSTORE_FLUSH_MS);
+    if (full) {
+        work_cancel(&flush_work);
+        work_queue(&flush_work);
+    }
+}
+
+// --- Boot scan ---
+
+// Replay one segment; returns where its log ends (the segment size if sealed)
+static uint32_t scan_segment(int s, char* buf)
+{
+    uint32_t offset = sizeof(segment_head_t);
+    while (offset + sizeof(record_head_t) <= segment_size) {
+        record_head_t head;
+        pflash_read(segment_offset(s) + offset, &head, sizeof(head));
+        if (head.magic == ERASED) {
+            return offset;
+        }
+        uint32_t value_len = head.value_len == TOMBSTONE ? 0 : head.value_len;
+        uint32_t size = record_size(head.key_len, value_len);
+        if (head.magic != RECORD_MAGIC || head.key_len == 0 || head.key_len > CFGSTORE_KEY_MAX ||
+            value_len > CFGSTORE_VALUE_MAX || offset + size > segment_size) {
+            break;
+        }
+        pflash_read(segment_offset(s) + offset + sizeof(head), buf, head.key_len + value_len);
+        uint32_t check = fnv1a(fnv1a(2166136261U, &head.key_len, 4), buf, head.key_len + value_len);
+        if (check != head.check) {
+            break;
+        }
+
+        uint32_t hash = key_hash(buf, head.key_len);
+        entry_t* e = lookup(buf, head.key_len, hash);
+        if (!e) e = insert(buf, head.key_len, hash);
+        if (!e || set_value(e, head.value_len == TOMBSTONE ? NULL : buf + head.key_len, value_len) != 0) {
+            break;
+        }
+        set_location(e, s, offset, size);
+        stats.scan_records++;
+        offset += size;
+    }
+    return segment_size;                    // Torn or unreadable: append elsewhere
+}
+
+// --- Interface ---
+
+void cfgstore_init(void)
+{
+    spin_lock_init(&store_lock, "cfgstore");
+
+    if (!pflash_present()) return;
+
+    segment_size = pflash_block_size();
+    segment_count = pflash_size() / segment_size;
+    if (segment_count > CFGSTORE_SEGMENTS_MAX) segment_count = CFGSTORE_SEGMENTS_MAX;
+    if (segment_count < CFGSTORE_RESERVE + 1) {
+        puts("cfgstore: flash too small");
+        return;
+    }
+    stage = page_alloc(1);
+    char* buf = kmalloc(CFGSTORE_KEY_MAX + CFGSTORE_VALUE_MAX);
+    if (!stage || !buf) {
+        puts("cfgstore: not enough memory");
+        return;
+    }
+
+    uint64_t start = timer_ticks();
+
+    // Segment headers, then replay oldest first; free segments are erased before use
+    int order[CFGSTORE_SEGMENTS_MAX];
+    int used = 0;
+    for (int s = 0; s < segment_count; s++) {
+        segment_head_t head;
+        pflash_read(segment_offset(s), &head, sizeof(head));
+        if (head.magic != SEGMENT_MAGIC || head.seq == 0) continue;
+
+        segments[s].seq = head.seq;
+        int i = used++;
+        while (i > 0 && segments[order[i - 1]].seq > head.seq) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = s;
+        if (head.seq >= next_seq) next_seq = head.seq + 1;
+    }
+    for (int i = 0; i < used; i++) {
+        segments[order[i]].used = scan_segment(order[i], buf);
+    }
+    kfree(buf);
+
+    // Keep appending to the newest segment unless it was sealed
+    if (used > 0 && segments[order[used - 1]].used < segment_size) {
+        active = order[used - 1];
+    }
+    stats.scan_us = timer_ticks_to_us(timer_ticks() - start);
+
+    work_init(&flush_work, flush_work_fn, NULL);
+    ready = 1;
+    printf("cfgstore: %d keys from %d of %d segments (%lu records in %lu us)\n",
+           key_count, used, segment_count, stats.scan_records, stats.scan_us);
+}
+
+int cfgstore_ready(void)
+{
+    return ready;
+}
+
+int cfgstore_put(const char* key, const void* value, size_t len)
+{
+    size_t key_len = key ? strlen(key) : 0;
+    if (!ready || key_len == 0 || key_len > CFGSTORE_KEY_MAX || len > CFGSTORE_VALUE_MAX) return -1;
+
+    uint32_t hash = key_hash(key, key_len);
+    int first = 0, full = 0, result = 0;
+
+    store_enter();
+    entry_t* e = lookup(key, key_len, hash);
+    if (e && !e->deleted && e->value_len == len && same_bytes(e->value, value, len)) {
+        stats.unchanged++;
+    } else {
+        if (!e) e = insert(key, key_len, hash);
+        if (!e) {
+            result = -1;
+        } else {
+            // The record size may change with the value
+            if (e->dirty) dirty_bytes -= entry_record_size(e);
+            if (set_value(e, value, len) != 0) {
+                if (e->dirty) dirty_bytes += entry_record_size(e);
+                result = -1;
+            } else {
+                if (e->dirty) dirty_bytes += entry_record_size(e);
+                first = dirty_count == 0;
+                mark_dirty(e);
+                full = dirty_bytes >= CFGSTORE_BATCH_BYTES;
+                stats.puts++;
+            }
+        }
+    }
+    store_leave();
+
+    schedule_flush(first, full);
+    return result;
+}
+
+int cfgstore_delete(const char* key)
+{
+    size_t key_len = key ? strlen(key) : 0;
+    if (!ready || key_len == 0 || key_len > CFGSTORE_KEY_MAX) return -1;
+
+    uint32_t hash = key_hash(key, key_len);
+    int first = 0, result = -1;
+
+    store_enter();
+    entry_t* e = lookup(key, key_len, hash);
+    if (e && !e->deleted) {
+        stats.deletes++;
+        result = 0;
+        if (e->dirty) {
+            dirty_count--;
+            dirty_bytes -= entry_record_size(e);
+            e->dirty = 0;
+        }
+        if (!e->persisted) {
+            unlink_entry(e);                // Never reached the flash
+        } else {
+            set_value(e, NULL, 0);
+            first = dirty_count == 0;
+            mark_dirty(e);
+        }
+    }
+    store_leave();
+
+    schedule_flush(first, 0);
+    return result;
+}
+
+int cfgstore_get(const char* key, void* buf, size_t max)
+{
+    size_t key_len = key ? strlen(key) : 0;
+    if (!ready || key_len == 0 || key_len > CFGSTORE_KEY_MAX) return -1;
+
+    uint32_t hash = key_hash(key, key_len);
+    int result = -1;
+
+    store_enter();
+    entry_t* e = lookup(key, key_len, hash);
+    if (e && !e->deleted) {
+        if (e->value_len) {
+            memcpy(buf, e->value, e->value_len < max ? e->value_len : max);
+        }
+        result = e->value_len;
+    }
+    store_leave();
+    return result;
+}
+
+int cfgstore_list(const char* prefix, cfgstore_list_fn fn, void* arg)
+{
+    if (!ready) return 0;
+
+    size_t prefix_len = strlen(prefix);
+    int count = 0;
+
+    store_enter();
+    for (int b = 0; b < CFGSTORE_BUCKETS; b++) {
+        for (entry_t* e = buckets[b]; e; e = e->next) {
+            if (e->deleted || strncmp(e->key, prefix, prefix_len) != 0) continue;
+            fn(e->key, e->value, e->value_len, arg);
+            count++;
+        }
+    }
+    store_leave();
+    return count;
+}
+
+int cfgstore_sync(void)
+{
+    if (!ready) return -1;
+
+    work_cancel(&flush_work);
+    store_enter();
+    int result = flush_and_compact();
+    store_leave();
+    return result;
+}
+
+int cfgstore_compact(void)
+{
+    if (!ready) return -1;
+
+    store_enter();
+    int result = compact();
+    store_leave();
+    return result;
+}
+
+int cfgstore_clear(void)
+{
+    if (!ready) return -1;
+
+    work_cancel(&flush_work);
+    store_enter();
+    for (int b = 0; b < CFGSTORE_BUCKETS; b++) {
+        while (buckets[b]) {
+            unlink_entry(buckets[b]);
+        }
+    }
+    dirty_count = 0;
+    dirty_bytes = 0;
+    active = -1;
+
+    int result = 0;
+    for (int s = 0; s < segment_count; s++) {
+        segments[s].seq = 0;
+        segments[s].used = 0;
+        segments[s].live = 0;
+        segments[s].erased = pflash_erase(segment_offset(s)) == 0;
+        if (!segments[s].erased) {
+            stats.errors++;
+            result = -1;
+        }
+    }
+    store_leave();
+    return result;
+}
+
+const cfgstore_stats_t* cfgstore_stats(void)
+{
+    return &stats;
+}
+
+void cfgstore_print(int keys)
+{
+    if (!ready) {
+        puts("No configuration store (no pflash bank)");
+        return;
+    }
+
+    store_enter();
+    printf("%d keys, %d waiting to be written (%u bytes); %d of %d segments free, %lu KB each\n",
+           key_count, dirty_count, dirty_bytes, free_segments(), segment_count,
+           (unsigned long)(segment_size / 1024));
+    puts("");
+    puts("Segment  Seq       Used        Live        State");
+    for (int s = 0; s < segment_count; s++) {
+        const segment_t* seg = &segments[s];
+        if (seg->seq == 0) continue;
+        print_uint_padded(s, 9);
+        print_uint_padded(seg->seq, 10);
+        print_uint_padded(seg->used, 12);
+        print_uint_padded(seg->live, 12);
+        puts(s == active ? "active" : "closed");
+    }
+    puts("");
+    printf("Changes:     %lu puts, %lu deletes, %lu unchanged, %lu coalesced in a batch\n",
+           stats.puts, stats.deletes, stats.unchanged, stats.coalesced);
+    printf("Flash:       %lu batches, %lu records, %lu bytes, %lu errors\n",
+           stats.flushes, stats.records, stats.bytes, stats.errors);
+    printf("Compaction:  %lu segments, %lu records copied, %lu tombstones dropped\n",
+           stats.compactions, stats.copied, stats.tombstones_dropped);
+    printf("Boot scan:   %lu records in %lu us\n", stats.scan_records, stats.scan_us);
+
+    if (keys) {
+        puts("");
+        for (int b = 0; b < CFGSTORE_BUCKETS; b++) {
+            for (entry_t* e = buckets[b]; e; e = e->next) {
+                if (e->deleted) continue;
+                printf("%s%s = ", e->key, e->dirty ? " (unsaved)" : "");
+                uart_write(e->value, e->value_len);
+                putchar('\n');
+            }
+        }
+    }
+    store_leave();
+}
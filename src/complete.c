@@ -0,0 +1,272 @@
+/*
+ * Tab Completion Implementation
+ * Each word set is a trie rooted in a shared static node pool. Children
+ * are kept in a sorted sibling list and every node counts the words below
+ * it, so a lookup walks only the prefix: the match count is read off the
+ * prefix node and the longest common extension follows single-child
+ * chains. Removing a word frees the nodes no other word uses.
+ */
+
+#include "complete.h"
+#include "string.h"
+
+// Node 0 is reserved so that 0 can mean "no link"
+typedef struct {
+    char ch;                    // Character on the edge into this node
+    uint16_t child;             // First child (sorted by ch)
+    uint16_t sibling;           // Next sibling, or next free node
+    uint16_t words;             // Words ending at or below this node
+    uint16_t terminal;          // Times a word ends exactly here
+} complete_node_t;
+
+static complete_node_t nodes[COMPLETE_MAX_NODES];
+static uint16_t free_list = 0;
+static int nodes_used = 0;
+
+static uint16_t set_roots[COMPLETE_MAX_SETS];
+static int set_count = 0;
+
+void complete_init(void)
+{
+    // Chain every node except the reserved one onto the free list
+    free_list = 0;
+    for (int i = COMPLETE_MAX_NODES - 1; i >= 1; i--) {
+        nodes[i].sibling = free_list;
+        free_list = (uint16_t)i;
+    }
+    nodes_used = 0;
+    set_count = 0;
+}
+
+static uint16_t node_alloc(char ch)
+{
+    uint16_t n = free_list;
+    if (n == 0) return 0;
+
+    free_list = nodes[n].sibling;
+    nodes[n].ch = ch;
+    nodes[n].child = 0;
+    nodes[n].sibling = 0;
+    nodes[n].words = 0;
+    nodes[n].terminal = 0;
+    nodes_used++;
+    return n;
+}
+
+static void node_free(uint16_t n)
+{
+    nodes[n].sibling = free_list;
+    free_list = n;
+    nodes_used--;
+}
+
+int complete_set_create(void)
+{
+    if (set_count >= COMPLETE_MAX_SETS) return -1;
+
+    uint16_t root = node_alloc('\0');
+    if (root == 0) return -1;
+
+    set_roots[set_count] = root;
+    return set_count++;
+}
+
+static int set_valid(int set)
+{
+    return set >= 0 && set < set_count;
+}
+
+// Child of 'parent' labelled 'ch', or 0
+static uint16_t find_child(uint16_t parent, char ch)
+{
+    for (uint16_t c = nodes[parent].child; c != 0; c = nodes[c].sibling) {
+        if (nodes[c].ch == ch) return c;
+        if (nodes[c].ch > ch) break;    // Sorted - no match further on
+    }
+    return 0;
+}
+
+// Link a new child into the parent's sorted sibling list
+static void link_child(uint16_t parent, uint16_t child)
+{
+    uint16_t* link = &nodes[parent].child;
+    while (*link != 0 && nodes[*link].ch < nodes[child].ch) {
+        link = &nodes[*link].sibling;
+    }
+    nodes[child].sibling = *link;
+    *link = child;
+}
+
+static void unlink_child(uint16_t parent, uint16_t child)
+{
+    uint16_t* link = &nodes[parent].child;
+    while (*link != 0 && *link != child) {
+        link = &nodes[*link].sibling;
+    }
+    if (*link == child) {
+        *link = nodes[child].sibling;
+    }
+}
+
+/*
+ * Add a word to a set
+ * Returns 0 on success, -1 if the word is invalid or the pool is full
+ */
+int complete_insert(int set, const char* word)
+{
+    if (!set_valid(set) || !word) return -1;
+
+    int len = strlen(word);
+    if (len == 0 || len >= COMPLETE_WORD_MAX) return -1;
+
+    // Count the nodes this word needs before touching the trie
+    uint16_t n = set_roots[set];
+    int depth = 0;
+    while (depth < len) {
+        uint16_t c = find_child(n, word[depth]);
+        if (c == 0) break;
+        n = c;
+        depth++;
+    }
+    if (len - depth > COMPLETE_MAX_NODES - 1 - nodes_used) return -1;
+
+    n = set_roots[set];
+    nodes[n].words++;
+    for (int i = 0; i < len; i++) {
+        uint16_t c = find_child(n, word[i]);
+        if (c == 0) {
+            c = node_alloc(word[i]);
+            link_child(n, c);
+        }
+        n = c;
+        nodes[n].words++;
+    }
+    nodes[n].terminal++;
+    return 0;
+}
+
+/*
+ * Drop one reference to a word, freeing nodes no other word needs
+ * Returns 0 on success, -1 if the word is not in the set
+ */
+int complete_remove(int set, const char* word)
+{
+    if (!set_valid(set) || !word) return -1;
+
+    int len = strlen(word);
+    if (len == 0 || len >= COMPLETE_WORD_MAX) return -1;
+
+    uint16_t path[COMPLETE_WORD_MAX + 1];
+    path[0] = set_roots[set];
+    for (int i = 0; i < len; i++) {
+        path[i + 1] = find_child(path[i], word[i]);
+        if (path[i + 1] == 0) return -1;
+    }
+    if (nodes[path[len]].terminal == 0) return -1;
+
+    nodes[path[len]].terminal--;
+    for (int i = 0; i <= len; i++) {
+        nodes[path[i]].words--;
+    }
+
+    // The first emptied node below the root takes the rest of the path with it
+    for (int i = 1; i <= len; i++) {
+        if (nodes[path[i]].words == 0) {
+            unlink_child(path[i - 1], path[i]);
+            for (int j = i; j <= len; j++) {
+                node_free(path[j]);
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+// Node reached by the prefix, or 0
+static uint16_t find_prefix(int set, const char* prefix, int prefix_len)
+{
+    uint16_t n = set_roots[set];
+    for (int i = 0; i < prefix_len && n != 0; i++) {
+        n = find_child(n, prefix[i]);
+    }
+    return n;
+}
+
+int complete_lookup(int set, const char* prefix, int prefix_len, complete_result_t* result)
+{
+    if (!result) return 0;
+
+    result->matches = 0;
+    result->exact = 0;
+    result->extension_len = 0;
+    result->extension[0] = '\0';
+
+    if (!set_valid(set) || !prefix || prefix_len >= COMPLETE_WORD_MAX) return 0;
+
+    uint16_t n = find_prefix(set, prefix, prefix_len);
+    if (n == 0 || nodes[n].words == 0) return 0;
+
+    result->matches = nodes[n].words;
+    result->exact = nodes[n].terminal > 0;
+
+    // Every match continues along a chain with no branches and no word ends
+    int len = prefix_len;
+    while (nodes[n].terminal == 0 && nodes[n].child != 0 &&
+           nodes[nodes[n].child].sibling == 0 && len < COMPLETE_WORD_MAX - 1) {
+        n = nodes[n].child;
+        result->extension[result->extension_len++] = nodes[n].ch;
+        len++;
+    }
+    result->extension[result->extension_len] = '\0';
+    return result->matches;
+}
+
+// Depth-first walk in sorted order
+typedef struct {
+    char word[COMPLETE_WORD_MAX];
+    int remaining;
+    int visited;
+    complete_visit_t visit;
+    void* ctx;
+} complete_walk_t;
+
+static void walk_node(complete_walk_t* walk, uint16_t n, int len)
+{
+    if (nodes[n].terminal > 0 && walk->remaining > 0) {
+        walk->word[len] = '\0';
+        walk->visit(walk->word, walk->ctx);
+        walk->remaining--;
+        walk->visited++;
+    }
+
+    for (uint16_t c = nodes[n].child; c != 0 && walk->remaining > 0; c = nodes[c].sibling) {
+        walk->word[len] = nodes[c].ch;
+        walk_node(walk, c, len + 1);
+    }
+}
+
+int complete_list(int set, const char* prefix, int prefix_len, int max,
+                  complete_visit_t visit, void* ctx)
+{
+    if (!set_valid(set) || !prefix || !visit || prefix_len >= COMPLETE_WORD_MAX) return 0;
+
+    uint16_t n = find_prefix(set, prefix, prefix_len);
+    if (n == 0) return 0;
+
+    static complete_walk_t walk;
+    for (int i = 0; i < prefix_len; i++) {
+        walk.word[i] = prefix[i];
+    }
+    walk.remaining = max;
+    walk.visited = 0;
+    walk.visit = visit;
+    walk.ctx = ctx;
+
+    walk_node(&walk, n, prefix_len);
+    return walk.visited;
+}
+
+int complete_nodes_used(void)
+{
+    return nodes_used;
+}
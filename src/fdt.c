@@ -0,0 +1,335 @@
+/*
+ * Flattened Device Tree (DTB) Reader Implementation
+ * Minimal walker over the structure block - no allocation, no copying
+ */
+
+#include "fdt.h"
+#include "string.h"
+
+// DTB header layout (all fields big-endian)
+typedef struct {
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+} fdt_header_t;
+
+// Parsed blob state
+static const uint8_t* fdt_blob = NULL;
+static const uint8_t* fdt_struct = NULL;
+static const char* fdt_strings = NULL;
+static uint32_t fdt_struct_size = 0;
+static uint32_t fdt_size = 0;
+static int fdt_addr_cells = 2;
+static int fdt_sz_cells = 1;
+
+uint32_t fdt32_to_cpu(uint32_t value)
+{
+    return ((value & 0x000000FF) << 24) |
+           ((value & 0x0000FF00) << 8)  |
+           ((value & 0x00FF0000) >> 8)  |
+           ((value & 0xFF000000) >> 24);
+}
+
+/*
+ * Combine 1 or 2 big-endian cells into a 64-bit value
+ */
+uint64_t fdt_read_cells(const void* cells, int count)
+{
+    const uint32_t* p = (const uint32_t*)cells;
+    uint64_t value = 0;
+
+    for (int i = 0; i < count; i++) {
+        value = (value << 32) | fdt32_to_cpu(p[i]);
+    }
+    return value;
+}
+
+// Read a token at an offset within the structure block
+static uint32_t fdt_token_at(int offset)
+{
+    return fdt32_to_cpu(*(const uint32_t*)(fdt_struct + offset));
+}
+
+// Round an offset up to the next 4-byte boundary
+static int fdt_align(int offset)
+{
+    return (offset + 3) & ~3;
+}
+
+/*
+ * Skip over the token at offset, return offset of the following token
+ */
+static int fdt_skip_token(int offset)
+{
+    uint32_t token = fdt_token_at(offset);
+    offset += 4;
+
+    switch (token) {
+        case FDT_BEGIN_NODE:
+            offset += strlen((const char*)(fdt_struct + offset)) + 1;
+            return fdt_align(offset);
+        case FDT_PROP: {
+            uint32_t len = fdt32_to_cpu(*(const uint32_t*)(fdt_struct + offset));
+            offset += 8;  // len + nameoff
+            return fdt_align(offset + len);
+        }
+        case FDT_END_NODE:
+        case FDT_NOP:
+            return offset;
+        default:
+            return -1;  // FDT_END or corrupt token
+    }
+}
+
+/*
+ * Validate the header and cache section pointers
+ */
+int fdt_init(uintptr_t blob)
+{
+    fdt_blob = NULL;
+
+    // QEMU passes the DTB 8-byte aligned inside RAM
+    if (blob == 0 || (blob & 0x7) != 0) {
+        return -1;
+    }
+
+    const fdt_header_t* header = (const fdt_header_t*)blob;
+    if (fdt32_to_cpu(header->magic) != FDT_MAGIC) {
+        return -1;
+    }
+
+    fdt_blob = (const uint8_t*)blob;
+    fdt_size = fdt32_to_cpu(header->totalsize);
+    fdt_struct = fdt_blob + fdt32_to_cpu(header->off_dt_struct);
+    fdt_struct_size = fdt32_to_cpu(header->size_dt_struct);
+    fdt_strings = (const char*)(fdt_blob + fdt32_to_cpu(header->off_dt_strings));
+
+    // Cache root cell sizes used for "reg" decoding
+    int len;
+    const void* cells = fdt_getprop(fdt_root_node(), "#address-cells", &len);
+    fdt_addr_cells = (cells && len == 4) ? (int)fdt_read_cells(cells, 1) : 2;
+    cells = fdt_getprop(fdt_root_node(), "#size-cells", &len);
+    fdt_sz_cells = (cells && len == 4) ? (int)fdt_read_cells(cells, 1) : 1;
+
+    return 0;
+}
+
+int fdt_present(void)
+{
+    return fdt_blob != NULL;
+}
+
+uintptr_t fdt_address(void)
+{
+    return (uintptr_t)fdt_blob;
+}
+
+uint32_t fdt_total_size(void)
+{
+    return fdt_blob ? fdt_size : 0;
+}
+
+int fdt_address_cells(void)
+{
+    return fdt_addr_cells;
+}
+
+int fdt_size_cells(void)
+{
+    return fdt_sz_cells;
+}
+
+/*
+ * Offset of the root node (first BEGIN_NODE, skipping NOPs)
+ */
+int fdt_root_node(void)
+{
+    if (!fdt_blob) return -1;
+
+    int offset = 0;
+    while (offset < (int)fdt_struct_size && fdt_token_at(offset) == FDT_NOP) {
+        offset += 4;
+    }
+    return fdt_token_at(offset) == FDT_BEGIN_NODE ? offset : -1;
+}
+
+/*
+ * Advance to the next node in document order
+ * depth is adjusted relative to the starting node (child = +1);
+ * with a depth pointer the walk stops once it leaves the subtree
+ */
+int fdt_next_node(int node, int* depth)
+{
+    if (!fdt_blob || node < 0) return -1;
+
+    int offset = fdt_skip_token(node);
+    while (offset >= 0 && offset < (int)fdt_struct_size) {
+        uint32_t token = fdt_token_at(offset);
+
+        if (token == FDT_BEGIN_NODE) {
+            if (depth) (*depth)++;
+            return offset;
+        }
+        if (token == FDT_END_NODE && depth) {
+            // Left the subtree of the node the walk started from
+            if (--(*depth) < 0) return -1;
+        }
+        if (token == FDT_END) {
+            return -1;
+        }
+        offset = fdt_skip_token(offset);
+    }
+    return -1;
+}
+
+const char* fdt_node_name(int node)
+{
+    if (!fdt_blob || node < 0) return NULL;
+    return (const char*)(fdt_struct + node + 4);
+}
+
+/*
+ * Compare a path component against a node name
+ * "memory" matches "memory@40000000"; "memory@40000000" must match exactly
+ */
+static int fdt_name_matches(const char* node_name, const char* component, int len)
+{
+    if (strncmp(node_name, component, len) != 0) return 0;
+    return node_name[len] == '\0' || node_name[len] == '@';
+}
+
+/*
+ * Resolve an absolute path such as "/chosen" or "/psci"
+ */
+int fdt_path_offset(const char* path)
+{
+    int node = fdt_root_node();
+    if (node < 0 || !path || path[0] != '/') return -1;
+
+    const char* p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+
+        int len = 0;
+        while (p[len] && p[len] != '/') len++;
+
+        // Search direct children of node for this component
+        int depth = 0;
+        int child = fdt_next_node(node, &depth);
+        int found = -1;
+        while (child >= 0 && depth > 0) {
+            if (depth == 1 && fdt_name_matches(fdt_node_name(child), p, len)) {
+                found = child;
+                break;
+            }
+            child = fdt_next_node(child, &depth);
+        }
+        if (found < 0) return -1;
+
+        node = found;
+        p += len;
+    }
+    return node;
+}
+
+/*
+ * Look up a property of a node (properties precede subnodes)
+ */
+const void* fdt_getprop(int node, const char* name, int* len)
+{
+    if (!fdt_blob || node < 0 || !name) return NULL;
+
+    int offset = fdt_skip_token(node);
+    while (offset >= 0 && offset < (int)fdt_struct_size) {
+        uint32_t token = fdt_token_at(offset);
+
+        if (token == FDT_PROP) {
+            uint32_t prop_len = fdt32_to_cpu(*(const uint32_t*)(fdt_struct + offset + 4));
+            uint32_t nameoff = fdt32_to_cpu(*(const uint32_t*)(fdt_struct + offset + 8));
+            if (strcmp(fdt_strings + nameoff, name) == 0) {
+                if (len) *len = (int)prop_len;
+                return fdt_struct + offset + 12;
+            }
+        } else if (token != FDT_NOP) {
+            break;  // Reached a subnode or end of this node
+        }
+        offset = fdt_skip_token(offset);
+    }
+    return NULL;
+}
+
+/*
+ * Check a node's "compatible" string list for an entry
+ */
+int fdt_node_is_compatible(int node, const char* compatible)
+{
+    int len;
+    const char* list = fdt_getprop(node, "compatible", &len);
+    if (!list) return 0;
+
+    int pos = 0;
+    while (pos < len) {
+        if (strcmp(list + pos, compatible) == 0) return 1;
+        pos += strlen(list + pos) + 1;
+    }
+    return 0;
+}
+
+/*
+ * Find the next node after 'after' (-1 = from the start) with a compatible entry
+ */
+int fdt_find_compatible(int after, const char* compatible)
+{
+    int node = (after < 0) ? fdt_root_node() : fdt_next_node(after, NULL);
+
+    while (node >= 0) {
+        if (fdt_node_is_compatible(node, compatible)) return node;
+        node = fdt_next_node(node, NULL);
+    }
+    return -1;
+}
+
+/*
+ * Decode entry 'index' of a node's "reg" property using root cell sizes
+ */
+int fdt_get_reg(int node, int index, uint64_t* base, uint64_t* size)
+{
+    int len;
+    const uint32_t* reg = fdt_getprop(node, "reg", &len);
+    if (!reg) return -1;
+
+    int entry_cells = fdt_addr_cells + fdt_sz_cells;
+    int entries = len / (entry_cells * 4);
+    if (index >= entries) return -1;
+
+    const uint32_t* entry = reg + index * entry_cells;
+    if (base) *base = fdt_read_cells(entry, fdt_addr_cells);
+    if (size) *size = fdt_read_cells(entry + fdt_addr_cells, fdt_sz_cells);
+    return 0;
+}
+
+/*
+ * Initial ramdisk placed by the boot loader (QEMU -initrd): /chosen
+ * linux,initrd-start and linux,initrd-end, each one or two cells
+ */
+int fdt_initrd(uint64_t* start, uint64_t* end)
+{
+    int node = fdt_path_offset("/chosen");
+    int start_len, end_len;
+    const void* start_prop = fdt_getprop(node, "linux,initrd-start", &start_len);
+    const void* end_prop = fdt_getprop(node, "linux,initrd-end", &end_len);
+    if (!start_prop || !end_prop) return -1;
+    if ((start_len != 4 && start_len != 8) || (end_len != 4 && end_len != 8)) return -1;
+
+    *start = fdt_read_cells(start_prop, start_len / 4);
+    *end = fdt_read_cells(end_prop, end_len / 4);
+    return (*end > *start) ? 0 : -1;
+}
@@ -0,0 +1,1113 @@
+/*
+ * Filesystem Implementation
+ * Every operation runs under one sleeping lock (a busy flag callers
+ * yield on), since block reads wait for the disk. Metadata is edited in
+ * place in buffer cache blocks and reaches the disk with the periodic
+ * write-back; the superblock stays referenced while mounted.
+ */
+
+#include "fs.h"
+#include "bcache.h"
+#include "page.h"
+#include "spinlock.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+#define DISK                BCACHE_DEV_DISK
+
+static spinlock_t fs_lock;
+static int fs_busy = 0;
+
+static buf_t* super_buf = NULL;             // Pinned while mounted
+static fs_super_t* sb = NULL;
+static uint32_t alloc_hint = 0;             // Where searches without a goal start
+static uint32_t inode_hint = FS_ROOT_INODE + 1;
+
+static void fs_enter(void)
+{
+    unsigned long flags = spin_lock_irqsave(&fs_lock);
+    while (fs_busy) {
+        spin_unlock_irqrestore(&fs_lock, flags);
+        thread_yield();
+        flags = spin_lock_irqsave(&fs_lock);
+    }
+    fs_busy = 1;
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+static void fs_leave(void)
+{
+    unsigned long flags = spin_lock_irqsave(&fs_lock);
+    fs_busy = 0;
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+static void super_dirty(void)
+{
+    bcache_dirty(super_buf);
+}
+
+static void put(buf_t* buf, int dirty)
+{
+    if (buf) {
+        if (dirty) {
+            bcache_dirty(buf);
+        }
+        bcache_release(buf);
+    }
+}
+
+// Data block of a file; block 0 (the superblock) means unmapped
+static buf_t* data_read(uint32_t block)
+{
+    return block ? bcache_read(DISK, block) : NULL;
+}
+
+// Data block about to be filled: no read, contents zeroed
+static buf_t* block_zero(uint32_t block)
+{
+    buf_t* b = block ? bcache_get(DISK, block) : NULL;
+    if (b) {
+        memset(b->data, 0, FS_BLOCK_SIZE);
+        bcache_dirty(b);
+    }
+    return b;
+}
+
+// --- Names ---
+
+// Strip one leading '/'; returns the length, or FS_ERR_NAME
+static int name_check(const char** name)
+{
+    const char* n = *name;
+    if (*n == '/') {
+        n++;
+    }
+    int len = 0;
+    while (n[len]) {
+        if (n[len] == '/') {
+            return FS_ERR_NAME;
+        }
+        len++;
+    }
+    if (len > FS_NAME_MAX || (len == 1 && n[0] == '.') ||
+        (len == 2 && n[0] == '.' && n[1] == '.')) {
+        return FS_ERR_NAME;
+    }
+    *name = n;
+    return len;
+}
+
+static int name_equal(const fs_dirent_t* d, const char* name, int len)
+{
+    if (d->name_len != len) {
+        return 0;
+    }
+    for (int i = 0; i < len; i++) {
+        if (d->name[i] != name[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// --- Inodes ---
+
+// Pointer into the referenced inode table block, or NULL
+static fs_inode_t* inode_get(uint32_t ino, buf_t** buf)
+{
+    if (ino == 0 || ino >= sb->inodes) {
+        return NULL;
+    }
+    buf_t* b = bcache_read(DISK, sb->inode_start + ino / FS_INODES_PER_BLOCK);
+    if (!b) {
+        return NULL;
+    }
+    *buf = b;
+    return (fs_inode_t*)(b->data + (ino % FS_INODES_PER_BLOCK) * FS_INODE_SIZE);
+}
+
+// Next free inode after the last one handed out; 0 if none left
+static uint32_t inode_alloc(int type)
+{
+    uint32_t span = sb->inodes - (FS_ROOT_INODE + 1);
+    if (sb->free_inodes == 0 || span == 0) {
+        return 0;
+    }
+    for (uint32_t n = 0; n < span; n++) {
+        uint32_t ino = FS_ROOT_INODE + 1 + (inode_hint - (FS_ROOT_INODE + 1) + n) % span;
+        buf_t* b;
+        fs_inode_t* inode = inode_get(ino, &b);
+        if (!inode) {
+            return 0;
+        }
+        if (inode->type == FS_TYPE_FREE) {
+            memset(inode, 0, sizeof(*inode));
+            inode->type = type;
+            inode->links = 1;
+            inode->mtime = timer_uptime_ms();
+            put(b, 1);
+            sb->free_inodes--;
+            super_dirty();
+            inode_hint = ino + 1;
+            return ino;
+        }
+        put(b, 0);
+    }
+    return 0;
+}
+
+// --- Block bitmap ---
+
+// Set or clear the bits of a run; 0, or FS_ERR_IO
+static int bitmap_mark(uint32_t start, uint32_t length, int used)
+{
+    buf_t* b = NULL;
+    uint32_t index = ~0U;
+    for (uint32_t block = start; block < start + length; block++) {
+        uint32_t i = block / FS_BITS_PER_BLOCK;
+        if (i != index) {
+            put(b, 1);
+            b = bcache_read(DISK, sb->bitmap_start + i);
+            if (!b) {
+                return FS_ERR_IO;
+            }
+            index = i;
+        }
+        uint32_t bit = block % FS_BITS_PER_BLOCK;
+        if (used) {
+            b->data[bit / 8] |= 1 << (bit % 8);
+        } else {
+            b->data[bit / 8] &= ~(1 << (bit % 8));
+        }
+    }
+    put(b, 1);
+    return FS_OK;
+}
+
+/*
+ * First fit: the first run of 'want' free blocks at or after 'goal'
+ * (wrapping), else the longest shorter run there is. Marks it used and
+ * returns its length; 0 when the disk is full, FS_ERR_IO on error.
+ */
+static long blocks_alloc(uint32_t goal, uint32_t want, uint32_t* start)
+{
+    if (sb->free_blocks == 0 || want == 0) {
+        return 0;
+    }
+    if (goal < sb->data_start || goal >= sb->blocks) {
+        goal = alloc_hint;
+    }
+
+    uint32_t run_start = 0, run_length = 0;
+    uint32_t best_start = 0, best_length = 0;
+    uint32_t pos = goal;
+    uint32_t index = ~0U;
+    buf_t* b = NULL;
+    for (uint64_t n = sb->blocks - sb->data_start; n > 0; n--, pos++) {
+        if (pos >= sb->blocks) {
+            pos = sb->data_start;           // Runs do not wrap
+            run_length = 0;
+        }
+        uint32_t i = pos / FS_BITS_PER_BLOCK;
+        if (i != index) {
+            put(b, 0);
+            b = bcache_read(DISK, sb->bitmap_start + i);
+            if (!b) {
+                return FS_ERR_IO;
+            }
+            index = i;
+        }
+        uint32_t bit = pos % FS_BITS_PER_BLOCK;
+        uint8_t byte = b->data[bit / 8];
+        if (byte == 0xFF && bit % 8 == 0 && n > 8) {
+            run_length = 0;                 // Skip a full byte
+            pos += 7;
+            n -= 7;
+            continue;
+        }
+        if (byte & (1 << (bit % 8))) {
+            run_length = 0;
+            continue;
+        }
+        if (run_length++ == 0) {
+            run_start = pos;
+        }
+        if (run_length > best_length) {
+            best_start = run_start;
+            best_length = run_length;
+            if (best_length == want) {
+                break;
+            }
+        }
+    }
+    put(b, 0);
+
+    if (best_length == 0) {
+        return 0;
+    }
+    if (bitmap_mark(best_start, best_length, 1) != FS_OK) {
+        return FS_ERR_IO;
+    }
+    sb->free_blocks -= best_length;
+    super_dirty();
+    alloc_hint = best_start + best_length;
+    *start = best_start;
+    return best_length;
+}
+
+static void blocks_free(uint32_t start, uint32_t length)
+{
+    if (bitmap_mark(start, length, 0) == FS_OK) {
+        sb->free_blocks += length;
+        super_dirty();
+    }
+}
+
+// --- Extents ---
+
+// Extent 'i' of an inode; *buf is the extent block to put() (or NULL)
+static fs_extent_t* extent_get(fs_inode_t* inode, uint32_t i, buf_t** buf)
+{
+    *buf = NULL;
+    if (i < FS_DIRECT_EXTENTS) {
+        return &inode->extents[i];
+    }
+    buf_t* b = bcache_read(DISK, inode->extent_block);
+    if (!b) {
+        return NULL;
+    }
+    *buf = b;
+    return (fs_extent_t*)b->data + (i - FS_DIRECT_EXTENTS);
+}
+
+// Disk block holding file block 'fblock', 0 if unmapped
+static uint32_t extent_map(fs_inode_t* inode, uint32_t fblock)
+{
+    uint32_t base = 0;
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        buf_t* b;
+        fs_extent_t* e = extent_get(inode, i, &b);
+        if (!e) {
+            return 0;
+        }
+        uint32_t start = e->start, length = e->length;
+        put(b, 0);
+        if (fblock < base + length) {
+            return start + (fblock - base);
+        }
+        base += length;
+    }
+    return 0;
+}
+
+// Add a run at the end of the file, growing the last extent if adjacent
+static int extent_append(fs_inode_t* inode, uint32_t start, uint32_t length)
+{
+    buf_t* b;
+    fs_extent_t* e;
+    if (inode->extent_count > 0) {
+        e = extent_get(inode, inode->extent_count - 1, &b);
+        if (!e) {
+            return FS_ERR_IO;
+        }
+        if (e->start + e->length == start) {
+            e->length += length;
+            put(b, 1);
+            return FS_OK;
+        }
+        put(b, 0);
+    }
+    if (inode->extent_count >= FS_MAX_EXTENTS) {
+        return FS_ERR_TOO_BIG;
+    }
+    if (inode->extent_count == FS_DIRECT_EXTENTS && inode->extent_block == 0) {
+        uint32_t block;
+        long got = blocks_alloc(start + length, 1, &block);
+        if (got <= 0) {
+            return got < 0 ? FS_ERR_IO : FS_ERR_NO_SPACE;
+        }
+        buf_t* z = block_zero(block);
+        if (!z) {
+            blocks_free(block, 1);
+            return FS_ERR_IO;
+        }
+        put(z, 0);
+        inode->extent_block = block;
+    }
+    e = extent_get(inode, inode->extent_count, &b);
+    if (!e) {
+        return FS_ERR_IO;
+    }
+    e->start = start;
+    e->length = length;
+    put(b, 1);
+    inode->extent_count++;
+    return FS_OK;
+}
+
+/*
+ * Allocate until the file has 'blocks' blocks, asking for 'prealloc'
+ * more in the first request so later appends find them contiguous. The
+ * search starts just past the last extent.
+ */
+static int inode_grow(fs_inode_t* inode, uint32_t blocks, uint32_t prealloc)
+{
+    if (blocks <= inode->blocks) {
+        return FS_OK;
+    }
+    uint32_t need = blocks - inode->blocks;
+    uint32_t want = need + prealloc;
+    uint32_t goal = 0;
+    if (inode->extent_count > 0) {
+        buf_t* b;
+        fs_extent_t* e = extent_get(inode, inode->extent_count - 1, &b);
+        if (!e) {
+            return FS_ERR_IO;
+        }
+        goal = e->start + e->length;
+        put(b, 0);
+    }
+
+    while (need > 0) {
+        uint32_t start;
+        long got = blocks_alloc(goal, want, &start);
+        if (got <= 0) {
+            return got < 0 ? FS_ERR_IO : FS_ERR_NO_SPACE;
+        }
+        int err = extent_append(inode, start, got);
+        if (err != FS_OK) {
+            blocks_free(start, got);
+            return err;
+        }
+        inode->blocks += got;
+        need = (uint32_t)got >= need ? 0 : need - got;
+        want = need;                        // Preallocation is best effort
+        goal = start + got;
+    }
+    return FS_OK;
+}
+
+// Give back every block; the inode keeps its type
+static void inode_truncate(fs_inode_t* inode)
+{
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        buf_t* b;
+        fs_extent_t* e = extent_get(inode, i, &b);
+        if (e) {
+            blocks_free(e->start, e->length);
+            put(b, 0);
+        }
+    }
+    if (inode->extent_block) {
+        blocks_free(inode->extent_block, 1);
+    }
+    inode->extent_block = 0;
+    inode->extent_count = 0;
+    inode->blocks = 0;
+    inode->size = 0;
+}
+
+// --- File data ---
+
+static long inode_read(fs_inode_t* inode, uint64_t offset, uint8_t* out, size_t len)
+{
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (len > inode->size - offset) {
+        len = inode->size - offset;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t in = pos % FS_BLOCK_SIZE;
+        buf_t* b = data_read(extent_map(inode, pos / FS_BLOCK_SIZE));
+        if (!b) {
+            return done ? (long)done : FS_ERR_IO;
+        }
+        size_t n = FS_BLOCK_SIZE - in;
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(out + done, b->data + in, n);
+        put(b, 0);
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * Blocks past the old end of the file hold nothing worth reading: they
+ * are fetched without a disk read and zeroed unless overwritten whole.
+ */
+static long inode_write(fs_inode_t* inode, uint64_t offset, const uint8_t* data, size_t len)
+{
+    if (len == 0) {
+        return 0;
+    }
+    uint64_t end = offset + len;
+    uint64_t old_size = inode->size;
+    uint32_t prealloc = 0;
+    if (inode->type == FS_TYPE_FILE) {
+        prealloc = inode->blocks < FS_PREALLOC_MAX ? inode->blocks : FS_PREALLOC_MAX;
+    }
+    int err = inode_grow(inode, (end + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE, prealloc);
+    if (err != FS_OK) {
+        return err;
+    }
+
+    // Writing past the end: zero the rest of the old last block
+    uint32_t tail = old_size % FS_BLOCK_SIZE;
+    if (offset > old_size && tail && offset / FS_BLOCK_SIZE > old_size / FS_BLOCK_SIZE) {
+        buf_t* b = data_read(extent_map(inode, old_size / FS_BLOCK_SIZE));
+        if (!b) {
+            return FS_ERR_IO;
+        }
+        memset(b->data + tail, 0, FS_BLOCK_SIZE - tail);
+        put(b, 1);
+    }
+    // Blocks skipped over entirely
+    uint32_t first_new = (old_size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    for (uint32_t fblock = first_new; fblock < offset / FS_BLOCK_SIZE; fblock++) {
+        buf_t* b = block_zero(extent_map(inode, fblock));
+        if (!b) {
+            return FS_ERR_IO;
+        }
+        put(b, 0);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t in = pos % FS_BLOCK_SIZE;
+        uint64_t block_pos = pos - in;
+        size_t n = FS_BLOCK_SIZE - in;
+        if (n > len - done) {
+            n = len - done;
+        }
+        uint32_t disk = extent_map(inode, pos / FS_BLOCK_SIZE);
+        int fresh = block_pos >= old_size;
+        int whole = n == FS_BLOCK_SIZE;
+        buf_t* b = NULL;
+        if (disk) {
+            b = (fresh || whole) ? bcache_get(DISK, disk) : bcache_read(DISK, disk);
+        }
+        if (!b) {
+            err = FS_ERR_IO;
+            break;
+        }
+        if (fresh && !whole) {
+            memset(b->data, 0, FS_BLOCK_SIZE);
+        } else if (pos > old_size && old_size > block_pos) {
+            memset(b->data + (old_size - block_pos), 0, pos - old_size);
+        }
+        memcpy(b->data + in, data + done, n);
+        put(b, 1);
+        done += n;
+    }
+
+    if (offset + done > old_size) {
+        inode->size = offset + done;
+    }
+    inode->mtime = timer_uptime_ms();
+    return done ? (long)done : err;
+}
+
+// --- Directories ---
+
+/*
+ * Slot holding 'name' in directory 'dir': its disk block and index, and
+ * the inode number (0 if absent). Probing starts at the name's bucket
+ * and only moves on past buckets that have overflowed.
+ */
+static uint32_t dir_lookup(fs_inode_t* dir, const char* name, int len,
+                           uint32_t* block_out, int* slot_out)
+{
+    uint32_t hash = fs_name_hash(name, len);
+    uint32_t buckets = dir->blocks;
+    for (uint32_t i = 0; i < buckets; i++) {
+        uint32_t disk = extent_map(dir, (hash + i) & (buckets - 1));
+        buf_t* b = data_read(disk);
+        if (!b) {
+            return 0;
+        }
+        fs_dirent_t* slots = (fs_dirent_t*)b->data;
+        for (int s = 1; s <= FS_DIRENTS_PER_BLOCK; s++) {
+            fs_dirent_t* d = &slots[s];
+            if (d->inode && d->hash == hash && name_equal(d, name, len)) {
+                uint32_t ino = d->inode;
+                if (block_out) {
+                    *block_out = disk;
+                    *slot_out = s;
+                }
+                put(b, 0);
+                return ino;
+            }
+        }
+        int overflow = ((fs_dirhead_t*)b->data)->overflow;
+        put(b, 0);
+        if (!overflow) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Store an entry in its bucket or the next with room; 1 if all are full
+static int dir_place(fs_inode_t* dir, const char* name, int len, uint32_t hash,
+                     uint32_t ino, int type)
+{
+    uint32_t buckets = dir->blocks;
+    for (uint32_t i = 0; i < buckets; i++) {
+        uint32_t disk = extent_map(dir, (hash + i) & (buckets - 1));
+        buf_t* b = data_read(disk);
+        if (!b) {
+            return FS_ERR_IO;
+        }
+        fs_dirhead_t* head = (fs_dirhead_t*)b->data;
+        if (head->count < FS_DIRENTS_PER_BLOCK) {
+            fs_dirent_t* slots = (fs_dirent_t*)b->data;
+            for (int s = 1; s <= FS_DIRENTS_PER_BLOCK; s++) {
+                fs_dirent_t* d = &slots[s];
+                if (d->inode == 0) {
+                    d->inode = ino;
+                    d->hash = hash;
+                    d->type = type;
+                    d->name_len = len;
+                    memcpy(d->name, name, len);
+                    head->count++;
+                    put(b, 1);
+                    return FS_OK;
+                }
+            }
+        }
+        if (!head->overflow) {
+            head->overflow = 1;
+            put(b, 1);
+        } else {
+            put(b, 0);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Double the bucket count: build the new table in freshly allocated
+ * blocks (one run where possible), rehash every entry into it, then free
+ * the old blocks. Overflow chains are rebuilt from scratch.
+ */
+static int dir_grow(fs_inode_t* dir)
+{
+    fs_inode_t table = *dir;
+    table.extent_count = 0;
+    table.extent_block = 0;
+    table.blocks = 0;
+    table.entries = 0;
+
+    int err = inode_grow(&table, dir->blocks ? dir->blocks * 2 : 1, 0);
+    for (uint32_t fblock = 0; err == FS_OK && fblock < table.blocks; fblock++) {
+        buf_t* b = block_zero(extent_map(&table, fblock));
+        if (!b) {
+            err = FS_ERR_IO;
+        }
+        put(b, 0);
+    }
+
+    uint8_t* copy = page_alloc(1);
+    if (!copy && err == FS_OK) {
+        err = FS_ERR_NO_MEMORY;
+    }
+    for (uint32_t fblock = 0; err == FS_OK && fblock < dir->blocks; fblock++) {
+        uint32_t disk = extent_map(dir, fblock);
+        buf_t* b = data_read(disk);
+        if (!b) {
+            err = FS_ERR_IO;
+            break;
+        }
+        memcpy(copy, b->data, FS_BLOCK_SIZE);
+        put(b, 0);
+
+        fs_dirent_t* slots = (fs_dirent_t*)copy;
+        for (int s = 1; s <= FS_DIRENTS_PER_BLOCK && err == FS_OK; s++) {
+            fs_dirent_t* d = &slots[s];
+            if (d->inode) {
+                err = dir_place(&table, d->name, d->name_len, d->hash, d->inode, d->type);
+                if (err == 1) {
+                    err = FS_ERR_NO_SPACE;
+                }
+            }
+        }
+    }
+    if (copy) {
+        page_free(copy, 1);
+    }
+    if (err != FS_OK) {
+        inode_truncate(&table);
+        return err;
+    }
+
+    inode_truncate(dir);
+    dir->extent_count = table.extent_count;
+    dir->extent_block = table.extent_block;
+    memcpy(dir->extents, table.extents, sizeof(dir->extents));
+    dir->blocks = table.blocks;
+    dir->size = (uint64_t)table.blocks * FS_BLOCK_SIZE;
+    return FS_OK;
+}
+
+static int dir_add(fs_inode_t* dir, const char* name, int len, uint32_t ino, int type)
+{
+    uint32_t hash = fs_name_hash(name, len);
+
+    // Keep probe chains short: grow at three quarters full
+    if ((dir->entries + 1) * 4 > dir->blocks * FS_DIRENTS_PER_BLOCK * 3) {
+        int err = dir_grow(dir);
+        if (err != FS_OK && err != FS_ERR_NO_SPACE) {
+            return err;
+        }
+    }
+    int err = dir_place(dir, name, len, hash, ino, type);
+    if (err == 1) {
+        err = dir_grow(dir);
+        if (err == FS_OK) {
+            err = dir_place(dir, name, len, hash, ino, type);
+        }
+        if (err == 1) {
+            err = FS_ERR_NO_SPACE;
+        }
+    }
+    if (err == FS_OK) {
+        dir->entries++;
+        dir->mtime = timer_uptime_ms();
+    }
+    return err;
+}
+
+static int dir_remove(fs_inode_t* dir, const char* name, int len)
+{
+    uint32_t disk;
+    int slot;
+    if (!dir_lookup(dir, name, len, &disk, &slot)) {
+        return FS_ERR_NOT_FOUND;
+    }
+    buf_t* b = bcache_read(DISK, disk);
+    if (!b) {
+        return FS_ERR_IO;
+    }
+    memset((fs_dirent_t*)b->data + slot, 0, FS_DIRENT_SIZE);
+    ((fs_dirhead_t*)b->data)->count--;
+    put(b, 1);
+    dir->entries--;
+    dir->mtime = timer_uptime_ms();
+    return FS_OK;
+}
+
+// --- Mounting ---
+
+void fs_init(void)
+{
+    spin_lock_init(&fs_lock, "fs");
+
+    uint64_t disk_blocks = bcache_blocks(DISK);
+    if (disk_blocks == 0) {
+        return;
+    }
+    buf_t* b = bcache_read(DISK, 0);
+    if (!b) {
+        printf("fs: cannot read the superblock\n");
+        return;
+    }
+    fs_super_t* s = (fs_super_t*)b->data;
+    if (s->magic != FS_MAGIC || s->version != FS_VERSION || s->block_size != FS_BLOCK_SIZE) {
+        printf("fs: no filesystem on the disk (format an image with build/mkfs)\n");
+        bcache_release(b);
+        return;
+    }
+    if (s->blocks > disk_blocks) {
+        printf("fs: filesystem is larger than the disk\n");
+        bcache_release(b);
+        return;
+    }
+
+    super_buf = b;
+    sb = s;
+    alloc_hint = sb->data_start;
+    printf("fs: mounted, %lu KB, %lu KB free, %u of %u inodes free\n",
+           (unsigned long)sb->blocks * (FS_BLOCK_SIZE / 1024),
+           (unsigned long)sb->free_blocks * (FS_BLOCK_SIZE / 1024),
+           sb->free_inodes, sb->inodes);
+}
+
+int fs_mounted(void)
+{
+    return sb != NULL;
+}
+
+// --- Operations ---
+
+static void fill_stat(uint32_t ino, const fs_inode_t* inode, fs_stat_t* st)
+{
+    st->inode = ino;
+    st->type = inode->type;
+    st->size = inode->size;
+    st->blocks = inode->blocks;
+    st->extent_count = inode->extent_count;
+    st->entries = inode->entries;
+    st->mtime = inode->mtime;
+}
+
+/*
+ * Enter the filesystem and look a name up: returns its inode number (0
+ * for the root itself) or an error, with the root inode referenced in
+ * *root / *root_buf. Leaves the lock held on success.
+ */
+static long fs_begin(const char** name, int* len, fs_inode_t** root, buf_t** root_buf)
+{
+    if (!sb) {
+        return FS_ERR_NOT_MOUNTED;
+    }
+    int n = name_check(name);
+    if (n < 0) {
+        return n;
+    }
+    fs_enter();
+    *root = inode_get(sb->root, root_buf);
+    if (!*root) {
+        fs_leave();
+        return FS_ERR_IO;
+    }
+    *len = n;
+    return n ? dir_lookup(*root, *name, n, NULL, NULL) : 0;
+}
+
+static void fs_end(buf_t* root_buf, int dirty)
+{
+    put(root_buf, dirty);
+    fs_leave();
+}
+
+int fs_stat(const char* name, fs_stat_t* st)
+{
+    fs_inode_t* root;
+    buf_t* root_buf;
+    int len;
+    long ino = fs_begin(&name, &len, &root, &root_buf);
+    if (ino < 0) {
+        return ino;
+    }
+
+    int err = FS_OK;
+    if (len == 0) {
+        fill_stat(sb->root, root, st);
+    } else if (ino == 0) {
+        err = FS_ERR_NOT_FOUND;
+    } else {
+        buf_t* b;
+        fs_inode_t* inode = inode_get(ino, &b);
+        if (inode) {
+            fill_stat(ino, inode, st);
+            put(b, 0);
+        } else {
+            err = FS_ERR_IO;
+        }
+    }
+    fs_end(root_buf, 0);
+    return err;
+}
+
+long fs_read(const char* name, uint64_t offset, void* buf, size_t len)
+{
+    fs_inode_t* root;
+    buf_t* root_buf;
+    int name_len;
+    long ino = fs_begin(&name, &name_len, &root, &root_buf);
+    if (ino < 0) {
+        return ino;
+    }
+
+    long result;
+    if (name_len == 0) {
+        result = FS_ERR_IS_DIR;
+    } else if (ino == 0) {
+        result = FS_ERR_NOT_FOUND;
+    } else {
+        buf_t* b = NULL;
+        fs_inode_t* inode = inode_get(ino, &b);
+        result = inode ? inode_read(inode, offset, buf, len) : FS_ERR_IO;
+        put(b, 0);
+    }
+    fs_end(root_buf, 0);
+    return result;
+}
+
+long fs_write(const char* name, uint64_t offset, const void* buf, size_t len, int flags)
+{
+    fs_inode_t* root;
+    buf_t* root_buf;
+    int name_len;
+    long ino = fs_begin(&name, &name_len, &root, &root_buf);
+    if (ino < 0) {
+        return ino;
+    }
+    if (name_len == 0) {
+        fs_end(root_buf, 0);
+        return FS_ERR_IS_DIR;
+    }
+
+    int root_dirty = 0;
+    if (ino == 0) {
+        if (!(flags & FS_CREATE)) {
+            fs_end(root_buf, 0);
+            return FS_ERR_NOT_FOUND;
+        }
+        ino = inode_alloc(FS_TYPE_FILE);
+        if (ino == 0) {
+            fs_end(root_buf, 0);
+            return FS_ERR_NO_SPACE;
+        }
+        int err = dir_add(root, name, name_len, ino, FS_TYPE_FILE);
+        root_dirty = 1;
+        if (err != FS_OK) {
+            buf_t* b;
+            fs_inode_t* inode = inode_get(ino, &b);
+            if (inode) {
+                inode->type = FS_TYPE_FREE;
+                put(b, 1);
+                sb->free_inodes++;
+                super_dirty();
+            }
+            fs_end(root_buf, root_dirty);
+            return err;
+        }
+    }
+
+    buf_t* b;
+    fs_inode_t* inode = inode_get(ino, &b);
+    long result = FS_ERR_IO;
+    if (inode) {
+        if (flags & FS_TRUNCATE) {
+            inode_truncate(inode);
+        }
+        if (flags & FS_APPEND) {
+            offset = inode->size;
+        }
+        result = inode_write(inode, offset, buf, len);
+        put(b, 1);
+    }
+    fs_end(root_buf, root_dirty);
+    return result;
+}
+
+int fs_remove(const char* name)
+{
+    fs_inode_t* root;
+    buf_t* root_buf;
+    int len;
+    long ino = fs_begin(&name, &len, &root, &root_buf);
+    if (ino < 0) {
+        return ino;
+    }
+
+    int err = FS_OK;
+    if (len == 0) {
+        err = FS_ERR_IS_DIR;
+    } else if (ino == 0) {
+        err = FS_ERR_NOT_FOUND;
+    } else {
+        err = dir_remove(root, name, len);
+    }
+    if (err == FS_OK) {
+        buf_t* b;
+        fs_inode_t* inode = inode_get(ino, &b);
+        if (inode) {
+            inode_truncate(inode);
+            inode->type = FS_TYPE_FREE;
+            inode->links = 0;
+            put(b, 1);
+            sb->free_inodes++;
+            super_dirty();
+        }
+    }
+    fs_end(root_buf, err == FS_OK);
+    return err;
+}
+
+int fs_list(fs_list_fn_t fn, void* arg)
+{
+    fs_inode_t* root;
+    buf_t* root_buf;
+    int len;
+    const char* name = "/";
+    long err = fs_begin(&name, &len, &root, &root_buf);
+    if (err < 0) {
+        return err;
+    }
+
+    int count = 0;
+    for (uint32_t fblock = 0; fblock < root->blocks; fblock++) {
+        uint32_t disk = extent_map(root, fblock);
+        buf_t* b = data_read(disk);
+        if (!b) {
+            count = FS_ERR_IO;
+            break;
+        }
+        fs_dirent_t* slots = (fs_dirent_t*)b->data;
+        for (int s = 1; s <= FS_DIRENTS_PER_BLOCK; s++) {
+            fs_dirent_t* d = &slots[s];
+            if (!d->inode) {
+                continue;
+            }
+            char entry[FS_NAME_MAX + 1];
+            memcpy(entry, d->name, d->name_len);
+            entry[d->name_len] = '\0';
+
+            fs_stat_t st;
+            buf_t* ib;
+            fs_inode_t* inode = inode_get(d->inode, &ib);
+            if (!inode) {
+                continue;
+            }
+            fill_stat(d->inode, inode, &st);
+            put(ib, 0);
+            fn(entry, &st, arg);
+            count++;
+        }
+        put(b, 0);
+    }
+    fs_end(root_buf, 0);
+    return count;
+}
+
+int fs_sync(void)
+{
+    if (!sb) {
+        return FS_ERR_NOT_MOUNTED;
+    }
+    return bcache_sync() == 0 ? FS_OK : FS_ERR_IO;
+}
+
+static void print_name_padded(const char* name, int width)
+{
+    int len = strlen(name);
+    printf("%s", name);
+    for (int i = len; i < width; i++) {
+        putchar(' ');
+    }
+    if (len >= width) {
+        putchar(' ');
+    }
+}
+
+static void print_dir_entry(const char* name, const fs_stat_t* st, void* arg)
+{
+    uint64_t* bytes = arg;
+    print_name_padded(name, 24);
+    print_uint_padded((unsigned long)st->size, 12);
+    print_uint_padded(st->blocks, 8);
+    printf("%u\n", st->extent_count);
+    *bytes += st->size;
+}
+
+int fs_print_dir(void)
+{
+    if (!sb) {
+        return FS_ERR_NOT_MOUNTED;
+    }
+    puts("Name                    Size        Blocks  Extents");
+    uint64_t bytes = 0;
+    int count = fs_list(print_dir_entry, &bytes);
+    if (count >= 0) {
+        printf("%d files, %lu bytes; %lu KB free\n", count, (unsigned long)bytes,
+               (unsigned long)sb->free_blocks * (FS_BLOCK_SIZE / 1024));
+    }
+    return count;
+}
+
+int fs_print_file(const char* name)
+{
+    fs_inode_t* root;
+    buf_t* root_buf;
+    int len;
+    long ino = fs_begin(&name, &len, &root, &root_buf);
+    if (ino < 0) {
+        return ino;
+    }
+    if (len == 0) {
+        ino = sb->root;
+    } else if (ino == 0) {
+        fs_end(root_buf, 0);
+        return FS_ERR_NOT_FOUND;
+    }
+
+    buf_t* b = NULL;
+    fs_inode_t* inode = len == 0 ? root : inode_get(ino, &b);
+    int err = inode ? FS_OK : FS_ERR_IO;
+    if (inode) {
+        printf("%s: %s, inode %u, %lu bytes, %u blocks, modified %lu ms after boot\n",
+               len ? name : "/", inode->type == FS_TYPE_DIR ? "directory" : "file",
+               (unsigned)ino, (unsigned long)inode->size, inode->blocks,
+               (unsigned long)inode->mtime);
+        if (inode->type == FS_TYPE_DIR) {
+            printf("  %u entries in %u hash buckets\n", inode->entries, inode->blocks);
+        }
+        printf("  %u extents%s\n", inode->extent_count,
+               inode->extent_block ? " (indirect block in use)" : "");
+        for (uint32_t i = 0; i < inode->extent_count; i++) {
+            buf_t* eb;
+            fs_extent_t* e = extent_get(inode, i, &eb);
+            if (!e) {
+                err = FS_ERR_IO;
+                break;
+            }
+            printf("    blocks %u-%u (%u)\n", e->start, e->start + e->length - 1, e->length);
+            put(eb, 0);
+        }
+    }
+    put(b, 0);
+    fs_end(root_buf, 0);
+    return err;
+}
+
+void fs_print(void)
+{
+    if (!sb) {
+        puts("No filesystem mounted");
+        return;
+    }
+    unsigned long kb = FS_BLOCK_SIZE / 1024;
+    printf("Filesystem: %lu blocks of %u KB (%lu KB)\n",
+           (unsigned long)sb->blocks, FS_BLOCK_SIZE / 1024,
+           (unsigned long)sb->blocks * kb);
+    printf("  Free:     %lu blocks (%lu KB)\n",
+           (unsigned long)sb->free_blocks, (unsigned long)sb->free_blocks * kb);
+    printf("  Inodes:   %u, %u free\n", sb->inodes, sb->free_inodes);
+    printf("  Layout:   bitmap at %u (%u blocks), inodes at %u (%u blocks), data from %u\n",
+           sb->bitmap_start, sb->bitmap_blocks, sb->inode_start,
+           sb->inode_blocks, sb->data_start);
+
+    fs_stat_t st;
+    if (fs_stat("/", &st) == FS_OK) {
+        printf("  Root:     %u entries in %u hash buckets, %u extents\n",
+               st.entries, st.blocks, st.extent_count);
+    }
+}
+
+const char* fs_error(int err)
+{
+    switch (err) {
+    case FS_OK:                 return "success";
+    case FS_ERR_NOT_FOUND:      return "no such file";
+    case FS_ERR_NO_SPACE:       return "no space left";
+    case FS_ERR_IO:             return "I/O error";
+    case FS_ERR_NAME:           return "invalid name";
+    case FS_ERR_NOT_MOUNTED:    return "no filesystem mounted";
+    case FS_ERR_IS_DIR:         return "is a directory";
+    case FS_ERR_TOO_BIG:        return "file too fragmented";
+    case FS_ERR_NO_MEMORY:      return "out of memory";
+    default:                    return "unknown error";
+    }
+}
@@ -0,0 +1,275 @@
+/*
+ * QEMU fw_cfg Implementation
+ * MMIO layout: data register at +0, selector at +8 (16-bit big-endian),
+ * DMA address at +16 (64-bit big-endian). A DMA request is a control
+ * word, a length and a guest address, all big-endian, in guest memory;
+ * writing its address starts it, and QEMU has finished when the
+ * control word reads back as 0 (or just the error bit).
+ */
+
+#include "fwcfg.h"
+#include "fdt.h"
+#include "page.h"
+#include "spinlock.h"
+#include "string.h"
+#include "uart.h"
+
+#define REG_DATA                0x00
+#define REG_SELECTOR            0x08
+#define REG_DMA                 0x10
+
+#define FWCFG_SIGNATURE_VALUE   0x554d4551      // "QEMU" read as a little-endian word
+#define FWCFG_ID_DMA            (1 << 1)
+#define FWCFG_DMA_SIGNATURE     0x51454d5520434647UL    // "QEMU CFG"
+
+// DMA control bits
+#define DMA_ERROR               0x01
+#define DMA_READ                0x02
+#define DMA_SELECT              0x08
+
+typedef struct {
+    uint32_t control;
+    uint32_t length;
+    uint64_t address;
+} fwcfg_dma_t;
+
+static spinlock_t fwcfg_lock;
+static uintptr_t base = 0;
+static int dma = 0;
+static fwcfg_dma_t dma_request __attribute__((aligned(16)));
+
+static fwcfg_file_t files[FWCFG_MAX_FILES];
+static int file_count = 0;
+static uint32_t directory_count = 0;        // Entries the device listed
+
+static fwcfg_stats_t stats;
+
+static uint32_t be32(uint32_t value)
+{
+    return __builtin_bswap32(value);
+}
+
+static uint64_t be64(uint64_t value)
+{
+    return __builtin_bswap64(value);
+}
+
+static void select_item(uint16_t select)
+{
+    *(volatile uint16_t*)(base + REG_SELECTOR) = __builtin_bswap16(select);
+}
+
+// Called with fwcfg_lock held
+static int read_dma(uint16_t select, void* buf, uint32_t len)
+{
+    dma_request.control = be32(((uint32_t)select << 16) | DMA_SELECT | DMA_READ);
+    dma_request.length = be32(len);
+    dma_request.address = be64((uintptr_t)buf);
+    __asm__ volatile("dmb sy" ::: "memory");
+
+    // The low half of the address register triggers the request
+    uint64_t addr = (uintptr_t)&dma_request;
+    *(volatile uint32_t*)(base + REG_DMA) = be32(addr >> 32);
+    *(volatile uint32_t*)(base + REG_DMA + 4) = be32((uint32_t)addr);
+
+    uint32_t control;
+    while ((control = be32(*(volatile uint32_t*)&dma_request.control)) & ~DMA_ERROR) {
+    }
+    __asm__ volatile("dmb sy" ::: "memory");
+
+    stats.dma_requests++;
+    if (control & DMA_ERROR) {
+        stats.errors++;
+        return -1;
+    }
+    stats.dma_bytes += len;
+    return 0;
+}
+
+// Called with fwcfg_lock held: the data register streams the item in order
+static int read_pio(uint16_t select, void* buf, uint32_t len)
+{
+    uint8_t* out = buf;
+    select_item(select);
+
+    uint32_t done = 0;
+    for (; done + 8 <= len; done += 8) {
+        uint64_t word = *(volatile uint64_t*)(base + REG_DATA);
+        memcpy(out + done, &word, 8);
+    }
+    for (; done < len; done++) {
+        out[done] = *(volatile uint8_t*)(base + REG_DATA);
+    }
+    stats.pio_bytes += len;
+    return 0;
+}
+
+int fwcfg_read(uint16_t select, void* buf, uint32_t len, int use_dma)
+{
+    if (!base) return -1;
+
+    unsigned long flags = spin_lock_irqsave(&fwcfg_lock);
+    int result = (dma && use_dma) ? read_dma(select, buf, len) : read_pio(select, buf, len);
+    spin_unlock_irqrestore(&fwcfg_lock, flags);
+    return result;
+}
+
+// Directory: a big-endian count, then 64-byte entries (size, select, name)
+static void read_directory(void)
+{
+    uint32_t count;
+    if (fwcfg_read(FWCFG_FILE_DIR, &count, 4, 1) != 0) return;
+    directory_count = be32(count);
+
+    size_t bytes = 4 + (size_t)directory_count * 64;
+    size_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint8_t* dir = page_alloc(pages);
+    if (!dir) return;
+
+    if (fwcfg_read(FWCFG_FILE_DIR, dir, bytes, 1) == 0) {
+        for (uint32_t i = 0; i < directory_count && file_count < FWCFG_MAX_FILES; i++) {
+            const uint8_t* entry = dir + 4 + i * 64;
+            fwcfg_file_t* f = &files[file_count++];
+            f->size = (uint32_t)entry[0] << 24 | (uint32_t)entry[1] << 16 |
+                      (uint32_t)entry[2] << 8 | entry[3];
+            f->select = (uint16_t)(entry[4] << 8 | entry[5]);
+            memcpy(f->name, entry + 8, FWCFG_NAME_MAX);
+            f->name[FWCFG_NAME_MAX - 1] = '\0';
+            f->data = NULL;
+        }
+    }
+    page_free(dir, pages);
+}
+
+void fwcfg_init(void)
+{
+    spin_lock_init(&fwcfg_lock, "fwcfg");
+
+    uintptr_t addr = FWCFG_DEFAULT_BASE;
+    if (fdt_present()) {
+        int node = fdt_find_compatible(-1, "qemu,fw-cfg-mmio");
+        uint64_t reg_base, reg_size;
+        if (node < 0 || fdt_get_reg(node, 0, &reg_base, &reg_size) != 0) return;
+        addr = (uintptr_t)reg_base;
+    }
+    base = addr;
+
+    uint32_t signature = 0, id = 0;
+    fwcfg_read(FWCFG_SIGNATURE, &signature, 4, 0);
+    if (signature != FWCFG_SIGNATURE_VALUE) {
+        base = 0;
+        return;
+    }
+    fwcfg_read(FWCFG_ID, &id, 4, 0);       // Little-endian
+    if ((id & FWCFG_ID_DMA) && be64(*(volatile uint64_t*)(base + REG_DMA)) == FWCFG_DMA_SIGNATURE) {
+        dma = 1;
+    }
+
+    read_directory();
+    printf("fw_cfg: %d files, %s\n", file_count, dma ? "DMA" : "data register only");
+}
+
+int fwcfg_present(void)
+{
+    return base != 0;
+}
+
+int fwcfg_has_dma(void)
+{
+    return dma;
+}
+
+int fwcfg_count(void)
+{
+    return file_count;
+}
+
+const fwcfg_file_t* fwcfg_file(int index)
+{
+    return (index >= 0 && index < file_count) ? &files[index] : NULL;
+}
+
+static fwcfg_file_t* find(const char* name)
+{
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(files[i].name, name) == 0) return &files[i];
+    }
+    // "opt/" may be left out
+    for (int i = 0; i < file_count; i++) {
+        if (strncmp(files[i].name, "opt/", 4) == 0 && strcmp(files[i].name + 4, name) == 0) {
+            return &files[i];
+        }
+    }
+    return NULL;
+}
+
+const fwcfg_file_t* fwcfg_find(const char* name)
+{
+    return find(name);
+}
+
+static size_t file_pages(const fwcfg_file_t* f)
+{
+    return f->size ? (f->size + PAGE_SIZE - 1) / PAGE_SIZE : 1;
+}
+
+const fwcfg_file_t* fwcfg_load(const char* name)
+{
+    fwcfg_file_t* f = find(name);
+    if (!f) return NULL;
+    if (f->data) return f;
+
+    // Straight into the pages that keep it: no bounce buffer
+    void* data = page_alloc(file_pages(f));
+    if (!data) return NULL;
+    if (fwcfg_read(f->select, data, f->size, 1) != 0) {
+        page_free(data, file_pages(f));
+        return NULL;
+    }
+    f->data = data;
+    return f;
+}
+
+void fwcfg_unload(const char* name)
+{
+    fwcfg_file_t* f = find(name);
+    if (f && f->data) {
+        page_free(f->data, file_pages(f));
+        f->data = NULL;
+    }
+}
+
+const fwcfg_stats_t* fwcfg_stats(void)
+{
+    return &stats;
+}
+
+void fwcfg_print(void)
+{
+    if (!base) {
+        puts("No fw_cfg device");
+        return;
+    }
+    printf("fw_cfg at %x: %s, %u directory entries", (unsigned long)base,
+           dma ? "DMA interface" : "data register only (no DMA)", directory_count);
+    if (directory_count > (uint32_t)file_count) {
+        printf(" (first %d kept)", file_count);
+    }
+    printf("\n");
+    printf("Transfers: %lu DMA requests, %lu bytes by DMA, %lu through the data register, %lu errors\n",
+           stats.dma_requests, stats.dma_bytes, stats.pio_bytes, stats.errors);
+    puts("");
+
+    puts("Select  Size        Loaded at   Name");
+    for (int i = 0; i < file_count; i++) {
+        const fwcfg_file_t* f = &files[i];
+        print_uint_padded(f->select, 8);
+        print_uint_padded(f->size, 12);
+        if (f->data) {
+            printf("%x  ", (unsigned long)(uintptr_t)f->data);
+        } else {
+            printf("-           ");
+        }
+        printf("%s\n", f->name);
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ * GICv2 Driver Implementation
+ * Base addresses come from the device tree (QEMU virt defaults otherwise).
+ * GICv3 systems are detected but not driven - interrupts stay off there.
+ */
+
+#include "gic.h"
+#include "fdt.h"
+#include "uart.h"
+
+// QEMU virt defaults
+#define GIC_DEFAULT_DIST_BASE 0x08000000UL
+#define GIC_DEFAULT_CPU_BASE  0x08010000UL
+
+// Distributor registers
+#define GICD_CTLR       0x000
+#define GICD_TYPER      0x004
+#define GICD_ISENABLER  0x100
+#define GICD_ICENABLER  0x180
+#define GICD_ICPENDR    0x280
+#define GICD_IPRIORITYR 0x400
+#define GICD_ITARGETSR  0x800
+#define GICD_SGIR       0xF00
+
+// CPU interface registers
+#define GICC_CTLR       0x000
+#define GICC_PMR        0x004
+#define GICC_BPR        0x008
+#define GICC_IAR        0x00C
+#define GICC_EOIR       0x010
+
+// All interrupts share one priority; PMR lets everything above idle through
+#define GIC_DEFAULT_PRIORITY 0xA0
+#define GIC_PRIORITY_MASK    0xF0
+
+static uintptr_t dist_base = 0;
+static uintptr_t cpu_base = 0;
+static unsigned int irq_lines = 0;
+
+static inline void gic_write(uintptr_t addr, uint32_t value)
+{
+    *(volatile uint32_t*)addr = value;
+}
+
+static inline uint32_t gic_read(uintptr_t addr)
+{
+    return *(volatile uint32_t*)addr;
+}
+
+int gic_present(void)
+{
+    return cpu_base != 0;
+}
+
+// Locate the controller in the device tree
+static int gic_probe(void)
+{
+    if (!fdt_present()) {
+        dist_base = GIC_DEFAULT_DIST_BASE;
+        cpu_base = GIC_DEFAULT_CPU_BASE;
+        return 0;
+    }
+
+    int node = fdt_find_compatible(-1, "arm,cortex-a15-gic");
+    if (node < 0) node = fdt_find_compatible(-1, "arm,gic-400");
+    if (node < 0) {
+        if (fdt_find_compatible(-1, "arm,gic-v3") >= 0) {
+            puts("GIC: GICv3 found - only GICv2 is supported, interrupts disabled");
+        } else {
+            puts("GIC: no interrupt controller in device tree");
+        }
+        return -1;
+    }
+
+    uint64_t base, size;
+    if (fdt_get_reg(node, 0, &base, &size) != 0) return -1;
+    dist_base = (uintptr_t)base;
+    if (fdt_get_reg(node, 1, &base, &size) != 0) return -1;
+    cpu_base = (uintptr_t)base;
+    return 0;
+}
+
+/*
+ * Per-CPU setup: banked SGI/PPI state and the CPU interface
+ */
+void gic_cpu_init(void)
+{
+    if (!gic_present()) return;
+
+    // SGIs and PPIs: disabled and cleared until a driver enables them
+    gic_write(dist_base + GICD_ICENABLER, 0xFFFFFFFF);
+    gic_write(dist_base + GICD_ICPENDR, 0xFFFFFFFF);
+    for (unsigned int i = 0; i < GIC_SPI_BASE; i += 4) {
+        gic_write(dist_base + GICD_IPRIORITYR + i, GIC_DEFAULT_PRIORITY * 0x01010101U);
+    }
+
+    gic_write(cpu_base + GICC_PMR, GIC_PRIORITY_MASK);
+    gic_write(cpu_base + GICC_BPR, 0);
+    gic_write(cpu_base + GICC_CTLR, 1);
+}
+
+int gic_init(void)
+{
+    if (gic_probe() != 0) {
+        dist_base = 0;
+        cpu_base = 0;
+        return -1;
+    }
+
+    gic_write(dist_base + GICD_CTLR, 0);
+
+    irq_lines = ((gic_read(dist_base + GICD_TYPER) & 0x1F) + 1) * 32;
+
+    // Shared interrupts: disabled, default priority, routed to CPU 0
+    for (unsigned int i = GIC_SPI_BASE; i < irq_lines; i += 32) {
+        gic_write(dist_base + GICD_ICENABLER + i / 8, 0xFFFFFFFF);
+        gic_write(dist_base + GICD_ICPENDR + i / 8, 0xFFFFFFFF);
+    }
+    for (unsigned int i = GIC_SPI_BASE; i < irq_lines; i += 4) {
+        gic_write(dist_base + GICD_IPRIORITYR + i, GIC_DEFAULT_PRIORITY * 0x01010101U);
+        gic_write(dist_base + GICD_ITARGETSR + i, 0x01010101);
+    }
+
+    gic_write(dist_base + GICD_CTLR, 1);
+    gic_cpu_init();
+
+    printf("GIC: distributor %x, cpu interface %x, %u interrupt lines\n",
+           (unsigned long)dist_base, (unsigned long)cpu_base, irq_lines);
+    return 0;
+}
+
+void gic_enable(unsigned int irq)
+{
+    if (!gic_present()) return;
+    gic_write(dist_base + GICD_ISENABLER + (irq / 32) * 4, 1U << (irq % 32));
+}
+
+void gic_disable(unsigned int irq)
+{
+    if (!gic_present()) return;
+    gic_write(dist_base + GICD_ICENABLER + (irq / 32) * 4, 1U << (irq % 32));
+}
+
+unsigned int gic_acknowledge(void)
+{
+    if (!gic_present()) return GIC_SPURIOUS;
+    return gic_read(cpu_base + GICC_IAR);
+}
+
+void gic_end_of_interrupt(unsigned int iar)
+{
+    if (!gic_present()) return;
+    gic_write(cpu_base + GICC_EOIR, iar);
+}
+
+void gic_send_sgi(unsigned int sgi, uint32_t cpu_mask)
+{
+    if (!gic_present() || sgi >= GIC_PPI_BASE) return;
+
+    // Make the caller's earlier stores visible before the target runs
+    __asm__ volatile("dsb ishst" ::: "memory");
+    gic_write(dist_base + GICD_SGIR, ((cpu_mask & 0xFF) << 16) | sgi);
+}
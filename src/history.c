@@ -0,0 +1,372 @@
+/*
+ * Command History Implementation
+ *
+ * Entries are stored back to back in a byte ring as
+ * [length lo][length hi][command bytes...], oldest evicted first.
+ * A small per-entry index holds each record's ring position and a
+ * 32-bit trigram signature; reverse search uses the signature to skip
+ * entries that cannot contain the query and narrows the previous
+ * keystroke's matches instead of rescanning the whole history.
+ *
+ * The ring is shared by every thread that runs commands and is guarded
+ * by a ticket lock; the navigation position and search state belong to
+ * the shell's line editor.
+ */
+
+#include "history.h"
+#include "page.h"
+#include "spinlock.h"
+#include "string.h"
+#include "uart.h"
+
+#define HISTORY_RING_MASK  (HISTORY_RING_SIZE - 1)
+#define HISTORY_INDEX_MASK (HISTORY_MAX_ENTRIES - 1)
+
+typedef struct {
+    char* ring;                             // HISTORY_RING_SIZE bytes
+    uint32_t head;                          // Ring write counter (bytes)
+    uint32_t tail;                          // Start of oldest record
+    uint32_t* offsets;                      // seq -> ring position of record
+    uint32_t* signatures;                   // seq -> trigram signature
+    uint32_t first_seq;                     // Oldest retained entry
+    uint32_t next_seq;                      // Number the next entry will get
+    uint32_t nav_seq;                       // Up/down arrow position
+} command_history_t;
+
+static command_history_t history;
+static ticket_lock_t history_lock;
+
+// Scratch copies handed out to callers and used for matching
+static char nav_buffer[HISTORY_ENTRY_MAX];
+static char match_buffer[HISTORY_ENTRY_MAX];
+
+/*
+ * 32-bit bloom signature of all trigrams in a string
+ * A query can only match an entry whose signature covers the query's
+ */
+static uint32_t history_signature(const char* str, int len)
+{
+    uint32_t sig = 0;
+
+    for (int i = 0; i + 2 < len; i++) {
+        uint32_t h = (unsigned char)str[i] * 961 +
+                     (unsigned char)str[i + 1] * 31 +
+                     (unsigned char)str[i + 2];
+        h ^= h >> 5;
+        sig |= 1u << (h & 31);
+    }
+    return sig;
+}
+
+// Read/write ring bytes with wrap-around
+static unsigned char ring_byte(uint32_t pos)
+{
+    return (unsigned char)history.ring[pos & HISTORY_RING_MASK];
+}
+
+static int record_length(uint32_t pos)
+{
+    return ring_byte(pos) | (ring_byte(pos + 1) << 8);
+}
+
+uint32_t history_first(void)
+{
+    return history.first_seq;
+}
+
+uint32_t history_end(void)
+{
+    return history.next_seq;
+}
+
+int history_count(void)
+{
+    return (int)(history.next_seq - history.first_seq);
+}
+
+unsigned long history_bytes_used(void)
+{
+    return history.head - history.tail;
+}
+
+// Copy entry 'seq' out of the ring (lock held)
+static int history_copy(uint32_t seq, char* dest, int max_size)
+{
+    if (seq - history.first_seq >= (uint32_t)history_count()) return -1;
+
+    uint32_t pos = history.offsets[seq & HISTORY_INDEX_MASK];
+    int len = record_length(pos);
+    if (len > max_size - 1) len = max_size - 1;
+
+    for (int i = 0; i < len; i++) {
+        dest[i] = (char)ring_byte(pos + 2 + i);
+    }
+    dest[len] = '\0';
+    return len;
+}
+
+/*
+ * Copy entry 'seq' out of the ring; returns its length or -1
+ */
+int history_get(uint32_t seq, char* dest, int max_size)
+{
+    if (!dest || max_size <= 0) return -1;
+
+    unsigned long flags = ticket_lock_irqsave(&history_lock);
+    int len = history_copy(seq, dest, max_size);
+    ticket_unlock_irqrestore(&history_lock, flags);
+    return len;
+}
+
+// Drop the oldest entry
+static void history_evict_oldest(void)
+{
+    history.first_seq++;
+    if (history.first_seq == history.next_seq) {
+        history.tail = history.head;
+    } else {
+        history.tail = history.offsets[history.first_seq & HISTORY_INDEX_MASK];
+    }
+}
+
+void history_add_command(const char* command)
+{
+    if (!command || strlen(command) == 0) {
+        return;  // Don't store empty commands
+    }
+
+    int len = strlen(command);
+    if (len > HISTORY_ENTRY_MAX - 1) len = HISTORY_ENTRY_MAX - 1;
+
+    if (!history.ring) return;              // No pages at boot: nothing is kept
+
+    unsigned long flags = ticket_lock_irqsave(&history_lock);
+
+    // Don't store duplicate consecutive commands
+    if (history_count() > 0) {
+        int last_len = history_copy(history.next_seq - 1, nav_buffer, sizeof(nav_buffer));
+        if (last_len == len && strncmp(nav_buffer, command, len) == 0) {
+            history.nav_seq = history.next_seq;
+            ticket_unlock_irqrestore(&history_lock, flags);
+            return;
+        }
+    }
+
+    // Make room: byte budget and index slots
+    uint32_t need = (uint32_t)len + 2;
+    while (history_count() > 0 &&
+           (HISTORY_RING_SIZE - history_bytes_used() < need ||
+            history_count() >= HISTORY_MAX_ENTRIES)) {
+        history_evict_oldest();
+    }
+
+    // Append the record
+    uint32_t pos = history.head;
+    history.ring[pos & HISTORY_RING_MASK] = (char)(len & 0xFF);
+    history.ring[(pos + 1) & HISTORY_RING_MASK] = (char)(len >> 8);
+    for (int i = 0; i < len; i++) {
+        history.ring[(pos + 2 + i) & HISTORY_RING_MASK] = command[i];
+    }
+
+    history.offsets[history.next_seq & HISTORY_INDEX_MASK] = pos;
+    history.signatures[history.next_seq & HISTORY_INDEX_MASK] = history_signature(command, len);
+    history.head += need;
+    history.next_seq++;
+
+    // Reset current pointer for navigation
+    history.nav_seq = history.next_seq;
+    ticket_unlock_irqrestore(&history_lock, flags);
+}
+
+const char* history_get_previous(void)
+{
+    // Don't go beyond the oldest command
+    if (history.nav_seq == history.first_seq) {
+        return NULL;
+    }
+
+    history.nav_seq--;
+    history_get(history.nav_seq, nav_buffer, sizeof(nav_buffer));
+    return nav_buffer;
+}
+
+const char* history_get_next(void)
+{
+    if (history.nav_seq == history.next_seq) {
+        return NULL;
+    }
+
+    // Stepping past the newest command returns an empty line
+    history.nav_seq++;
+    if (history.nav_seq == history.next_seq) {
+        return "";
+    }
+
+    history_get(history.nav_seq, nav_buffer, sizeof(nav_buffer));
+    return nav_buffer;
+}
+
+void history_reset_navigation(void)
+{
+    history.nav_seq = history.next_seq;
+}
+
+void history_init(void)
+{
+    ticket_lock_init(&history_lock, "history");
+
+    size_t index_bytes = HISTORY_MAX_ENTRIES * sizeof(uint32_t);
+    size_t pages = (HISTORY_RING_SIZE + 2 * index_bytes) / PAGE_SIZE;
+    uint8_t* storage = page_alloc(pages);
+    if (!storage) {
+        puts("Warning: no pages for the command history");
+        return;
+    }
+    history.offsets = (uint32_t*)storage;
+    history.signatures = (uint32_t*)(storage + index_bytes);
+    history.ring = (char*)(storage + 2 * index_bytes);
+}
+
+void history_clear(void)
+{
+    unsigned long flags = ticket_lock_irqsave(&history_lock);
+    history.head = 0;
+    history.tail = 0;
+    history.first_seq = 0;
+    history.next_seq = 0;
+    history.nav_seq = 0;
+    ticket_unlock_irqrestore(&history_lock, flags);
+}
+
+// Naive substring test (queries are short)
+static int contains(const char* text, int text_len, const char* query, int query_len)
+{
+    for (int i = 0; i + query_len <= text_len; i++) {
+        if (strncmp(text + i, query, query_len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Does entry 'seq' contain the current query?
+static int history_search_matches(const history_search_t* search, uint32_t seq)
+{
+    uint32_t sig = history.signatures[seq & HISTORY_INDEX_MASK];
+    if ((sig & search->query_sig) != search->query_sig) {
+        return 0;  // Missing a query trigram - skip without touching the ring
+    }
+
+    int len = history_get(seq, match_buffer, sizeof(match_buffer));
+    return len >= 0 && contains(match_buffer, len, search->query, search->query_len);
+}
+
+/*
+ * Examine older entries until 'want' matches are known or history runs out
+ */
+static void history_search_fill(history_search_t* search, int want)
+{
+    if (want > HISTORY_SEARCH_MAX_MATCHES) want = HISTORY_SEARCH_MAX_MATCHES;
+
+    while (search->match_count < want && !search->scan_done) {
+        uint32_t seq = search->scan_next;
+
+        if (history_count() == 0 || seq - history.first_seq >= (uint32_t)history_count()) {
+            search->scan_done = 1;
+            break;
+        }
+        if (history_search_matches(search, seq)) {
+            search->matches[search->match_count++] = seq;
+        }
+        if (seq == history.first_seq) {
+            search->scan_done = 1;
+        } else {
+            search->scan_next = seq - 1;
+        }
+    }
+}
+
+// Restart the scan from the newest entry
+static void history_search_restart(history_search_t* search)
+{
+    search->match_count = 0;
+    search->current = 0;
+    search->scan_next = history.next_seq - 1;
+    search->scan_done = (history_count() == 0);
+}
+
+void history_search_begin(history_search_t* search)
+{
+    search->query[0] = '\0';
+    search->query_len = 0;
+    search->query_sig = 0;
+    history_search_restart(search);
+}
+
+/*
+ * Extend the query by one character
+ * Every match of the longer query is a match of the shorter one, so the
+ * known matches are filtered in place and only older entries are scanned
+ * Returns 0 if there is a match to show, -1 otherwise
+ */
+int history_search_push(history_search_t* search, char c)
+{
+    if (search->query_len >= HISTORY_SEARCH_QUERY_MAX - 1) return -1;
+
+    search->query[search->query_len++] = c;
+    search->query[search->query_len] = '\0';
+    search->query_sig = history_signature(search->query, search->query_len);
+
+    int kept = 0;
+    for (int i = 0; i < search->match_count; i++) {
+        if (history_search_matches(search, search->matches[i])) {
+            search->matches[kept++] = search->matches[i];
+        }
+    }
+    search->match_count = kept;
+    search->current = 0;
+
+    history_search_fill(search, 1);
+    return search->match_count > 0 ? 0 : -1;
+}
+
+/*
+ * Remove the last query character - the match set grows, so rescan
+ */
+int history_search_pop(history_search_t* search)
+{
+    if (search->query_len == 0) return -1;
+
+    search->query[--search->query_len] = '\0';
+    search->query_sig = history_signature(search->query, search->query_len);
+    history_search_restart(search);
+
+    if (search->query_len > 0) {
+        history_search_fill(search, 1);
+    }
+    return search->match_count > 0 ? 0 : -1;
+}
+
+/*
+ * Step to the next older match (Ctrl-R again)
+ */
+int history_search_older(history_search_t* search)
+{
+    if (search->query_len == 0) return -1;
+
+    history_search_fill(search, search->current + 2);
+    if (search->current + 1 < search->match_count) {
+        search->current++;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Copy the currently selected match; returns its length or -1
+ */
+int history_search_result(const history_search_t* search, char* dest, int max_size)
+{
+    if (search->query_len == 0 || search->current >= search->match_count) {
+        return -1;
+    }
+    return history_get(search->matches[search->current], dest, max_size);
+}
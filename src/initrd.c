@@ -0,0 +1,242 @@
+/*
+ * Initial Ramdisk Implementation
+ * newc cpio: each member is a 110-byte ASCII header ("070701" and
+ * thirteen 8-digit hex fields), the NUL-terminated path, then the data,
+ * with header+path and data each padded to 4 bytes. The archive ends at
+ * "TRAILER!!!". Paths are NUL-terminated in the archive, so the index
+ * keeps pointers to them as well as to the data.
+ */
+
+#include "initrd.h"
+#include "fdt.h"
+#include "page.h"
+#include "string.h"
+#include "uart.h"
+
+#define CPIO_HEADER_SIZE    110
+#define CPIO_FIELD_MODE     1               // Field indexes after the magic
+#define CPIO_FIELD_FILESIZE 6
+#define CPIO_FIELD_NAMESIZE 11
+
+static const uint8_t* archive = NULL;
+static size_t archive_size = 0;
+
+static initrd_file_t* files = NULL;
+static int file_count = 0;
+static int* buckets = NULL;                 // First file of each chain, -1 if none
+static uint32_t bucket_mask = 0;
+
+// FNV-1a over a path
+static uint32_t path_hash(const char* path, uint32_t len)
+{
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// Drop leading '/' and "./" so every spelling of a path indexes the same
+static const char* path_trim(const char* path)
+{
+    for (;;) {
+        if (path[0] == '/') {
+            path++;
+        } else if (path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            return path;
+        }
+    }
+}
+
+static size_t align4(size_t offset)
+{
+    return (offset + 3) & ~(size_t)3;
+}
+
+// One 8-digit hex header field; -1 if it is not hex
+static long cpio_field(const uint8_t* header, int field)
+{
+    const uint8_t* p = header + 6 + field * 8;
+    long value = 0;
+    for (int i = 0; i < 8; i++) {
+        uint8_t c = p[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return -1;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+/*
+ * Walk the archive; with 'out' set, record every member. Returns the
+ * member count, or -1 if the archive is malformed before its trailer.
+ */
+static int cpio_walk(initrd_file_t* out)
+{
+    size_t offset = 0;
+    int count = 0;
+
+    while (offset + CPIO_HEADER_SIZE <= archive_size) {
+        const uint8_t* header = archive + offset;
+        if (strncmp((const char*)header, "07070", 5) != 0 || (header[5] != '1' && header[5] != '2')) {
+            return -1;
+        }
+        long mode = cpio_field(header, CPIO_FIELD_MODE);
+        long size = cpio_field(header, CPIO_FIELD_FILESIZE);
+        long name_size = cpio_field(header, CPIO_FIELD_NAMESIZE);
+        if (mode < 0 || size < 0 || name_size < 1) {
+            return -1;
+        }
+
+        size_t name_offset = offset + CPIO_HEADER_SIZE;
+        size_t data_offset = align4(name_offset + name_size);
+        if (data_offset > archive_size || (size_t)size > archive_size - data_offset) {
+            return -1;
+        }
+        const char* name = (const char*)archive + name_offset;
+        if (name[name_size - 1] != '\0') {
+            return -1;
+        }
+        if (strcmp(name, "TRAILER!!!") == 0) {
+            return count;
+        }
+
+        const char* path = path_trim(name);
+        if (*path && strcmp(path, ".") != 0) {
+            if (out) {
+                initrd_file_t* f = &out[count];
+                f->path = path;
+                f->path_len = strlen(path);
+                f->mode = mode;
+                f->data = archive + data_offset;
+                f->size = size;
+                f->hash = path_hash(path, f->path_len);
+                f->next = -1;
+            }
+            count++;
+        }
+        offset = align4(data_offset + size);
+    }
+    return -1;
+}
+
+void initrd_init(void)
+{
+    uint64_t start, end;
+    if (fdt_initrd(&start, &end) != 0) {
+        return;
+    }
+    archive = (const uint8_t*)(uintptr_t)start;
+    archive_size = end - start;
+
+    int count = cpio_walk(NULL);
+    if (count < 0) {
+        printf("initrd: %lu bytes at %x are not a newc cpio archive\n",
+               (unsigned long)archive_size, (unsigned long)start);
+        archive = NULL;
+        return;
+    }
+
+    // Buckets: a power of two, at least twice the file count
+    uint32_t bucket_count = 16;
+    while (bucket_count < (uint32_t)count * 2) {
+        bucket_count *= 2;
+    }
+    size_t bytes = count * sizeof(initrd_file_t) + bucket_count * sizeof(int);
+    uint8_t* mem = page_alloc((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!mem) {
+        printf("initrd: no memory for an index of %d files\n", count);
+        archive = NULL;
+        return;
+    }
+    buckets = (int*)mem;
+    files = (initrd_file_t*)(mem + bucket_count * sizeof(int));
+    bucket_mask = bucket_count - 1;
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        buckets[i] = -1;
+    }
+
+    file_count = cpio_walk(files);
+    for (int i = 0; i < file_count; i++) {
+        uint32_t b = files[i].hash & bucket_mask;
+        files[i].next = buckets[b];
+        buckets[b] = i;
+    }
+
+    printf("initrd: %d files, %lu KB at %x\n", file_count,
+           (unsigned long)(archive_size + 1023) / 1024, (unsigned long)start);
+}
+
+int initrd_present(void)
+{
+    return archive != NULL;
+}
+
+const initrd_file_t* initrd_lookup(const char* path)
+{
+    if (!archive) {
+        return NULL;
+    }
+    path = path_trim(path);
+    uint32_t len = strlen(path);
+    while (len > 0 && path[len - 1] == '/') {
+        len--;
+    }
+    uint32_t hash = path_hash(path, len);
+
+    for (int i = buckets[hash & bucket_mask]; i >= 0; i = files[i].next) {
+        const initrd_file_t* f = &files[i];
+        if (f->hash == hash && f->path_len == len && strncmp(f->path, path, len) == 0) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+int initrd_count(void)
+{
+    return file_count;
+}
+
+const initrd_file_t* initrd_file(int index)
+{
+    return (index >= 0 && index < file_count) ? &files[index] : NULL;
+}
+
+void initrd_print(void)
+{
+    if (!archive) {
+        puts("No initrd (boot with ./run.sh -initrd <archive.cpio>)");
+        return;
+    }
+
+    // Longest hash chain, to show the index is doing its job
+    int longest = 0;
+    for (uint32_t b = 0; b <= bucket_mask; b++) {
+        int length = 0;
+        for (int i = buckets[b]; i >= 0; i = files[i].next) {
+            length++;
+        }
+        if (length > longest) {
+            longest = length;
+        }
+    }
+    printf("initrd at %x, %lu bytes: %d files, %u hash buckets, longest chain %d\n",
+           (unsigned long)(uintptr_t)archive, (unsigned long)archive_size,
+           file_count, bucket_mask + 1, longest);
+
+    puts("Type  Size        Path");
+    for (int i = 0; i < file_count; i++) {
+        const initrd_file_t* f = &files[i];
+        uint32_t type = f->mode & INITRD_MODE_TYPE;
+        printf("%s  ", type == INITRD_MODE_DIR ? "dir " : type == INITRD_MODE_FILE ? "file" : "-   ");
+        print_uint_padded(f->size, 12);
+        printf("%s\n", f->path);
+    }
+}
@@ -0,0 +1,479 @@
+/*
+ * I/O Scheduler Implementation
+ * Queued device requests sit on two lists: by start sector for the
+ * elevator and by arrival for deadlines. The lock is never held while
+ * calling into the driver, since completions come back through it.
+ */
+
+#include "iosched.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+#include "virtio_blk.h"
+
+// A device request being built from merged I/Os, queued or in flight
+typedef struct sched_req {
+    blk_request_t blk;
+    int type;
+    uint64_t sector;                        // First sector
+    uint64_t end;                           // One past the last
+    uint32_t bytes;
+    int count;                              // I/Os, one segment each
+    io_t* head;                             // I/Os in sector order
+    io_t* tail;
+    uint64_t deadline;
+    struct sched_req* sort_prev;
+    struct sched_req* sort_next;
+    struct sched_req* fifo_prev;
+    struct sched_req* fifo_next;
+} sched_req_t;
+
+static spinlock_t iosched_lock;
+static int ready = 0;
+
+static sched_req_t requests[IOSCHED_REQUESTS];
+static sched_req_t* free_requests = NULL;   // Linked through sort_next
+static sched_req_t* sorted = NULL;
+static sched_req_t* fifo_head = NULL;
+static sched_req_t* fifo_tail = NULL;
+static int queued = 0;
+static int in_flight = 0;
+static int depth = 0;                       // Most requests in flight
+static int plugged = 0;
+static int stalled = 0;                     // Device queue was full at dispatch
+static uint64_t head_pos = 0;               // Sector after the last dispatch
+static int max_segments = 0;
+static uint64_t read_expire = 0;            // Ticks
+static uint64_t write_expire = 0;
+static iosched_stats_t stats;
+
+// --- Queue ---
+
+static void sort_insert(sched_req_t* r)
+{
+    sched_req_t* prev = NULL;
+    sched_req_t* next = sorted;
+    while (next && next->sector <= r->sector) {
+        prev = next;
+        next = next->sort_next;
+    }
+    r->sort_prev = prev;
+    r->sort_next = next;
+    if (prev) {
+        prev->sort_next = r;
+    } else {
+        sorted = r;
+    }
+    if (next) next->sort_prev = r;
+}
+
+static void sort_remove(sched_req_t* r)
+{
+    if (r->sort_prev) {
+        r->sort_prev->sort_next = r->sort_next;
+    } else {
+        sorted = r->sort_next;
+    }
+    if (r->sort_next) r->sort_next->sort_prev = r->sort_prev;
+}
+
+static void fifo_remove(sched_req_t* r)
+{
+    if (r->fifo_prev) {
+        r->fifo_prev->fifo_next = r->fifo_next;
+    } else {
+        fifo_head = r->fifo_next;
+    }
+    if (r->fifo_next) {
+        r->fifo_next->fifo_prev = r->fifo_prev;
+    } else {
+        fifo_tail = r->fifo_prev;
+    }
+}
+
+static void queue_insert(sched_req_t* r)
+{
+    sort_insert(r);
+    r->fifo_next = NULL;
+    r->fifo_prev = fifo_tail;
+    if (fifo_tail) {
+        fifo_tail->fifo_next = r;
+    } else {
+        fifo_head = r;
+    }
+    fifo_tail = r;
+
+    queued++;
+    if ((unsigned long)queued > stats.max_queued) stats.max_queued = queued;
+}
+
+static void queue_remove(sched_req_t* r)
+{
+    sort_remove(r);
+    fifo_remove(r);
+    queued--;
+}
+
+static void request_free(sched_req_t* r)
+{
+    r->sort_next = free_requests;
+    free_requests = r;
+}
+
+// --- Merging ---
+
+static int fits(const sched_req_t* r, int type, int count, uint32_t bytes)
+{
+    return r->type == type && r->count + count <= max_segments &&
+           r->bytes + bytes <= IOSCHED_MAX_BYTES;
+}
+
+/*
+ * Join 'b' onto the end of 'a' if a merge made them adjacent. The joined
+ * request keeps the earlier deadline and that one's place in the FIFO.
+ */
+static void try_join(sched_req_t* a, sched_req_t* b)
+{
+    if (!a || !b || a->end != b->sector || !fits(a, b->type, b->count, b->bytes)) return;
+
+    a->tail->next = b->head;
+    a->tail = b->tail;
+    a->end = b->end;
+    a->bytes += b->bytes;
+    a->count += b->count;
+
+    sort_remove(b);
+    if (b->deadline < a->deadline) {
+        // 'a' takes over b's FIFO slot
+        a->deadline = b->deadline;
+        fifo_remove(a);
+        a->fifo_prev = b->fifo_prev;
+        a->fifo_next = b->fifo_next;
+        if (a->fifo_prev) {
+            a->fifo_prev->fifo_next = a;
+        } else {
+            fifo_head = a;
+        }
+        if (a->fifo_next) {
+            a->fifo_next->fifo_prev = a;
+        } else {
+            fifo_tail = a;
+        }
+    } else {
+        fifo_remove(b);
+    }
+    queued--;
+    request_free(b);
+    stats.request_merges++;
+}
+
+// Add an I/O to a queued request it extends at either end; 1 if merged
+static int merge(io_t* io)
+{
+    uint64_t io_end = io->sector + io->len / BLK_SECTOR_SIZE;
+
+    for (sched_req_t* r = sorted; r && r->sector <= io_end; r = r->sort_next) {
+        if (!fits(r, io->type, 1, io->len)) continue;
+
+        if (r->end == io->sector) {
+            r->tail->next = io;
+            r->tail = io;
+            r->end = io_end;
+            r->bytes += io->len;
+            r->count++;
+            stats.back_merges++;
+            try_join(r, r->sort_next);
+            return 1;
+        }
+        if (r->sector == io_end) {
+            io->next = r->head;
+            r->head = io;
+            r->sector = io->sector;
+            r->bytes += io->len;
+            r->count++;
+            stats.front_merges++;
+            sort_remove(r);
+            sort_insert(r);
+            try_join(r->sort_prev, r);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// --- Dispatch and completion ---
+
+// Expired deadline first, otherwise the next request up from the head
+static sched_req_t* pick(void)
+{
+    if (timer_ticks() >= fifo_head->deadline) {
+        stats.expired++;
+        return fifo_head;
+    }
+    for (sched_req_t* r = sorted; r; r = r->sort_next) {
+        if (r->sector >= head_pos) return r;
+    }
+    return sorted;                          // Wrap around to the lowest sector
+}
+
+static void finish(sched_req_t* r, int status)
+{
+    uint64_t now = timer_ticks();
+    io_t* io = r->head;
+
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    unsigned long* hist = r->type == BLK_READ ? stats.read_hist : stats.write_hist;
+    for (io_t* i = io; i; i = i->next) {
+        uint64_t us = timer_ticks_to_us(now - i->queued);
+        int bucket = 0;
+        for (uint64_t v = us >> 4; v && bucket < IOSCHED_HIST_BUCKETS - 1; v >>= 1) bucket++;
+        hist[bucket]++;
+    }
+    if (status != BLK_OK) stats.errors++;
+    in_flight--;
+    request_free(r);
+    spin_unlock_irqrestore(&iosched_lock, flags);
+
+    // The owner may reuse an I/O as soon as its status is set
+    while (io) {
+        io_t* next = io->next;
+        io_done_fn_t done = io->done;
+        io->status = status;
+        if (done) done(io);
+        io = next;
+    }
+}
+
+static void dispatch(int force);
+
+// Device completion: finish the I/Os, then refill the device queue
+static void request_done(blk_request_t* blk)
+{
+    finish(blk->priv, blk->status);
+    dispatch(0);
+}
+
+/*
+ * Move queued requests to the device, up to 'depth' in flight, as one
+ * batch with one doorbell. 'force' ignores the plug.
+ */
+static void dispatch(int force)
+{
+    blk_request_t* batch[IOSCHED_REQUESTS];
+    int count = 0;
+
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    stalled = 0;
+    if (plugged && !force) {
+        spin_unlock_irqrestore(&iosched_lock, flags);
+        return;
+    }
+    while (queued > 0 && in_flight < depth) {
+        sched_req_t* r = pick();
+        queue_remove(r);
+        in_flight++;
+        head_pos = r->end;
+
+        blk_request_t* blk = &r->blk;
+        blk->type = r->type;
+        blk->sector = r->sector;
+        blk->segment_count = 0;
+        for (io_t* io = r->head; io; io = io->next) {
+            blk->segments[blk->segment_count].addr = io->buf;
+            blk->segments[blk->segment_count].len = io->len;
+            blk->segment_count++;
+        }
+        blk->done = request_done;
+        blk->priv = r;
+        batch[count++] = blk;
+    }
+    stats.requests += count;
+    spin_unlock_irqrestore(&iosched_lock, flags);
+
+    if (count == 0) return;
+    int accepted = blk_submit(batch, count);
+    if (accepted == count) return;
+
+    if (accepted < 0) {
+        for (int i = 0; i < count; i++) {
+            finish(batch[i]->priv, BLK_ERROR);
+        }
+        return;
+    }
+
+    // The device queue is shared with direct users: requeue the rest
+    flags = spin_lock_irqsave(&iosched_lock);
+    for (int i = accepted; i < count; i++) {
+        queue_insert(batch[i]->priv);
+        in_flight--;
+    }
+    stats.requests -= count - accepted;
+    stalled = 1;
+    spin_unlock_irqrestore(&iosched_lock, flags);
+}
+
+// --- Interface ---
+
+void iosched_init(void)
+{
+    spin_lock_init(&iosched_lock, "iosched");
+
+    if (!blk_present()) return;
+
+    max_segments = blk_max_segments();
+    depth = blk_max_depth(max_segments);
+    if (depth > IOSCHED_REQUESTS) depth = IOSCHED_REQUESTS;
+    if (depth < 1) depth = 1;
+    read_expire = timer_ms_to_ticks(IOSCHED_READ_EXPIRE_MS);
+    write_expire = timer_ms_to_ticks(IOSCHED_WRITE_EXPIRE_MS);
+
+    for (int i = 0; i < IOSCHED_REQUESTS; i++) {
+        request_free(&requests[i]);
+    }
+    ready = 1;
+}
+
+int io_submit(io_t* io)
+{
+    if (!ready) return -1;
+    if (io->type != BLK_READ && io->type != BLK_WRITE) return -1;
+    if (io->type == BLK_WRITE && blk_read_only()) return -1;
+    if (io->len == 0 || io->len % BLK_SECTOR_SIZE || io->len > blk_max_segment_size()) return -1;
+    if (io->sector + io->len / BLK_SECTOR_SIZE > blk_capacity()) return -1;
+
+    io->status = BLK_PENDING;
+    io->queued = timer_ticks();
+    io->next = NULL;
+
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    stats.ios++;
+    if (!merge(io)) {
+        while (!free_requests) {
+            // Every request is queued or in flight: push some out
+            spin_unlock_irqrestore(&iosched_lock, flags);
+            dispatch(1);
+            blk_poll();
+            thread_yield();
+            flags = spin_lock_irqsave(&iosched_lock);
+        }
+
+        sched_req_t* r = free_requests;
+        free_requests = r->sort_next;
+        r->type = io->type;
+        r->sector = io->sector;
+        r->end = io->sector + io->len / BLK_SECTOR_SIZE;
+        r->bytes = io->len;
+        r->count = 1;
+        r->head = r->tail = io;
+        r->deadline = io->queued + (io->type == BLK_READ ? read_expire : write_expire);
+        queue_insert(r);
+    }
+    spin_unlock_irqrestore(&iosched_lock, flags);
+
+    dispatch(0);
+    return 0;
+}
+
+static int io_finished(void* arg)
+{
+    return ((io_t*)arg)->status != BLK_PENDING || stalled;
+}
+
+int io_wait(io_t* io)
+{
+    while (io->status == BLK_PENDING) {
+        dispatch(0);
+        if (stalled) {
+            // Only completions of other device users can make room
+            blk_poll();
+            thread_yield();
+            continue;
+        }
+        blk_wait_event(io_finished, io);
+    }
+    return io->status;
+}
+
+void iosched_plug(void)
+{
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    plugged++;
+    stats.plugs++;
+    spin_unlock_irqrestore(&iosched_lock, flags);
+}
+
+void iosched_unplug(void)
+{
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    plugged--;
+    int now = plugged == 0;
+    spin_unlock_irqrestore(&iosched_lock, flags);
+
+    if (now) dispatch(0);
+}
+
+const iosched_stats_t* iosched_stats(void)
+{
+    return &stats;
+}
+
+static void print_histogram(const char* title, const unsigned long* hist)
+{
+    unsigned long total = 0;
+    unsigned long most = 0;
+    for (int i = 0; i < IOSCHED_HIST_BUCKETS; i++) {
+        total += hist[i];
+        if (hist[i] > most) most = hist[i];
+    }
+    printf("  %s latency (%lu I/Os):\n", title, total);
+    if (total == 0) return;
+
+    for (int i = 0; i < IOSCHED_HIST_BUCKETS; i++) {
+        if (hist[i] == 0) continue;
+        if (i == 0) {
+            printf("    <16 us       ");
+        } else {
+            printf("    >=");
+            print_uint_padded(16UL << (i - 1), 8);
+            printf("us ");
+        }
+        print_uint_padded(hist[i], 9);
+        for (unsigned long n = (hist[i] * 40 + most - 1) / most; n; n--) putchar('#');
+        putchar('\n');
+    }
+}
+
+void iosched_print(void)
+{
+    if (!ready) {
+        puts("No I/O scheduler (no virtio-blk disk)");
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    iosched_stats_t s = stats;
+    int now_queued = queued, now_in_flight = in_flight, now_plugged = plugged;
+    spin_unlock_irqrestore(&iosched_lock, flags);
+
+    unsigned long ratio = s.requests ? s.ios * 10 / s.requests : 0;
+
+    printf("I/O scheduler: %d in flight at most, requests up to %d KB in %d segments\n",
+           depth, IOSCHED_MAX_BYTES / 1024, max_segments);
+    printf("  Deadlines: read %d ms, write %d ms; %lu dispatched out of LBA order\n",
+           IOSCHED_READ_EXPIRE_MS, IOSCHED_WRITE_EXPIRE_MS, s.expired);
+    printf("  Now: %d queued, %d in flight, plug depth %d (most queued %lu, %lu plugs)\n",
+           now_queued, now_in_flight, now_plugged, s.max_queued, s.plugs);
+    printf("  %lu I/Os in %lu requests (%lu.%lu per request): %lu back merges, %lu front, %lu joins\n",
+           s.ios, s.requests, ratio / 10, ratio % 10, s.back_merges, s.front_merges, s.request_merges);
+    printf("  Errors: %lu\n", s.errors);
+    print_histogram("Read", s.read_hist);
+    print_histogram("Write", s.write_hist);
+}
+
+void iosched_reset_stats(void)
+{
+    unsigned long flags = spin_lock_irqsave(&iosched_lock);
+    memset(&stats, 0, sizeof(stats));
+    spin_unlock_irqrestore(&iosched_lock, flags);
+}
@@ -0,0 +1,290 @@
+/*
+ * Inter-Processor Interrupts Implementation
+ * A remote call is a descriptor queued on each target's per-CPU MPMC
+ * queue, followed by one SGI to all targets. The descriptor counts the
+ * targets still running it: a synchronous caller keeps it on its stack
+ * and waits for zero, an asynchronous one allocates it and the last
+ * target frees it.
+ */
+
+#include "ipi.h"
+#include "atomic.h"
+#include "gic.h"
+#include "irq.h"
+#include "kmalloc.h"
+#include "percpu.h"
+#include "smp.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+typedef struct {
+    smp_call_func_t func;
+    void* arg;
+    volatile uint64_t pending;  // Targets that have not finished yet
+    int async;                  // Freed by the last target
+} smp_call_t;
+
+static inline void cpu_relax(void)
+{
+    __asm__ volatile("yield" ::: "memory");
+}
+
+static void ipi_handler(unsigned int irq)
+{
+    percpu_t* area = percpu_this();
+    if (irq < IPI_COUNT) area->ipi_received[irq]++;
+
+    if (irq == IPI_RESCHEDULE) {
+        thread_need_resched();
+    } else {
+        smp_call_process();
+    }
+}
+
+void ipi_init(void)
+{
+    for (int ipi = 0; ipi < IPI_COUNT; ipi++) {
+        irq_register(ipi, ipi_handler);
+    }
+}
+
+void ipi_cpu_init(void)
+{
+    // SGI enables are banked per CPU
+    for (int ipi = 0; ipi < IPI_COUNT; ipi++) {
+        gic_enable(ipi);
+    }
+}
+
+void ipi_send_mask(uint32_t cpu_mask, int ipi)
+{
+    if (cpu_mask == 0) return;
+
+    unsigned long flags = irq_save();
+    gic_send_sgi((unsigned int)ipi, cpu_mask);
+    percpu_this()->ipi_sent++;
+    irq_restore(flags);
+}
+
+void ipi_send(int cpu, int ipi)
+{
+    if (cpu < 0 || cpu >= SMP_MAX_CPUS) return;
+    ipi_send_mask(1U << cpu, ipi);
+}
+
+void smp_call_process(void)
+{
+    percpu_t* area = percpu_this();
+    uint64_t item;
+
+    while (mpmc_dequeue(&area->call_queue, &item) == 0) {
+        smp_call_t* call = (smp_call_t*)item;
+        int async = call->async;   // The descriptor may be gone after the decrement
+
+        call->func(call->arg);
+        area->calls_run++;
+
+        if (atomic_fetch_add64(&call->pending, (uint64_t)-1) == 1 && async) {
+            kfree(call);
+        }
+    }
+}
+
+int smp_call_function_many(uint32_t cpu_mask, smp_call_func_t func, void* arg, int wait)
+{
+    if (!func) return -1;
+
+    unsigned long flags = irq_save();
+    int self = smp_cpu_id();
+    int run_local = (cpu_mask >> self) & 1;
+    cpu_mask &= ~(1U << self);
+
+    int remote = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!((cpu_mask >> cpu) & 1)) continue;
+        if (!smp_cpu_online(cpu) || !gic_present()) {
+            irq_restore(flags);
+            return -1;
+        }
+        remote++;
+    }
+
+    smp_call_t local_call;
+    smp_call_t* call = NULL;
+    if (remote > 0) {
+        call = wait ? &local_call : kmalloc(sizeof(smp_call_t));
+        if (!call) {
+            irq_restore(flags);
+            return -1;
+        }
+        call->func = func;
+        call->arg = arg;
+        call->pending = (uint64_t)remote;
+        call->async = !wait;
+
+        for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if (!((cpu_mask >> cpu) & 1)) continue;
+
+            // A full queue drains once its CPU takes our earlier IPI;
+            // serve our own queue meanwhile in case it is calling us
+            while (mpmc_enqueue(&percpu_of(cpu)->call_queue, (uint64_t)call) != 0) {
+                smp_call_process();
+                cpu_relax();
+            }
+        }
+        ipi_send_mask(cpu_mask, IPI_CALL_FUNC);
+    }
+
+    if (run_local) func(arg);
+
+    if (call && wait) {
+        while (atomic_load_acquire(&call->pending) != 0) {
+            smp_call_process();
+            cpu_relax();
+        }
+    }
+
+    irq_restore(flags);
+    return 0;
+}
+
+int smp_call_function(int cpu, smp_call_func_t func, void* arg, int wait)
+{
+    if (cpu < 0 || cpu >= SMP_MAX_CPUS) return -1;
+    return smp_call_function_many(1U << cpu, func, arg, wait);
+}
+
+// --- Shootdowns ---
+// The MMU and caches are still off, so these invalidate nothing today;
+// they are the hooks page table edits and code loading will call
+
+static void tlb_flush_local(void* arg)
+{
+    (void)arg;
+    __asm__ volatile("dsb ishst\n tlbi vmalle1\n dsb ish\n isb" ::: "memory");
+}
+
+static void icache_flush_local(void* arg)
+{
+    (void)arg;
+    __asm__ volatile("ic iallu\n dsb ish\n isb" ::: "memory");
+}
+
+static uint32_t online_mask(void)
+{
+    uint32_t mask = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (smp_cpu_online(cpu)) mask |= 1U << cpu;
+    }
+    return mask;
+}
+
+void smp_tlb_shootdown(void)
+{
+    uint32_t mask = gic_present() ? online_mask() : 1U << smp_cpu_id();
+    smp_call_function_many(mask, tlb_flush_local, NULL, 1);
+}
+
+void smp_icache_shootdown(void)
+{
+    uint32_t mask = gic_present() ? online_mask() : 1U << smp_cpu_id();
+    smp_call_function_many(mask, icache_flush_local, NULL, 1);
+}
+
+// --- Benchmark ---
+
+static volatile uint32_t bench_busy;    // A run is in progress
+
+static volatile uint64_t bench_calls_done;
+static unsigned long bench_count;
+static volatile uint32_t bench_pinned;
+
+static void bench_noop(void* arg)
+{
+    (void)arg;
+}
+
+static void bench_count_call(void* arg)
+{
+    (void)arg;
+    atomic_fetch_add64(&bench_calls_done, 1);
+}
+
+// Runs pinned to CPU 0 so every target is measured from the same place
+static void bench_thread(void* arg)
+{
+    (void)arg;
+    while (!atomic_load_acquire(&bench_pinned) || smp_cpu_id() != 0) {
+        thread_yield();
+    }
+
+    puts("TARGET  SYNC RTT(ns)  ASYNC(calls/s)");
+    for (int cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) continue;
+
+        // Synchronous: IPI out, function runs, completion seen back here
+        uint64_t start = timer_ticks();
+        for (unsigned long i = 0; i < bench_count; i++) {
+            smp_call_function(cpu, bench_noop, NULL, 1);
+        }
+        uint64_t sync_ns = timer_ticks_to_ns(timer_ticks() - start);
+
+        // Asynchronous: queue them all, then wait for the last one
+        bench_calls_done = 0;
+        start = timer_ticks();
+        unsigned long queued = 0;
+        for (unsigned long i = 0; i < bench_count; i++) {
+            if (smp_call_function(cpu, bench_count_call, NULL, 0) == 0) queued++;
+        }
+        while (atomic_load_acquire(&bench_calls_done) < queued) {
+            cpu_relax();
+        }
+        uint64_t async_ns = timer_ticks_to_ns(timer_ticks() - start);
+
+        printf("CPU %d   ", cpu);
+        print_uint_padded((unsigned long)(sync_ns / bench_count), 14);
+        printf("%lu\n", async_ns ? (unsigned long)(queued * 1000000000UL / async_ns) : 0);
+    }
+}
+
+/*
+ * Remote call cost from CPU 0 to every other online CPU: 'count'
+ * synchronous round trips, then 'count' asynchronous calls
+ */
+static void ipi_bench_run(unsigned long count)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+    if (!gic_present() || smp_cpus_online() < 2) {
+        puts("IPI benchmark needs the GIC and at least 2 online CPUs");
+        return;
+    }
+
+    puts("=== IPI Benchmark ===");
+    printf("Calls per target: %lu, from CPU 0\n\n", count);
+
+    bench_count = count;
+    bench_pinned = 0;
+    int id = thread_create("ipi-bench", bench_thread, NULL, 1);
+    if (id < 0) {
+        puts("Error: could not create benchmark thread");
+        return;
+    }
+    thread_set_affinity(id, 1U << 0);
+    atomic_store_release(&bench_pinned, 1);
+    thread_join(id);
+}
+
+void ipi_bench(unsigned long count)
+{
+    // One completion counter serves the whole run: one run at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("IPI benchmark already running");
+        return;
+    }
+    ipi_bench_run(count);
+    atomic_store_release(&bench_busy, 0);
+}
@@ -0,0 +1,129 @@
+/*
+ * Exceptions and Interrupts Implementation
+ * irq_handle() is entered from boot/vectors.S with IRQs masked and the
+ * interrupted registers saved on the current stack
+ */
+
+#include "irq.h"
+#include "gic.h"
+#include "semihost.h"
+#include "thread.h"
+#include "uart.h"
+
+// Vector table in boot/vectors.S
+extern uint8_t exception_vectors[];
+
+// Saved registers (layout shared with boot/vectors.S)
+typedef struct {
+    uint64_t x[31];
+    uint64_t elr;
+    uint64_t spsr;
+} exception_frame_t;
+
+static irq_handler_t handlers[IRQ_MAX];
+static unsigned long counts[IRQ_MAX];
+
+void irq_init(void)
+{
+    __asm__ volatile("msr vbar_el1, %0\n isb" :: "r"(exception_vectors) : "memory");
+}
+
+int irq_register(unsigned int irq, irq_handler_t handler)
+{
+    if (irq >= IRQ_MAX) return -1;
+    handlers[irq] = handler;
+    return 0;
+}
+
+unsigned long irq_count(unsigned int irq)
+{
+    return irq < IRQ_MAX ? counts[irq] : 0;
+}
+
+/*
+ * Called from irq_entry for every IRQ exception
+ * Handlers run with the interrupt already completed at the GIC, so a
+ * handler that asks for a reschedule does not hold the line active
+ * while another thread runs
+ */
+void irq_handle(void)
+{
+    while (1) {
+        unsigned int iar = gic_acknowledge();
+        unsigned int irq = iar & GIC_IAR_ID_MASK;
+        if (irq >= GIC_SPURIOUS) break;
+
+        if (irq < IRQ_MAX) {
+            counts[irq]++;
+            if (handlers[irq]) {
+                handlers[irq](irq);
+            }
+        }
+        gic_end_of_interrupt(iar);
+    }
+
+    // Preempt the interrupted thread if a handler asked for it
+    thread_irq_exit();
+}
+
+// Vector table slot: four exception types for each of four sources
+static const char* exception_type(unsigned long kind)
+{
+    switch (kind & 3) {
+    case 0:  return "sync";
+    case 1:  return "irq";
+    case 2:  return "fiq";
+    default: return "serror";
+    }
+}
+
+static const char* exception_source(unsigned long kind)
+{
+    switch (kind >> 2) {
+    case 0:  return "EL1t";
+    case 1:  return "EL1h";
+    case 2:  return "EL0/64";
+    case 3:  return "EL0/32";
+    default: return "unknown";
+    }
+}
+
+#define ESR_CLASS_UNKNOWN 0x00                 // Undefined instruction
+
+/*
+ * Synchronous exception from EL1 that can be recovered from; returns 1
+ * with the frame adjusted to resume, 0 to report it
+ * A semihosting HLT without -semihosting is undefined: skip it and fail
+ * the call with -1, so semihosting can be probed safely
+ */
+int exception_fixup(exception_frame_t* frame)
+{
+    uint64_t esr;
+    __asm__ volatile("mrs %0, esr_el1" : "=r"(esr));
+
+    if ((esr >> 26) == ESR_CLASS_UNKNOWN && *(uint32_t*)frame->elr == SEMIHOST_HLT_INSN) {
+        frame->x[0] = (uint64_t)-1;
+        frame->elr += 4;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Unexpected exception - print what we know and halt this CPU
+ */
+void exception_report(unsigned long kind, exception_frame_t* frame)
+{
+    uint64_t esr, far;
+    __asm__ volatile("mrs %0, esr_el1" : "=r"(esr));
+    __asm__ volatile("mrs %0, far_el1" : "=r"(far));
+
+    puts("");
+    printf("*** Unhandled exception: %s (%s) ***\n", exception_type(kind), exception_source(kind));
+    printf("ESR_EL1:  %x (class %x)\n", esr, esr >> 26);
+    printf("ELR_EL1:  %x\n", frame->elr);
+    printf("FAR_EL1:  %x\n", far);
+    printf("SPSR_EL1: %x\n", frame->spsr);
+    printf("LR:       %x\n", frame->x[30]);
+    puts("CPU halted");
+}
@@ -0,0 +1,301 @@
+/*
+ * Background Jobs Implementation
+ * Job slots belong to the shell thread, which starts, follows and
+ * releases them; the job's thread only appends output and finally
+ * records its result. Both sides meet under the per-job lock.
+ */
+
+#include "jobs.h"
+#include "atomic.h"
+#include "cancel.h"
+#include "spinlock.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+typedef enum {
+    JOB_FREE = 0,
+    JOB_RUNNING,
+    JOB_DONE
+} job_state_t;
+
+typedef struct {
+    spinlock_t lock;            // Output ring, state and result
+    volatile uint32_t state;    // job_state_t
+    volatile uint32_t cancel;   // The job's Ctrl-C flag (set by fg)
+    int thread;
+    int joined;                 // Thread collected with thread_join()
+    int notified;               // Completion already announced
+    int status;                 // Command result
+    unsigned long sequence;     // Start order, for the default fg job
+    uint64_t started;
+    uint64_t ended;
+
+    command_handler_t handler;
+    token_result_t tokens;      // Private copy: argv points into it
+    char line[JOB_LINE_MAX];
+
+    // Output ring: bytes [tail, head) are waiting to be printed
+    char output[JOB_OUTPUT_SIZE];
+    size_t head;
+    size_t tail;
+    unsigned long dropped;
+    unsigned long dropped_shown;
+} job_t;
+
+static job_t jobs[JOB_MAX];
+static unsigned long job_sequence = 0;
+
+void jobs_init(void)
+{
+    for (int i = 0; i < JOB_MAX; i++) {
+        spin_lock_init_indexed(&jobs[i].lock, "job", i + 1);
+    }
+}
+
+static job_t* job_get(int number)
+{
+    if (number < 1 || number > JOB_MAX) return NULL;
+    job_t* job = &jobs[number - 1];
+    return atomic_load_acquire(&job->state) == JOB_FREE ? NULL : job;
+}
+
+// Output sink of the job's threads (called from their putchar)
+static void job_output(void* arg, char c)
+{
+    job_t* job = arg;
+
+    unsigned long flags = spin_lock_irqsave(&job->lock);
+    if (job->head - job->tail == JOB_OUTPUT_SIZE) {
+        job->tail++;
+        job->dropped++;
+    }
+    job->output[job->head % JOB_OUTPUT_SIZE] = c;
+    job->head++;
+    spin_unlock_irqrestore(&job->lock, flags);
+}
+
+static void job_main(void* arg)
+{
+    job_t* job = arg;
+
+    thread_redirect(job_output, job, &job->cancel);
+    int status = job->handler(job->tokens.argc, job->tokens.argv);
+
+    unsigned long flags = spin_lock_irqsave(&job->lock);
+    job->status = status;
+    job->ended = timer_ticks();
+    atomic_store_release(&job->state, JOB_DONE);
+    spin_unlock_irqrestore(&job->lock, flags);
+}
+
+int job_start(command_handler_t handler, const token_result_t* tokens)
+{
+    if (!handler || !tokens || tokens->argc == 0) return -1;
+
+    job_t* job = NULL;
+    for (int i = 0; i < JOB_MAX; i++) {
+        if (atomic_load_acquire(&jobs[i].state) == JOB_FREE) {
+            job = &jobs[i];
+            break;
+        }
+    }
+    if (!job) return -1;
+
+    job->handler = handler;
+    job->tokens = *tokens;
+    int pos = 0;
+    for (int i = 0; i < job->tokens.argc; i++) {
+        job->tokens.argv[i] = job->tokens.tokens[i];
+        for (const char* p = job->tokens.tokens[i]; *p && pos < JOB_LINE_MAX - 1; p++) {
+            job->line[pos++] = *p;
+        }
+        if (i + 1 < job->tokens.argc && pos < JOB_LINE_MAX - 1) job->line[pos++] = ' ';
+    }
+    job->line[pos] = '\0';
+
+    job->cancel = 0;
+    job->joined = 0;
+    job->notified = 0;
+    job->status = 0;
+    job->head = 0;
+    job->tail = 0;
+    job->dropped = 0;
+    job->dropped_shown = 0;
+    job->sequence = ++job_sequence;
+    job->started = timer_ticks();
+    job->ended = 0;
+    atomic_store_release(&job->state, JOB_RUNNING);
+
+    // Named after the command so ps shows what it is
+    job->thread = thread_create(job->tokens.argv[0], job_main, job, JOB_STACK_PAGES);
+    if (job->thread < 0) {
+        atomic_store_release(&job->state, JOB_FREE);
+        return -1;
+    }
+    return (int)(job - jobs) + 1;
+}
+
+// Held job with the lowest (oldest) or highest (latest) start order
+static int job_by_order(int latest)
+{
+    int number = 0;
+    unsigned long best = 0;
+
+    for (int i = 0; i < JOB_MAX; i++) {
+        if (atomic_load_acquire(&jobs[i].state) == JOB_FREE) continue;
+        unsigned long seq = jobs[i].sequence;
+        if (number == 0 || (latest ? seq > best : seq < best)) {
+            best = seq;
+            number = i + 1;
+        }
+    }
+    return number;
+}
+
+int job_latest(void)
+{
+    return job_by_order(1);
+}
+
+int job_oldest(void)
+{
+    return job_by_order(0);
+}
+
+// Print whatever the job has buffered so far
+static void job_drain(job_t* job)
+{
+    char chunk[128];
+    size_t n;
+
+    do {
+        unsigned long flags = spin_lock_irqsave(&job->lock);
+        unsigned long dropped = job->dropped - job->dropped_shown;
+        job->dropped_shown = job->dropped;
+        n = job->head - job->tail;
+        if (n > sizeof(chunk)) n = sizeof(chunk);
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = job->output[(job->tail + i) % JOB_OUTPUT_SIZE];
+        }
+        job->tail += n;
+        spin_unlock_irqrestore(&job->lock, flags);
+
+        if (dropped) {
+            printf("[... %lu bytes of output lost ...]\n", dropped);
+        }
+        for (size_t i = 0; i < n; i++) {
+            putchar(chunk[i]);
+        }
+    } while (n);
+}
+
+// The command has returned: collect its thread once
+static void job_reap(job_t* job)
+{
+    if (!job->joined) {
+        thread_join(job->thread);
+        job->joined = 1;
+    }
+}
+
+int job_follow(int number, int forward_cancel, int* status)
+{
+    job_t* job = job_get(number);
+    if (!job) return -1;
+
+    printf("[%d] %s\n", number, job->line);
+    for (;;) {
+        job_drain(job);
+        if (atomic_load_acquire(&job->state) == JOB_DONE) break;
+
+        if (cancel_requested()) {
+            if (!forward_cancel) return 0;
+            if (!atomic_load_acquire(&job->cancel)) {
+                atomic_store_release(&job->cancel, 1);
+                puts("^C");
+            }
+        }
+        thread_sleep(10);
+    }
+
+    // Output written after the last drain but before the job finished
+    job_drain(job);
+    job_reap(job);
+    job->notified = 1;
+    if (status) *status = job->status;
+    atomic_store_release(&job->state, JOB_FREE);
+    return 1;
+}
+
+static const char* job_state_name(job_t* job)
+{
+    if (atomic_load_acquire(&job->state) == JOB_RUNNING) {
+        return atomic_load_acquire(&job->cancel) ? "Stopping" : "Running";
+    }
+    if (atomic_load_acquire(&job->cancel)) return "Interrupted";
+    return job->status == 0 ? "Done" : "Exit";
+}
+
+void jobs_print(void)
+{
+    int shown = 0;
+    int latest = job_latest();
+
+    for (int i = 0; i < JOB_MAX; i++) {
+        job_t* job = &jobs[i];
+        if (atomic_load_acquire(&job->state) == JOB_FREE) continue;
+
+        if (!shown) {
+            puts("   JOB THREAD  STATE        TIME(ms)  OUTPUT  COMMAND");
+        }
+        shown++;
+
+        unsigned long flags = spin_lock_irqsave(&job->lock);
+        uint64_t end = job->state == JOB_DONE ? job->ended : timer_ticks();
+        unsigned long buffered = job->head - job->tail;
+        spin_unlock_irqrestore(&job->lock, flags);
+
+        const char* state = job_state_name(job);
+        printf("  %s", i + 1 == latest ? "+" : " ");
+        print_uint_padded(i + 1, 4);
+        print_uint_padded(job->thread, 8);
+        printf("%s", state);
+        for (int pad = strlen(state); pad < 13; pad++) putchar(' ');
+        print_uint_padded((unsigned long)(timer_ticks_to_us(end - job->started) / 1000), 10);
+        print_uint_padded(buffered, 8);
+        printf("%s\n", job->line);
+    }
+
+    if (!shown) {
+        puts("No jobs");
+    }
+}
+
+void jobs_notify(void)
+{
+    for (int i = 0; i < JOB_MAX; i++) {
+        job_t* job = &jobs[i];
+        if (atomic_load_acquire(&job->state) != JOB_DONE || job->notified) continue;
+
+        job_reap(job);
+        job->notified = 1;
+
+        if (atomic_load_acquire(&job->cancel)) {
+            printf("[%d] Interrupted  %s\n", i + 1, job->line);
+        } else if (job->status != 0) {
+            printf("[%d] Exit %d  %s\n", i + 1, job->status, job->line);
+        } else {
+            printf("[%d] Done  %s\n", i + 1, job->line);
+        }
+
+        // Kept until fg or wait prints its output; otherwise finished with
+        if (job->head != job->tail) {
+            printf("    %lu bytes of output - 'fg %%%d' to show\n",
+                   (unsigned long)(job->head - job->tail), i + 1);
+        } else {
+            atomic_store_release(&job->state, JOB_FREE);
+        }
+    }
+}
@@ -0,0 +1,554 @@
+/*
+ * Kernel Object Allocator Implementation
+ *
+ * Three layers, after Bonwick's magazine allocator:
+ *   CPU cache  each CPU holds a 'loaded' and a 'previous' magazine per
+ *              class; alloc pops and free pushes with IRQs masked on the
+ *              local CPU only - no lock, no atomic
+ *   depot      per-class lists of full and empty magazines, exchanged
+ *              one magazine at a time when both CPU magazines run out
+ *   slab       per-class free list carved from page allocator pages
+ *              (the depot lock covers it)
+ * The size class of any pointer is read back from a tag per pool page.
+ * Statistics are per CPU and only summed when meminfo asks for them.
+ */
+
+#include "kmalloc.h"
+#include "irq.h"
+#include "page.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+// Page tags: 0 = not ours, 1..KMALLOC_CLASSES = slab page of class-1,
+// PAGE_TAG_LARGE | n = first page of an n-page allocation
+#define PAGE_TAG_LARGE     0x8000
+#define PAGE_TAG_MAX_PAGES 0x7FFF
+
+typedef struct magazine {
+    struct magazine* next;      // Depot list link
+    uint64_t rounds;            // Objects held
+    void* objs[KMALLOC_MAG_ROUNDS];
+} magazine_t;
+
+// One class of one CPU
+typedef struct {
+    magazine_t* loaded;
+    magazine_t* previous;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long depot_trips;  // Both magazines empty (alloc) or full (free)
+} cpu_class_t;
+
+typedef struct {
+    cpu_class_t classes[KMALLOC_CLASSES];
+    unsigned long large_allocs;
+    unsigned long large_frees;
+    unsigned long failures;
+} __attribute__((aligned(64))) cpu_cache_t;
+
+typedef struct {
+    spinlock_t lock;
+    magazine_t* full;
+    magazine_t* empty;
+    unsigned long full_count;
+    unsigned long empty_count;
+    void* slab_free;            // Objects linked through their first word
+    unsigned long slab_pages;
+} __attribute__((aligned(64))) depot_t;
+
+static cpu_cache_t cpu_caches[SMP_MAX_CPUS];
+static depot_t depots[KMALLOC_CLASSES];
+
+// Spare magazines, carved a page at a time
+static spinlock_t magazine_lock;
+static magazine_t* magazine_free = NULL;
+static unsigned long magazine_pages = 0;
+
+// One tag per pool page, in pages taken by kmalloc_init()
+static uint16_t* page_tags = NULL;
+
+// Cleared only by the benchmark to measure the depot lock alone
+static int magazines_enabled = 1;
+
+static size_t class_size(int cls)
+{
+    return 1UL << (KMALLOC_MIN_SHIFT + cls);
+}
+
+static int size_to_class(size_t size)
+{
+    int cls = 0;
+    while (class_size(cls) < size) cls++;
+    return cls;
+}
+
+static size_t page_index(const void* ptr)
+{
+    return ((uintptr_t)ptr - page_pool_start()) / PAGE_SIZE;
+}
+
+static int page_index_valid(const void* ptr)
+{
+    uintptr_t a = (uintptr_t)ptr;
+    return page_tags && a >= page_pool_start() && page_index(ptr) < page_total_count();
+}
+
+// --- Magazine storage ---
+
+static magazine_t* magazine_alloc(void)
+{
+    unsigned long flags = spin_lock_irqsave(&magazine_lock);
+
+    if (!magazine_free) {
+        magazine_t* page = page_alloc(1);
+        if (page) {
+            for (size_t i = 0; i < PAGE_SIZE / sizeof(magazine_t); i++) {
+                page[i].next = magazine_free;
+                magazine_free = &page[i];
+            }
+            magazine_pages++;
+        }
+    }
+
+    magazine_t* m = magazine_free;
+    if (m) {
+        magazine_free = m->next;
+        m->next = NULL;
+        m->rounds = 0;
+    }
+
+    spin_unlock_irqrestore(&magazine_lock, flags);
+    return m;
+}
+
+// --- Slab layer (depot lock held) ---
+
+static void* slab_take(int cls)
+{
+    depot_t* d = &depots[cls];
+
+    if (!d->slab_free) {
+        uint8_t* page = page_alloc(1);
+        if (!page) return NULL;
+
+        page_tags[page_index(page)] = (uint16_t)(cls + 1);
+        d->slab_pages++;
+
+        size_t size = class_size(cls);
+        for (size_t off = PAGE_SIZE; off >= size; off -= size) {
+            void** obj = (void**)(page + off - size);
+            *obj = d->slab_free;
+            d->slab_free = obj;
+        }
+    }
+
+    void** obj = d->slab_free;
+    d->slab_free = *obj;
+    return obj;
+}
+
+static void slab_give(int cls, void* ptr)
+{
+    void** obj = ptr;
+    *obj = depots[cls].slab_free;
+    depots[cls].slab_free = obj;
+}
+
+// --- Depot ---
+
+/*
+ * A full magazine for 'cls': from the depot, or filled from the slab
+ * Returns NULL only when not a single object can be found
+ */
+static magazine_t* depot_get_full(int cls)
+{
+    depot_t* d = &depots[cls];
+    magazine_t* m;
+
+    spin_lock(&d->lock);
+    m = d->full;
+    if (m) {
+        d->full = m->next;
+        d->full_count--;
+        spin_unlock(&d->lock);
+        return m;
+    }
+    m = d->empty;
+    if (m) {
+        d->empty = m->next;
+        d->empty_count--;
+    }
+    spin_unlock(&d->lock);
+
+    if (!m) {
+        m = magazine_alloc();
+        if (!m) return NULL;
+    }
+
+    spin_lock(&d->lock);
+    while (m->rounds < KMALLOC_MAG_ROUNDS) {
+        void* obj = slab_take(cls);
+        if (!obj) break;
+        m->objs[m->rounds++] = obj;
+    }
+    if (m->rounds == 0) {
+        m->next = d->empty;
+        d->empty = m;
+        d->empty_count++;
+        m = NULL;
+    }
+    spin_unlock(&d->lock);
+    return m;
+}
+
+static magazine_t* depot_get_empty(int cls)
+{
+    depot_t* d = &depots[cls];
+
+    spin_lock(&d->lock);
+    magazine_t* m = d->empty;
+    if (m) {
+        d->empty = m->next;
+        d->empty_count--;
+    }
+    spin_unlock(&d->lock);
+
+    return m ? m : magazine_alloc();
+}
+
+static void depot_put(int cls, magazine_t* m)
+{
+    depot_t* d = &depots[cls];
+
+    spin_lock(&d->lock);
+    if (m->rounds == 0) {
+        m->next = d->empty;
+        d->empty = m;
+        d->empty_count++;
+    } else {
+        m->next = d->full;
+        d->full = m;
+        d->full_count++;
+    }
+    spin_unlock(&d->lock);
+}
+
+// --- CPU layer (IRQs masked, so the thread cannot migrate) ---
+
+static void* cache_alloc(cpu_class_t* cc, int cls)
+{
+    while (1) {
+        magazine_t* m = cc->loaded;
+        if (m && m->rounds > 0) {
+            return m->objs[--m->rounds];
+        }
+
+        magazine_t* p = cc->previous;
+        if (p && p->rounds > 0) {
+            cc->loaded = p;
+            cc->previous = m;
+            continue;
+        }
+
+        // Both empty: swap the older one for a full magazine
+        cc->depot_trips++;
+        magazine_t* full = depot_get_full(cls);
+        if (!full) return NULL;
+        if (p) depot_put(cls, p);
+        cc->previous = m;
+        cc->loaded = full;
+    }
+}
+
+static void cache_free(cpu_class_t* cc, int cls, void* obj)
+{
+    while (1) {
+        magazine_t* m = cc->loaded;
+        if (m && m->rounds < KMALLOC_MAG_ROUNDS) {
+            m->objs[m->rounds++] = obj;
+            return;
+        }
+
+        magazine_t* p = cc->previous;
+        if (p && p->rounds < KMALLOC_MAG_ROUNDS) {
+            cc->loaded = p;
+            cc->previous = m;
+            continue;
+        }
+
+        // Both full: swap the older one for an empty magazine
+        cc->depot_trips++;
+        magazine_t* empty = depot_get_empty(cls);
+        if (!empty) {
+            // No memory for a magazine - hand the object straight back
+            spin_lock(&depots[cls].lock);
+            slab_give(cls, obj);
+            spin_unlock(&depots[cls].lock);
+            return;
+        }
+        if (p) depot_put(cls, p);
+        cc->previous = m;
+        cc->loaded = empty;
+    }
+}
+
+// --- Public interface ---
+
+static void* large_alloc(size_t size, cpu_cache_t* cpu)
+{
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages > PAGE_TAG_MAX_PAGES) return NULL;
+
+    void* ptr = page_alloc(pages);
+    if (ptr) {
+        page_tags[page_index(ptr)] = (uint16_t)(PAGE_TAG_LARGE | pages);
+        cpu->large_allocs++;
+    }
+    return ptr;
+}
+
+void kmalloc_init(void)
+{
+    // Depot locks are named by their class size: kmalloc/16 ... kmalloc/2048
+    for (int cls = 0; cls < KMALLOC_CLASSES; cls++) {
+        spin_lock_init_indexed(&depots[cls].lock, "kmalloc", (int)class_size(cls));
+    }
+    spin_lock_init(&magazine_lock, "kmalloc-mags");
+
+    size_t bytes = page_total_count() * sizeof(uint16_t);
+    uint16_t* tags = page_alloc((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!tags) {
+        puts("Warning: no pages for the kmalloc page tags");
+        return;
+    }
+    for (size_t i = 0; i < page_total_count(); i++) {
+        tags[i] = 0;
+    }
+    page_tags = tags;
+}
+
+void* kmalloc(size_t size)
+{
+    if (size == 0 || !page_tags) return NULL;
+
+    unsigned long flags = irq_save();
+    cpu_cache_t* cpu = &cpu_caches[smp_cpu_id()];
+    void* ptr;
+
+    if (size > KMALLOC_MAX_SIZE) {
+        ptr = large_alloc(size, cpu);
+    } else {
+        int cls = size_to_class(size);
+        cpu_class_t* cc = &cpu->classes[cls];
+
+        if (magazines_enabled) {
+            ptr = cache_alloc(cc, cls);
+        } else {
+            spin_lock(&depots[cls].lock);
+            ptr = slab_take(cls);
+            spin_unlock(&depots[cls].lock);
+        }
+        if (ptr) cc->allocs++;
+    }
+
+    if (!ptr) cpu->failures++;
+    irq_restore(flags);
+    return ptr;
+}
+
+void kfree(void* ptr)
+{
+    if (!ptr || !page_index_valid(ptr)) return;
+
+    uint16_t tag = page_tags[page_index(ptr)];
+    if (tag == 0) return;   // Not a kmalloc pointer
+
+    unsigned long flags = irq_save();
+    cpu_cache_t* cpu = &cpu_caches[smp_cpu_id()];
+
+    if (tag & PAGE_TAG_LARGE) {
+        page_tags[page_index(ptr)] = 0;
+        page_free(ptr, tag & PAGE_TAG_MAX_PAGES);
+        cpu->large_frees++;
+    } else {
+        int cls = tag - 1;
+        cpu_class_t* cc = &cpu->classes[cls];
+        cc->frees++;
+
+        if (magazines_enabled) {
+            cache_free(cc, cls, ptr);
+        } else {
+            spin_lock(&depots[cls].lock);
+            slab_give(cls, ptr);
+            spin_unlock(&depots[cls].lock);
+        }
+    }
+
+    irq_restore(flags);
+}
+
+size_t kmalloc_size(const void* ptr)
+{
+    if (!ptr || !page_index_valid(ptr)) return 0;
+
+    uint16_t tag = page_tags[page_index(ptr)];
+    if (tag & PAGE_TAG_LARGE) return (size_t)(tag & PAGE_TAG_MAX_PAGES) * PAGE_SIZE;
+    return tag ? class_size(tag - 1) : 0;
+}
+
+/*
+ * Object allocator statistics, merged across CPUs at display time
+ * (counters are read without stopping the other CPUs)
+ */
+void kmalloc_print(void)
+{
+    unsigned long total_in_use = 0;
+    unsigned long total_pages = 0;
+    unsigned long large_allocs = 0, large_frees = 0, failures = 0;
+
+    puts("OBJECT ALLOCATOR (per-CPU magazines):");
+    puts("  CLASS  ALLOCS      FREES       IN USE    DEPOT%  FULL  EMPTY  PAGES");
+
+    for (int cls = 0; cls < KMALLOC_CLASSES; cls++) {
+        unsigned long allocs = 0, frees = 0, trips = 0;
+        for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            allocs += cpu_caches[cpu].classes[cls].allocs;
+            frees += cpu_caches[cpu].classes[cls].frees;
+            trips += cpu_caches[cpu].classes[cls].depot_trips;
+        }
+        depot_t* d = &depots[cls];
+        if (allocs == 0 && d->slab_pages == 0) continue;
+
+        unsigned long in_use = allocs > frees ? allocs - frees : 0;
+        unsigned long ops = allocs + frees;
+        total_in_use += in_use * class_size(cls);
+        total_pages += d->slab_pages;
+
+        printf("  ");
+        print_uint_padded(class_size(cls), 7);
+        print_uint_padded(allocs, 12);
+        print_uint_padded(frees, 12);
+        print_uint_padded(in_use, 10);
+        print_uint_padded(ops ? trips * 100 / ops : 0, 8);
+        print_uint_padded(d->full_count, 6);
+        print_uint_padded(d->empty_count, 7);
+        printf("%lu\n", d->slab_pages);
+    }
+
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        large_allocs += cpu_caches[cpu].large_allocs;
+        large_frees += cpu_caches[cpu].large_frees;
+        failures += cpu_caches[cpu].failures;
+    }
+
+    printf("  Objects in use:   %lu bytes in %lu slab pages\n", total_in_use, total_pages);
+    printf("  Page-sized allocs: %lu (%lu freed)\n", large_allocs, large_frees);
+    printf("  Magazine pages:   %lu, failed allocations: %lu\n", magazine_pages, failures);
+}
+
+// --- Churn benchmark ---
+
+#define BENCH_SLOTS 32
+
+static volatile uint32_t bench_busy;    // A run is in progress
+static unsigned long bench_ops;
+
+static void bench_churn(void* arg)
+{
+    void* slots[BENCH_SLOTS] = { 0 };
+    uint64_t x = 0x9E3779B97F4A7C15UL ^ (uint64_t)arg;
+
+    for (unsigned long i = 0; i < bench_ops; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        int slot = (int)(x % BENCH_SLOTS);
+        kfree(slots[slot]);
+        slots[slot] = kmalloc(16UL << ((x >> 8) % 6));    // 16 .. 512 bytes
+    }
+
+    for (int i = 0; i < BENCH_SLOTS; i++) {
+        kfree(slots[i]);
+    }
+}
+
+// Wall time in ns for 'threads' churners, or 0 if they could not start
+static uint64_t bench_run(int threads)
+{
+    int ids[THREAD_MAX];
+    int created = 0;
+    uint64_t start = timer_ticks();
+
+    for (int i = 0; i < threads; i++) {
+        ids[i] = thread_create("churn", bench_churn, (void*)(uintptr_t)(i + 1), 1);
+        if (ids[i] >= 0) created++;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (ids[i] >= 0) thread_join(ids[i]);
+    }
+
+    return created == threads ? timer_ticks_to_ns(timer_ticks() - start) : 0;
+}
+
+/*
+ * Each thread frees a random slot and allocates a random size into it,
+ * 'ops' times; run with the depot lock alone and with magazines, on one
+ * thread and on 'threads' threads
+ */
+static void kmalloc_bench_run(int threads, unsigned long ops)
+{
+    static const char* mode_names[2] = { "depot lock", "magazines " };
+
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    bench_ops = ops;
+
+    puts("=== Allocator Churn Benchmark ===");
+    printf("CPUs online: %d, ops per thread: %lu, sizes 16-512 bytes\n\n", smp_cpus_online(), ops);
+    puts("MODE         THREADS  TIME(us)    OPS/S       SCALING");
+
+    for (int mode = 0; mode < 2; mode++) {
+        magazines_enabled = mode;
+
+        unsigned long rate1 = 0;
+        int counts[2] = { 1, threads };
+        for (int run = 0; run < (threads > 1 ? 2 : 1); run++) {
+            uint64_t ns = bench_run(counts[run]);
+            if (ns == 0) {
+                magazines_enabled = 1;
+                puts("Error: could not create benchmark threads");
+                return;
+            }
+
+            unsigned long rate = (unsigned long)(counts[run] * ops * 1000000000UL / ns);
+            if (run == 0) rate1 = rate;
+            unsigned long scaling_x100 = rate1 ? rate * 100 / rate1 : 0;
+
+            printf("%s   ", mode_names[mode]);
+            print_uint_padded(counts[run], 9);
+            print_uint_padded((unsigned long)(ns / 1000), 12);
+            print_uint_padded(rate, 12);
+            printf("%lu.%lu%lux\n", scaling_x100 / 100, (scaling_x100 / 10) % 10, scaling_x100 % 10);
+        }
+    }
+
+    magazines_enabled = 1;
+}
+
+void kmalloc_bench(int threads, unsigned long ops)
+{
+    // It switches the magazines off and shares bench_ops: one run at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("Allocator benchmark already running");
+        return;
+    }
+    kmalloc_bench_run(threads, ops);
+    atomic_store_release(&bench_busy, 0);
+}
@@ -0,0 +1,247 @@
+/*
+ * Kernel Timers Implementation
+ * Classic cascading wheel: a timer goes into the level whose span covers
+ * its distance from the wheel's clock. Each time level 0 wraps, the next
+ * slot of level 1 is re-sorted into level 0, and so on up the levels.
+ */
+
+#include "ktimer.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "uart.h"
+
+#define SLOT_MASK   (KTIMER_SLOTS - 1)
+#define WHEEL_SPAN  (1UL << (KTIMER_LEVELS * KTIMER_SLOT_BITS))
+
+typedef struct {
+    spinlock_t lock;
+    uint64_t clock;                 // Next tick to process
+    ktimer_t* slots[KTIMER_LEVELS][KTIMER_SLOTS];
+
+    // Statistics
+    unsigned long pending;
+    unsigned long added;
+    unsigned long fired;
+    unsigned long cancelled;
+    unsigned long cascaded;         // Timers moved down a level
+    uint64_t max_late_ticks;        // Worst tick processed late
+} __attribute__((aligned(64))) wheel_t;
+
+static wheel_t wheels[SMP_MAX_CPUS];
+static uint64_t ticks_per_jiffy;
+
+// Current tick number from the free-running counter
+static uint64_t jiffies_now(void)
+{
+    return timer_ticks() / ticks_per_jiffy;
+}
+
+void ktimer_init(void)
+{
+    ticks_per_jiffy = timer_frequency() / TIMER_TICK_HZ;
+    if (ticks_per_jiffy == 0) ticks_per_jiffy = 1;
+
+    uint64_t now = jiffies_now();
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init_indexed(&wheels[cpu].lock, "wheel", cpu);
+        wheels[cpu].clock = now;
+    }
+}
+
+void ktimer_setup(ktimer_t* timer, ktimer_fn_t fn, void* arg)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expired_next = NULL;
+    timer->running = 0;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->cpu = -1;
+}
+
+static void slot_insert(ktimer_t** slot, ktimer_t* timer)
+{
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void slot_remove(ktimer_t* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Place by distance from the wheel clock (wheel lock held)
+static void wheel_insert(wheel_t* w, ktimer_t* timer)
+{
+    uint64_t expires = timer->expires;
+
+    if (expires < w->clock) {
+        expires = w->clock;                     // Already due: next tick
+    } else if (expires - w->clock >= WHEEL_SPAN) {
+        expires = w->clock + WHEEL_SPAN - 1;    // Beyond the wheel: clamp
+    }
+
+    uint64_t delta = expires - w->clock;
+    int level = 0;
+    while (level < KTIMER_LEVELS - 1 && delta >= (1UL << ((level + 1) * KTIMER_SLOT_BITS))) {
+        level++;
+    }
+
+    int index = (int)((expires >> (level * KTIMER_SLOT_BITS)) & SLOT_MASK);
+    slot_insert(&w->slots[level][index], timer);
+}
+
+// Re-sort one slot of a higher level into the levels below it
+static void wheel_cascade(wheel_t* w, int level, int index)
+{
+    ktimer_t* timer = w->slots[level][index];
+    w->slots[level][index] = NULL;
+
+    while (timer) {
+        ktimer_t* next = timer->next;
+        timer->pprev = NULL;
+        wheel_insert(w, timer);
+        w->cascaded++;
+        timer = next;
+    }
+}
+
+int ktimer_add(ktimer_t* timer, unsigned int ms)
+{
+    if (!timer_tick_running() || !timer->fn) return -1;
+
+    ktimer_cancel(timer);
+
+    // Round up, and never fire on the tick already in progress
+    uint64_t ticks = ((uint64_t)ms * TIMER_TICK_HZ + 999) / 1000;
+    if (ticks == 0) ticks = 1;
+
+    unsigned long flags = irq_save();
+    int cpu = smp_cpu_id();
+    wheel_t* w = &wheels[cpu];
+
+    spin_lock(&w->lock);
+    timer->expires = jiffies_now() + ticks;
+    timer->cpu = cpu;
+    wheel_insert(w, timer);
+    w->pending++;
+    w->added++;
+    spin_unlock(&w->lock);
+
+    irq_restore(flags);
+    return 0;
+}
+
+int ktimer_cancel(ktimer_t* timer)
+{
+    int cpu = timer->cpu;
+    if (cpu < 0 || cpu >= SMP_MAX_CPUS) return 0;
+
+    wheel_t* w = &wheels[cpu];
+    unsigned long flags = spin_lock_irqsave(&w->lock);
+    int was_pending = timer->pprev != NULL && timer->cpu == cpu;
+    if (was_pending) {
+        slot_remove(timer);
+        w->pending--;
+        w->cancelled++;
+    }
+    spin_unlock_irqrestore(&w->lock, flags);
+    return was_pending;
+}
+
+void ktimer_tick(void)
+{
+    wheel_t* w = &wheels[smp_cpu_id()];
+    uint64_t now = jiffies_now();
+    ktimer_t* expired = NULL;
+
+    spin_lock(&w->lock);
+    if (now > w->clock && now - w->clock > w->max_late_ticks) {
+        w->max_late_ticks = now - w->clock;
+    }
+
+    while (w->clock <= now) {
+        int index = (int)(w->clock & SLOT_MASK);
+
+        // Level 0 wrapped: pull the next slot of each level down
+        if (index == 0) {
+            for (int level = 1; level < KTIMER_LEVELS; level++) {
+                int upper = (int)((w->clock >> (level * KTIMER_SLOT_BITS)) & SLOT_MASK);
+                wheel_cascade(w, level, upper);
+                if (upper != 0) break;
+            }
+        }
+
+        // Everything in this slot is due, except timers re-armed here
+        // while their last callback is still queued or running on another
+        // CPU: those wait a tick, so each is on one expired list at a time
+        ktimer_t* timer = w->slots[0][index];
+        w->slots[0][index] = NULL;
+        while (timer) {
+            ktimer_t* next = timer->next;
+            timer->pprev = NULL;
+            if (atomic_load_acquire(&timer->running)) {
+                slot_insert(&w->slots[0][(index + 1) & SLOT_MASK], timer);
+            } else {
+                timer->running = 1;
+                timer->expired_next = expired;
+                expired = timer;
+                w->pending--;
+                w->fired++;
+            }
+            timer = next;
+        }
+        w->clock++;
+    }
+    spin_unlock(&w->lock);
+
+    // Callbacks run unlocked so they can re-arm themselves; the expired
+    // list has its own link because re-arming rewrites next and pprev
+    while (expired) {
+        ktimer_t* timer = expired;
+        expired = timer->expired_next;
+        timer->expired_next = NULL;
+        timer->fn(timer->arg);
+        atomic_store_release(&timer->running, 0);
+    }
+}
+
+void ktimer_print(void)
+{
+    puts("Timer wheel (4 x 64 slots, 10ms ticks):");
+    puts("  CPU  PENDING  ADDED       FIRED       CANCELLED   CASCADED    MAX LATE(ticks)");
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) continue;
+        wheel_t* w = &wheels[cpu];
+
+        printf("  ");
+        print_uint_padded(cpu, 5);
+        print_uint_padded(w->pending, 9);
+        print_uint_padded(w->added, 12);
+        print_uint_padded(w->fired, 12);
+        print_uint_padded(w->cancelled, 12);
+        print_uint_padded(w->cascaded, 12);
+        printf("%lu\n", (unsigned long)w->max_late_ticks);
+    }
+}
+
+void ktimer_reset_stats(void)
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        wheel_t* w = &wheels[cpu];
+        unsigned long flags = spin_lock_irqsave(&w->lock);
+        w->added = 0;
+        w->fired = 0;
+        w->cancelled = 0;
+        w->cascaded = 0;
+        w->max_late_ticks = 0;
+        spin_unlock_irqrestore(&w->lock, flags);
+    }
+}
@@ -0,0 +1,2091 @@
+/*
+ * Key-Value Store Implementation
+ * Files in the root directory, named by a number from one counter:
+ *   kv-NNNNNN.log   write-ahead log of a memtable: records of an FNV-1a
+ *                   check, key and value lengths, the key and the value
+ *   kv-NNNNNN.run   sorted run: data blocks (a record count, then records
+ *                   of key and value lengths, key and value), the index
+ *                   (each block's first key, then the run's last key),
+ *                   the bloom filter and a footer
+ *   kv-manifest.0/1 which runs make up each level, the oldest log still
+ *                   needed and the counter; written alternately, so a
+ *                   torn write leaves the previous one
+ * Boot loads the newest valid manifest, replays the logs it still needs
+ * and writes them out as a level-0 run, then removes every other file.
+ *
+ * One sleeping lock covers the memtables, the levels and the log. A
+ * lookup holds it while it reads blocks, so runs can only be freed under
+ * it. Only the background work changes the levels; it merges with the
+ * lock dropped (runs never change) and takes it again to install its
+ * output. Lengths are decoded a byte at a time: records are packed and
+ * unaligned loads fault with the MMU off.
+ */
+
+#include "kv.h"
+#include "cancel.h"
+#include "fs.h"
+#include "kmalloc.h"
+#include "spinlock.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+#include "workqueue.h"
+
+#define RUN_MAGIC               0x4e52564b  // "KVRN"
+#define MANIFEST_MAGIC          0x464d564b  // "KVMF"
+#define TOMBSTONE               0xffff      // value_len of a deletion
+
+#define BLOCK_SIZE              FS_BLOCK_SIZE
+#define RECORD_HEAD             4           // Key and value lengths
+#define LOG_HEAD                8           // Check, then key and value lengths
+#define LOG_BUFFER              4096        // Log records gathered per file append
+#define SKIP_HEIGHT             12          // Skiplist levels (1 in 4 nodes rises)
+#define BLOOM_HASHES            7           // About KV_BLOOM_BITS * ln 2
+#define NAME_LEN                16          // "kv-NNNNNN.run" and a NUL
+#define SCAN_FILES_MAX          512         // Files of the store looked at by boot
+#define SCAN_CURSORS            (2 + KV_RUNS_MAX + KV_LEVELS - 1)
+
+typedef struct node {
+    uint16_t key_len;
+    uint16_t value_len;                     // TOMBSTONE for a deletion
+    uint8_t height;
+    char* key;                              // NUL terminated, after next[]
+    uint8_t* value;                         // ... then the value
+    struct node* next[];
+} node_t;
+
+typedef struct {
+    node_t* head;                           // SKIP_HEIGHT links, no key
+    int height;                             // Levels in use
+    uint32_t entries;
+    uint32_t bytes;                         // Log bytes behind it
+    uint32_t log;                           // Its log file
+} memtable_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t blocks;                        // Data blocks, from the start of the file
+    uint32_t entries;
+    uint64_t bytes;                         // File size
+    uint8_t* index;                         // Index then filter, as in the file
+    uint32_t* index_at;                     // Offset of each block's first key in 'index'
+    const uint8_t* bloom;
+    uint32_t bloom_bits;
+    uint16_t first_len;
+    uint16_t last_len;
+    char first[KV_KEY_MAX + 1];
+    char last[KV_KEY_MAX + 1];
+} run_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t blocks;
+    uint32_t entries;
+    uint32_t index_len;                     // Block first keys and the last key
+    uint32_t bloom_len;
+    uint32_t bloom_bits;
+    uint32_t check;                         // FNV-1a of index and filter
+    uint32_t reserved;
+} run_footer_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;                           // Higher is newer
+    uint32_t next_file;
+    uint32_t log;                           // Oldest log still needed
+    uint32_t runs;
+    uint32_t check;                         // FNV-1a of the entries
+} manifest_head_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t level;
+} manifest_entry_t;
+
+typedef struct {
+    run_t* runs[KV_RUNS_MAX];               // Level 0 oldest first, deeper levels by key
+    int count;
+    uint64_t bytes;
+} level_t;
+
+// Growable byte array for the index and key hashes of a run being written
+typedef struct {
+    uint8_t* data;
+    uint32_t len;
+    uint32_t cap;
+} vec_t;
+
+typedef struct {
+    uint32_t id;
+    char name[NAME_LEN];
+    uint8_t* block;                         // Data block being filled
+    uint32_t block_used;
+    uint32_t block_records;
+    uint64_t offset;                        // Bytes in the file
+    uint32_t blocks;
+    uint32_t entries;
+    vec_t index;
+    vec_t hashes;
+    uint16_t last_len;
+    char last[KV_KEY_MAX + 1];
+} writer_t;
+
+// Position in a memtable, or in a list of runs with disjoint key ranges
+typedef struct {
+    int valid;
+    const char* key;
+    uint32_t key_len;
+    const uint8_t* value;
+    uint32_t value_len;
+    node_t* node;                           // Memtable cursor (runs == NULL)
+    run_t** runs;
+    int run_count;
+    int run;
+    uint8_t* block;
+    uint32_t block_no;
+    uint32_t left;                          // Records left in the block, this one included
+    uint32_t pos;
+    unsigned long reads;
+    int error;
+} cursor_t;
+
+// A compaction: runs of 'level' merged with the overlapping ones below it
+typedef struct {
+    int level;
+    run_t* upper[KV_RUNS_MAX];              // Level 0: oldest first
+    int upper_count;
+    run_t* lower[KV_RUNS_MAX];              // By key
+    int lower_count;
+} job_t;
+
+typedef struct {
+    uint32_t ids[SCAN_FILES_MAX];
+    uint8_t is_log[SCAN_FILES_MAX];
+    int count;
+} file_scan_t;
+
+static spinlock_t kv_lock;
+static int kv_busy = 0;
+static int ready = 0;
+
+static memtable_t* mem = NULL;
+static memtable_t* imm = NULL;              // Frozen, being written to level 0
+static level_t levels[KV_LEVELS];
+static char compact_from[KV_LEVELS][KV_KEY_MAX + 1];    // Last key compacted from each level
+static uint32_t next_file = 1;
+static uint32_t manifest_seq = 0;
+static uint64_t skip_seed = 0x2545F4914F6CDD1DUL;
+
+static uint8_t* log_buf = NULL;             // Records not yet appended to the log file
+static uint32_t log_used = 0;
+static work_t log_work;
+
+static uint8_t* lookup_block = NULL;
+static cursor_t scan_cursors[SCAN_CURSORS];
+static uint8_t* scan_blocks[SCAN_CURSORS];
+
+// Background thread; a job runs with the lock dropped
+static spinlock_t kick_lock;
+static int worker = -1;
+static int worker_parked = 0;
+static int kicked = 0;
+static int background_running = 0;
+static int background_error = 0;
+static job_t job;
+static cursor_t job_cursors[KV_RUNS_MAX + 1];
+static run_t* job_outputs[KV_RUNS_MAX];
+
+static kv_stats_t stats;
+
+static void kv_enter(void)
+{
+    unsigned long flags = spin_lock_irqsave(&kv_lock);
+    while (kv_busy) {
+        spin_unlock_irqrestore(&kv_lock, flags);
+        thread_yield();
+        flags = spin_lock_irqsave(&kv_lock);
+    }
+    kv_busy = 1;
+    spin_unlock_irqrestore(&kv_lock, flags);
+}
+
+static void kv_leave(void)
+{
+    unsigned long flags = spin_lock_irqsave(&kv_lock);
+    kv_busy = 0;
+    spin_unlock_irqrestore(&kv_lock, flags);
+}
+
+// --- Encoding ---
+
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static uint32_t key_hash(const char* key, size_t len)
+{
+    return fnv1a(2166136261U, key, len);
+}
+
+// Volatile so GCC cannot merge the two bytes into one unaligned access
+static void put16(uint8_t* p, uint32_t value)
+{
+    volatile uint8_t* b = p;
+    b[0] = value & 0xff;
+    b[1] = (value >> 8) & 0xff;
+}
+
+static uint32_t get16(const uint8_t* p)
+{
+    const volatile uint8_t* b = p;
+    return b[0] | (uint32_t)b[1] << 8;
+}
+
+static void put32(uint8_t* p, uint32_t value)
+{
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return get16(p) | get16(p + 2) << 16;
+}
+
+// Bytes order, then the shorter key first
+static int key_compare(const char* a, size_t a_len, const char* b, size_t b_len)
+{
+    size_t n = a_len < b_len ? a_len : b_len;
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            return (uint8_t)a[i] < (uint8_t)b[i] ? -1 : 1;
+        }
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static uint32_t value_bytes(uint32_t value_len)
+{
+    return value_len == TOMBSTONE ? 0 : value_len;
+}
+
+static uint32_t record_size(uint32_t key_len, uint32_t value_len)
+{
+    return RECORD_HEAD + key_len + value_bytes(value_len);
+}
+
+// "kv-NNNNNN" and a suffix
+static void file_name(char* out, uint32_t id, const char* suffix)
+{
+    strcpy(out, "kv-");
+    for (int i = 8; i >= 3; i--) {
+        out[i] = '0' + id % 10;
+        id /= 10;
+    }
+    strcpy(out + 9, suffix);
+}
+
+// Id of a run or log file name; -1 for other names
+static int parse_file_name(const char* name, uint32_t* id, int* is_log)
+{
+    if (strlen(name) != 13 || strncmp(name, "kv-", 3) != 0) return -1;
+    uint32_t n = 0;
+    for (int i = 3; i < 9; i++) {
+        if (name[i] < '0' || name[i] > '9') return -1;
+        n = n * 10 + (name[i] - '0');
+    }
+    if (strcmp(name + 9, ".run") == 0) {
+        *is_log = 0;
+    } else if (strcmp(name + 9, ".log") == 0) {
+        *is_log = 1;
+    } else {
+        return -1;
+    }
+    *id = n;
+    return 0;
+}
+
+static int vec_append(vec_t* v, const void* data, uint32_t len)
+{
+    if (v->len + len > v->cap) {
+        uint32_t cap = v->cap ? v->cap * 2 : 256;
+        while (cap < v->len + len) cap *= 2;
+        uint8_t* grown = kmalloc(cap);
+        if (!grown) return KV_ERR_NO_MEMORY;
+        if (v->len) memcpy(grown, v->data, v->len);
+        kfree(v->data);
+        v->data = grown;
+        v->cap = cap;
+    }
+    memcpy(v->data + v->len, data, len);
+    v->len += len;
+    return KV_OK;
+}
+
+static void vec_free(vec_t* v)
+{
+    kfree(v->data);
+    v->data = NULL;
+    v->len = v->cap = 0;
+}
+
+// --- Memtable ---
+
+static int random_height(void)
+{
+    skip_seed ^= skip_seed << 13;
+    skip_seed ^= skip_seed >> 7;
+    skip_seed ^= skip_seed << 17;
+
+    int height = 1;
+    uint64_t bits = skip_seed;
+    while (height < SKIP_HEIGHT && (bits & 3) == 0) {
+        height++;
+        bits >>= 2;
+    }
+    return height;
+}
+
+static node_t* node_alloc(int height, const char* key, uint32_t key_len,
+                          const void* value, uint32_t value_len)
+{
+    size_t links = sizeof(node_t) + height * sizeof(node_t*);
+    node_t* n = kmalloc(links + key_len + 1 + value_bytes(value_len));
+    if (!n) return NULL;
+
+    n->key_len = key_len;
+    n->value_len = value_len;
+    n->height = height;
+    n->key = (char*)n + links;
+    n->value = (uint8_t*)n->key + key_len + 1;
+    memcpy(n->key, key, key_len);
+    n->key[key_len] = '\0';
+    if (value_bytes(value_len)) {
+        memcpy(n->value, value, value_len);
+    }
+    for (int i = 0; i < height; i++) {
+        n->next[i] = NULL;
+    }
+    return n;
+}
+
+static memtable_t* memtable_create(uint32_t log)
+{
+    memtable_t* m = kmalloc(sizeof(memtable_t));
+    if (!m) return NULL;
+    m->head = node_alloc(SKIP_HEIGHT, "", 0, NULL, 0);
+    if (!m->head) {
+        kfree(m);
+        return NULL;
+    }
+    m->height = 1;
+    m->entries = 0;
+    m->bytes = 0;
+    m->log = log;
+    return m;
+}
+
+static void memtable_free(memtable_t* m)
+{
+    node_t* n = m->head;
+    while (n) {
+        node_t* next = n->next[0];
+        kfree(n);
+        n = next;
+    }
+    kfree(m);
+}
+
+// First node >= key; the last node before it on every level into 'update'
+static node_t* memtable_seek(memtable_t* m, const char* key, size_t len, node_t** update)
+{
+    node_t* x = m->head;
+    for (int level = m->height - 1; level >= 0; level--) {
+        while (x->next[level] &&
+               key_compare(x->next[level]->key, x->next[level]->key_len, key, len) < 0) {
+            x = x->next[level];
+        }
+        if (update) update[level] = x;
+    }
+    return x->next[0];
+}
+
+static node_t* memtable_get(memtable_t* m, const char* key, size_t len)
+{
+    node_t* n = memtable_seek(m, key, len, NULL);
+    return n && key_compare(n->key, n->key_len, key, len) == 0 ? n : NULL;
+}
+
+// A new value for a key replaces its node
+static int memtable_insert(memtable_t* m, const char* key, uint32_t key_len,
+                           const void* value, uint32_t value_len)
+{
+    node_t* update[SKIP_HEIGHT];
+    node_t* old = memtable_seek(m, key, key_len, update);
+
+    if (old && key_compare(old->key, old->key_len, key, key_len) == 0) {
+        node_t* n = node_alloc(old->height, key, key_len, value, value_len);
+        if (!n) return KV_ERR_NO_MEMORY;
+        for (int i = 0; i < old->height; i++) {
+            n->next[i] = old->next[i];
+            update[i]->next[i] = n;
+        }
+        kfree(old);
+        return KV_OK;
+    }
+
+    int height = random_height();
+    node_t* n = node_alloc(height, key, key_len, value, value_len);
+    if (!n) return KV_ERR_NO_MEMORY;
+    for (int i = m->height; i < height; i++) {
+        update[i] = m->head;
+    }
+    if (height > m->height) m->height = height;
+    for (int i = 0; i < height; i++) {
+        n->next[i] = update[i]->next[i];
+        update[i]->next[i] = n;
+    }
+    m->entries++;
+    return KV_OK;
+}
+
+// --- Runs ---
+
+static void run_free(run_t* run)
+{
+    kfree(run->index);
+    kfree(run->index_at);
+    kfree(run);
+}
+
+static void run_remove_file(uint32_t id)
+{
+    char name[NAME_LEN];
+    file_name(name, id, ".run");
+    fs_remove(name);
+}
+
+/*
+ * Fill in a run from its index and filter (the file's tail, which it
+ * takes over): the offset of each block's first key, then the range
+ */
+static int run_parse(run_t* run, uint8_t* tail, uint32_t index_len, uint32_t bloom_len)
+{
+    run->index = tail;
+    run->bloom = tail + index_len;
+    run->index_at = kmalloc((run->blocks ? run->blocks : 1) * sizeof(uint32_t));
+    if (!run->index_at) return KV_ERR_NO_MEMORY;
+
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i <= run->blocks; i++) {
+        if (pos + 2 > index_len) return KV_ERR_IO;
+        uint32_t len = get16(tail + pos);
+        if (len == 0 || len > KV_KEY_MAX || pos + 2 + len > index_len) return KV_ERR_IO;
+        if (i < run->blocks) {
+            run->index_at[i] = pos;
+        } else {
+            run->last_len = len;
+            memcpy(run->last, tail + pos + 2, len);
+            run->last[len] = '\0';
+        }
+        pos += 2 + len;
+    }
+    if (run->blocks == 0 || run->bloom_bits == 0 || run->bloom_bits > bloom_len * 8) return KV_ERR_IO;
+
+    run->first_len = get16(tail);
+    memcpy(run->first, tail + 2, run->first_len);
+    run->first[run->first_len] = '\0';
+    return KV_OK;
+}
+
+// Load a run's index and filter; NULL if it is missing or damaged
+static run_t* run_open(uint32_t id)
+{
+    char name[NAME_LEN];
+    file_name(name, id, ".run");
+    fs_stat_t st;
+    run_footer_t footer;
+    if (fs_stat(name, &st) != FS_OK || st.size < sizeof(footer) ||
+        fs_read(name, st.size - sizeof(footer), &footer, sizeof(footer)) != sizeof(footer)) {
+        return NULL;
+    }
+    uint64_t tail_len = (uint64_t)footer.index_len + footer.bloom_len;
+    if (footer.magic != RUN_MAGIC ||
+        (uint64_t)footer.blocks * BLOCK_SIZE + tail_len + sizeof(footer) != st.size) {
+        return NULL;
+    }
+
+    run_t* run = kmalloc(sizeof(run_t));
+    uint8_t* tail = kmalloc(tail_len);
+    if (!run || !tail) {
+        kfree(run);
+        kfree(tail);
+        return NULL;
+    }
+    memset(run, 0, sizeof(run_t));
+    run->id = id;
+    run->blocks = footer.blocks;
+    run->entries = footer.entries;
+    run->bytes = st.size;
+    run->bloom_bits = footer.bloom_bits;
+    if (fs_read(name, (uint64_t)footer.blocks * BLOCK_SIZE, tail, tail_len) != (long)tail_len ||
+        fnv1a(2166136261U, tail, tail_len) != footer.check ||
+        run_parse(run, tail, footer.index_len, footer.bloom_len) != KV_OK) {
+        run->index = tail;
+        run_free(run);
+        return NULL;
+    }
+    return run;
+}
+
+static int run_read_block(const run_t* run, uint32_t block, uint8_t* buf)
+{
+    char name[NAME_LEN];
+    file_name(name, run->id, ".run");
+    return fs_read(name, (uint64_t)block * BLOCK_SIZE, buf, BLOCK_SIZE) == BLOCK_SIZE ? KV_OK : KV_ERR_IO;
+}
+
+static int run_contains(const run_t* run, const char* key, size_t len)
+{
+    return key_compare(run->first, run->first_len, key, len) <= 0 &&
+           key_compare(run->last, run->last_len, key, len) >= 0;
+}
+
+static int bloom_may_contain(const run_t* run, uint32_t hash)
+{
+    uint32_t delta = hash >> 17 | hash << 15;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        uint32_t bit = hash % run->bloom_bits;
+        if (!(run->bloom[bit / 8] & (1 << (bit % 8)))) return 0;
+        hash += delta;
+    }
+    return 1;
+}
+
+// Last block whose first key is <= key
+static uint32_t run_find_block(const run_t* run, const char* key, size_t len)
+{
+    uint32_t lo = 0;
+    uint32_t hi = run->blocks - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        const uint8_t* entry = run->index + run->index_at[mid];
+        if (key_compare((const char*)entry + 2, get16(entry), key, len) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// --- Cursors ---
+
+static void cursor_node(cursor_t* c)
+{
+    c->valid = c->node != NULL;
+    if (c->valid) {
+        c->key = c->node->key;
+        c->key_len = c->node->key_len;
+        c->value = c->node->value;
+        c->value_len = c->node->value_len;
+    }
+}
+
+static void cursor_fail(cursor_t* c)
+{
+    c->error = 1;
+    c->valid = 0;
+}
+
+static int cursor_load(cursor_t* c)
+{
+    if (run_read_block(c->runs[c->run], c->block_no, c->block) != KV_OK) {
+        cursor_fail(c);
+        return KV_ERR_IO;
+    }
+    c->reads++;
+    c->left = get16(c->block);
+    c->pos = 2;
+    return KV_OK;
+}
+
+// Decode the record at c->pos; a malformed one ends the cursor
+static void cursor_decode(cursor_t* c)
+{
+    if (c->left == 0 || c->pos + RECORD_HEAD > BLOCK_SIZE) {
+        cursor_fail(c);
+        return;
+    }
+    const uint8_t* p = c->block + c->pos;
+    uint32_t key_len = get16(p);
+    uint32_t value_len = get16(p + 2);
+    if (key_len == 0 || key_len > KV_KEY_MAX ||
+        (value_len != TOMBSTONE && value_len > KV_VALUE_MAX) ||
+        c->pos + record_size(key_len, value_len) > BLOCK_SIZE) {
+        cursor_fail(c);
+        return;
+    }
+    c->key = (const char*)p + RECORD_HEAD;
+    c->key_len = key_len;
+    c->value = p + RECORD_HEAD + key_len;
+    c->value_len = value_len;
+    c->valid = 1;
+}
+
+static void cursor_next(cursor_t* c)
+{
+    if (!c->valid) return;
+    if (!c->runs) {
+        c->node = c->node->next[0];
+        cursor_node(c);
+        return;
+    }
+
+    c->pos += record_size(c->key_len, c->value_len);
+    if (--c->left == 0) {
+        if (++c->block_no == c->runs[c->run]->blocks) {
+            c->block_no = 0;
+            if (++c->run == c->run_count) {
+                c->valid = 0;
+                return;
+            }
+        }
+        if (cursor_load(c) != KV_OK) return;
+    }
+    cursor_decode(c);
+}
+
+static void cursor_memtable(cursor_t* c, memtable_t* m, const char* key, size_t len)
+{
+    memset(c, 0, sizeof(cursor_t));
+    c->node = key ? memtable_seek(m, key, len, NULL) : m->head->next[0];
+    cursor_node(c);
+}
+
+// First record >= key (NULL: the first) of runs in key order
+static void cursor_runs(cursor_t* c, run_t** runs, int count, uint8_t* block,
+                        const char* key, size_t len)
+{
+    memset(c, 0, sizeof(cursor_t));
+    c->runs = runs;
+    c->run_count = count;
+    c->block = block;
+    while (key && c->run < count && key_compare(runs[c->run]->last, runs[c->run]->last_len, key, len) < 0) {
+        c->run++;
+    }
+    if (c->run == count) return;
+
+    c->block_no = key ? run_find_block(runs[c->run], key, len) : 0;
+    if (cursor_load(c) != KV_OK) return;
+    cursor_decode(c);
+    while (key && c->valid && key_compare(c->key, c->key_len, key, len) < 0) {
+        cursor_next(c);
+    }
+}
+
+// Cursor at the smallest key; on a tie the first (newest) one
+static int merge_pick(cursor_t* c, int n)
+{
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        if (c[i].valid && (best < 0 || key_compare(c[i].key, c[i].key_len, c[best].key, c[best].key_len) < 0)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Step every cursor at 'key' past it, once its newest record has been used
+static void merge_skip(cursor_t* c, int n, const char* key, uint32_t len)
+{
+    for (int i = 0; i < n; i++) {
+        if (c[i].valid && key_compare(c[i].key, c[i].key_len, key, len) == 0) {
+            cursor_next(&c[i]);
+        }
+    }
+}
+
+// --- Writing runs ---
+
+static int writer_begin(writer_t* w, uint32_t id)
+{
+    memset(w, 0, sizeof(writer_t));
+    w->id = id;
+    file_name(w->name, id, ".run");
+    w->block = kmalloc(BLOCK_SIZE);
+    if (!w->block) return KV_ERR_NO_MEMORY;
+    w->block_used = 2;
+    fs_remove(w->name);     // Left by a crash before it was installed
+    return KV_OK;
+}
+
+static void writer_abort(writer_t* w)
+{
+    kfree(w->block);
+    vec_free(&w->index);
+    vec_free(&w->hashes);
+    fs_remove(w->name);
+}
+
+static uint64_t writer_size(const writer_t* w)
+{
+    return w->offset + w->block_used;
+}
+
+static int writer_write_block(writer_t* w)
+{
+    put16(w->block, w->block_records);
+    memset(w->block + w->block_used, 0, BLOCK_SIZE - w->block_used);
+    if (fs_write(w->name, w->offset, w->block, BLOCK_SIZE, FS_CREATE) != BLOCK_SIZE) {
+        return KV_ERR_IO;
+    }
+    w->offset += BLOCK_SIZE;
+    w->blocks++;
+    w->block_used = 2;
+    w->block_records = 0;
+    return KV_OK;
+}
+
+// Records arrive in key order
+static int writer_add(writer_t* w, const char* key, uint32_t key_len,
+                      const uint8_t* value, uint32_t value_len)
+{
+    uint32_t size = record_size(key_len, value_len);
+    if (w->block_records && w->block_used + size > BLOCK_SIZE) {
+        int err = writer_write_block(w);
+        if (err != KV_OK) return err;
+    }
+
+    uint8_t len[2];
+    uint32_t hash = key_hash(key, key_len);
+    put16(len, key_len);
+    if (w->block_records == 0 &&
+        (vec_append(&w->index, len, 2) != KV_OK || vec_append(&w->index, key, key_len) != KV_OK)) {
+        return KV_ERR_NO_MEMORY;
+    }
+    if (vec_append(&w->hashes, &hash, sizeof(hash)) != KV_OK) return KV_ERR_NO_MEMORY;
+
+    uint8_t* p = w->block + w->block_used;
+    put16(p, key_len);
+    put16(p + 2, value_len);
+    memcpy(p + RECORD_HEAD, key, key_len);
+    if (value_bytes(value_len)) {
+        memcpy(p + RECORD_HEAD + key_len, value, value_len);
+    }
+    w->block_used += size;
+    w->block_records++;
+    w->entries++;
+    w->last_len = key_len;
+    memcpy(w->last, key, key_len);
+    return KV_OK;
+}
+
+/*
+ * Write the last block, the index, the filter and the footer; the run
+ * (NULL if nothing was added) goes to *out. Frees the writer either way.
+ */
+static int writer_finish(writer_t* w, run_t** out)
+{
+    *out = NULL;
+    if (w->entries == 0) {
+        writer_abort(w);
+        return KV_OK;
+    }
+
+    uint8_t len[2];
+    put16(len, w->last_len);
+    int err = w->block_records ? writer_write_block(w) : KV_OK;
+    if (err == KV_OK &&
+        (vec_append(&w->index, len, 2) != KV_OK || vec_append(&w->index, w->last, w->last_len) != KV_OK)) {
+        err = KV_ERR_NO_MEMORY;
+    }
+
+    uint32_t bloom_bits = w->entries * KV_BLOOM_BITS;
+    if (bloom_bits < 64) bloom_bits = 64;
+    uint32_t bloom_len = (bloom_bits + 7) / 8;
+    uint32_t tail_len = w->index.len + bloom_len + sizeof(run_footer_t);
+    uint8_t* tail = err == KV_OK ? kmalloc(tail_len) : NULL;
+    run_t* run = err == KV_OK ? kmalloc(sizeof(run_t)) : NULL;
+    if (err == KV_OK && (!tail || !run)) err = KV_ERR_NO_MEMORY;
+
+    if (err == KV_OK) {
+        // Filter: BLOOM_HASHES bits per key by double hashing
+        uint8_t* bloom = tail + w->index.len;
+        memcpy(tail, w->index.data, w->index.len);
+        memset(bloom, 0, bloom_len);
+        for (uint32_t i = 0; i < w->entries; i++) {
+            uint32_t hash;
+            memcpy(&hash, w->hashes.data + i * sizeof(hash), sizeof(hash));
+            uint32_t delta = hash >> 17 | hash << 15;
+            for (int k = 0; k < BLOOM_HASHES; k++) {
+                uint32_t bit = hash % bloom_bits;
+                bloom[bit / 8] |= 1 << (bit % 8);
+                hash += delta;
+            }
+        }
+
+        run_footer_t footer;
+        footer.magic = RUN_MAGIC;
+        footer.blocks = w->blocks;
+        footer.entries = w->entries;
+        footer.index_len = w->index.len;
+        footer.bloom_len = bloom_len;
+        footer.bloom_bits = bloom_bits;
+        footer.check = fnv1a(2166136261U, tail, w->index.len + bloom_len);
+        footer.reserved = 0;
+        memcpy(tail + w->index.len + bloom_len, &footer, sizeof(footer));
+        if (fs_write(w->name, w->offset, tail, tail_len, FS_CREATE) != (long)tail_len) {
+            err = KV_ERR_IO;
+        }
+    }
+
+    if (err == KV_OK) {
+        memset(run, 0, sizeof(run_t));
+        run->id = w->id;
+        run->blocks = w->blocks;
+        run->entries = w->entries;
+        run->bytes = w->offset + tail_len;
+        run->bloom_bits = bloom_bits;
+        err = run_parse(run, tail, w->index.len, bloom_len);
+        tail = NULL;
+        if (err != KV_OK) {
+            run_free(run);
+            run = NULL;
+        }
+    } else {
+        kfree(run);
+        run = NULL;
+    }
+    kfree(tail);
+
+    if (err != KV_OK) {
+        writer_abort(w);
+        return err;
+    }
+    kfree(w->block);
+    vec_free(&w->index);
+    vec_free(&w->hashes);
+    *out = run;
+    return KV_OK;
+}
+
+// --- Levels and the manifest ---
+
+static uint64_t level_target(int level)
+{
+    uint64_t target = KV_L1_BYTES;
+    for (int i = 1; i < level; i++) {
+        target *= KV_LEVEL_RATIO;
+    }
+    return target;
+}
+
+static int level_add(int l, run_t* run)
+{
+    level_t* level = &levels[l];
+    if (level->count == KV_RUNS_MAX) return KV_ERR_NO_MEMORY;
+
+    int at = level->count;
+    if (l > 0) {
+        while (at > 0 && key_compare(level->runs[at - 1]->first, level->runs[at - 1]->first_len,
+                                     run->first, run->first_len) > 0) {
+            level->runs[at] = level->runs[at - 1];
+            at--;
+        }
+    }
+    level->runs[at] = run;
+    level->count++;
+    level->bytes += run->bytes;
+    return KV_OK;
+}
+
+static void level_remove(int l, run_t* run)
+{
+    level_t* level = &levels[l];
+    for (int i = 0; i < level->count; i++) {
+        if (level->runs[i] == run) {
+            for (int j = i + 1; j < level->count; j++) {
+                level->runs[j - 1] = level->runs[j];
+            }
+            level->count--;
+            level->bytes -= run->bytes;
+            return;
+        }
+    }
+}
+
+static int run_count(void)
+{
+    int count = 0;
+    for (int l = 0; l < KV_LEVELS; l++) {
+        count += levels[l].count;
+    }
+    return count;
+}
+
+static const char* manifest_name(uint32_t seq)
+{
+    return seq & 1 ? "kv-manifest.1" : "kv-manifest.0";
+}
+
+// Called in kv_enter(): record the levels, then sync the disk
+static int manifest_write(void)
+{
+    int runs = run_count();
+    size_t size = sizeof(manifest_head_t) + runs * sizeof(manifest_entry_t);
+    uint8_t* buf = kmalloc(size);
+    if (!buf) {
+        stats.errors++;
+        return KV_ERR_NO_MEMORY;
+    }
+
+    manifest_head_t* head = (manifest_head_t*)buf;
+    manifest_entry_t* entries = (manifest_entry_t*)(head + 1);
+    int n = 0;
+    for (int l = 0; l < KV_LEVELS; l++) {
+        for (int i = 0; i < levels[l].count; i++) {
+            entries[n].id = levels[l].runs[i]->id;
+            entries[n].level = l;
+            n++;
+        }
+    }
+    head->magic = MANIFEST_MAGIC;
+    head->seq = manifest_seq + 1;
+    head->next_file = next_file;
+    head->log = imm ? imm->log : mem->log;
+    head->runs = runs;
+    head->check = fnv1a(2166136261U, entries, runs * sizeof(manifest_entry_t));
+
+    long written = fs_write(manifest_name(head->seq), 0, buf, size, FS_CREATE | FS_TRUNCATE);
+    kfree(buf);
+    if (written != (long)size || fs_sync() != FS_OK) {
+        stats.errors++;
+        return KV_ERR_IO;
+    }
+    manifest_seq++;
+    return KV_OK;
+}
+
+// Read a manifest into a buffer; NULL if missing or damaged
+static uint8_t* manifest_read(const char* name)
+{
+    fs_stat_t st;
+    if (fs_stat(name, &st) != FS_OK || st.size < sizeof(manifest_head_t)) return NULL;
+    uint8_t* buf = kmalloc(st.size);
+    if (!buf) return NULL;
+
+    manifest_head_t* head = (manifest_head_t*)buf;
+    if (fs_read(name, 0, buf, st.size) != (long)st.size || head->magic != MANIFEST_MAGIC ||
+        st.size != sizeof(manifest_head_t) + (uint64_t)head->runs * sizeof(manifest_entry_t) ||
+        head->check != fnv1a(2166136261U, head + 1, head->runs * sizeof(manifest_entry_t))) {
+        kfree(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// The newest valid manifest's runs into the levels; its oldest log, 0 if none
+static uint32_t manifest_load(void)
+{
+    uint8_t* m[2] = { manifest_read(manifest_name(0)), manifest_read(manifest_name(1)) };
+    int newest = -1;
+    for (int i = 0; i < 2; i++) {
+        if (m[i] && (newest < 0 || ((manifest_head_t*)m[i])->seq > ((manifest_head_t*)m[newest])->seq)) {
+            newest = i;
+        }
+    }
+    uint32_t log = 0;
+    if (newest >= 0) {
+        manifest_head_t* head = (manifest_head_t*)m[newest];
+        manifest_entry_t* entries = (manifest_entry_t*)(head + 1);
+        manifest_seq = head->seq;
+        next_file = head->next_file;
+        log = head->log;
+        for (uint32_t i = 0; i < head->runs; i++) {
+            run_t* run = entries[i].level < KV_LEVELS ? run_open(entries[i].id) : NULL;
+            if (!run || level_add(entries[i].level, run) != KV_OK) {
+                printf("kv: run %u is unreadable, its keys are lost\n", entries[i].id);
+                if (run) run_free(run);
+                stats.errors++;
+            }
+        }
+    }
+    kfree(m[0]);
+    kfree(m[1]);
+    return log;
+}
+
+// --- Log ---
+
+static void log_remove(uint32_t id)
+{
+    char name[NAME_LEN];
+    file_name(name, id, ".log");
+    fs_remove(name);
+}
+
+// Called in kv_enter(): append the buffered records to the memtable's log
+static int log_write(void)
+{
+    if (log_used == 0) return KV_OK;
+
+    char name[NAME_LEN];
+    file_name(name, mem->log, ".log");
+    if (fs_write(name, 0, log_buf, log_used, FS_CREATE | FS_APPEND) != (long)log_used) {
+        stats.errors++;
+        return KV_ERR_IO;
+    }
+    stats.log_bytes += log_used;
+    log_used = 0;
+    return KV_OK;
+}
+
+static void log_work_fn(void* arg)
+{
+    (void)arg;
+    kv_enter();
+    log_write();
+    kv_leave();
+}
+
+// Called in kv_enter(); returns the record's size or KV_ERR_IO
+static long log_append(const char* key, uint32_t key_len, const void* value, uint32_t value_len)
+{
+    uint32_t size = LOG_HEAD + key_len + value_bytes(value_len);
+    if (log_used + size > LOG_BUFFER && log_write() != KV_OK) {
+        return KV_ERR_IO;
+    }
+
+    uint8_t* p = log_buf + log_used;
+    put16(p + 4, key_len);
+    put16(p + 6, value_len);
+    memcpy(p + LOG_HEAD, key, key_len);
+    if (value_bytes(value_len)) {
+        memcpy(p + LOG_HEAD + key_len, value, value_len);
+    }
+    put32(p, fnv1a(2166136261U, p + 4, size - 4));
+    if (log_used == 0) {
+        work_queue_delayed(&log_work, KV_LOG_FLUSH_MS);
+    }
+    log_used += size;
+    return size;
+}
+
+// Replay a log into a memtable, up to its first torn record
+static int log_replay(uint32_t id, memtable_t* m)
+{
+    char name[NAME_LEN];
+    file_name(name, id, ".log");
+    fs_stat_t st;
+    if (fs_stat(name, &st) != FS_OK || st.size == 0) return 0;
+    uint8_t* buf = kmalloc(st.size);
+    if (!buf) return KV_ERR_NO_MEMORY;
+    if (fs_read(name, 0, buf, st.size) != (long)st.size) {
+        kfree(buf);
+        return KV_ERR_IO;
+    }
+
+    int count = 0;
+    uint64_t pos = 0;
+    while (pos + LOG_HEAD <= st.size) {
+        const uint8_t* p = buf + pos;
+        uint32_t key_len = get16(p + 4);
+        uint32_t value_len = get16(p + 6);
+        uint32_t size = LOG_HEAD + key_len + value_bytes(value_len);
+        if (key_len == 0 || key_len > KV_KEY_MAX ||
+            (value_len != TOMBSTONE && value_len > KV_VALUE_MAX) || pos + size > st.size ||
+            fnv1a(2166136261U, p + 4, size - 4) != get32(p)) {
+            break;
+        }
+        if (memtable_insert(m, (const char*)p + LOG_HEAD, key_len, p + LOG_HEAD + key_len, value_len) != KV_OK) {
+            break;
+        }
+        m->bytes += size;
+        count++;
+        pos += size;
+    }
+    kfree(buf);
+    return count;
+}
+
+// --- Background work ---
+
+static uint32_t file_id_alloc(void)
+{
+    kv_enter();
+    uint32_t id = next_file++;
+    kv_leave();
+    return id;
+}
+
+// Write a frozen memtable as a level-0 run, then forget it and its log
+static int flush_memtable(memtable_t* m)
+{
+    writer_t w;
+    run_t* run = NULL;
+    int err = writer_begin(&w, file_id_alloc());
+    for (node_t* n = m->head->next[0]; n && err == KV_OK; n = n->next[0]) {
+        err = writer_add(&w, n->key, n->key_len, n->value, n->value_len);
+    }
+    if (err == KV_OK) {
+        err = writer_finish(&w, &run);
+    } else {
+        writer_abort(&w);
+    }
+    if (err == KV_OK && fs_sync() != FS_OK) err = KV_ERR_IO;
+
+    kv_enter();
+    if (err == KV_OK && run) err = level_add(0, run);
+    int installed = err == KV_OK;
+    if (installed) {
+        imm = NULL;
+        stats.flushes++;
+        stats.flush_bytes += run ? run->bytes : 0;
+        err = manifest_write();
+        if (err == KV_OK) log_remove(m->log);
+    } else if (run) {
+        run_remove_file(run->id);
+        run_free(run);
+    }
+    kv_leave();
+
+    if (installed) memtable_free(m);
+    return err;
+}
+
+// A deletion can be dropped once no level below 'level' holds the key
+static int key_is_bottom(int level, const char* key, size_t len)
+{
+    for (int l = level + 1; l < KV_LEVELS; l++) {
+        for (int i = 0; i < levels[l].count; i++) {
+            if (run_contains(levels[l].runs[i], key, len)) return 0;
+        }
+    }
+    return 1;
+}
+
+// Level over its size by the most (level 0: by run count), -1 if none
+static int pick_level(void)
+{
+    int best = -1;
+    unsigned long best_score = 99;
+    for (int l = 0; l < KV_LEVELS - 1; l++) {
+        unsigned long score = l == 0 ? levels[0].count * 100UL / KV_L0_COMPACT
+                                     : (unsigned long)(levels[l].bytes * 100 / level_target(l));
+        if (score > best_score) {
+            best = l;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+/*
+ * Called in kv_enter(): choose the job's inputs. Level 0 runs overlap, so
+ * all of them go; a deeper level gives one run, taking turns through its
+ * key range. Then every run of the next level that overlaps them.
+ */
+static void job_prepare(int level)
+{
+    job.level = level;
+    job.upper_count = 0;
+    job.lower_count = 0;
+
+    const char* lo;
+    const char* hi;
+    size_t lo_len, hi_len;
+    if (level == 0) {
+        lo = levels[0].runs[0]->first;
+        lo_len = levels[0].runs[0]->first_len;
+        hi = levels[0].runs[0]->last;
+        hi_len = levels[0].runs[0]->last_len;
+        for (int i = 0; i < levels[0].count; i++) {
+            run_t* run = levels[0].runs[i];
+            job.upper[job.upper_count++] = run;
+            if (key_compare(run->first, run->first_len, lo, lo_len) < 0) {
+                lo = run->first;
+                lo_len = run->first_len;
+            }
+            if (key_compare(run->last, run->last_len, hi, hi_len) > 0) {
+                hi = run->last;
+                hi_len = run->last_len;
+            }
+        }
+    } else {
+        const char* from = compact_from[level];
+        int pick = 0;
+        while (pick < levels[level].count &&
+               key_compare(levels[level].runs[pick]->first, levels[level].runs[pick]->first_len,
+                           from, strlen(from)) <= 0) {
+            pick++;
+        }
+        if (pick == levels[level].count) pick = 0;
+        run_t* run = levels[level].runs[pick];
+        job.upper[job.upper_count++] = run;
+        strcpy(compact_from[level], run->last);
+        lo = run->first;
+        lo_len = run->first_len;
+        hi = run->last;
+        hi_len = run->last_len;
+    }
+
+    for (int i = 0; i < levels[level + 1].count; i++) {
+        run_t* run = levels[level + 1].runs[i];
+        if (key_compare(run->last, run->last_len, lo, lo_len) >= 0 &&
+            key_compare(run->first, run->first_len, hi, hi_len) <= 0) {
+            job.lower[job.lower_count++] = run;
+        }
+    }
+}
+
+// Merge the job's runs into new runs for the next level and install them
+static int compact_job(void)
+{
+    int n = 0;
+    int err = KV_OK;
+    for (int i = job.upper_count - 1; i >= 0; i--) {
+        job_cursors[n++].runs = &job.upper[i];
+    }
+    if (job.lower_count) {
+        job_cursors[n++].runs = job.lower;
+    }
+    uint64_t read_bytes = 0;
+    for (int i = 0; i < n; i++) {
+        run_t** runs = job_cursors[i].runs;
+        int count = runs == job.lower ? job.lower_count : 1;
+        uint8_t* block = kmalloc(BLOCK_SIZE);
+        if (block) {
+            cursor_runs(&job_cursors[i], runs, count, block, NULL, 0);
+        } else {
+            memset(&job_cursors[i], 0, sizeof(cursor_t));
+            err = KV_ERR_NO_MEMORY;
+        }
+        for (int r = 0; r < count; r++) {
+            read_bytes += runs[r]->bytes;
+        }
+    }
+
+    writer_t w;
+    int open = 0;
+    int outputs = 0;
+    unsigned long dropped = 0;
+    int pick;
+    while (err == KV_OK && (pick = merge_pick(job_cursors, n)) >= 0) {
+        cursor_t* c = &job_cursors[pick];
+        char key[KV_KEY_MAX];
+        uint32_t key_len = c->key_len;
+        memcpy(key, c->key, key_len);
+
+        if (c->value_len == TOMBSTONE && key_is_bottom(job.level + 1, key, key_len)) {
+            dropped++;
+        } else {
+            if (open && writer_size(&w) >= KV_RUN_BYTES) {
+                open = 0;
+                err = writer_finish(&w, &job_outputs[outputs]);
+                if (err == KV_OK && job_outputs[outputs]) outputs++;
+            }
+            if (err == KV_OK && !open && outputs == KV_RUNS_MAX) {
+                err = KV_ERR_NO_MEMORY;
+            } else if (err == KV_OK && !open) {
+                err = writer_begin(&w, file_id_alloc());
+                open = 1;
+            }
+            if (err == KV_OK) {
+                err = writer_add(&w, key, key_len, c->value, c->value_len);
+            }
+        }
+        merge_skip(job_cursors, n, key, key_len);
+    }
+    for (int i = 0; i < n; i++) {
+        if (job_cursors[i].error) err = KV_ERR_IO;
+        kfree(job_cursors[i].block);
+    }
+    if (open) {
+        if (err == KV_OK) {
+            err = writer_finish(&w, &job_outputs[outputs]);
+            if (err == KV_OK && job_outputs[outputs]) outputs++;
+        } else {
+            writer_abort(&w);
+        }
+    }
+    if (err == KV_OK && fs_sync() != FS_OK) err = KV_ERR_IO;
+
+    kv_enter();
+    int lower = job.level + 1;
+    if (err == KV_OK && levels[lower].count - job.lower_count + outputs > KV_RUNS_MAX) {
+        err = KV_ERR_NO_MEMORY;
+    }
+    if (err != KV_OK) {
+        kv_leave();
+        for (int i = 0; i < outputs; i++) {
+            run_remove_file(job_outputs[i]->id);
+            run_free(job_outputs[i]);
+        }
+        return err;
+    }
+
+    uint64_t written = 0;
+    for (int i = 0; i < job.upper_count; i++) {
+        level_remove(job.level, job.upper[i]);
+    }
+    for (int i = 0; i < job.lower_count; i++) {
+        level_remove(lower, job.lower[i]);
+    }
+    for (int i = 0; i < outputs; i++) {
+        level_add(lower, job_outputs[i]);
+        written += job_outputs[i]->bytes;
+    }
+    stats.compactions++;
+    stats.compact_read += read_bytes;
+    stats.compact_bytes += written;
+    stats.tombstones_dropped += dropped;
+    err = manifest_write();
+    if (err == KV_OK) {
+        for (int i = 0; i < job.upper_count; i++) {
+            run_remove_file(job.upper[i]->id);
+        }
+        for (int i = 0; i < job.lower_count; i++) {
+            run_remove_file(job.lower[i]->id);
+        }
+    }
+    kv_leave();
+
+    // No lookup can reach the inputs now
+    for (int i = 0; i < job.upper_count; i++) {
+        run_free(job.upper[i]);
+    }
+    for (int i = 0; i < job.lower_count; i++) {
+        run_free(job.lower[i]);
+    }
+    return err;
+}
+
+static int background_done(int err)
+{
+    kv_enter();
+    background_running = 0;
+    background_error = err != KV_OK;
+    if (err != KV_OK) stats.errors++;
+    kv_leave();
+    return err == KV_OK;
+}
+
+/*
+ * One piece of background work: write out the frozen memtable, else
+ * move or merge a run out of the level furthest over its size. Returns 1
+ * if it did something.
+ */
+static int background_step(void)
+{
+    kv_enter();
+    if (background_running) {
+        kv_leave();
+        return 0;
+    }
+    if (imm) {
+        memtable_t* m = imm;
+        background_running = 1;
+        kv_leave();
+        return background_done(flush_memtable(m));
+    }
+
+    int level = pick_level();
+    if (level < 0) {
+        kv_leave();
+        return 0;
+    }
+    job_prepare(level);
+
+    // Nothing below overlaps a single run: move it down without a rewrite
+    if (job.upper_count == 1 && job.lower_count == 0 && levels[level + 1].count < KV_RUNS_MAX) {
+        level_remove(level, job.upper[0]);
+        level_add(level + 1, job.upper[0]);
+        stats.moves++;
+        int err = manifest_write();
+        background_error = err != KV_OK;
+        kv_leave();
+        return err == KV_OK;
+    }
+    background_running = 1;
+    kv_leave();
+    return background_done(compact_job());
+}
+
+static void kick(void)
+{
+    if (worker < 0) return;
+
+    unsigned long flags = spin_lock_irqsave(&kick_lock);
+    kicked = 1;
+    int wake = worker_parked;
+    worker_parked = 0;
+    spin_unlock_irqrestore(&kick_lock, flags);
+
+    if (wake) thread_wake(worker);
+}
+
+static void background_main(void* arg)
+{
+    (void)arg;
+    while (1) {
+        unsigned long flags = spin_lock_irqsave(&kick_lock);
+        while (!kicked) {
+            worker_parked = 1;
+            thread_block(&kick_lock);
+            spin_lock(&kick_lock);
+        }
+        kicked = 0;
+        spin_unlock_irqrestore(&kick_lock, flags);
+
+        while (background_step()) {
+        }
+    }
+}
+
+// Called in kv_enter(): let the background work catch up (without a thread, do it)
+static void wait_background(void)
+{
+    kv_leave();
+    if (worker >= 0) {
+        kick();
+        thread_yield();
+    } else {
+        while (background_step()) {
+        }
+    }
+    kv_enter();
+}
+
+// Called in kv_enter(): hand the memtable to the background thread
+static int freeze(void)
+{
+    if (log_write() != KV_OK) return KV_ERR_IO;
+    memtable_t* fresh = memtable_create(next_file);
+    if (!fresh) return KV_ERR_NO_MEMORY;
+    next_file++;
+    imm = mem;
+    mem = fresh;
+    kick();
+    return KV_OK;
+}
+
+/*
+ * Called in kv_enter() before a write: stall while level 0 is too deep,
+ * or while the memtable is full and the last one is still being written
+ */
+static int make_room(void)
+{
+    int stalled = 0;
+    while (levels[0].count >= KV_L0_STOP || (mem->bytes >= KV_MEMTABLE_BYTES && imm)) {
+        if (!stalled) {
+            stats.stalls++;
+            background_error = 0;
+        } else if (background_error) {
+            return KV_ERR_IO;
+        }
+        stalled = 1;
+        wait_background();
+    }
+    return mem->bytes >= KV_MEMTABLE_BYTES ? freeze() : KV_OK;
+}
+
+static int write_record(const char* key, uint32_t key_len, const void* value, uint32_t value_len)
+{
+    kv_enter();
+    int err = make_room();
+    long size = err == KV_OK ? log_append(key, key_len, value, value_len) : err;
+    if (size < 0) {
+        err = size;
+    } else {
+        err = memtable_insert(mem, key, key_len, value, value_len);
+        mem->bytes += size;
+    }
+    if (err == KV_OK) {
+        if (value_len == TOMBSTONE) {
+            stats.deletes++;
+        } else {
+            stats.puts++;
+        }
+        stats.user_bytes += key_len + value_bytes(value_len);
+    }
+    kv_leave();
+    return err;
+}
+
+// --- Boot ---
+
+static void collect_file(const char* name, const fs_stat_t* st, void* arg)
+{
+    file_scan_t* scan = arg;
+    uint32_t id;
+    int is_log;
+    (void)st;
+    if (parse_file_name(name, &id, &is_log) == 0 && scan->count < SCAN_FILES_MAX) {
+        scan->ids[scan->count] = id;
+        scan->is_log[scan->count] = is_log;
+        scan->count++;
+    }
+}
+
+static int run_installed(uint32_t id)
+{
+    for (int l = 0; l < KV_LEVELS; l++) {
+        for (int i = 0; i < levels[l].count; i++) {
+            if (levels[l].runs[i]->id == id) return 1;
+        }
+    }
+    return 0;
+}
+
+void kv_init(void)
+{
+    spin_lock_init(&kv_lock, "kv");
+    spin_lock_init(&kick_lock, "kv_kick");
+
+    if (!fs_mounted()) return;
+
+    file_scan_t* scan = kmalloc(sizeof(file_scan_t));
+    log_buf = kmalloc(LOG_BUFFER);
+    lookup_block = kmalloc(BLOCK_SIZE);
+    if (!scan || !log_buf || !lookup_block) {
+        puts("kv: out of memory");
+        kfree(scan);
+        return;
+    }
+    work_init(&log_work, log_work_fn, NULL);
+    uint64_t start = timer_ticks();
+
+    uint32_t oldest_log = manifest_load();
+    scan->count = 0;
+    fs_list(collect_file, scan);
+    for (int i = 0; i < scan->count; i++) {
+        if (scan->ids[i] >= next_file) next_file = scan->ids[i] + 1;
+    }
+
+    // Replay the logs still needed, oldest first, into one memtable
+    mem = memtable_create(0);
+    if (!mem) {
+        puts("kv: out of memory");
+        kfree(scan);
+        return;
+    }
+    uint32_t replayed = oldest_log;
+    while (1) {
+        int next = -1;
+        for (int i = 0; i < scan->count; i++) {
+            if (scan->is_log[i] && scan->ids[i] >= replayed &&
+                (next < 0 || scan->ids[i] < scan->ids[next])) {
+                next = i;
+            }
+        }
+        if (next < 0) break;
+        int count = log_replay(scan->ids[next], mem);
+        if (count < 0) {
+            printf("kv: log %u is unreadable\n", scan->ids[next]);
+            stats.errors++;
+        } else {
+            stats.recovered += count;
+        }
+        replayed = scan->ids[next] + 1;
+    }
+
+    // Write the replayed keys out as a run, then start a fresh log
+    mem->log = next_file++;
+    if (mem->entries) {
+        imm = mem;
+        mem = memtable_create(next_file++);
+        if (!mem || flush_memtable(imm) != KV_OK) {
+            puts("kv: could not write the recovered keys");
+            kfree(scan);
+            return;
+        }
+    } else {
+        kv_enter();
+        manifest_write();
+        kv_leave();
+    }
+
+    // Whatever the manifest does not need was left by a crash
+    for (int i = 0; i < scan->count; i++) {
+        if (scan->is_log[i] ? scan->ids[i] < mem->log : !run_installed(scan->ids[i])) {
+            if (scan->is_log[i]) {
+                log_remove(scan->ids[i]);
+            } else {
+                run_remove_file(scan->ids[i]);
+            }
+        }
+    }
+    kfree(scan);
+
+    worker = thread_create("kv", background_main, NULL, 0);
+    if (worker < 0) {
+        puts("Warning: no kv thread; writes will compact in line");
+    }
+    ready = 1;
+    printf("kv: %d runs, %lu log records replayed in %lu us\n", run_count(), stats.recovered,
+           (unsigned long)timer_ticks_to_us(timer_ticks() - start));
+}
+
+int kv_ready(void)
+{
+    return ready;
+}
+
+// --- Operations ---
+
+static int check_key(const char* key, size_t* len)
+{
+    if (!ready) return KV_ERR_NOT_READY;
+    *len = key ? strlen(key) : 0;
+    return *len == 0 || *len > KV_KEY_MAX ? KV_ERR_INVALID : KV_OK;
+}
+
+int kv_put(const char* key, const void* value, size_t len)
+{
+    size_t key_len;
+    int err = check_key(key, &key_len);
+    if (err != KV_OK) return err;
+    if (len > KV_VALUE_MAX) return KV_ERR_INVALID;
+    return write_record(key, key_len, value, len);
+}
+
+int kv_delete(const char* key)
+{
+    size_t key_len;
+    int err = check_key(key, &key_len);
+    if (err != KV_OK) return err;
+    return write_record(key, key_len, NULL, TOMBSTONE);
+}
+
+static int copy_value(const uint8_t* value, uint32_t value_len, void* buf, size_t max)
+{
+    if (value_len == TOMBSTONE) return KV_ERR_NOT_FOUND;
+    size_t n = value_len < max ? value_len : max;
+    if (n) memcpy(buf, value, n);
+    return value_len;
+}
+
+/*
+ * Called in kv_enter(): level 0 newest first, then the one run per
+ * deeper level whose range holds the key. The filter rules most runs
+ * out; the index then names the only block that can hold the key.
+ */
+static int runs_get(const char* key, size_t len, void* buf, size_t max)
+{
+    uint32_t hash = key_hash(key, len);
+    for (int l = 0; l < KV_LEVELS; l++) {
+        level_t* level = &levels[l];
+        if (level->count == 0) continue;
+        int i = l == 0 ? level->count - 1 : 0;
+        int end = -1;
+        if (l > 0) {
+            // Runs are disjoint: binary search for the last run starting <= key
+            int lo = 0;
+            int hi = level->count - 1;
+            while (lo < hi) {
+                int mid = (lo + hi + 1) / 2;
+                if (key_compare(level->runs[mid]->first, level->runs[mid]->first_len, key, len) <= 0) {
+                    lo = mid;
+                } else {
+                    hi = mid - 1;
+                }
+            }
+            i = lo;
+            end = lo + 1;
+        }
+
+        for (; i != end; i += l == 0 ? -1 : 1) {
+            const run_t* run = level->runs[i];
+            if (!run_contains(run, key, len)) continue;
+            stats.run_probes++;
+            if (!bloom_may_contain(run, hash)) {
+                stats.bloom_skips++;
+                continue;
+            }
+
+            // Only the block the index names can hold the key
+            cursor_t c;
+            memset(&c, 0, sizeof(c));
+            c.runs = &level->runs[i];
+            c.run_count = 1;
+            c.block = lookup_block;
+            c.block_no = run_find_block(run, key, len);
+            if (cursor_load(&c) != KV_OK) return KV_ERR_IO;
+            stats.blocks_read++;
+            cursor_decode(&c);
+            while (c.valid) {
+                int cmp = key_compare(c.key, c.key_len, key, len);
+                if (cmp == 0) return copy_value(c.value, c.value_len, buf, max);
+                if (cmp > 0 || c.left == 1) break;
+                cursor_next(&c);
+            }
+            if (c.error) return KV_ERR_IO;
+            stats.bloom_false++;
+        }
+    }
+    return KV_ERR_NOT_FOUND;
+}
+
+int kv_get(const char* key, void* buf, size_t max)
+{
+    size_t len;
+    int err = check_key(key, &len);
+    if (err != KV_OK) return err;
+
+    kv_enter();
+    stats.gets++;
+    node_t* n = memtable_get(mem, key, len);
+    if (!n && imm) n = memtable_get(imm, key, len);
+    int result;
+    if (n) {
+        stats.memtable_hits++;
+        result = copy_value(n->value, n->value_len, buf, max);
+    } else {
+        result = runs_get(key, len, buf, max);
+    }
+    kv_leave();
+    return result;
+}
+
+int kv_scan(const char* start, int limit, kv_scan_fn fn, void* arg)
+{
+    if (!ready) return KV_ERR_NOT_READY;
+    size_t len = start ? strlen(start) : 0;
+    if (len == 0) start = NULL;
+
+    kv_enter();
+    stats.scans++;
+
+    // Newest first: memtables, level-0 runs, then one cursor per deeper level
+    int n = 0;
+    int err = KV_OK;
+    cursor_memtable(&scan_cursors[n++], mem, start, len);
+    if (imm) cursor_memtable(&scan_cursors[n++], imm, start, len);
+    for (int l = 0; l < KV_LEVELS && err == KV_OK; l++) {
+        int cursors = l == 0 ? levels[0].count : (levels[l].count ? 1 : 0);
+        for (int i = 0; i < cursors && err == KV_OK; i++) {
+            if (!scan_blocks[n]) scan_blocks[n] = kmalloc(BLOCK_SIZE);
+            if (!scan_blocks[n]) {
+                err = KV_ERR_NO_MEMORY;
+                break;
+            }
+            if (l == 0) {
+                cursor_runs(&scan_cursors[n], &levels[0].runs[levels[0].count - 1 - i], 1,
+                            scan_blocks[n], start, len);
+            } else {
+                cursor_runs(&scan_cursors[n], levels[l].runs, levels[l].count, scan_blocks[n], start, len);
+            }
+            n++;
+        }
+    }
+
+    int count = 0;
+    int pick;
+    while (err == KV_OK && count < limit && (pick = merge_pick(scan_cursors, n)) >= 0) {
+        cursor_t* c = &scan_cursors[pick];
+        char key[KV_KEY_MAX + 1];
+        uint32_t key_len = c->key_len;
+        memcpy(key, c->key, key_len);
+        key[key_len] = '\0';
+        if (c->value_len != TOMBSTONE) {
+            fn(key, c->value, c->value_len, arg);
+            count++;
+        }
+        merge_skip(scan_cursors, n, key, key_len);
+        if (cancel_requested()) break;
+    }
+    for (int i = 0; i < n; i++) {
+        stats.blocks_read += scan_cursors[i].reads;
+        if (scan_cursors[i].error) err = KV_ERR_IO;
+    }
+    kv_leave();
+    return err == KV_OK ? count : err;
+}
+
+int kv_sync(void)
+{
+    if (!ready) return KV_ERR_NOT_READY;
+
+    kv_enter();
+    int err = log_write();
+    kv_leave();
+    if (err == KV_OK && fs_sync() != FS_OK) err = KV_ERR_IO;
+    return err;
+}
+
+int kv_compact(void)
+{
+    if (!ready) return KV_ERR_NOT_READY;
+
+    int err = KV_OK;
+    kv_enter();
+    background_error = 0;
+    while (err == KV_OK && imm && mem->entries) {
+        wait_background();
+        if (background_error) err = KV_ERR_IO;
+    }
+    if (err == KV_OK && mem->entries) {
+        err = freeze();
+    }
+    while (err == KV_OK && (imm || background_running || pick_level() >= 0)) {
+        wait_background();
+        if (background_error) err = KV_ERR_IO;
+    }
+    kv_leave();
+    return err;
+}
+
+const kv_stats_t* kv_stats(void)
+{
+    return &stats;
+}
+
+void kv_reset_stats(void)
+{
+    kv_enter();
+    unsigned long recovered = stats.recovered;
+    memset(&stats, 0, sizeof(stats));
+    stats.recovered = recovered;
+    kv_leave();
+}
+
+const char* kv_error(int err)
+{
+    switch (err) {
+    case KV_OK:             return "success";
+    case KV_ERR_NOT_FOUND:  return "no such key";
+    case KV_ERR_NOT_READY:  return "no key-value store (no filesystem)";
+    case KV_ERR_INVALID:    return "keys are 1-64 bytes, values at most 1024";
+    case KV_ERR_IO:         return "I/O error";
+    case KV_ERR_NO_MEMORY:  return "out of memory";
+    default:                return "unknown error";
+    }
+}
+
+// --- Display ---
+
+// "N.Nx", rounded down
+static void print_ratio(unsigned long num, unsigned long den)
+{
+    unsigned long tenths = den ? num * 10 / den : 0;
+    printf("%lu.%lux", tenths / 10, tenths % 10);
+}
+
+static unsigned long bytes_written(const kv_stats_t* s)
+{
+    return s->log_bytes + s->flush_bytes + s->compact_bytes;
+}
+
+void kv_print(void)
+{
+    if (!ready) {
+        puts("No key-value store (no filesystem)");
+        return;
+    }
+
+    kv_enter();
+    printf("Memtable: %u keys, %u KB of log; frozen: ", mem->entries, mem->bytes / 1024);
+    if (imm) {
+        printf("%u keys being written\n", imm->entries);
+    } else {
+        puts("none");
+    }
+    printf("Background: %s%s\n", background_running ? "working" : "idle",
+           background_error ? " (last job failed)" : "");
+    puts("");
+    puts("Level  Runs   KB        Limit");
+    for (int l = 0; l < KV_LEVELS; l++) {
+        print_uint_padded(l, 7);
+        print_uint_padded(levels[l].count, 7);
+        print_uint_padded((unsigned long)(levels[l].bytes / 1024), 10);
+        if (l == 0) {
+            printf("%d runs\n", KV_L0_COMPACT);
+        } else if (l < KV_LEVELS - 1) {
+            printf("%lu KB\n", (unsigned long)(level_target(l) / 1024));
+        } else {
+            puts("-");
+        }
+    }
+    if (run_count()) {
+        puts("");
+        puts("Run      Level  Keys     KB      Range");
+        for (int l = 0; l < KV_LEVELS; l++) {
+            for (int i = 0; i < levels[l].count; i++) {
+                const run_t* run = levels[l].runs[i];
+                print_uint_padded(run->id, 9);
+                print_uint_padded(l, 7);
+                print_uint_padded(run->entries, 9);
+                print_uint_padded((unsigned long)(run->bytes / 1024), 8);
+                printf("%s .. %s\n", run->first, run->last);
+            }
+        }
+    }
+    puts("");
+    printf("Operations:  %lu puts, %lu deletes, %lu gets, %lu scans, %lu stalled writes\n",
+           stats.puts, stats.deletes, stats.gets, stats.scans, stats.stalls);
+    printf("Lookups:     %lu memtable hits, %lu run probes, %lu skipped by filters, %lu false positives, %lu blocks read\n",
+           stats.memtable_hits, stats.run_probes, stats.bloom_skips, stats.bloom_false, stats.blocks_read);
+    printf("Background:  %lu flushes, %lu compactions, %lu moves, %lu tombstones dropped, %lu errors\n",
+           stats.flushes, stats.compactions, stats.moves, stats.tombstones_dropped, stats.errors);
+    printf("Bytes:       %lu KB put; written %lu KB log, %lu KB flushes, %lu KB compaction (%lu KB merged)\n",
+           stats.user_bytes / 1024, stats.log_bytes / 1024, stats.flush_bytes / 1024,
+           stats.compact_bytes / 1024, stats.compact_read / 1024);
+    printf("Write amplification: ");
+    print_ratio(bytes_written(&stats), stats.user_bytes);
+    puts("");
+    printf("Boot:        %lu log records replayed\n", stats.recovered);
+    kv_leave();
+}
+
+// --- Benchmark ---
+
+static volatile uint32_t bench_busy;    // A run is in progress
+
+static uint64_t bench_seed = 0x9E3779B97F4A7C15UL;
+
+static uint64_t bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+// "bench" and 'n' in 8 digits, then 'suffix'
+static void bench_key(char* out, unsigned long n, const char* suffix)
+{
+    strcpy(out, "bench");
+    for (int i = 12; i >= 5; i--) {
+        out[i] = '0' + n % 10;
+        n /= 10;
+    }
+    strcpy(out + 13, suffix);
+}
+
+static unsigned long gcd(unsigned long a, unsigned long b)
+{
+    while (b) {
+        unsigned long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static unsigned long per_second(unsigned long count, uint64_t us)
+{
+    return us ? (unsigned long)(count * 1000000ULL / us) : 0;
+}
+
+static void bench_count(const char* key, const void* value, size_t len, void* arg)
+{
+    (void)key;
+    (void)value;
+    (void)len;
+    (*(unsigned long*)arg)++;
+}
+
+static void kv_bench_run(unsigned long ops, size_t value_size)
+{
+    if (!ready) {
+        puts("No key-value store (no filesystem)");
+        return;
+    }
+    uint8_t* value = kmalloc(value_size ? value_size : 1);
+    if (!value) {
+        puts("kv bench: out of memory");
+        return;
+    }
+    for (size_t i = 0; i < value_size; i++) {
+        value[i] = 'a' + i % 26;
+    }
+
+    // Every key once, in an order scattered by a stride coprime to 'ops'
+    unsigned long stride = (ops * 618 / 1000) | 1;
+    while (gcd(stride, ops) != 1) stride += 2;
+
+    kv_stats_t before = stats;
+    char key[24];
+    int err = KV_OK;
+    unsigned long done = 0;
+    uint64_t start = timer_ticks();
+    while (done < ops && !cancel_requested()) {
+        bench_key(key, (unsigned long)((uint64_t)done * stride % ops), "");
+        err = kv_put(key, value, value_size);
+        if (err != KV_OK) break;
+        done++;
+    }
+    uint64_t fill_us = timer_ticks_to_us(timer_ticks() - start);
+    printf("Fill:    %lu puts of %lu byte values, random order: %lu ops/s, %lu stalls\n",
+           done, (unsigned long)value_size, per_second(done, fill_us), stats.stalls - before.stalls);
+
+    if (err == KV_OK && !cancel_requested()) {
+        start = timer_ticks();
+        err = kv_compact();
+        printf("Settle:  memtable written and levels compacted in %lu ms\n",
+               (unsigned long)(timer_ticks_to_us(timer_ticks() - start) / 1000));
+    }
+
+    if (err == KV_OK && !cancel_requested()) {
+        kv_stats_t mark = stats;
+        unsigned long found = 0;
+        start = timer_ticks();
+        for (done = 0; done < ops && !cancel_requested(); done++) {
+            bench_key(key, bench_random() % ops, "");
+            if (kv_get(key, value, value_size) == (int)value_size) found++;
+        }
+        uint64_t us = timer_ticks_to_us(timer_ticks() - start);
+        printf("Read:    %lu gets: %lu ops/s, %lu found, %lu blocks read per 100 gets\n",
+               done, per_second(done, us), found,
+               done ? (stats.blocks_read - mark.blocks_read) * 100 / done : 0);
+
+        // Between two stored keys, so only the filters can rule runs out
+        mark = stats;
+        start = timer_ticks();
+        for (done = 0; done < ops && !cancel_requested(); done++) {
+            bench_key(key, bench_random() % ops, "x");
+            kv_get(key, value, value_size);
+        }
+        us = timer_ticks_to_us(timer_ticks() - start);
+        printf("Miss:    %lu gets of absent keys: %lu ops/s, %lu of %lu run probes skipped by filters\n",
+               done, per_second(done, us), stats.bloom_skips - mark.bloom_skips,
+               stats.run_probes - mark.run_probes);
+
+        unsigned long scanned = 0;
+        start = timer_ticks();
+        kv_scan("bench", (int)ops, bench_count, &scanned);
+        us = timer_ticks_to_us(timer_ticks() - start);
+        printf("Scan:    %lu keys in order: %lu keys/s\n", scanned, per_second(scanned, us));
+    }
+    kfree(value);
+
+    unsigned long user = stats.user_bytes - before.user_bytes;
+    printf("Writes:  %lu KB put, %lu KB written (log %lu, flushes %lu, compaction %lu): write amplification ",
+           user / 1024, (bytes_written(&stats) - bytes_written(&before)) / 1024,
+           (stats.log_bytes - before.log_bytes) / 1024, (stats.flush_bytes - before.flush_bytes) / 1024,
+           (stats.compact_bytes - before.compact_bytes) / 1024);
+    print_ratio(bytes_written(&stats) - bytes_written(&before), user);
+    puts("");
+    if (err != KV_OK) {
+        printf("kv bench: %s\n", kv_error(err));
+    }
+}
+
+void kv_bench(unsigned long ops, size_t value_size)
+{
+    // Runs write the same bench keys: one at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("Key-value benchmark already running");
+        return;
+    }
+    kv_bench_run(ops, value_size);
+    atomic_store_release(&bench_busy, 0);
+}
@@ -0,0 +1,339 @@
+/*
+ * Line Editor Implementation
+ * Gap buffer keeps inserts/deletes at the cursor O(1); the renderer diffs
+ * the logical line against what the terminal shows and emits only the
+ * cursor moves and changed cells (using ANSI insert/delete character when
+ * that is cheaper than repainting the tail). Lines longer than the rest
+ * of the prompt row wrap at LINEEDIT_COLUMNS; the cursor then moves by
+ * row and column, and changes are repainted rather than shifted.
+ */
+
+#include "lineedit.h"
+#include "uart.h"
+
+// Gap size and logical length helpers
+static int gap_size(const line_editor_t* le)
+{
+    return le->gap_end - le->gap_start;
+}
+
+int lineedit_length(const line_editor_t* le)
+{
+    return LINEEDIT_MAX - gap_size(le);
+}
+
+int lineedit_cursor(const line_editor_t* le)
+{
+    return le->gap_start;
+}
+
+char lineedit_char_at(const line_editor_t* le, int index)
+{
+    if (index < le->gap_start) {
+        return le->text[index];
+    }
+    return le->text[index + gap_size(le)];
+}
+
+/*
+ * Start editing a new, empty line of at most 'limit' characters
+ */
+void lineedit_begin(line_editor_t* le, int limit, int origin)
+{
+    if (limit > LINEEDIT_MAX) limit = LINEEDIT_MAX;
+    if (limit < 0) limit = 0;
+    if (origin < 0) origin = 0;
+
+    le->limit = limit;
+    le->origin = origin % LINEEDIT_COLUMNS;
+    le->gap_start = 0;
+    le->gap_end = LINEEDIT_MAX;
+    le->shown_len = 0;
+    le->shown_cursor = 0;
+}
+
+/*
+ * Forget what the terminal shows - the caller has just printed a fresh
+ * prompt, so the next refresh repaints the whole line
+ */
+void lineedit_invalidate(line_editor_t* le)
+{
+    le->shown_len = 0;
+    le->shown_cursor = 0;
+}
+
+/*
+ * Copy the logical line out as a NUL-terminated string
+ */
+int lineedit_copy(const line_editor_t* le, char* dest, int max_size)
+{
+    if (!dest || max_size <= 0) return -1;
+
+    int len = lineedit_length(le);
+    if (len > max_size - 1) len = max_size - 1;
+
+    for (int i = 0; i < len; i++) {
+        dest[i] = lineedit_char_at(le, i);
+    }
+    dest[len] = '\0';
+    return len;
+}
+
+int lineedit_insert(line_editor_t* le, char c)
+{
+    if (lineedit_length(le) >= le->limit) return -1;
+
+    le->text[le->gap_start++] = c;
+    return 0;
+}
+
+int lineedit_insert_string(line_editor_t* le, const char* str)
+{
+    if (!str) return -1;
+
+    while (*str) {
+        if (lineedit_insert(le, *str++) != 0) return -1;
+    }
+    return 0;
+}
+
+int lineedit_backspace(line_editor_t* le)
+{
+    if (le->gap_start == 0) return -1;
+
+    le->gap_start--;
+    return 0;
+}
+
+int lineedit_delete(line_editor_t* le)
+{
+    if (le->gap_end == LINEEDIT_MAX) return -1;
+
+    le->gap_end++;
+    return 0;
+}
+
+/*
+ * Move the cursor (and with it the gap) - cost is the distance moved
+ */
+void lineedit_move_to(line_editor_t* le, int position)
+{
+    int len = lineedit_length(le);
+    if (position < 0) position = 0;
+    if (position > len) position = len;
+
+    while (le->gap_start > position) {
+        le->text[--le->gap_end] = le->text[--le->gap_start];
+    }
+    while (le->gap_start < position) {
+        le->text[le->gap_start++] = le->text[le->gap_end++];
+    }
+}
+
+/*
+ * Replace the whole line (history recall); cursor ends up at the end
+ */
+void lineedit_set_text(line_editor_t* le, const char* str)
+{
+    int len = 0;
+
+    while (str && str[len] && len < le->limit) {
+        le->text[len] = str[len];
+        len++;
+    }
+    le->gap_start = len;
+    le->gap_end = LINEEDIT_MAX;
+}
+
+// Number of decimal digits in a positive count
+static int count_digits(int n)
+{
+    int digits = 1;
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+// Bytes needed for an ESC [ n <final> sequence (n omitted when 1)
+static int csi_cost(int n)
+{
+    return 3 + (n > 1 ? count_digits(n) : 0);
+}
+
+// Emit ESC [ n <final>
+static void emit_csi(int n, char final)
+{
+    char digits[12];
+    int i = 0;
+
+    putchar('\x1b');
+    putchar('[');
+    if (n > 1) {
+        while (n > 0) {
+            digits[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+        while (i > 0) {
+            putchar(digits[--i]);
+        }
+    }
+    putchar(final);
+}
+
+// Screen row (from the prompt's row) and column of a line position
+static int row_of(const line_editor_t* le, int pos)
+{
+    return (le->origin + pos) / LINEEDIT_COLUMNS;
+}
+
+static int column_of(const line_editor_t* le, int pos)
+{
+    return (le->origin + pos) % LINEEDIT_COLUMNS;
+}
+
+/*
+ * Move the terminal cursor to a line position using the cheapest encoding:
+ * within a row, backspaces or re-sent characters for short hops and
+ * CUB/CUF otherwise; across rows, CUU/CUD and then the column
+ */
+static void move_terminal_cursor(line_editor_t* le, int target)
+{
+    int delta = target - le->shown_cursor;
+    int from_row = row_of(le, le->shown_cursor);
+    int to_row = row_of(le, target);
+
+    if (from_row != to_row) {
+        int from_col = column_of(le, le->shown_cursor);
+        int to_col = column_of(le, target);
+
+        if (to_row < from_row) {
+            emit_csi(from_row - to_row, 'A');
+        } else {
+            emit_csi(to_row - from_row, 'B');
+        }
+        if (to_col == 0) {
+            putchar('\r');
+        } else if (to_col < from_col) {
+            emit_csi(from_col - to_col, 'D');
+        } else if (to_col > from_col) {
+            emit_csi(to_col - from_col, 'C');
+        }
+    } else if (delta < 0) {
+        int n = -delta;
+        if (n <= csi_cost(n)) {
+            while (n-- > 0) putchar('\b');
+        } else {
+            emit_csi(n, 'D');
+        }
+    } else if (delta > 0) {
+        if (delta <= csi_cost(delta)) {
+            for (int i = le->shown_cursor; i < target; i++) {
+                putchar(le->shown[i]);
+            }
+        } else {
+            emit_csi(delta, 'C');
+        }
+    }
+    le->shown_cursor = target;
+}
+
+/*
+ * Sync the terminal with the logical line
+ * Finds the changed span between common prefix and suffix, then either
+ * repaints from the first change or uses ICH/DCH to shift the suffix in
+ * place, whichever sends fewer bytes. ICH/DCH only shift cells within one
+ * row, so a line that wraps (before or after the change) is repainted.
+ */
+void lineedit_refresh(line_editor_t* le)
+{
+    int new_len = lineedit_length(le);
+    int old_len = le->shown_len;
+
+    // Common prefix
+    int prefix = 0;
+    while (prefix < new_len && prefix < old_len &&
+           lineedit_char_at(le, prefix) == le->shown[prefix]) {
+        prefix++;
+    }
+
+    if (prefix == new_len && prefix == old_len) {
+        move_terminal_cursor(le, lineedit_cursor(le));
+        return;
+    }
+
+    // Common suffix, not overlapping the prefix
+    int suffix = 0;
+    while (suffix < new_len - prefix && suffix < old_len - prefix &&
+           lineedit_char_at(le, new_len - 1 - suffix) == le->shown[old_len - 1 - suffix]) {
+        suffix++;
+    }
+
+    int longest = new_len > old_len ? new_len : old_len;
+    int wraps = le->origin + longest >= LINEEDIT_COLUMNS;
+
+    int old_mid = old_len - prefix - suffix;
+    int new_mid = new_len - prefix - suffix;
+    int common = old_mid < new_mid ? old_mid : new_mid;
+    int diff = new_mid - old_mid;
+
+    // Cost of repainting everything from the first change
+    int repaint_cost = (new_len - prefix) + (new_len < old_len ? csi_cost(1) : 0);
+
+    // Cost of overwriting the changed span and shifting the suffix
+    int shift_cost = common;
+    if (diff > 0) shift_cost += csi_cost(diff) + diff;
+    if (diff < 0) shift_cost += csi_cost(-diff);
+
+    move_terminal_cursor(le, prefix);
+
+    if (!wraps && suffix > 0 && shift_cost < repaint_cost) {
+        for (int i = prefix; i < prefix + common; i++) {
+            putchar(lineedit_char_at(le, i));
+        }
+        if (diff > 0) {
+            emit_csi(diff, '@');        // ICH: open 'diff' blank cells
+            for (int i = prefix + common; i < prefix + new_mid; i++) {
+                putchar(lineedit_char_at(le, i));
+            }
+        } else if (diff < 0) {
+            emit_csi(-diff, 'P');       // DCH: close up the deleted cells
+        }
+        le->shown_cursor = prefix + new_mid;
+    } else {
+        for (int i = prefix; i < new_len; i++) {
+            putchar(lineedit_char_at(le, i));
+        }
+        if (new_len > prefix && column_of(le, new_len) == 0) {
+            // Filling a row's last cell leaves the cursor on it with the
+            // wrap pending; take the next row now so positions stay exact
+            putchar('\n');
+        }
+        if (new_len < old_len) {
+            emit_csi(1, 'J');           // ED: erase the stale tail and rows below
+        }
+        le->shown_cursor = new_len;
+    }
+
+    // Terminal now shows the new line
+    for (int i = prefix; i < new_len; i++) {
+        le->shown[i] = lineedit_char_at(le, i);
+    }
+    le->shown_len = new_len;
+
+    move_terminal_cursor(le, lineedit_cursor(le));
+}
+
+void lineedit_finish(line_editor_t* le)
+{
+    move_terminal_cursor(le, le->shown_len);
+}
+
+void lineedit_erase(line_editor_t* le)
+{
+    move_terminal_cursor(le, 0);
+    putchar('\r');
+    emit_csi(1, 'J');
+    lineedit_invalidate(le);
+}
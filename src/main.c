@@ -7,15 +7,148 @@
 #include "memory.h"
 #include "string.h"
 #include "shell.h"
+#include "memmap.h"
+#include "page.h"
+#include "kmalloc.h"
+#include "timer.h"
+#include "thread.h"
+#include "irq.h"
+#include "gic.h"
+#include "smp.h"
+#include "atomic.h"
+#include "percpu.h"
+#include "ipi.h"
+#include "parallel.h"
+#include "ktimer.h"
+#include "workqueue.h"
+#include "jobs.h"
+#include "virtio.h"
+#include "virtio_blk.h"
+#include "iosched.h"
+#include "bcache.h"
+#include "fs.h"
+#include "initrd.h"
+#include "fwcfg.h"
+#include "semihost.h"
+#include "pflash.h"
+#include "cfgstore.h"
+#include "kv.h"
 
-void main(void)
+// Shell thread stack: nested batch commands keep large structures on it
+#define SHELL_STACK_PAGES 16
+
+/*
+ * Shell main loop - runs as its own kernel thread
+ */
+static void shell_thread(void* arg)
+{
+    // Static: lines may be far longer than one screen row
+    static char command_buffer[SHELL_LINE_MAX];
+    
+    (void)arg;
+    
+    while (1) {
+        // Report background jobs that finished meanwhile
+        jobs_notify();
+        
+        // Display shell prompt with color support
+        shell_display_prompt();
+        
+        // Read command line (yields to other threads while waiting)
+        int len = shell_read_line(command_buffer, sizeof(command_buffer));
+        
+        // Skip empty input
+        if (len <= 0) {
+            continue;
+        }
+        
+        // Execute command
+        shell_parse_and_execute(command_buffer);
+    }
+}
+
+void main(unsigned long dtb_addr)
 {
     // Initialize UART for serial output
     uart_init();
     
+    // Pick LSE or exclusive-access atomics before any lock is taken
+    atomic_init();
+    
+    // This CPU's per-CPU area (TPIDR_EL1)
+    percpu_init();
+    
+    // CRC32 instruction detection for the parallel memory kernels
+    parallel_init();
+    
+    // Start the generic timer (uptime, sleeps, benchmarks)
+    timer_init();
+    
     // Initialize memory allocator for Phase 2
     memory_init();
     
+    // Build the physical memory map from linker symbols and the DTB
+    memmap_init(dtb_addr);
+    
+    // Hand the RAM above the heap to the page allocator
+    page_init();
+    
+    // Object allocator: its page tags come from the page allocator
+    kmalloc_init();
+    
+    // Index the cpio archive QEMU loaded with -initrd (used in place)
+    initrd_init();
+    
+    // Files the host passed with -fw_cfg
+    fwcfg_init();
+    
+    // Exception vectors and the interrupt controller
+    irq_init();
+    gic_init();
+    
+    // Host calls with -semihosting (probed through the vectors)
+    semihost_init();
+    
+    // Reschedule and remote-call IPIs (GIC SGIs)
+    ipi_init();
+    ipi_cpu_init();
+    
+    // UART receive interrupt, so Ctrl-C reaches busy commands
+    uart_irq_init();
+    
+    // Periodic tick for preemption (needs the GIC)
+    timer_tick_init();
+    
+    // Timer wheel for kernel timers and delayed work
+    ktimer_init();
+    
+    // The boot flow of control becomes thread 0
+    thread_init();
+    
+    // Bring up the secondary CPUs
+    smp_init();
+    
+    // One work queue worker per online CPU
+    workqueue_init();
+    
+    // Virtio-MMIO devices from the device tree, reset for their drivers
+    virtio_init();
+    
+    // The first virtio-blk device becomes the disk: I/O scheduler, then buffer cache
+    blk_init();
+    iosched_init();
+    bcache_init();
+    
+    // Mount the filesystem on the disk, if it has one (build/mkfs)
+    fs_init();
+    
+    // Key-value store in the filesystem: replay its log, start its compaction thread
+    kv_init();
+    
+    // Saved settings: the second flash bank, then one scan of its log
+    pflash_init();
+    cfgstore_init();
+    
     // Initialize shell command table
     shell_init();
     
@@ -38,30 +171,19 @@ void main(void)
     puts("");
     puts("Welcome to ARM64 OS!");
     puts("This is a minimal educational operating system");
-    puts("Features: Memory management, interactive shell, 17 commands");
+    puts("Features: Memory management, interactive shell, SMP preemptive threads, background jobs, virtio-blk, buffer cache, I/O scheduler, extent filesystem, initrd, fw_cfg, semihosting, persistent settings, LSM key-value store, 42 commands");
     puts("");
-    puts("Available commands: help, echo, clear, meminfo, about, uptime, calc, peek, poke, dump, color, reboot, sysinfo, history, errors, stats, alias");
+    puts("Available commands: help, echo, clear, meminfo, about, uptime, calc, peek, poke, dump, color, reboot, sysinfo, history, errors, stats, alias, memmap, batch-mode, ps, bench, cpus, locks, mem, work, jobs, fg, wait, virtio, blkbench, cache, iosched, ls, cat, write, rm, stat, fwcfg, export, exit, config, kv");
     puts("Type 'help' for detailed command information");
     puts("Type 'about' for system information");
     puts("");
     
-    // Shell main loop
-    char command_buffer[256];
-    
-    while (1) {
-        // Display shell prompt with color support
-        shell_display_prompt();
-        
-        // Read command line
-        int len = shell_read_line(command_buffer, sizeof(command_buffer));
-        
-        
-        // Skip empty input
-        if (len <= 0) {
-            continue;
-        }
-        
-        // Execute command
-        shell_parse_and_execute(command_buffer);
+    // Run the shell as a thread; this thread becomes the idle loop
+    if (thread_create("shell", shell_thread, NULL, SHELL_STACK_PAGES) < 0) {
+        puts("Error: could not start shell thread");
+        shell_thread(NULL);
     }
-}
\ No newline at end of file
+    timer_tick_start();
+    irq_enable();
+    thread_idle();
+}
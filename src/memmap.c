@@ -0,0 +1,288 @@
+/*
+ * ARM64 OS Physical Memory Map Implementation
+ * Sorted, non-overlapping region table built from linker symbols and the DTB
+ */
+
+#include "memmap.h"
+#include "fdt.h"
+#include "string.h"
+#include "uart.h"
+
+// Linker script and boot.S symbols
+extern uint8_t _start[];
+extern uint8_t __rodata_end[];
+extern uint8_t __data_start[];
+extern uint8_t _end[];
+extern uint8_t stack_bottom[];
+extern uint8_t stack_top[];
+
+// Fallback layout when no DTB is available (QEMU virt defaults)
+#define MEMMAP_DEFAULT_RAM_BASE  0x40000000UL
+#define MEMMAP_DEFAULT_RAM_SIZE  (128UL * 1024 * 1024)
+#define MEMMAP_DEFAULT_UART_BASE 0x09000000UL
+#define MEMMAP_DEFAULT_UART_SIZE 0x1000UL
+
+// Region table, sorted by base address
+static memmap_region_t regions[MEMMAP_MAX_REGIONS];
+static int region_count = 0;
+
+// Scratch table used while splitting regions in memmap_add()
+static memmap_region_t scratch[MEMMAP_MAX_REGIONS];
+
+// Access rights granted to shell commands for each region type
+static const unsigned int type_access[MEMMAP_TYPE_COUNT] = {
+    [MEMMAP_UNMAPPED]    = 0,
+    [MEMMAP_RAM]         = MEMMAP_ACCESS_READ | MEMMAP_ACCESS_WRITE,
+    [MEMMAP_DEVICE]      = 0,
+    [MEMMAP_FIRMWARE]    = MEMMAP_ACCESS_READ,
+    [MEMMAP_KERNEL_TEXT] = MEMMAP_ACCESS_READ,
+    [MEMMAP_KERNEL_DATA] = MEMMAP_ACCESS_READ | MEMMAP_ACCESS_WRITE,
+    [MEMMAP_HEAP]        = MEMMAP_ACCESS_READ | MEMMAP_ACCESS_WRITE,
+    [MEMMAP_STACK]       = MEMMAP_ACCESS_READ,
+};
+
+const char* memmap_type_name(memmap_type_t type)
+{
+    switch (type) {
+    case MEMMAP_UNMAPPED:       return "unmapped";
+    case MEMMAP_RAM:            return "ram";
+    case MEMMAP_DEVICE:         return "device";
+    case MEMMAP_FIRMWARE:       return "firmware";
+    case MEMMAP_KERNEL_TEXT:    return "kernel-text";
+    case MEMMAP_KERNEL_DATA:    return "kernel-data";
+    case MEMMAP_HEAP:           return "heap";
+    case MEMMAP_STACK:          return "stack";
+    default:                    return "unknown";
+    }
+}
+
+/*
+ * Binary search: index of the last region with base <= addr, or -1
+ */
+static int memmap_find_index(uintptr_t addr)
+{
+    int lo = 0;
+    int hi = region_count - 1;
+    int found = -1;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (regions[mid].base <= addr) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+/*
+ * Insert a region, trimming or splitting any regions it overlaps
+ * Returns 0 on success, -1 if the table is full or the range is invalid
+ */
+int memmap_add(uintptr_t base, size_t size, memmap_type_t type, const char* name)
+{
+    uintptr_t end = base + size;
+    if (size == 0 || end < base) return -1;
+
+    int out = 0;
+    int inserted = 0;
+
+    for (int i = 0; i < region_count; i++) {
+        memmap_region_t r = regions[i];
+
+        // Keep the part of r below the new region
+        if (r.base < base) {
+            if (out >= MEMMAP_MAX_REGIONS) return -1;
+            scratch[out] = r;
+            if (scratch[out].end > base) scratch[out].end = base;
+            out++;
+        }
+
+        // Place the new region once we reach its sorted position
+        if (!inserted && r.end > base) {
+            if (out >= MEMMAP_MAX_REGIONS) return -1;
+            scratch[out].base = base;
+            scratch[out].end = end;
+            scratch[out].type = type;
+            scratch[out].access = type_access[type];
+            scratch[out].name = name;
+            out++;
+            inserted = 1;
+        }
+
+        // Keep the part of r above the new region
+        if (r.end > end) {
+            if (out >= MEMMAP_MAX_REGIONS) return -1;
+            scratch[out] = r;
+            if (scratch[out].base < end) scratch[out].base = end;
+            out++;
+        }
+    }
+
+    if (!inserted) {
+        if (out >= MEMMAP_MAX_REGIONS) return -1;
+        scratch[out].base = base;
+        scratch[out].end = end;
+        scratch[out].type = type;
+        scratch[out].access = type_access[type];
+        scratch[out].name = name;
+        out++;
+    }
+
+    for (int i = 0; i < out; i++) {
+        regions[i] = scratch[i];
+    }
+    region_count = out;
+    return 0;
+}
+
+/*
+ * Find the region containing addr (NULL if unmapped)
+ */
+const memmap_region_t* memmap_lookup(uintptr_t addr)
+{
+    int i = memmap_find_index(addr);
+    if (i < 0 || addr >= regions[i].end) return NULL;
+    return &regions[i];
+}
+
+/*
+ * Check that every byte of [addr, addr+len) is mapped with the given rights
+ * O(log n) to locate the first region, then one step per region spanned
+ */
+int memmap_check_range(uintptr_t addr, size_t len, unsigned int access)
+{
+    uintptr_t end = addr + len;
+    if (len == 0 || end < addr) return 0;
+
+    int i = memmap_find_index(addr);
+    if (i < 0) return 0;
+
+    uintptr_t cur = addr;
+    while (i < region_count) {
+        const memmap_region_t* r = &regions[i];
+        if (cur < r->base || cur >= r->end) return 0;        // Hole in the map
+        if ((r->access & access) != access) return 0;        // Insufficient rights
+        if (end <= r->end) return 1;
+        cur = r->end;
+        i++;
+    }
+    return 0;
+}
+
+/*
+ * Add RAM and device regions described by the device tree
+ */
+static void memmap_add_fdt_regions(void)
+{
+    int depth = 0;
+    int node = fdt_next_node(fdt_root_node(), &depth);
+
+    while (node >= 0) {
+        // Only direct children of the root carry root-sized "reg" cells
+        if (depth == 1) {
+            const char* device_type = fdt_getprop(node, "device_type", NULL);
+            memmap_type_t type = MEMMAP_DEVICE;
+            if (device_type && strcmp(device_type, "memory") == 0) {
+                type = MEMMAP_RAM;
+            }
+
+            uint64_t base, size;
+            for (int i = 0; fdt_get_reg(node, i, &base, &size) == 0; i++) {
+                memmap_add((uintptr_t)base, (size_t)size, type, fdt_node_name(node));
+            }
+        }
+        node = fdt_next_node(node, &depth);
+    }
+}
+
+/*
+ * Build the memory map
+ * RAM and devices first, then progressively more specific kernel regions
+ */
+void memmap_init(uintptr_t dtb_addr)
+{
+    region_count = 0;
+
+    if (fdt_init(dtb_addr) == 0) {
+        memmap_add_fdt_regions();
+        memmap_add(fdt_address(), fdt_total_size(), MEMMAP_FIRMWARE, "device tree");
+
+        // Keep the initial ramdisk out of the page allocator: it is read in place
+        uint64_t initrd_start, initrd_end;
+        if (fdt_initrd(&initrd_start, &initrd_end) == 0) {
+            memmap_add((uintptr_t)initrd_start, (size_t)(initrd_end - initrd_start),
+                       MEMMAP_FIRMWARE, "initrd");
+        }
+    } else {
+        memmap_add(MEMMAP_DEFAULT_RAM_BASE, MEMMAP_DEFAULT_RAM_SIZE, MEMMAP_RAM, "ram (default)");
+        memmap_add(MEMMAP_DEFAULT_UART_BASE, MEMMAP_DEFAULT_UART_SIZE, MEMMAP_DEVICE, "pl011 (default)");
+    }
+
+    // Kernel image from linker symbols
+    memmap_add((uintptr_t)_start, (uintptr_t)__rodata_end - (uintptr_t)_start,
+               MEMMAP_KERNEL_TEXT, "kernel .text/.rodata");
+    memmap_add((uintptr_t)__data_start, (uintptr_t)_end - (uintptr_t)__data_start,
+               MEMMAP_KERNEL_DATA, "kernel .data/.bss");
+    memmap_add((uintptr_t)stack_bottom, (uintptr_t)stack_top - (uintptr_t)stack_bottom,
+               MEMMAP_STACK, "boot stack");
+
+    // Heap from the allocator
+    memory_stats_t* stats = get_memory_stats();
+    memmap_add(stats->heap_start, stats->heap_end - stats->heap_start,
+               MEMMAP_HEAP, "kernel heap");
+
+    printf("Memory map: %x regions (%s)\n", (unsigned long)region_count,
+           fdt_present() ? "from device tree" : "built-in defaults");
+}
+
+/*
+ * Print a hex value followed by spaces up to a column width
+ * (printf has no field width support)
+ */
+static void print_hex_padded(uintptr_t value, int width)
+{
+    int digits = 1;
+    for (uintptr_t v = value >> 4; v; v >>= 4) digits++;
+
+    printf("%x", (unsigned long)value);
+    for (int i = 2 + digits; i < width; i++) {
+        putchar(' ');
+    }
+}
+
+/*
+ * Display the region table - used by the memmap command
+ */
+void memmap_print(void)
+{
+    puts("=== ARM64 OS Memory Map ===");
+    puts("");
+
+    if (fdt_present()) {
+        printf("Device tree: %x (%x bytes)\n", (unsigned long)fdt_address(),
+               (unsigned long)fdt_total_size());
+    } else {
+        puts("Device tree: not found (using built-in defaults)");
+    }
+    puts("");
+
+    puts("START              END                ACCESS  TYPE         NAME");
+    for (int i = 0; i < region_count; i++) {
+        const memmap_region_t* r = &regions[i];
+
+        print_hex_padded(r->base, 19);
+        print_hex_padded(r->end - 1, 19);
+        printf("%s%s      %s  %s\n",
+               (r->access & MEMMAP_ACCESS_READ) ? "r" : "-",
+               (r->access & MEMMAP_ACCESS_WRITE) ? "w" : "-",
+               memmap_type_name(r->type), r->name ? r->name : "");
+    }
+
+    puts("");
+    printf("Total regions: %x/%x\n", (unsigned long)region_count,
+           (unsigned long)MEMMAP_MAX_REGIONS);
+    puts("Only r/w regions are accessible to peek, poke and dump");
+}
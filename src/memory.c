@@ -4,6 +4,7 @@
  */
 
 #include "memory.h"
+#include "spinlock.h"
 #include "uart.h"
 
 // External symbol from linker script - end of kernel
@@ -12,6 +13,7 @@ extern uint8_t _end[];
 // Memory management state
 static memory_stats_t mem_stats;
 static int memory_initialized = 0;
+static spinlock_t heap_lock;
 
 /*
  * Initialize memory allocator
@@ -19,6 +21,8 @@ static int memory_initialized = 0;
  */
 void memory_init(void)
 {
+    spin_lock_init(&heap_lock, "heap");
+    
     // Calculate heap boundaries
     mem_stats.heap_start = (uintptr_t)_end;
     mem_stats.heap_end = mem_stats.heap_start + HEAP_SIZE;
@@ -59,8 +63,11 @@ void* malloc(size_t size)
     // Align the requested size
     size_t aligned_size = align_size(size);
     
+    unsigned long flags = spin_lock_irqsave(&heap_lock);
+    
     // Check if we have enough space
     if (mem_stats.current_ptr + aligned_size > mem_stats.heap_end) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         return NULL;  // Out of memory
     }
     
@@ -71,6 +78,7 @@ void* malloc(size_t size)
     mem_stats.num_allocations++;
     mem_stats.bytes_remaining -= aligned_size;
     
+    spin_unlock_irqrestore(&heap_lock, flags);
     return ptr;
 }
 
@@ -112,28 +120,33 @@ void memory_info(void)
         return;
     }
     
+    // Consistent snapshot - other CPUs may be allocating
+    unsigned long flags = spin_lock_irqsave(&heap_lock);
+    memory_stats_t stats = mem_stats;
+    spin_unlock_irqrestore(&heap_lock, flags);
+    
     puts("=== ARM64 OS Memory Information ===");
     puts("");
     
     // Basic heap statistics
     puts("HEAP STATISTICS:");
-    printf("  Start address:   %x\n", (unsigned long)mem_stats.heap_start);
-    printf("  End address:     %x\n", (unsigned long)mem_stats.heap_end);
+    printf("  Start address:   %x\n", (unsigned long)stats.heap_start);
+    printf("  End address:     %x\n", (unsigned long)stats.heap_end);
     printf("  Total size:      %x bytes (1MB)\n", HEAP_SIZE);
-    printf("  Current pointer: %x\n", (unsigned long)mem_stats.current_ptr);
+    printf("  Current pointer: %x\n", (unsigned long)stats.current_ptr);
     puts("");
     
     // Allocation statistics
     puts("ALLOCATION DETAILS:");
-    printf("  Total allocated: %x bytes\n", (unsigned long)mem_stats.total_allocated);
-    printf("  Bytes remaining: %x bytes\n", (unsigned long)mem_stats.bytes_remaining);
-    printf("  Number of allocs: %x\n", (unsigned long)mem_stats.num_allocations);
+    printf("  Total allocated: %x bytes\n", (unsigned long)stats.total_allocated);
+    printf("  Bytes remaining: %x bytes\n", (unsigned long)stats.bytes_remaining);
+    printf("  Number of allocs: %x\n", (unsigned long)stats.num_allocations);
     puts("");
     
     // Usage percentages
     puts("MEMORY USAGE:");
-    unsigned int heap_used_pct = calculate_percentage_x10(mem_stats.total_allocated, HEAP_SIZE);
-    unsigned int heap_free_pct = calculate_percentage_x10(mem_stats.bytes_remaining, HEAP_SIZE);
+    unsigned int heap_used_pct = calculate_percentage_x10(stats.total_allocated, HEAP_SIZE);
+    unsigned int heap_free_pct = calculate_percentage_x10(stats.bytes_remaining, HEAP_SIZE);
     printf("  Heap used:       ");
     print_percentage(heap_used_pct);
     puts("%");
@@ -144,20 +157,20 @@ void memory_info(void)
     
     // Memory map layout
     puts("MEMORY MAP LAYOUT:");
-    printf("  Kernel code:     %x - %x\n", 0x40000000, (unsigned long)mem_stats.heap_start);
-    printf("  Heap region:     %x - %x\n", (unsigned long)mem_stats.heap_start, (unsigned long)mem_stats.heap_end);
+    printf("  Kernel code:     %x - %x\n", 0x40000000, (unsigned long)stats.heap_start);
+    printf("  Heap region:     %x - %x\n", (unsigned long)stats.heap_start, (unsigned long)stats.heap_end);
     printf("  Stack region:    ~%x - %x (estimated)\n", 0x40000000 - 0x10000, 0x40000000 - 1);
     puts("");
     
     // Memory efficiency
     puts("ALLOCATION EFFICIENCY:");
-    if (mem_stats.num_allocations > 0) {
-        unsigned long avg_alloc = mem_stats.total_allocated / mem_stats.num_allocations;
+    if (stats.num_allocations > 0) {
+        unsigned long avg_alloc = stats.total_allocated / stats.num_allocations;
         printf("  Average alloc:   %x bytes\n", avg_alloc);
         
         // Estimate fragmentation (simple calculation)
-        unsigned long used_space = mem_stats.current_ptr - mem_stats.heap_start;
-        unsigned long internal_frag = used_space - mem_stats.total_allocated;
+        unsigned long used_space = stats.current_ptr - stats.heap_start;
+        unsigned long internal_frag = used_space - stats.total_allocated;
         unsigned int frag_pct = calculate_percentage_x10(internal_frag, used_space);
         printf("  Internal frag:   %x bytes (", internal_frag);
         print_percentage(frag_pct);
@@ -169,7 +182,7 @@ void memory_info(void)
     
     // System memory estimates
     puts("SYSTEM MEMORY ESTIMATES:");
-    unsigned long kernel_size = mem_stats.heap_start - 0x40000000;
+    unsigned long kernel_size = stats.heap_start - 0x40000000;
     printf("  Kernel size:     %x bytes\n", kernel_size);
     printf("  Stack usage:     ~%x bytes (estimated)\n", 0x1000); // Rough estimate
     printf("  UART buffers:    ~%x bytes (minimal)\n", 0x100);
@@ -0,0 +1,165 @@
+/*
+ * Physical Page Allocator Implementation
+ * One bit per 4KB page (set = in use). Allocation is next-fit: the scan
+ * resumes where the last allocation ended and skips full 64-bit words,
+ * so single-page requests rarely touch more than one word.
+ */
+
+#include "page.h"
+#include "memmap.h"
+#include "spinlock.h"
+#include "uart.h"
+
+#define PAGE_WORDS (PAGE_MAX_PAGES / 64)
+
+static uint64_t page_bitmap[PAGE_WORDS];
+static uintptr_t pool_start = 0;
+static size_t pool_pages = 0;
+static size_t free_pages = 0;
+static size_t search_hint = 0;
+
+// Stacks are allocated and freed on every CPU
+static spinlock_t page_lock;
+
+static int page_in_use(size_t page)
+{
+    return (page_bitmap[page / 64] >> (page % 64)) & 1;
+}
+
+static void page_mark(size_t page, int used)
+{
+    if (used) {
+        page_bitmap[page / 64] |= 1UL << (page % 64);
+    } else {
+        page_bitmap[page / 64] &= ~(1UL << (page % 64));
+    }
+}
+
+/*
+ * Build the pool from the RAM that follows the kernel heap
+ * Pages covered by anything other than plain RAM (e.g. the device tree)
+ * are marked in use up front
+ */
+void page_init(void)
+{
+    spin_lock_init(&page_lock, "page");
+
+    memory_stats_t* stats = get_memory_stats();
+    pool_start = (stats->heap_end + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+
+    // Extend across RAM and firmware regions until the end of memory
+    uintptr_t pool_end = pool_start;
+    const memmap_region_t* r;
+    while ((r = memmap_lookup(pool_end)) != NULL &&
+           (r->type == MEMMAP_RAM || r->type == MEMMAP_FIRMWARE)) {
+        pool_end = r->end;
+    }
+    pool_end &= ~(uintptr_t)(PAGE_SIZE - 1);
+
+    pool_pages = (pool_end > pool_start) ? (pool_end - pool_start) / PAGE_SIZE : 0;
+    if (pool_pages > PAGE_MAX_PAGES) pool_pages = PAGE_MAX_PAGES;
+
+    free_pages = 0;
+    for (size_t i = 0; i < PAGE_WORDS; i++) {
+        page_bitmap[i] = ~0UL;
+    }
+    for (size_t i = 0; i < pool_pages; i++) {
+        uintptr_t addr = pool_start + i * PAGE_SIZE;
+        if (memmap_check_range(addr, PAGE_SIZE, MEMMAP_ACCESS_READ | MEMMAP_ACCESS_WRITE) &&
+            memmap_lookup(addr)->type == MEMMAP_RAM) {
+            page_mark(i, 0);
+            free_pages++;
+        }
+    }
+    search_hint = 0;
+
+    printf("Page allocator: %x free pages at %x\n", (unsigned long)free_pages,
+           (unsigned long)pool_start);
+}
+
+/*
+ * Find 'count' consecutive free pages starting the scan at 'from'
+ * Returns the first page index or pool_pages if none
+ */
+static size_t page_find_run(size_t from, size_t limit, size_t count)
+{
+    size_t run = 0;
+    size_t page = from;
+
+    while (page < limit) {
+        // Skip whole words that are fully allocated
+        if (run == 0 && page % 64 == 0 && page_bitmap[page / 64] == ~0UL) {
+            page += 64;
+            continue;
+        }
+
+        if (page_in_use(page)) {
+            run = 0;
+        } else if (++run == count) {
+            return page + 1 - count;
+        }
+        page++;
+    }
+    return pool_pages;
+}
+
+void* page_alloc(size_t count)
+{
+    if (count == 0) return NULL;
+
+    unsigned long flags = spin_lock_irqsave(&page_lock);
+    if (count > free_pages) {
+        spin_unlock_irqrestore(&page_lock, flags);
+        return NULL;
+    }
+
+    size_t first = page_find_run(search_hint, pool_pages, count);
+    if (first == pool_pages) {
+        first = page_find_run(0, pool_pages, count);
+        if (first == pool_pages) {
+            spin_unlock_irqrestore(&page_lock, flags);
+            return NULL;
+        }
+    }
+
+    for (size_t i = first; i < first + count; i++) {
+        page_mark(i, 1);
+    }
+    free_pages -= count;
+    search_hint = first + count;
+    spin_unlock_irqrestore(&page_lock, flags);
+    return (void*)(pool_start + first * PAGE_SIZE);
+}
+
+void page_free(void* addr, size_t count)
+{
+    uintptr_t a = (uintptr_t)addr;
+    if (!addr || count == 0 || a < pool_start || (a & (PAGE_SIZE - 1)) != 0) return;
+
+    size_t first = (a - pool_start) / PAGE_SIZE;
+    if (first + count > pool_pages) return;
+
+    unsigned long flags = spin_lock_irqsave(&page_lock);
+    for (size_t i = first; i < first + count; i++) {
+        if (page_in_use(i)) {
+            page_mark(i, 0);
+            free_pages++;
+        }
+    }
+    spin_unlock_irqrestore(&page_lock, flags);
+}
+
+uintptr_t page_pool_start(void)
+{
+    return pool_start;
+}
+
+size_t page_total_count(void)
+{
+    return pool_pages;
+}
+
+size_t page_free_count(void)
+{
+    return free_pages;
+}
@@ -0,0 +1,502 @@
+/*
+ * Parallel Memory Kernels Implementation
+ * Helpers are ordinary threads pinned one per CPU for the duration of a
+ * call; they and the caller take chunks from a shared counter, so a CPU
+ * slowed by other work simply takes fewer of them.
+ *
+ * With the MMU off all data accesses are Device memory: unaligned word
+ * accesses fault, so every kernel aligns itself before going wide and
+ * falls back to bytes when two buffers disagree in alignment.
+ */
+
+#include "parallel.h"
+#include "atomic.h"
+#include "cancel.h"
+#include "page.h"
+#include "smp.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+// Keep GCC from turning the word loops back into calls to the byte-wise memset/memcpy
+#define NO_LIBCALL __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+// ID_AA64ISAR0_EL1.CRC32 (bits 19:16): 1 = CRC32B/H/W/X
+#define ISAR0_CRC32_SHIFT 16
+
+#define CRC32_POLY 0xEDB88320U     // Reflected IEEE 802.3 polynomial
+
+static int crc32_hw;
+static uint32_t crc32_table[256];
+static uint32_t crc32_x2n[32];      // x^(2^n) mod P, for crc32_combine()
+
+typedef struct {
+    parallel_fn_t fn;
+    void* ctx;
+    uint64_t* results;
+    size_t length;
+    size_t chunk;
+    uint64_t chunks;
+    int cancellable;
+    volatile uint64_t next;         // Next chunk to claim
+    volatile uint64_t done;         // Bytes in chunks that ran
+} parallel_job_t;
+
+// --- CRC-32 ---
+
+// a(x) * b(x) mod P(x), bit-reflected
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b)
+{
+    // Shift crc_a past length_b bytes: multiply by x^(8 * length_b)
+    uint32_t p = 1U << 31;          // x^0
+    unsigned int k = 3;             // 2^3 bits per byte
+    for (size_t n = length_b; n; n >>= 1, k++) {
+        if (n & 1) p = crc32_multmodp(crc32_x2n[k & 31], p);
+    }
+    return crc32_multmodp(p, crc_a) ^ crc_b;
+}
+
+void parallel_init(void)
+{
+    uint64_t isar0;
+    __asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+    crc32_hw = ((isar0 >> ISAR0_CRC32_SHIFT) & 0xF) >= 1;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+
+    uint32_t p = 1U << 30;          // x^1
+    crc32_x2n[0] = p;
+    for (int n = 1; n < 32; n++) {
+        crc32_x2n[n] = p = crc32_multmodp(p, p);
+    }
+}
+
+static inline uint32_t crc32_byte(uint32_t crc, uint8_t byte)
+{
+    if (crc32_hw) {
+        __asm__(".arch_extension crc\n crc32b %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)byte));
+        return crc;
+    }
+    return crc32_table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+}
+
+// Raw CRC update (no pre/post inversion)
+static uint32_t crc32_update(uint32_t crc, const uint8_t* p, size_t n)
+{
+    while (n && ((uintptr_t)p & 7)) {
+        crc = crc32_byte(crc, *p++);
+        n--;
+    }
+
+    if (crc32_hw) {
+        const uint64_t* w = (const uint64_t*)p;
+        for (; n >= 8; n -= 8) {
+            __asm__(".arch_extension crc\n crc32x %w0, %w0, %x1" : "+r"(crc) : "r"(*w++));
+        }
+        p = (const uint8_t*)w;
+    }
+
+    while (n--) {
+        crc = crc32_byte(crc, *p++);
+    }
+    return crc;
+}
+
+// --- Work distribution ---
+
+int parallel_chunks(size_t length, size_t* chunk_size)
+{
+    size_t chunk = (length + PARALLEL_MAX_CHUNKS - 1) / PARALLEL_MAX_CHUNKS;
+    if (chunk < PARALLEL_MIN_CHUNK) chunk = PARALLEL_MIN_CHUNK;
+    chunk = (chunk + PARALLEL_LINE - 1) & ~(size_t)(PARALLEL_LINE - 1);
+
+    if (chunk_size) *chunk_size = chunk;
+    return (int)((length + chunk - 1) / chunk);
+}
+
+int parallel_cpus(size_t length, int jobs)
+{
+    if (length == 0) return 0;
+    if (!thread_scheduler_running()) return 1;
+
+    int online = smp_cpus_online();
+    int chunks = parallel_chunks(length, NULL);
+    if (jobs <= 0 || jobs > online) jobs = online;
+    return jobs < chunks ? jobs : chunks;
+}
+
+static void run_chunks(parallel_job_t* job)
+{
+    for (;;) {
+        uint64_t i = atomic_fetch_add64(&job->next, 1);
+        if (i >= job->chunks) break;
+
+        // After Ctrl-C the remaining chunks are claimed but not run
+        if (job->cancellable && cancel_requested()) {
+            if (job->results) job->results[i] = PARALLEL_SKIPPED;
+            continue;
+        }
+
+        size_t offset = (size_t)i * job->chunk;
+        size_t length = job->length - offset;
+        if (length > job->chunk) length = job->chunk;
+
+        uint64_t result = job->fn(offset, length, job->ctx);
+        if (job->results) job->results[i] = result;
+        atomic_fetch_add64(&job->done, length);
+    }
+}
+
+static void helper_thread(void* arg)
+{
+    run_chunks((parallel_job_t*)arg);
+}
+
+static size_t parallel_run(size_t length, int jobs, parallel_fn_t fn, void* ctx, uint64_t* results,
+                           int cancellable)
+{
+    if (length == 0 || !fn) return 0;
+
+    parallel_job_t job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.results = results;
+    job.length = length;
+    job.chunks = (uint64_t)parallel_chunks(length, &job.chunk);
+    job.cancellable = cancellable;
+    job.next = 0;
+    job.done = 0;
+
+    jobs = parallel_cpus(length, jobs);
+
+    // One helper on each of the next online CPUs after ours
+    int ids[SMP_MAX_CPUS];
+    int helpers = 0;
+    int cpu = smp_cpu_id();
+    while (helpers < jobs - 1) {
+        do {
+            cpu = (cpu + 1) % SMP_MAX_CPUS;
+        } while (!smp_cpu_online(cpu));
+
+        int id = thread_create("parallel", helper_thread, &job, 1);
+        if (id < 0) break;              // Fewer helpers; the chunks still all get done
+        thread_set_affinity(id, 1U << cpu);
+        ids[helpers++] = id;
+    }
+
+    run_chunks(&job);
+
+    for (int i = 0; i < helpers; i++) {
+        thread_join(ids[i]);
+    }
+    return job.done;
+}
+
+size_t parallel_for(size_t length, int jobs, parallel_fn_t fn, void* ctx, uint64_t* results)
+{
+    return parallel_run(length, jobs, fn, ctx, results, 1);
+}
+
+// --- Kernels ---
+
+typedef struct {
+    uint8_t* dst;
+    const uint8_t* src;
+    uint8_t value;
+} kernel_args_t;
+
+NO_LIBCALL static void fill_bytes(uint8_t* p, uint8_t value, size_t n)
+{
+    uint64_t pattern = 0x0101010101010101UL * value;
+
+    while (n && ((uintptr_t)p & 7)) {
+        *p++ = value;
+        n--;
+    }
+
+    uint64_t* w = (uint64_t*)p;
+    for (; n >= 64; n -= 64, w += 8) {
+        w[0] = pattern; w[1] = pattern; w[2] = pattern; w[3] = pattern;
+        w[4] = pattern; w[5] = pattern; w[6] = pattern; w[7] = pattern;
+    }
+    for (; n >= 8; n -= 8) {
+        *w++ = pattern;
+    }
+
+    p = (uint8_t*)w;
+    while (n--) {
+        *p++ = value;
+    }
+}
+
+NO_LIBCALL static void copy_bytes(uint8_t* d, const uint8_t* s, size_t n)
+{
+    if ((((uintptr_t)d ^ (uintptr_t)s) & 7) == 0) {
+        while (n && ((uintptr_t)d & 7)) {
+            *d++ = *s++;
+            n--;
+        }
+
+        uint64_t* wd = (uint64_t*)d;
+        const uint64_t* ws = (const uint64_t*)s;
+        for (; n >= 64; n -= 64, wd += 8, ws += 8) {
+            uint64_t a = ws[0], b = ws[1], c = ws[2], e = ws[3];
+            uint64_t f = ws[4], g = ws[5], h = ws[6], i = ws[7];
+            wd[0] = a; wd[1] = b; wd[2] = c; wd[3] = e;
+            wd[4] = f; wd[5] = g; wd[6] = h; wd[7] = i;
+        }
+        for (; n >= 8; n -= 8) {
+            *wd++ = *ws++;
+        }
+        d = (uint8_t*)wd;
+        s = (const uint8_t*)ws;
+    }
+
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
+// Offset of the first difference, or n if none
+static size_t compare_bytes(const uint8_t* a, const uint8_t* b, size_t n)
+{
+    size_t i = 0;
+
+    if ((((uintptr_t)a ^ (uintptr_t)b) & 7) == 0) {
+        while (i < n && ((uintptr_t)(a + i) & 7)) {
+            if (a[i] != b[i]) return i;
+            i++;
+        }
+        // Skip equal words, then locate the byte in the first unequal one
+        while (i + 8 <= n && *(const uint64_t*)(a + i) == *(const uint64_t*)(b + i)) {
+            i += 8;
+        }
+    }
+
+    for (; i < n; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return n;
+}
+
+static uint64_t fill_chunk(size_t offset, size_t length, void* ctx)
+{
+    kernel_args_t* args = ctx;
+    fill_bytes(args->dst + offset, args->value, length);
+    return 0;
+}
+
+static uint64_t copy_chunk(size_t offset, size_t length, void* ctx)
+{
+    kernel_args_t* args = ctx;
+    copy_bytes(args->dst + offset, args->src + offset, length);
+    return 0;
+}
+
+static uint64_t compare_chunk(size_t offset, size_t length, void* ctx)
+{
+    kernel_args_t* args = ctx;
+    size_t at = compare_bytes(args->dst + offset, args->src + offset, length);
+    return at < length ? offset + at : (uint64_t)-1;
+}
+
+static uint64_t crc32_chunk(size_t offset, size_t length, void* ctx)
+{
+    kernel_args_t* args = ctx;
+    return ~crc32_update(0xFFFFFFFFU, args->src + offset, length);
+}
+
+size_t parallel_fill(void* dst, uint8_t value, size_t length, int jobs)
+{
+    kernel_args_t args = { (uint8_t*)dst, NULL, value };
+    return parallel_for(length, jobs, fill_chunk, &args, NULL);
+}
+
+size_t parallel_zero(void* dst, size_t length, int jobs)
+{
+    return parallel_fill(dst, 0, length, jobs);
+}
+
+size_t parallel_copy(void* dst, const void* src, size_t length, int jobs)
+{
+    kernel_args_t args = { (uint8_t*)dst, (const uint8_t*)src, 0 };
+    return parallel_for(length, jobs, copy_chunk, &args, NULL);
+}
+
+long parallel_compare(const void* a, const void* b, size_t length, int jobs)
+{
+    uint64_t results[PARALLEL_MAX_CHUNKS];
+    kernel_args_t args = { (uint8_t*)a, (const uint8_t*)b, 0 };
+    int chunks = parallel_chunks(length, NULL);
+
+    parallel_for(length, jobs, compare_chunk, &args, results);
+
+    // Chunks are in address order, so the first hit is the first difference -
+    // unless a chunk before it was skipped
+    for (int i = 0; i < chunks; i++) {
+        if (results[i] == PARALLEL_SKIPPED) return PARALLEL_CANCELLED;
+        if (results[i] != (uint64_t)-1) return (long)results[i];
+    }
+    return -1;
+}
+
+size_t parallel_crc32(const void* buf, size_t length, int jobs, uint32_t* crc_out)
+{
+    uint64_t results[PARALLEL_MAX_CHUNKS];
+    kernel_args_t args = { NULL, (const uint8_t*)buf, 0 };
+    size_t chunk;
+    int chunks = parallel_chunks(length, &chunk);
+
+    *crc_out = 0;
+    if (length == 0) return 0;
+    parallel_for(length, jobs, crc32_chunk, &args, results);
+
+    // Combine the run of finished chunks from the start
+    uint32_t crc = 0;
+    size_t covered = 0;
+    for (int i = 0; i < chunks && results[i] != PARALLEL_SKIPPED; i++) {
+        size_t chunk_length = (i == chunks - 1) ? length - (size_t)i * chunk : chunk;
+        crc = (i == 0) ? (uint32_t)results[0] : crc32_combine(crc, (uint32_t)results[i], chunk_length);
+        covered += chunk_length;
+    }
+    *crc_out = crc;
+    return covered;
+}
+
+void* parallel_page_alloc_zeroed(size_t count, int jobs)
+{
+    void* pages = page_alloc(count);
+    if (pages) {
+        // Never cancelled: the caller relies on getting zeroed memory
+        kernel_args_t args = { (uint8_t*)pages, NULL, 0 };
+        parallel_run(count * PAGE_SIZE, jobs, fill_chunk, &args, NULL, 0);
+    }
+    return pages;
+}
+
+// --- Benchmark ---
+
+#define BENCH_KERNELS 5
+
+// Time in ns for one kernel over the buffers on 'jobs' CPUs
+static uint64_t bench_kernel(int kernel, uint8_t* a, uint8_t* b, size_t length, int jobs,
+                             uint32_t* crc, long* diff)
+{
+    uint64_t start = timer_ticks();
+    switch (kernel) {
+    case 0: parallel_fill(a, 0x5A, length, jobs); break;
+    case 1: parallel_copy(b, a, length, jobs); break;
+    case 2: *diff = parallel_compare(a, b, length, jobs); break;
+    case 3: parallel_crc32(b, length, jobs, crc); break;
+    default: parallel_zero(b, length, jobs); break;
+    }
+    uint64_t ns = timer_ticks_to_ns(timer_ticks() - start);
+    return ns ? ns : 1;
+}
+
+/*
+ * Fill, copy, compare, CRC and zero over two 'length' byte page runs on
+ * 1, 2, ... max_jobs CPUs: MB/s per kernel, then speedup over one CPU
+ */
+void parallel_bench(size_t length, int max_jobs)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    int online = smp_cpus_online();
+    if (max_jobs <= 0 || max_jobs > online) max_jobs = online;
+
+    size_t pages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+    length = pages * PAGE_SIZE;
+    uint8_t* a = page_alloc(pages);
+    uint8_t* b = page_alloc(pages);
+    if (!a || !b) {
+        if (a) page_free(a, pages);
+        puts("Error: not enough free pages for the benchmark buffers");
+        return;
+    }
+
+    size_t chunk;
+    int chunks = parallel_chunks(length, &chunk);
+    puts("=== Parallel Memory Kernels ===");
+    printf("Buffer: %lu KB, %d chunks of %lu bytes, CRC32 %s\n\n", (unsigned long)(length / 1024),
+           chunks, (unsigned long)chunk, crc32_hw ? "instructions" : "table");
+
+    uint64_t ns1[BENCH_KERNELS];
+    unsigned long speedup_x100[SMP_MAX_CPUS + 1][BENCH_KERNELS];
+    uint32_t crc_ref = 0;
+    int ok = 1;
+
+    puts("MB/s     fill      copy      compare   crc32     zero");
+    int rows = 0;
+    for (int jobs = 1; jobs <= max_jobs && !cancel_requested(); jobs++) {
+        printf("%d CPU%s   ", jobs, jobs == 1 ? " " : "s");
+        int k;
+        for (k = 0; k < BENCH_KERNELS; k++) {
+            uint32_t crc = 0;
+            long diff = -1;
+            uint64_t ns = bench_kernel(k, a, b, length, jobs, &crc, &diff);
+            if (cancel_requested()) break;      // Partial timing - drop it
+
+            if (jobs == 1) ns1[k] = ns;
+            speedup_x100[jobs][k] = (unsigned long)(ns1[k] * 100 / ns);
+            print_uint_padded((unsigned long)((length * 1000000000UL / ns) >> 20), 10);
+
+            // The copy must compare equal and every CPU count must agree on the CRC
+            if (k == 2 && diff != -1) ok = 0;
+            if (k == 3) {
+                if (jobs == 1) crc_ref = crc;
+                else if (crc != crc_ref) ok = 0;
+            }
+        }
+        puts("");
+        if (k == BENCH_KERNELS) rows = jobs;
+    }
+
+    puts("");
+    puts("Speedup  fill      copy      compare   crc32     zero");
+    for (int jobs = 1; jobs <= rows; jobs++) {
+        printf("%d CPU%s   ", jobs, jobs == 1 ? " " : "s");
+        for (int k = 0; k < BENCH_KERNELS; k++) {
+            unsigned long s = speedup_x100[jobs][k];
+            printf("%lu.%lu%lux     ", s / 100, (s / 10) % 10, s % 10);
+        }
+        puts("");
+    }
+
+    puts("");
+    if (rows < max_jobs) {
+        printf("Interrupted after %d of %d CPU counts\n", rows, max_jobs);
+    } else {
+        // The combined CRC must match one pass over the whole buffer ('a' still holds the fill)
+        if (crc_ref != ~crc32_update(0xFFFFFFFFU, a, length)) ok = 0;
+        printf("CRC32: %x, results %s\n", (unsigned long)crc_ref, ok ? "verified" : "MISMATCH");
+    }
+
+    page_free(a, pages);
+    page_free(b, pages);
+}
@@ -0,0 +1,25 @@
+/*
+ * Per-CPU Data Implementation
+ */
+
+#include "percpu.h"
+#include "smp.h"
+
+static percpu_t areas[SMP_MAX_CPUS];
+
+void percpu_init(void)
+{
+    int cpu = smp_cpu_id();
+    percpu_t* area = &areas[cpu];
+
+    area->self = area;
+    area->cpu = cpu;
+    mpmc_init(&area->call_queue, area->call_cells, PERCPU_CALL_QUEUE);
+
+    __asm__ volatile("msr tpidr_el1, %0" :: "r"(area) : "memory");
+}
+
+percpu_t* percpu_of(int cpu)
+{
+    return (cpu >= 0 && cpu < SMP_MAX_CPUS) ? &areas[cpu] : NULL;
+}
@@ -0,0 +1,234 @@
+/*
+ * CFI Parallel Flash Implementation
+ * The bank is PFLASH_WIDTH bytes wide, made of one or more interleaved
+ * chips. Commands go to every chip at once (the byte repeated in each
+ * lane); status and counts are per chip, so they use the lane pattern
+ * of the interleave. After a command the bank stays in status mode
+ * until read-array (0xFF) is written, so every operation runs under one
+ * lock and ends in read-array mode.
+ */
+
+#include "pflash.h"
+#include "fdt.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "uart.h"
+
+// Commands (Intel/Sharp command set)
+#define CMD_READ_ARRAY          0xff
+#define CMD_READ_STATUS         0x70
+#define CMD_CLEAR_STATUS        0x50
+#define CMD_QUERY               0x98
+#define CMD_WORD_PROGRAM        0x40
+#define CMD_BUFFERED_PROGRAM    0xe8
+#define CMD_BLOCK_ERASE         0x20
+#define CMD_LOCK_SETUP          0x60
+#define CMD_CONFIRM             0xd0        // Also unlocks after CMD_LOCK_SETUP
+
+// Status register bits (per chip)
+#define STATUS_READY            0x80
+#define STATUS_ERRORS           0x3a        // Erase, program, VPP and lock errors
+
+#define BUFFER_CHUNK_MAX        256         // Bytes per buffered program command
+
+static spinlock_t pflash_lock;
+static uintptr_t base = 0;
+static size_t size = 0;
+static size_t block_size = 0;
+static size_t buffer_size = 0;              // Write buffer, 0 if word programming only
+static uint32_t lanes = 0x01010101;         // One bit per chip lane, scaled by values
+
+static pflash_stats_t stats;
+
+static void write_cmd(size_t offset, uint8_t cmd)
+{
+    *(volatile uint32_t*)(base + offset) = 0x01010101U * cmd;
+}
+
+static void write_word(size_t offset, uint32_t value)
+{
+    *(volatile uint32_t*)(base + offset) = value;
+}
+
+static uint32_t read_word(size_t offset)
+{
+    return *(volatile uint32_t*)(base + offset);
+}
+
+// Byte 'index' of the CFI query table (the first chip's copy)
+static uint8_t cfi_byte(int index)
+{
+    return read_word((size_t)index * PFLASH_WIDTH) & 0xff;
+}
+
+/*
+ * Called with pflash_lock held after a command: wait until every chip is
+ * ready, then check for errors and go back to read-array mode
+ */
+static int wait_ready(size_t offset)
+{
+    uint64_t start = timer_ticks();
+    uint32_t status;
+    while (((status = read_word(offset)) & (STATUS_READY * lanes)) != STATUS_READY * lanes) {
+        if (timer_ticks_to_us(timer_ticks() - start) > PFLASH_TIMEOUT_MS * 1000UL) {
+            break;
+        }
+    }
+
+    int result = 0;
+    if ((status & (STATUS_READY * lanes)) != STATUS_READY * lanes || (status & (STATUS_ERRORS * lanes))) {
+        write_cmd(offset, CMD_CLEAR_STATUS);
+        stats.errors++;
+        result = -1;
+    }
+    write_cmd(offset, CMD_READ_ARRAY);
+    return result;
+}
+
+void pflash_init(void)
+{
+    spin_lock_init(&pflash_lock, "pflash");
+
+    uintptr_t addr = PFLASH_DEFAULT_BASE;
+    size_t bank_size = PFLASH_DEFAULT_SIZE;
+    if (fdt_present()) {
+        // One "cfi-flash" node with a reg entry per bank
+        int node = fdt_find_compatible(-1, "cfi-flash");
+        uint64_t reg_base, reg_size;
+        if (node < 0 || fdt_get_reg(node, 1, &reg_base, &reg_size) != 0) return;
+        int len;
+        const uint32_t* width = fdt_getprop(node, "bank-width", &len);
+        if (width && len == 4 && fdt32_to_cpu(*width) != PFLASH_WIDTH) return;
+        addr = (uintptr_t)reg_base;
+        bank_size = reg_size;
+    }
+    base = addr;
+
+    write_cmd(0, CMD_QUERY);
+    if (cfi_byte(0x10) != 'Q' || cfi_byte(0x11) != 'R' || cfi_byte(0x12) != 'Y') {
+        write_cmd(0, CMD_READ_ARRAY);
+        base = 0;
+        return;
+    }
+
+    // The table describes one chip; the bank size says how many there are
+    size_t chip_size = 1UL << cfi_byte(0x27);
+    size_t interleave = bank_size / chip_size;
+    size_t chip_block = ((size_t)cfi_byte(0x2f) | (size_t)cfi_byte(0x30) << 8) * 256;
+    size_t chip_buffer = cfi_byte(0x2a) ? 1UL << cfi_byte(0x2a) : 0;
+    write_cmd(0, CMD_READ_ARRAY);
+
+    if (interleave == 0 || PFLASH_WIDTH % interleave != 0 || chip_block == 0) {
+        printf("pflash: unsupported geometry (%lu byte chips in a %lu byte bank)\n",
+               (unsigned long)chip_size, (unsigned long)bank_size);
+        base = 0;
+        return;
+    }
+    lanes = 0;
+    for (size_t i = 0; i < interleave; i++) {
+        lanes |= 1U << (i * 8 * (PFLASH_WIDTH / interleave));
+    }
+    size = bank_size;
+    block_size = chip_block * interleave;
+    buffer_size = chip_buffer * interleave;
+
+    printf("pflash: %lu MB at %x, %lu KB erase blocks, %lu byte write buffer\n",
+           (unsigned long)(size >> 20), (unsigned long)base,
+           (unsigned long)(block_size / 1024), (unsigned long)buffer_size);
+}
+
+int pflash_present(void)
+{
+    return base != 0;
+}
+
+size_t pflash_size(void)
+{
+    return size;
+}
+
+size_t pflash_block_size(void)
+{
+    return block_size;
+}
+
+int pflash_read(size_t offset, void* buf, size_t len)
+{
+    if (!base || offset > size || len > size - offset) return -1;
+
+    unsigned long flags = spin_lock_irqsave(&pflash_lock);
+    memcpy(buf, (const void*)(base + offset), len);
+    stats.bytes_read += len;
+    spin_unlock_irqrestore(&pflash_lock, flags);
+    return 0;
+}
+
+int pflash_erase(size_t offset)
+{
+    if (!base || offset >= size) return -1;
+    offset -= offset % block_size;
+
+    unsigned long flags = spin_lock_irqsave(&pflash_lock);
+    // Chips may power up with their blocks locked
+    write_cmd(offset, CMD_LOCK_SETUP);
+    write_cmd(offset, CMD_CONFIRM);
+    write_cmd(offset, CMD_BLOCK_ERASE);
+    write_cmd(offset, CMD_CONFIRM);
+    int result = wait_ready(offset);
+    stats.erases++;
+    spin_unlock_irqrestore(&pflash_lock, flags);
+    return result;
+}
+
+int pflash_program(size_t offset, const void* buf, size_t len)
+{
+    if (!base || offset > size || len > size - offset) return -1;
+    if (offset % PFLASH_WIDTH || len % PFLASH_WIDTH) return -1;
+
+    const uint8_t* src = buf;
+    size_t chunk_max = buffer_size < BUFFER_CHUNK_MAX ? buffer_size : BUFFER_CHUNK_MAX;
+    int result = 0;
+
+    unsigned long flags = spin_lock_irqsave(&pflash_lock);
+    while (len > 0 && result == 0) {
+        uint32_t word;
+        if (chunk_max < PFLASH_WIDTH) {
+            memcpy(&word, src, PFLASH_WIDTH);
+            write_cmd(offset, CMD_WORD_PROGRAM);
+            write_word(offset, word);
+            result = wait_ready(offset);
+            stats.programs++;
+            stats.bytes_programmed += PFLASH_WIDTH;
+            offset += PFLASH_WIDTH;
+            src += PFLASH_WIDTH;
+            len -= PFLASH_WIDTH;
+            continue;
+        }
+
+        // One buffer load, never across a write buffer boundary
+        size_t chunk = chunk_max - offset % chunk_max;
+        if (chunk > len) chunk = len;
+        size_t words = chunk / PFLASH_WIDTH;
+
+        write_cmd(offset, CMD_BUFFERED_PROGRAM);
+        write_word(offset, (uint32_t)(words - 1) * lanes);
+        for (size_t i = 0; i < words; i++) {
+            memcpy(&word, src + i * PFLASH_WIDTH, PFLASH_WIDTH);
+            write_word(offset + i * PFLASH_WIDTH, word);
+        }
+        write_cmd(offset, CMD_CONFIRM);
+        result = wait_ready(offset);
+        stats.programs++;
+        stats.bytes_programmed += chunk;
+        offset += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+    spin_unlock_irqrestore(&pflash_lock, flags);
+    return result;
+}
+
+const pflash_stats_t* pflash_stats(void)
+{
+    return &stats;
+}
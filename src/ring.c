@@ -0,0 +1,465 @@
+/*
+ * Lock-Free Ring Queues Implementation
+ * Indices are free-running 64-bit counters (never wrap in practice);
+ * the slot is index & mask. Producers publish with a store-release that
+ * consumers read with a load-acquire, so the slot contents are visible
+ * before the index that covers them.
+ */
+
+#include "ring.h"
+#include "atomic.h"
+#include "smp.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+static int is_power_of_two(uint64_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// --- SPSC ---
+
+int spsc_init(spsc_ring_t* ring, uint64_t* slots, uint64_t capacity)
+{
+    if (!ring || !slots || !is_power_of_two(capacity)) return -1;
+
+    ring->head = 0;
+    ring->tail_cache = 0;
+    ring->tail = 0;
+    ring->head_cache = 0;
+    ring->slots = slots;
+    ring->mask = capacity - 1;
+    return 0;
+}
+
+// Free slots as seen by the producer, refreshing its tail copy if short
+static uint64_t spsc_space(spsc_ring_t* ring, uint64_t head, uint64_t want)
+{
+    uint64_t space = ring->mask + 1 - (head - ring->tail_cache);
+    if (space < want) {
+        ring->tail_cache = atomic_load_acquire(&ring->tail);
+        space = ring->mask + 1 - (head - ring->tail_cache);
+    }
+    return space;
+}
+
+// Items available to the consumer, refreshing its head copy if short
+static uint64_t spsc_avail(spsc_ring_t* ring, uint64_t tail, uint64_t want)
+{
+    uint64_t avail = ring->head_cache - tail;
+    if (avail < want) {
+        ring->head_cache = atomic_load_acquire(&ring->head);
+        avail = ring->head_cache - tail;
+    }
+    return avail;
+}
+
+int spsc_push(spsc_ring_t* ring, uint64_t item)
+{
+    uint64_t head = ring->head;
+    if (spsc_space(ring, head, 1) == 0) return -1;
+
+    ring->slots[head & ring->mask] = item;
+    atomic_store_release(&ring->head, head + 1);
+    return 0;
+}
+
+int spsc_push_batch(spsc_ring_t* ring, const uint64_t* items, int count)
+{
+    if (count <= 0) return 0;
+
+    uint64_t head = ring->head;
+    uint64_t space = spsc_space(ring, head, (uint64_t)count);
+    int n = space < (uint64_t)count ? (int)space : count;
+
+    for (int i = 0; i < n; i++) {
+        ring->slots[(head + i) & ring->mask] = items[i];
+    }
+    if (n > 0) atomic_store_release(&ring->head, head + n);
+    return n;
+}
+
+int spsc_pop(spsc_ring_t* ring, uint64_t* item)
+{
+    uint64_t tail = ring->tail;
+    if (spsc_avail(ring, tail, 1) == 0) return -1;
+
+    *item = ring->slots[tail & ring->mask];
+    atomic_store_release(&ring->tail, tail + 1);
+    return 0;
+}
+
+int spsc_pop_batch(spsc_ring_t* ring, uint64_t* items, int max)
+{
+    if (max <= 0) return 0;
+
+    uint64_t tail = ring->tail;
+    uint64_t avail = spsc_avail(ring, tail, (uint64_t)max);
+    int n = avail < (uint64_t)max ? (int)avail : max;
+
+    for (int i = 0; i < n; i++) {
+        items[i] = ring->slots[(tail + i) & ring->mask];
+    }
+    if (n > 0) atomic_store_release(&ring->tail, tail + n);
+    return n;
+}
+
+uint64_t spsc_count(const spsc_ring_t* ring)
+{
+    return atomic_load_acquire(&ring->head) - atomic_load_acquire(&ring->tail);
+}
+
+// --- MPMC ---
+
+int mpmc_init(mpmc_queue_t* queue, mpmc_cell_t* cells, uint64_t capacity)
+{
+    if (!queue || !cells || capacity < 2 || !is_power_of_two(capacity)) return -1;
+
+    for (uint64_t i = 0; i < capacity; i++) {
+        cells[i].sequence = i;
+    }
+    queue->cells = cells;
+    queue->mask = capacity - 1;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    return 0;
+}
+
+/*
+ * A cell at position p is free for the producer of turn p when its
+ * sequence equals p, and holds that producer's item when it equals p+1;
+ * the consumer hands it back for turn p+capacity
+ */
+int mpmc_enqueue(mpmc_queue_t* queue, uint64_t item)
+{
+    return mpmc_enqueue_batch(queue, &item, 1) == 1 ? 0 : -1;
+}
+
+int mpmc_dequeue(mpmc_queue_t* queue, uint64_t* item)
+{
+    return mpmc_dequeue_batch(queue, item, 1) == 1 ? 0 : -1;
+}
+
+int mpmc_enqueue_batch(mpmc_queue_t* queue, const uint64_t* items, int count)
+{
+    if (count <= 0) return 0;
+
+    uint64_t pos = atomic_load_relaxed(&queue->enqueue_pos);
+    int n;
+
+    while (1) {
+        // Count consecutive free cells from pos
+        n = 0;
+        while (n < count) {
+            mpmc_cell_t* cell = &queue->cells[(pos + n) & queue->mask];
+            if (atomic_load_acquire(&cell->sequence) != pos + n) break;
+            n++;
+        }
+
+        if (n == 0) {
+            mpmc_cell_t* cell = &queue->cells[pos & queue->mask];
+            int64_t diff = (int64_t)(atomic_load_acquire(&cell->sequence) - pos);
+            if (diff < 0) return 0;         // Full - a consumer has not freed it yet
+            pos = atomic_load_relaxed(&queue->enqueue_pos);
+            continue;                       // Another producer took it
+        }
+
+        if (atomic_cas64(&queue->enqueue_pos, pos, pos + n)) break;
+        pos = atomic_load_relaxed(&queue->enqueue_pos);
+    }
+
+    for (int i = 0; i < n; i++) {
+        mpmc_cell_t* cell = &queue->cells[(pos + i) & queue->mask];
+        cell->data = items[i];
+        atomic_store_release(&cell->sequence, pos + i + 1);
+    }
+    return n;
+}
+
+int mpmc_dequeue_batch(mpmc_queue_t* queue, uint64_t* items, int max)
+{
+    if (max <= 0) return 0;
+
+    uint64_t pos = atomic_load_relaxed(&queue->dequeue_pos);
+    int n;
+
+    while (1) {
+        // Count consecutive published cells from pos
+        n = 0;
+        while (n < max) {
+            mpmc_cell_t* cell = &queue->cells[(pos + n) & queue->mask];
+            if (atomic_load_acquire(&cell->sequence) != pos + n + 1) break;
+            n++;
+        }
+
+        if (n == 0) {
+            mpmc_cell_t* cell = &queue->cells[pos & queue->mask];
+            int64_t diff = (int64_t)(atomic_load_acquire(&cell->sequence) - (pos + 1));
+            if (diff < 0) return 0;         // Empty - nothing published yet
+            pos = atomic_load_relaxed(&queue->dequeue_pos);
+            continue;                       // Another consumer took it
+        }
+
+        if (atomic_cas64(&queue->dequeue_pos, pos, pos + n)) break;
+        pos = atomic_load_relaxed(&queue->dequeue_pos);
+    }
+
+    for (int i = 0; i < n; i++) {
+        mpmc_cell_t* cell = &queue->cells[(pos + i) & queue->mask];
+        items[i] = cell->data;
+        atomic_store_release(&cell->sequence, pos + i + queue->mask + 1);
+    }
+    return n;
+}
+
+// --- Benchmark ---
+
+#define BENCH_CAPACITY  1024
+#define BENCH_BATCH     16
+#define BENCH_RTT_MAX   100000
+
+enum { MODE_SPSC, MODE_SPSC_BATCH, MODE_MPMC, MODE_PINGPONG, MODE_COUNT };
+
+static spsc_ring_t bench_ab;
+static spsc_ring_t bench_ba;
+static mpmc_queue_t bench_mpmc;
+static uint64_t bench_ab_slots[BENCH_CAPACITY];
+static uint64_t bench_ba_slots[BENCH_CAPACITY];
+static mpmc_cell_t bench_cells[BENCH_CAPACITY];
+
+static volatile uint32_t bench_busy;    // A run is in progress
+static int bench_mode;
+static int bench_cpu[2];                // Producer, consumer
+static unsigned long bench_items;
+static volatile uint32_t bench_pinned;
+static volatile uint64_t bench_ready;
+static volatile uint32_t bench_go;
+static volatile uint64_t bench_start;
+static volatile uint64_t bench_end;
+static volatile unsigned long bench_errors;
+
+static inline void cpu_relax(void)
+{
+    __asm__ volatile("yield" ::: "memory");
+}
+
+static void bench_producer(void)
+{
+    unsigned long n = bench_items;
+    uint64_t batch[BENCH_BATCH];
+
+    switch (bench_mode) {
+    case MODE_SPSC:
+        for (uint64_t i = 1; i <= n; i++) {
+            while (spsc_push(&bench_ab, i) != 0) cpu_relax();
+        }
+        break;
+    case MODE_SPSC_BATCH:
+        for (uint64_t i = 1; i <= n; ) {
+            int want = (n - i + 1) < BENCH_BATCH ? (int)(n - i + 1) : BENCH_BATCH;
+            for (int k = 0; k < want; k++) batch[k] = i + k;
+            int sent = 0;
+            while (sent < want) {
+                int pushed = spsc_push_batch(&bench_ab, batch + sent, want - sent);
+                if (pushed == 0) cpu_relax();
+                sent += pushed;
+            }
+            i += want;
+        }
+        break;
+    case MODE_MPMC:
+        for (uint64_t i = 1; i <= n; i++) {
+            while (mpmc_enqueue(&bench_mpmc, i) != 0) cpu_relax();
+        }
+        break;
+    default:    // Ping-pong: send, wait for the echo
+        for (uint64_t i = 1; i <= n; i++) {
+            uint64_t echo;
+            while (spsc_push(&bench_ab, i) != 0) cpu_relax();
+            while (spsc_pop(&bench_ba, &echo) != 0) cpu_relax();
+            if (echo != i) bench_errors++;
+        }
+        bench_end = timer_ticks();
+        break;
+    }
+}
+
+static void bench_consumer(void)
+{
+    unsigned long n = bench_items;
+    uint64_t batch[BENCH_BATCH];
+    uint64_t expected = 1;
+    uint64_t item;
+
+    switch (bench_mode) {
+    case MODE_SPSC:
+        while (expected <= n) {
+            while (spsc_pop(&bench_ab, &item) != 0) cpu_relax();
+            if (item != expected) bench_errors++;
+            expected++;
+        }
+        bench_end = timer_ticks();
+        break;
+    case MODE_SPSC_BATCH:
+        while (expected <= n) {
+            int got = spsc_pop_batch(&bench_ab, batch, BENCH_BATCH);
+            if (got == 0) cpu_relax();
+            for (int k = 0; k < got; k++) {
+                if (batch[k] != expected) bench_errors++;
+                expected++;
+            }
+        }
+        bench_end = timer_ticks();
+        break;
+    case MODE_MPMC:
+        while (expected <= n) {
+            while (mpmc_dequeue(&bench_mpmc, &item) != 0) cpu_relax();
+            if (item != expected) bench_errors++;
+            expected++;
+        }
+        bench_end = timer_ticks();
+        break;
+    default:
+        while (expected <= n) {
+            while (spsc_pop(&bench_ab, &item) != 0) cpu_relax();
+            while (spsc_push(&bench_ba, item) != 0) cpu_relax();
+            expected++;
+        }
+        break;
+    }
+}
+
+// Thread body: move to the assigned CPU, wait for the start signal, run
+static void bench_thread(void* arg)
+{
+    int role = (int)(uintptr_t)arg;
+
+    // Yielding re-queues the thread on a CPU its affinity allows
+    while (!atomic_load_acquire(&bench_pinned) || smp_cpu_id() != bench_cpu[role]) {
+        thread_yield();
+    }
+    atomic_fetch_add64(&bench_ready, 1);
+    while (!atomic_load_acquire(&bench_go)) {
+        cpu_relax();
+    }
+
+    if (role == 0) {
+        bench_producer();
+    } else {
+        bench_consumer();
+    }
+}
+
+// One measurement; returns elapsed ns or 0 on failure
+static uint64_t bench_pair(int mode, int producer_cpu, int consumer_cpu, unsigned long items)
+{
+    spsc_init(&bench_ab, bench_ab_slots, BENCH_CAPACITY);
+    spsc_init(&bench_ba, bench_ba_slots, BENCH_CAPACITY);
+    mpmc_init(&bench_mpmc, bench_cells, BENCH_CAPACITY);
+
+    bench_mode = mode;
+    bench_cpu[0] = producer_cpu;
+    bench_cpu[1] = consumer_cpu;
+    bench_items = items;
+    bench_pinned = 0;
+    bench_ready = 0;
+    bench_go = 0;
+    bench_errors = 0;
+
+    int ids[2];
+    for (int role = 0; role < 2; role++) {
+        ids[role] = thread_create(role ? "ring-cons" : "ring-prod", bench_thread,
+                                  (void*)(uintptr_t)role, 1);
+        if (ids[role] >= 0) {
+            thread_set_affinity(ids[role], 1U << bench_cpu[role]);
+        }
+    }
+    if (ids[0] < 0 || ids[1] < 0) {
+        // A lone thread would wait forever for its partner
+        bench_items = 0;
+        atomic_store_release(&bench_pinned, 1);
+        atomic_store_release(&bench_go, 1);
+        for (int role = 0; role < 2; role++) {
+            if (ids[role] >= 0) thread_join(ids[role]);
+        }
+        return 0;
+    }
+    atomic_store_release(&bench_pinned, 1);
+
+    while (atomic_load_acquire(&bench_ready) < 2) {
+        thread_yield();
+    }
+    bench_start = timer_ticks();
+    atomic_store_release(&bench_go, 1);
+
+    thread_join(ids[0]);
+    thread_join(ids[1]);
+    return timer_ticks_to_ns(bench_end - bench_start);
+}
+
+// Print thousands of items per second, padded
+static void print_rate(unsigned long items, uint64_t ns)
+{
+    print_uint_padded(ns ? (unsigned long)(items * 1000000UL / ns) : 0, 14);
+}
+
+/*
+ * For every ordered pair of online CPUs (producer < consumer): SPSC
+ * throughput one item and 16 items at a time, MPMC throughput with one
+ * producer and one consumer, and the SPSC ping-pong round trip
+ */
+static void ring_bench_run(unsigned long items)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+    if (smp_cpus_online() < 2) {
+        puts("Ring benchmark needs at least 2 online CPUs");
+        return;
+    }
+
+    unsigned long rtt_items = items < BENCH_RTT_MAX ? items : BENCH_RTT_MAX;
+
+    puts("=== Ring Queue Benchmark ===");
+    printf("Items per run: %lu (round trips: %lu), capacity %d\n\n", items, rtt_items,
+           BENCH_CAPACITY);
+    puts("PAIR    SPSC(K/s)     BATCH16(K/s)  MPMC(K/s)     RTT(ns)   CHECK");
+
+    for (int a = 0; a < SMP_MAX_CPUS; a++) {
+        if (!smp_cpu_online(a)) continue;
+        for (int b = a + 1; b < SMP_MAX_CPUS; b++) {
+            if (!smp_cpu_online(b)) continue;
+
+            uint64_t ns[MODE_COUNT];
+            unsigned long errors = 0;
+            for (int mode = 0; mode < MODE_COUNT; mode++) {
+                ns[mode] = bench_pair(mode, a, b, mode == MODE_PINGPONG ? rtt_items : items);
+                errors += bench_errors;
+                if (ns[mode] == 0) {
+                    puts("Error: could not create benchmark threads");
+                    return;
+                }
+            }
+
+            printf("%d->%d    ", a, b);
+            print_rate(items, ns[MODE_SPSC]);
+            print_rate(items, ns[MODE_SPSC_BATCH]);
+            print_rate(items, ns[MODE_MPMC]);
+            print_uint_padded((unsigned long)(ns[MODE_PINGPONG] / rtt_items), 10);
+            printf("%s\n", errors ? "ORDER ERROR" : "ok");
+        }
+    }
+}
+
+void ring_bench(unsigned long items)
+{
+    // The benchmark rings are file-level statics: one run at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("Ring benchmark already running");
+        return;
+    }
+    ring_bench_run(items);
+    atomic_store_release(&bench_busy, 0);
+}
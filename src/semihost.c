@@ -0,0 +1,74 @@
+/*
+ * ARM Semihosting Implementation
+ * AArch64 calling convention: w0 holds the operation, x1 points at a
+ * block of 64-bit parameters, and the result comes back in x0. QEMU
+ * carries out the whole operation before the HLT retires, so a call
+ * needs no locking beyond what its caller's data needs.
+ */
+
+#include "semihost.h"
+#include "string.h"
+#include "uart.h"
+
+#define OPEN_MODE_WB            5           // fopen() mode "wb"
+#define OPEN_MODE_AB            9           // "ab"
+
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+static int present = 0;
+
+static long semihost_call(unsigned long op, void* block)
+{
+    register unsigned long x0 __asm__("x0") = op;
+    register void* x1 __asm__("x1") = block;
+    __asm__ volatile("hlt #0xf000" : "+r"(x0) : "r"(x1) : "memory");
+    return (long)x0;
+}
+
+void semihost_init(void)
+{
+    // Without -semihosting the exception fixup skips the HLT and returns
+    // -1, which the host clock never reads
+    present = semihost_call(SEMIHOST_SYS_TIME, NULL) != -1;
+    if (present) {
+        puts("Semihosting: host file export and exit available");
+    }
+}
+
+int semihost_present(void)
+{
+    return present;
+}
+
+long semihost_open(const char* path, int append)
+{
+    if (!present) return -1;
+
+    uint64_t block[3] = { (uintptr_t)path, append ? OPEN_MODE_AB : OPEN_MODE_WB, strlen(path) };
+    return semihost_call(SEMIHOST_SYS_OPEN, block);
+}
+
+int semihost_write(long handle, const void* buf, size_t len)
+{
+    if (!present || handle < 0) return -1;
+
+    // Returns the number of bytes it did not write
+    uint64_t block[3] = { (uint64_t)handle, (uintptr_t)buf, len };
+    return semihost_call(SEMIHOST_SYS_WRITE, block) == 0 ? 0 : -1;
+}
+
+int semihost_close(long handle)
+{
+    if (!present || handle < 0) return -1;
+
+    uint64_t block[1] = { (uint64_t)handle };
+    return semihost_call(SEMIHOST_SYS_CLOSE, block) == 0 ? 0 : -1;
+}
+
+void semihost_exit(int status)
+{
+    if (!present) return;
+
+    uint64_t block[2] = { ADP_STOPPED_APPLICATION_EXIT, (uint64_t)(unsigned int)status };
+    semihost_call(SEMIHOST_SYS_EXIT, block);
+}
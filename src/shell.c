@@ -7,6 +7,31 @@
 #include "string.h"
 #include "uart.h"
 #include "memory.h"
+#include "memmap.h"
+#include "lineedit.h"
+#include "history.h"
+#include "complete.h"
+#include "thread.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "kmalloc.h"
+#include "ring.h"
+#include "ipi.h"
+#include "parallel.h"
+#include "workqueue.h"
+#include "cancel.h"
+#include "jobs.h"
+#include "virtio.h"
+#include "virtio_blk.h"
+#include "bcache.h"
+#include "iosched.h"
+#include "fs.h"
+#include "initrd.h"
+#include "fwcfg.h"
+#include "semihost.h"
+#include "cfgstore.h"
+#include "kv.h"
+#include "page.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -18,6 +43,7 @@
 #define ANSI_CLEAR_LINE     "\x1b[2K"     // Clear entire current line
 #define ANSI_CLEAR_TO_EOL   "\x1b[0K"     // Clear from cursor to end of line
 #define ANSI_CLEAR_TO_BOL   "\x1b[1K"     // Clear from beginning of line to cursor
+#define ANSI_CLEAR_TO_EOS   "\x1b[0J"     // Clear from cursor to end of screen
 #define ANSI_CURSOR_HOME    "\x1b[H"      // Move cursor to top-left (1,1)
 #define ANSI_CURSOR_POS(r,c) "\x1b[" #r ";" #c "H"  // Move cursor to row r, column c
 #define ANSI_SAVE_CURSOR    "\x1b[s"      // Save cursor position
@@ -75,6 +101,7 @@ typedef enum {
     SHELL_ERROR_ALIGNMENT,      // Address alignment error
     SHELL_ERROR_PARSE,          // Parsing error
     SHELL_ERROR_SYSTEM,         // System or hardware error
+    SHELL_ERROR_INTERRUPTED,    // Stopped by Ctrl-C
     SHELL_ERROR_COUNT           // Total number of error types
 } shell_error_t;
 
@@ -96,6 +123,7 @@ typedef struct {
 
 static error_log_t error_log = {0};
 static unsigned int error_timestamp_counter = 0;
+static ticket_lock_t error_log_lock;
 
 // Day 20 Task 2: Performance Monitoring System
 // Command execution statistics structure
@@ -117,6 +145,7 @@ typedef struct {
 } performance_monitor_t;
 
 static performance_monitor_t perf_monitor = {0};
+static ticket_lock_t perf_monitor_lock;
 
 // Simple timer functions (using incrementing counter since no real timer)
 // Removed unused get_simple_timer function
@@ -137,6 +166,76 @@ typedef struct {
 } alias_table_t;
 
 static alias_table_t alias_table = {0};
+static mcs_lock_t alias_lock;
+
+// Tab completion word sets (built in shell_init)
+static int complete_commands = -1;      // Command names and aliases
+static int complete_aliases = -1;       // Alias names only
+static int complete_files = -1;         // Files in the root directory
+
+// Per-command argument completers
+// The first entry matching the command, argument position and (optionally)
+// the preceding argument supplies the word set
+typedef struct {
+    const char* command;        // Command the argument belongs to
+    int arg_index;              // 1 = first argument after the command
+    const char* previous;       // Required preceding argument, or NULL
+    const char* keywords;       // Space separated keywords, or NULL
+    int* shared;                // Existing word set used instead of keywords
+    int set;                    // Word set built from keywords
+} arg_completer_t;
+
+// Runtime initialized, like command_table: filled by arg_completers_init()
+#define ARG_COMPLETER_MAX 40
+static arg_completer_t arg_completers[ARG_COMPLETER_MAX];
+static int arg_completer_count = 0;
+
+static void arg_completer_add(const char* command, int arg_index, const char* previous,
+                              const char* keywords, int* shared)
+{
+    if (arg_completer_count >= ARG_COMPLETER_MAX) return;
+    
+    arg_completer_t* ac = &arg_completers[arg_completer_count++];
+    ac->command = command;
+    ac->arg_index = arg_index;
+    ac->previous = previous;
+    ac->keywords = keywords;
+    ac->shared = shared;
+    ac->set = -1;
+}
+
+static void arg_completers_init(void)
+{
+    arg_completer_count = 0;
+    arg_completer_add("color",      1, NULL, "on off enable disable test", NULL);
+    arg_completer_add("poke",       3, NULL, "byte word long", NULL);
+    arg_completer_add("history",    1, NULL, "-c", NULL);
+    arg_completer_add("batch-mode", 1, NULL, "on off status", NULL);
+    arg_completer_add("bench",      1, NULL, "switch sched locks alloc ring ipi", NULL);
+    arg_completer_add("cpus",       1, NULL, "reset pin", NULL);
+    arg_completer_add("locks",      1, NULL, "reset", NULL);
+    arg_completer_add("pmem",       1, NULL, "fill zero copy cmp crc bench", NULL);
+    arg_completer_add("work",       1, NULL, "reset bench", NULL);
+    arg_completer_add("virtio",     1, NULL, "reset", NULL);
+    arg_completer_add("blkbench",   1, NULL, "read write stats reset -m", NULL);
+    arg_completer_add("blkbench",   2, "-m", "irq poll adaptive", NULL);
+    arg_completer_add("cache",      1, NULL, "sync drop reset read", NULL);
+    arg_completer_add("iosched",    1, NULL, "reset", NULL);
+    arg_completer_add("fwcfg",      1, NULL, "load cat free bench", NULL);
+    arg_completer_add("config",     1, NULL, "keys sync compact clear", NULL);
+    arg_completer_add("kv",         1, NULL, "put get del scan sync compact reset bench", NULL);
+    arg_completer_add("export",     1, NULL, "-a", NULL);
+    arg_completer_add("export",     2, NULL, NULL, &complete_commands);
+    arg_completer_add("cat",        1, NULL, NULL, &complete_files);
+    arg_completer_add("rm",         1, NULL, NULL, &complete_files);
+    arg_completer_add("stat",       1, NULL, NULL, &complete_files);
+    arg_completer_add("write",      1, NULL, NULL, &complete_files);
+    arg_completer_add("write",      2, "-a", NULL, &complete_files);
+    arg_completer_add("alias",      1, NULL, "-d -c", NULL);
+    arg_completer_add("alias",      2, "-d", NULL, &complete_aliases);
+    arg_completer_add("alias",      2, NULL, NULL, &complete_commands);
+    arg_completer_add("help",       1, NULL, NULL, &complete_commands);
+}
 
 // Day 20 Task 4: Batch Commands System
 // Operator types for command chaining
@@ -171,28 +270,14 @@ static const char* error_messages[SHELL_ERROR_COUNT] = {
     "Value is out of valid range",                      // SHELL_ERROR_RANGE
     "Address alignment error",                          // SHELL_ERROR_ALIGNMENT
     "Failed to parse command or arguments",             // SHELL_ERROR_PARSE
-    "System or hardware error"                          // SHELL_ERROR_SYSTEM
+    "System or hardware error",                         // SHELL_ERROR_SYSTEM
+    "Interrupted by Ctrl-C"                             // SHELL_ERROR_INTERRUPTED
 };
 
-// Day 19 Task 1: Command History Implementation
-#define HISTORY_SIZE 20
-#define MAX_COMMAND_LENGTH 256
-
-typedef struct {
-    char commands[HISTORY_SIZE][MAX_COMMAND_LENGTH];
-    int count;          // Total commands stored
-    int current;        // Current position for navigation
-    int write_index;    // Where to write next command
-} command_history_t;
-
-static command_history_t history = {0};
-
-// Forward declarations for history functions
-static void history_add_command(const char* command);
-static const char* history_get_previous(void);
-static const char* history_get_next(void);
-static void history_reset_navigation(void);
-static void shell_complete_command(const char* partial, char* buffer, int* pos, int* cursor_pos, int max_size, int word_start);
+// Forward declarations for line editing helpers
+static void shell_complete_word(line_editor_t* le, int set, const char* partial, int partial_len);
+static int shell_ingest_line(char* buffer, int max_size, int start_len);
+static int shell_reverse_search(line_editor_t* le);
 
 // Forward declarations for error system functions
 static void shell_log_error(shell_error_t error_code, const char* command, const char* context);
@@ -207,19 +292,37 @@ static const char* shell_get_error_message(shell_error_t error_code);
 // Forward declarations for alias system functions
 static void alias_init_builtins(void);
 static int alias_add(const char* name, const char* expansion, int is_builtin);
-static const char* alias_find(const char* name);
+static int alias_find(const char* name, char* expansion, int max_size);
 static int alias_remove(const char* name);
 static void alias_clear_user_aliases(void);
 static int alias_validate_name(const char* name);
 
+// Forward declarations for persistent settings (config store)
+static void settings_load(void);
+static void settings_save_alias(const char* name, const char* expansion);
+static void settings_clear_aliases(void);
+static void settings_save_colors(void);
+static void shell_history_add(const char* line);
+static void settings_clear_history(void);
+
+// Forward declaration for the export command
+static void export_init(void);
+
 // Forward declarations for batch command functions
 static int batch_parse_commands(const char* input, batch_sequence_t* sequence);
 static int batch_execute_sequence(const batch_sequence_t* sequence);
 static int batch_execute_single_command(const char* command_str);
 // Removed unused batch function declarations (batch_detect_operator, batch_trim_whitespace)
 
+// Seed the file name completions from the mounted filesystem (and the initrd)
+static void complete_add_file(const char* name, const fs_stat_t* st, void* arg)
+{
+    complete_insert(complete_files, name);
+}
+
 // Command table - Phase 3 Day 20 expanded (runtime initialized)
-static shell_command_t command_table[18];  // 17 commands + NULL terminator
+#define SHELL_COMMAND_COUNT 42
+static shell_command_t command_table[SHELL_COMMAND_COUNT + 1];  // commands + NULL terminator
 
 void shell_init(void)
 {
@@ -292,283 +395,615 @@ void shell_init(void)
     command_table[16].description = "Manage command aliases";
     command_table[16].handler = cmd_alias;
     
+    command_table[17].name = "memmap";
+    command_table[17].description = "Show physical memory map";
+    command_table[17].handler = cmd_memmap;
+    
+    command_table[18].name = "batch-mode";
+    command_table[18].description = "Fast scripted input mode";
+    command_table[18].handler = cmd_batch_mode;
+    
+    command_table[19].name = "ps";
+    command_table[19].description = "List kernel threads";
+    command_table[19].handler = cmd_ps;
+    
+    command_table[20].name = "bench";
+    command_table[20].description = "Run kernel benchmarks";
+    command_table[20].handler = cmd_bench;
+    
+    command_table[21].name = "cpus";
+    command_table[21].description = "Per-CPU scheduler statistics";
+    command_table[21].handler = cmd_cpus;
+    
+    command_table[22].name = "locks";
+    command_table[22].description = "Lock contention statistics";
+    command_table[22].handler = cmd_locks;
+    
+    command_table[23].name = "pmem";
+    command_table[23].description = "Parallel fill, copy, compare and CRC";
+    command_table[23].handler = cmd_pmem;
+    
+    command_table[24].name = "work";
+    command_table[24].description = "Work queue and timer statistics";
+    command_table[24].handler = cmd_work;
+    
+    command_table[25].name = "jobs";
+    command_table[25].description = "List background jobs";
+    command_table[25].handler = cmd_jobs;
+    
+    command_table[26].name = "fg";
+    command_table[26].description = "Show a background job's output and wait for it";
+    command_table[26].handler = cmd_fg;
+    
+    command_table[27].name = "wait";
+    command_table[27].description = "Wait for background jobs to finish";
+    command_table[27].handler = cmd_wait;
+    
+    command_table[28].name = "virtio";
+    command_table[28].description = "Virtio devices and queue statistics";
+    command_table[28].handler = cmd_virtio;
+    
+    command_table[29].name = "blkbench";
+    command_table[29].description = "virtio-blk IOPS and MB/s at queue depths 1-64";
+    command_table[29].handler = cmd_blkbench;
+    
+    command_table[30].name = "cache";
+    command_table[30].description = "Buffer cache hit rates, readahead and write-back";
+    command_table[30].handler = cmd_cache;
+    
+    command_table[31].name = "iosched";
+    command_table[31].description = "I/O scheduler merge ratios and latency histograms";
+    command_table[31].handler = cmd_iosched;
+    
+    command_table[32].name = "ls";
+    command_table[32].description = "List files: size, blocks and extents";
+    command_table[32].handler = cmd_ls;
+    
+    command_table[33].name = "cat";
+    command_table[33].description = "Print a file";
+    command_table[33].handler = cmd_cat;
+    
+    command_table[34].name = "write";
+    command_table[34].description = "Write or append a line of text to a file";
+    command_table[34].handler = cmd_write;
+    
+    command_table[35].name = "rm";
+    command_table[35].description = "Remove a file";
+    command_table[35].handler = cmd_rm;
+    
+    command_table[36].name = "stat";
+    command_table[36].description = "File extents, or filesystem layout and free space";
+    command_table[36].handler = cmd_stat;
+    
+    command_table[37].name = "fwcfg";
+    command_table[37].description = "List and load files passed with QEMU -fw_cfg";
+    command_table[37].handler = cmd_fwcfg;
+    
+    command_table[38].name = "export";
+    command_table[38].description = "Write a command's output to a host file (semihosting)";
+    command_table[38].handler = cmd_export;
+    
+    command_table[39].name = "exit";
+    command_table[39].description = "Stop QEMU with an exit status (semihosting)";
+    command_table[39].handler = cmd_exit;
+    
+    command_table[40].name = "config";
+    command_table[40].description = "Saved aliases, history and colors (flash config store)";
+    command_table[40].handler = cmd_config;
+    
+    command_table[41].name = "kv";
+    command_table[41].description = "Key-value store (LSM tree in files): put, get, scan, bench";
+    command_table[41].handler = cmd_kv;
+    
     // Terminator
-    command_table[17].name = NULL;
-    command_table[17].description = NULL;
-    command_table[17].handler = NULL;
+    command_table[SHELL_COMMAND_COUNT].name = NULL;
+    command_table[SHELL_COMMAND_COUNT].description = NULL;
+    command_table[SHELL_COMMAND_COUNT].handler = NULL;
+    
+    // Name the shell's locks for the locks command
+    ticket_lock_init(&error_log_lock, "error_log");
+    ticket_lock_init(&perf_monitor_lock, "perf_monitor");
+    mcs_lock_init(&alias_lock, "alias_table");
+    export_init();
+    history_init();
+    
+    // Tab completion word sets - commands now, aliases as they are added
+    complete_init();
+    complete_commands = complete_set_create();
+    complete_aliases = complete_set_create();
+    for (int i = 0; i < SHELL_COMMAND_COUNT; i++) {
+        complete_insert(complete_commands, command_table[i].name);
+    }
+    arg_completers_init();
+    for (int i = 0; i < arg_completer_count; i++) {
+        arg_completer_t* ac = &arg_completers[i];
+        if (!ac->keywords) continue;
+        
+        ac->set = complete_set_create();
+        const char* p = ac->keywords;
+        while (*p) {
+            char word[COMPLETE_WORD_MAX];
+            int len = 0;
+            while (*p && *p != ' ') {
+                if (len < COMPLETE_WORD_MAX - 1) word[len++] = *p;
+                p++;
+            }
+            word[len] = '\0';
+            complete_insert(ac->set, word);
+            while (*p == ' ') p++;
+        }
+    }
+    complete_files = complete_set_create();
+    fs_list(complete_add_file, NULL);
+    for (int i = 0; i < initrd_count(); i++) {
+        const initrd_file_t* f = initrd_file(i);
+        char word[COMPLETE_WORD_MAX];
+        int prefix = strlen(INITRD_PREFIX);
+        if (prefix + 1 + f->path_len >= COMPLETE_WORD_MAX) continue;
+        strcpy(word, INITRD_PREFIX "/");
+        strcpy(word + prefix + 1, f->path);
+        complete_insert(complete_files, word);
+    }
     
     // Initialize alias system with built-in aliases
     alias_init_builtins();
+    
+    // User aliases, history and colors saved by earlier boots
+    settings_load();
+    
+    // Background job slots ("cmd &")
+    jobs_init();
+    
+    // Ask the terminal to bracket pastes with ESC[200~ / ESC[201~
+    printf("\x1b[?2004h");
 }
 
-// Day 19 Task 4: Tab completion implementation
-static void shell_complete_command(const char* partial, char* buffer, int* pos, int* cursor_pos, int max_size, int word_start)
+// Line editor state shared by shell_read_line and tab completion
+static line_editor_t line_editor;
+
+// Visible columns of "OS> " (the color codes take none)
+#define SHELL_PROMPT_WIDTH 4
+
+// Column the next line read starts at: set by the prompt, taken by
+// shell_read_line so the editor knows where the terminal wraps the line
+static int prompt_width = 0;
+
+// Fast paste / batch ingestion
+// In these modes lines are pulled from the UART RX ring in bulk with no
+// echo, prompt or redraw, and executed back to back by the main loop
+typedef enum {
+    INGEST_OFF = 0,             // Normal interactive editing
+    INGEST_PASTE,               // Inside ESC[200~ ... ESC[201~
+    INGEST_BATCH                // Explicit 'batch-mode on'
+} ingest_mode_t;
+
+#define INGEST_CHUNK_SIZE 256
+
+static ingest_mode_t ingest_mode = INGEST_OFF;
+static int read_line_depth = 0;                 // Nesting of shell_read_line calls
+static char ingest_chunk[INGEST_CHUNK_SIZE];    // Bytes taken from the RX ring
+static int ingest_chunk_pos = 0;
+static int ingest_chunk_len = 0;
+static char ingest_pending[SHELL_LINE_MAX];     // Partial line when a paste ends
+static unsigned int ingest_lines = 0;           // Lines executed via ingestion
+
+// Next input byte for ingestion, refilling from the RX ring in bulk
+static char ingest_getchar(void)
+{
+    if (ingest_chunk_pos == ingest_chunk_len) {
+        ingest_chunk_len = uart_read_bulk(ingest_chunk, INGEST_CHUNK_SIZE);
+        ingest_chunk_pos = 0;
+    }
+    return ingest_chunk[ingest_chunk_pos++];
+}
+
+/*
+ * Parse the rest of an escape sequence after ESC
+ * Returns the final byte of a CSI sequence (ESC [ params final) and its
+ * numeric parameter (0 if none); returns 0 for non-CSI escapes
+ */
+static char shell_read_csi(char (*next)(void), int* param)
 {
-    if (!partial || !buffer || !pos || !cursor_pos) return;
+    *param = 0;
+    if (next() != '[') return 0;
     
-    // Find all matching commands
-    char matches[17][32];  // Up to 17 commands, 32 chars each
-    int match_count = 0;
-    int partial_len = strlen(partial);
+    char c = next();
+    for (int i = 0; i < 8 && c >= '0' && c <= '9'; i++) {
+        *param = *param * 10 + (c - '0');
+        c = next();
+    }
+    return c;
+}
+
+/*
+ * Read one line in paste/batch mode
+ * No echo and no redraw; start_len bytes of buffer are already filled.
+ * Returns the line length, or 0 when the mode ends (paste end marker,
+ * Ctrl-D in batch mode)
+ */
+static int shell_ingest_line(char* buffer, int max_size, int start_len)
+{
+    int pos = start_len;
     
-    // Search through command table
-    for (int i = 0; i < 17 && command_table[i].name != NULL; i++) {
-        if (strncmp(command_table[i].name, partial, partial_len) == 0) {
-            if (match_count < 17) {
-                strcpy(matches[match_count], command_table[i].name);
-                match_count++;
+    while (1) {
+        char c = ingest_getchar();
+        
+        if (c == '\r' || c == '\n') {
+            buffer[pos] = '\0';
+            if (pos > 0) ingest_lines++;
+            return pos;
+        }
+        
+        if (c == 0x1B) {
+            int param;
+            if (shell_read_csi(ingest_getchar, &param) == '~' && param == 201) {
+                // Paste ended - keep any unterminated text for the editor
+                buffer[pos] = '\0';
+                strcpy(ingest_pending, buffer);
+                ingest_mode = INGEST_OFF;
+                return 0;
             }
+            continue;
         }
-    }
-    
-    // Also search through aliases
-    for (int i = 0; i < alias_table.count && match_count < 17; i++) {
-        if (strncmp(alias_table.aliases[i].name, partial, partial_len) == 0) {
-            strcpy(matches[match_count], alias_table.aliases[i].name);
-            match_count++;
+        
+        if (c == 0x04 && ingest_mode == INGEST_BATCH) {  // Ctrl-D
+            ingest_mode = INGEST_OFF;
+            puts("Batch mode off");
+            buffer[0] = '\0';
+            return 0;
+        }
+        
+        if ((c >= 0x20 && c <= 0x7E) || c == '\t') {
+            if (pos < max_size - 1) {
+                buffer[pos++] = c;
+            }
         }
     }
+}
+
+// Day 19 Task 4: Tab completion implementation
+// Words live in prefix tries (see complete.c) built once at init and kept
+// in sync by the alias functions, so a Tab costs O(length of the word)
+
+// Show the matches for an ambiguous word
+#define COMPLETE_LIST_MAX 64
+
+static void shell_print_completion(const char* word, void* ctx)
+{
+    int* shown = (int*)ctx;
+    printf("  %s", word);
+    if (*shown % 4 == 3) printf("\n");  // 4 words per line
+    else printf("\t");
+    (*shown)++;
+}
+
+static void shell_complete_word(line_editor_t* le, int set, const char* partial, int partial_len)
+{
+    if (!le || !partial) return;
     
-    if (match_count == 0) {
+    complete_result_t result;
+    complete_lookup(set, partial, partial_len, &result);
+    
+    if (result.matches == 0) {
         // No matches - make a beep sound (BEL character)
         putchar('\x07');
-    } else if (match_count == 1) {
-        // Single match - complete the command
-        const char* completion = matches[0];
-        int completion_len = strlen(completion);
-        int insert_len = completion_len - partial_len;
-        
-        // Check if we have space to insert
-        if (*pos + insert_len < max_size - 1) {
-            // Shift characters after cursor to make room
-            for (int i = *pos; i >= *cursor_pos; i--) {
-                buffer[i + insert_len] = buffer[i];
-            }
-            
-            // Insert the completion
-            for (int i = 0; i < insert_len; i++) {
-                buffer[word_start + partial_len + i] = completion[partial_len + i];
-            }
-            
-            // Update positions
-            *pos += insert_len;
-            *cursor_pos += insert_len;
-            
-            // Redraw the line from word_start
-            printf("\r");
-            for (int i = 0; i < word_start; i++) {
-                putchar(buffer[i]);
-            }
-            for (int i = word_start; i < *pos; i++) {
-                putchar(buffer[i]);
-            }
-            
-            // Move cursor to correct position
-            for (int i = *pos - 1; i >= *cursor_pos; i--) {
-                putchar('\b');
-            }
-        } else {
-            // Not enough space - beep
+    } else if (result.matches == 1) {
+        // Single match - insert the rest of the word and a separator;
+        // the caller's refresh sends only the new characters
+        int ok = lineedit_insert_string(le, result.extension) == 0;
+        if (ok && lineedit_cursor(le) == lineedit_length(le)) {
+            ok = lineedit_insert(le, ' ') == 0;
+        }
+        if (!ok) {
+            putchar('\x07');  // Not enough space - beep
+        }
+    } else if (result.extension_len > 0) {
+        // Several matches sharing more characters - extend to the common prefix
+        if (lineedit_insert_string(le, result.extension) != 0) {
             putchar('\x07');
         }
     } else {
-        // Multiple matches - show them
+        // Nothing more in common - show the possibilities below the line
+        int shown = 0;
+        lineedit_finish(le);
         putchar('\n');
         printf("Possible completions:\n");
-        for (int i = 0; i < match_count; i++) {
-            printf("  %s", matches[i]);
-            if (i % 4 == 3) printf("\n");  // 4 commands per line
-            else printf("\t");
+        complete_list(set, partial, partial_len, COMPLETE_LIST_MAX,
+                      shell_print_completion, &shown);
+        if (shown % 4 != 0) printf("\n");
+        if (result.matches > shown) {
+            printf("  ... and %x more\n", (unsigned int)(result.matches - shown));
         }
-        if (match_count % 4 != 0) printf("\n");
         
-        // Redisplay prompt and current line
-        printf("OS> ");
-        for (int i = 0; i < *pos; i++) {
-            putchar(buffer[i]);
+        // Redisplay prompt; the caller's refresh repaints the line
+        shell_display_prompt();
+        lineedit_invalidate(le);
+    }
+}
+
+/*
+ * Pick the word set for the word ending at the cursor
+ * Looks at the command and earlier arguments of the current batch segment
+ * (after the last ';', '&' or '|'); aliases resolve to their command.
+ * Returns the set id, or -1 when there is nothing to complete against.
+ */
+static int shell_completion_context(const line_editor_t* le, int word_start, int* is_command)
+{
+    *is_command = 0;
+    
+    // Start of the current command within a batch line
+    int seg = word_start;
+    while (seg > 0) {
+        char c = lineedit_char_at(le, seg - 1);
+        if (c == ';' || c == '&' || c == '|') break;
+        seg--;
+    }
+    
+    // Collect the command and the argument just before the word
+    char command[COMPLETE_WORD_MAX] = "";
+    char previous[COMPLETE_WORD_MAX] = "";
+    int arg_index = 0;
+    int i = seg;
+    
+    while (i < word_start) {
+        while (i < word_start && lineedit_char_at(le, i) == ' ') i++;
+        if (i >= word_start) break;
+        
+        char* dest = (arg_index == 0) ? command : previous;
+        int len = 0;
+        while (i < word_start && lineedit_char_at(le, i) != ' ') {
+            if (len < COMPLETE_WORD_MAX - 1) dest[len++] = lineedit_char_at(le, i);
+            i++;
+        }
+        dest[len] = '\0';
+        arg_index++;
+    }
+    
+    if (arg_index == 0) {
+        *is_command = 1;
+        return complete_commands;   // Completing the command itself
+    }
+    
+    // Use the command an alias stands for
+    char expansion[128];
+    if (alias_find(command, expansion, sizeof(expansion))) {
+        int len = 0;
+        while (expansion[len] && expansion[len] != ' ' && len < COMPLETE_WORD_MAX - 1) {
+            command[len] = expansion[len];
+            len++;
+        }
+        command[len] = '\0';
+    }
+    
+    for (int k = 0; k < arg_completer_count; k++) {
+        const arg_completer_t* ac = &arg_completers[k];
+        if (ac->arg_index == arg_index && strcmp(ac->command, command) == 0 &&
+            (!ac->previous || strcmp(ac->previous, previous) == 0)) {
+            return ac->shared ? *ac->shared : ac->set;
         }
-        // Move cursor to correct position
-        for (int i = *pos - 1; i >= *cursor_pos; i--) {
-            putchar('\b');
+    }
+    return -1;
+}
+
+// Move to the start of a line that wrapped onto 'rows' more rows and clear it
+static void search_line_clear(int rows)
+{
+    putchar('\r');
+    if (rows > 0) printf(ANSI_ESC "%dA", rows);
+    printf(ANSI_CLEAR_TO_EOS);
+}
+
+// Ctrl-R incremental reverse history search
+// Each keystroke narrows the previous matches (see history.c); the search
+// line is redrawn in place. Returns 1 if Enter accepted the match.
+static int shell_reverse_search(line_editor_t* le)
+{
+    static history_search_t search;
+    static char match[HISTORY_ENTRY_MAX];
+    static char original[SHELL_LINE_MAX];
+    int execute = 0;
+    int found = 0;
+    int rows = 0;                           // Rows the search line wrapped onto
+    
+    lineedit_copy(le, original, sizeof(original));
+    lineedit_erase(le);
+    history_search_begin(&search);
+    match[0] = '\0';
+    
+    while (1) {
+        // Redraw the search line from the start of its first row
+        const char* failed = (found || search.query_len == 0) ? "" : "failed ";
+        const char* shown = found ? match : "";
+        search_line_clear(rows);
+        printf("(%sreverse-i-search)`%s': %s", failed, search.query, shown);
+        rows = (int)(strlen(failed) + 19 + search.query_len + 3 + strlen(shown) - 1) / LINEEDIT_COLUMNS;
+        
+        char c = getchar();
+        
+        if (c == 0x12) {                    // Ctrl-R: next older match
+            if (history_search_older(&search) != 0) putchar('\x07');
+        } else if (c == '\b' || c == 0x7F) {
+            history_search_pop(&search);
+        } else if (c == 0x07) {             // Ctrl-G: cancel
+            found = 0;
+            lineedit_set_text(le, original);
+            break;
+        } else if (c == '\r' || c == '\n') {
+            execute = 1;
+            break;
+        } else if (c == 0x1B) {             // Arrow/edit key: accept and keep editing
+            int param;
+            shell_read_csi(getchar, &param);
+            break;
+        } else if (c >= 0x20 && c <= 0x7E) {
+            if (history_search_push(&search, c) != 0) putchar('\x07');
+        } else {
+            break;                          // Other control keys accept
         }
+        
+        found = history_search_result(&search, match, sizeof(match)) >= 0;
+    }
+    
+    // Restore the normal prompt with the chosen line
+    search_line_clear(rows);
+    shell_display_prompt();
+    lineedit_invalidate(le);
+    if (found) {
+        lineedit_set_text(le, match);
     }
+    return execute;
 }
 
 // Day 19 Task 2: Enhanced shell_read_line with arrow key support
+// Editing goes through the gap-buffer line editor, which redraws only
+// the cells that changed after each keystroke
 int shell_read_line(char* buffer, int max_size)
 {
     if (!buffer || max_size <= 0) return -1;
     
-    int pos = 0;
-    int cursor_pos = 0;  // Current cursor position within the line
+    // Paste or batch mode: pull the next line straight from the RX ring
+    if (ingest_mode != INGEST_OFF && read_line_depth == 0) {
+        return shell_ingest_line(buffer, max_size, 0);
+    }
+    
+    line_editor_t* le = &line_editor;
     char c;
     
+    read_line_depth++;
+    lineedit_begin(le, max_size - 1, prompt_width);
+    prompt_width = 0;
+    
+    // Restore a partial line left over when a paste ended mid-line
+    if (ingest_pending[0] != '\0' && read_line_depth == 1) {
+        lineedit_set_text(le, ingest_pending);
+        ingest_pending[0] = '\0';
+        lineedit_refresh(le);
+    }
+    
     // Reset history navigation
     history_reset_navigation();
     
-    while (pos < max_size - 1) {
+    while (1) {
         c = getchar();
         
-        
         // Handle escape sequences for arrow keys and special keys
         if (c == 0x1B) {  // ESC character
-            char seq[4];
-            seq[0] = getchar();
-            if (seq[0] == '[') {
-                seq[1] = getchar();
-                seq[2] = '\0';
-                seq[3] = '\0';
-                
-                // Check if it's a multi-character sequence (like Home/End/Delete)
-                if (seq[1] == '1' || seq[1] == '3' || seq[1] == '4' || seq[1] == 'H' || seq[1] == 'F') {
-                    if (seq[1] == '1' || seq[1] == '3' || seq[1] == '4') {
-                        seq[2] = getchar();  // Should be '~'
-                        seq[3] = '\0';
+            int param;
+            char final = shell_read_csi(getchar, &param);
+            
+            // Handle arrow keys and special keys
+            switch (final) {
+                case 'A':  // Up arrow - previous command in history
+                {
+                    const char* prev_cmd = history_get_previous();
+                    if (prev_cmd != NULL) {
+                        lineedit_set_text(le, prev_cmd);
                     }
+                    break;
                 }
-                
-                // Handle arrow keys and special keys
-                switch (seq[1]) {
-                    case 'A':  // Up arrow - previous command in history
-                    {
-                        const char* prev_cmd = history_get_previous();
-                        if (prev_cmd != NULL) {
-                            // Clear current line using ANSI escape sequences (more reliable)
-                            printf("\r");        // Move cursor to beginning of line
-                            printf("\033[K");    // Clear from cursor to end of line
-                            printf("OS> ");      // Redraw prompt
-                            
-                            // Copy history command to buffer and display
-                            strncpy(buffer, prev_cmd, max_size - 1);
-                            buffer[max_size - 1] = '\0';
-                            pos = strlen(buffer);
-                            cursor_pos = pos;
-                            printf("%s", buffer);
-                        }
-                        break;
+                case 'B':  // Down arrow - next command in history
+                {
+                    const char* next_cmd = history_get_next();
+                    if (next_cmd != NULL) {
+                        lineedit_set_text(le, next_cmd);
                     }
-                    case 'B':  // Down arrow - next command in history
-                    {
-                        const char* next_cmd = history_get_next();
-                        if (next_cmd != NULL) {
-                            // Clear current line using ANSI escape sequences (more reliable)
-                            printf("\r");        // Move cursor to beginning of line
-                            printf("\033[K");    // Clear from cursor to end of line
-                            printf("OS> ");      // Redraw prompt
-                            
-                            // Copy history command to buffer and display
-                            strncpy(buffer, next_cmd, max_size - 1);
-                            buffer[max_size - 1] = '\0';
-                            pos = strlen(buffer);
-                            cursor_pos = pos;
-                            printf("%s", buffer);
-                        }
-                        break;
-                    }
-                    case 'C':  // Right arrow - move cursor right
-                        if (cursor_pos < pos) {
-                            putchar(buffer[cursor_pos]);
-                            cursor_pos++;
-                        }
-                        break;
-                    case 'D':  // Left arrow - move cursor left
-                        if (cursor_pos > 0) {
-                            putchar('\b');
-                            cursor_pos--;
-                        }
-                        break;
-                    case 'H':  // Home key - move cursor to beginning
-                    case '1':  // Home key (alternative sequence)
-                        if (seq[1] == '1' && seq[2] != '~') break;  // Validate sequence
-                        while (cursor_pos > 0) {
-                            putchar('\b');
-                            cursor_pos--;
-                        }
-                        break;
-                    case 'F':  // End key - move cursor to end
-                    case '4':  // End key (alternative sequence)
-                        if (seq[1] == '4' && seq[2] != '~') break;  // Validate sequence
-                        while (cursor_pos < pos) {
-                            putchar(buffer[cursor_pos]);
-                            cursor_pos++;
-                        }
-                        break;
-                    case '3':  // Delete key - delete character at cursor
-                        if (seq[2] == '~' && cursor_pos < pos) {
-                            // Move characters after cursor one position left
-                            for (int i = cursor_pos; i < pos - 1; i++) {
-                                buffer[i] = buffer[i + 1];
-                            }
-                            pos--;
-                            
-                            // Redraw line from cursor position
-                            for (int i = cursor_pos; i < pos; i++) {
-                                putchar(buffer[i]);
-                            }
-                            putchar(' ');  // Clear the last character
-                            // Move cursor back to correct position
-                            for (int i = pos; i >= cursor_pos; i--) {
-                                putchar('\b');
-                            }
-                        }
-                        break;
-                    default:
-                        // Unknown escape sequence, ignore
-                        break;
+                    break;
                 }
+                case 'C':  // Right arrow - move cursor right
+                    lineedit_move_to(le, lineedit_cursor(le) + 1);
+                    break;
+                case 'D':  // Left arrow - move cursor left
+                    lineedit_move_to(le, lineedit_cursor(le) - 1);
+                    break;
+                case 'H':  // Home key - move cursor to beginning
+                    lineedit_move_to(le, 0);
+                    break;
+                case 'F':  // End key - move cursor to end
+                    lineedit_move_to(le, lineedit_length(le));
+                    break;
+                case '~':  // VT-style keys: ESC [ n ~
+                    if (param == 1) {
+                        lineedit_move_to(le, 0);                    // Home
+                    } else if (param == 4) {
+                        lineedit_move_to(le, lineedit_length(le));  // End
+                    } else if (param == 3) {
+                        lineedit_delete(le);                        // Delete
+                    } else if (param == 200 && read_line_depth == 1) {
+                        // Bracketed paste start: the typed prefix joins the
+                        // first pasted line, the rest is ingested in bulk
+                        int len = lineedit_copy(le, buffer, max_size);
+                        lineedit_finish(le);
+                        putchar('\n');
+                        ingest_mode = INGEST_PASTE;
+                        len = shell_ingest_line(buffer, max_size, len);
+                        prompt_width = 0;
+                        read_line_depth--;
+                        return len;
+                    }
+                    break;
+                default:
+                    // Unknown escape sequence, ignore
+                    break;
             }
+            lineedit_refresh(le);
             continue;
         }
         
         // Handle backspace
         if (c == '\b' || c == 0x7F) {
-            if (cursor_pos > 0) {
-                // Move characters after cursor one position left
-                for (int i = cursor_pos - 1; i < pos - 1; i++) {
-                    buffer[i] = buffer[i + 1];
-                }
-                pos--;
-                cursor_pos--;
-                
-                // Redraw line from cursor position
-                putchar('\b');
-                for (int i = cursor_pos; i < pos; i++) {
-                    putchar(buffer[i]);
-                }
-                putchar(' ');  // Clear the last character
-                // Move cursor back to correct position
-                for (int i = pos; i >= cursor_pos; i--) {
-                    putchar('\b');
-                }
+            lineedit_backspace(le);
+            lineedit_refresh(le);
+            continue;
+        }
+        
+        // Handle Ctrl-R reverse history search
+        if (c == 0x12) {
+            int execute = shell_reverse_search(le);
+            lineedit_refresh(le);
+            if (execute) {
+                lineedit_finish(le);
+                putchar('\n');
+                break;
             }
             continue;
         }
         
         // Handle enter/newline
         if (c == '\r' || c == '\n') {
+            lineedit_finish(le);
             putchar('\n');
             break;
         }
         
-        // Handle tab for command completion
+        // Handle tab for command/argument completion
         if (c == '\t') {
+            int cursor = lineedit_cursor(le);
+            
             // Only do completion at cursor position if at end of a word
-            if (cursor_pos == pos || buffer[cursor_pos] == ' ') {
+            if (cursor == lineedit_length(le) || lineedit_char_at(le, cursor) == ' ') {
                 // Find start of current word
-                int word_start = cursor_pos;
-                while (word_start > 0 && buffer[word_start - 1] != ' ') {
+                int word_start = cursor;
+                while (word_start > 0 && lineedit_char_at(le, word_start - 1) != ' ') {
                     word_start--;
                 }
                 
-                // Extract current word
-                int word_len = cursor_pos - word_start;
-                if (word_len > 0) {
-                    char word[32];
-                    strncpy(word, buffer + word_start, word_len);
+                int is_command;
+                int set = shell_completion_context(le, word_start, &is_command);
+                
+                // Extract current word (empty is fine for arguments)
+                int word_len = cursor - word_start;
+                if (set >= 0 && word_len < COMPLETE_WORD_MAX &&
+                    (word_len > 0 || !is_command)) {
+                    char word[COMPLETE_WORD_MAX];
+                    for (int i = 0; i < word_len; i++) {
+                        word[i] = lineedit_char_at(le, word_start + i);
+                    }
                     word[word_len] = '\0';
                     
-                    // Try to complete the command
-                    shell_complete_command(word, buffer, &pos, &cursor_pos, max_size, word_start);
+                    shell_complete_word(le, set, word, word_len);
+                    lineedit_refresh(le);
+                } else {
+                    putchar('\x07');
                 }
             }
             continue;
@@ -576,32 +1011,28 @@ int shell_read_line(char* buffer, int max_size)
         
         // Handle printable characters
         if (c >= 0x20 && c <= 0x7E) {
-            // Insert character at cursor position
-            if (pos < max_size - 1) {
-                // Shift characters after cursor one position right
-                for (int i = pos; i > cursor_pos; i--) {
-                    buffer[i] = buffer[i - 1];
-                }
-                buffer[cursor_pos] = c;
-                pos++;
-                
-                // Redraw line from cursor position
-                for (int i = cursor_pos; i < pos; i++) {
-                    putchar(buffer[i]);
-                }
-                cursor_pos++;
-                // Move cursor back to correct position
-                for (int i = pos - 1; i >= cursor_pos; i--) {
-                    putchar('\b');
-                }
+            if (lineedit_insert(le, c) != 0) {
+                putchar('\x07');  // Line full - beep
             }
+            lineedit_refresh(le);
         }
     }
     
-    buffer[pos] = '\0';
-    
-    
-    return pos;
+    prompt_width = 0;                   // Redraws above reprinted the prompt
+    read_line_depth--;
+    return lineedit_copy(le, buffer, max_size);
+}
+
+// Say why a line could not be split into words
+static void shell_tokenize_error(int result)
+{
+    if (result == SHELL_TOKEN_TOO_LONG) {
+        printf("Error: A word is longer than %d characters\n", MAX_TOKEN_SIZE - 1);
+    } else if (result == SHELL_TOO_MANY_ARGS) {
+        printf("Error: More than %d words in a command\n", MAX_ARGS);
+    } else {
+        puts("Error: Failed to parse command");
+    }
 }
 
 int shell_tokenize(const char* input, token_result_t* result)
@@ -618,12 +1049,13 @@ int shell_tokenize(const char* input, token_result_t* result)
         i++;
     }
     
-    while (input[i] != '\0' && token_idx < MAX_ARGS) {
+    while (input[i] != '\0') {
+        if (token_idx == MAX_ARGS) return SHELL_TOO_MANY_ARGS;
         char_idx = 0;
         
         // Read characters until whitespace or end
-        while (input[i] != '\0' && input[i] != ' ' && input[i] != '\t' && 
-               input[i] != '\n' && char_idx < (MAX_TOKEN_SIZE - 1)) {
+        while (input[i] != '\0' && input[i] != ' ' && input[i] != '\t' && input[i] != '\n') {
+            if (char_idx == MAX_TOKEN_SIZE - 1) return SHELL_TOKEN_TOO_LONG;
             result->tokens[token_idx][char_idx++] = input[i++];
         }
         
@@ -648,7 +1080,7 @@ shell_command_t* shell_find_command(const char* name)
 {
     if (!name) return NULL;
     
-    for (int i = 0; i < 17 && command_table[i].name != NULL; i++) {
+    for (int i = 0; i < SHELL_COMMAND_COUNT && command_table[i].name != NULL; i++) {
         if (strcmp(name, command_table[i].name) == 0) {
             return &command_table[i];
         }
@@ -657,22 +1089,60 @@ shell_command_t* shell_find_command(const char* name)
     return NULL;
 }
 
+// Copy 'tokens' without a trailing "&" (alone or ending the last word);
+// returns 1 if there was one
+static int shell_strip_background(const token_result_t* tokens, token_result_t* stripped)
+{
+    int last = tokens->argc - 1;
+    int len = strlen(tokens->argv[last]);
+    if (len == 0 || tokens->argv[last][len - 1] != '&') return 0;
+    
+    *stripped = *tokens;
+    for (int i = 0; i < stripped->argc; i++) {
+        stripped->argv[i] = stripped->tokens[i];
+    }
+    if (len == 1) {
+        stripped->argc--;
+    } else {
+        stripped->tokens[last][len - 1] = '\0';
+    }
+    return 1;
+}
+
+// Commands that wait on the console or on other jobs
+static int shell_foreground_only(const char* name)
+{
+    return strcmp(name, "reboot") == 0 || strcmp(name, "batch-mode") == 0 || strcmp(name, "exit") == 0 ||
+           strcmp(name, "fg") == 0 || strcmp(name, "wait") == 0;
+}
+
 int shell_execute_command(const token_result_t* tokens)
 {
     if (!tokens || tokens->argc == 0) return -1;
     
+    // "cmd args &" runs the command as a background job
+    token_result_t stripped;
+    int background = shell_strip_background(tokens, &stripped);
+    if (background) {
+        tokens = &stripped;
+        if (tokens->argc == 0) {
+            shell_display_error(SHELL_ERROR_SYNTAX, "Nothing to run in the background");
+            return SHELL_ERROR_SYNTAX;
+        }
+    }
+    
     shell_command_t* cmd = shell_find_command(tokens->argv[0]);
     if (!cmd) {
         printf("Unknown command: '%s'\n", tokens->argv[0]);
         puts("Type 'help' to see available commands, or 'about' for system info.");
         
         // Suggest similar commands for common mistakes
-        if (strcmp(tokens->argv[0], "ls") == 0) {
-            puts("Hint: This OS has no filesystem. Try 'help' instead.");
-        } else if (strcmp(tokens->argv[0], "exit") == 0 || strcmp(tokens->argv[0], "quit") == 0) {
-            puts("Hint: This OS runs indefinitely. Use Ctrl+A, X to quit QEMU.");
-        } else if (strcmp(tokens->argv[0], "cat") == 0 || strcmp(tokens->argv[0], "more") == 0) {
-            puts("Hint: No filesystem available. Try 'meminfo' to see memory status.");
+        if (strcmp(tokens->argv[0], "quit") == 0) {
+            puts("Hint: Use 'exit' (with ./run.sh -semihosting) or Ctrl+A, X to quit QEMU.");
+        } else if (strcmp(tokens->argv[0], "more") == 0 || strcmp(tokens->argv[0], "less") == 0) {
+            puts("Hint: Use 'cat' to print a file.");
+        } else if (strcmp(tokens->argv[0], "del") == 0 || strcmp(tokens->argv[0], "unlink") == 0) {
+            puts("Hint: Use 'rm' to remove a file.");
         }
         
         return -1;
@@ -683,8 +1153,25 @@ int shell_execute_command(const token_result_t* tokens)
     // unsigned int start_time = get_simple_timer();
     // perf_monitor.total_commands++;
     
-    // Execute the command (cast to fix const qualifier warning)
+    if (background) {
+        if (shell_foreground_only(cmd->name)) {
+            printf("'%s' cannot run in the background\n", cmd->name);
+            return SHELL_ERROR_PERMISSION;
+        }
+        int job = job_start(cmd->handler, tokens);
+        if (job < 0) {
+            shell_display_error(SHELL_ERROR_SYSTEM, "No free job slot or thread (see 'jobs')");
+            return SHELL_ERROR_SYSTEM;
+        }
+        printf("[%d] %s running in the background\n", job, cmd->name);
+        return SHELL_SUCCESS;
+    }
+    
+    // Execute the command (cast to fix const qualifier warning); Ctrl-C
+    // from here on cancels it instead of becoming input
+    cancel_arm();
     int result = cmd->handler(tokens->argc, (char**)tokens->argv);
+    cancel_disarm();
     
     // Record execution time
     // perf_record_command_end(tokens->argv[0], start_time);
@@ -704,7 +1191,11 @@ int shell_parse_and_execute(const char* input)
     // Day 20 Task 4: Check for batch commands first
     // Re-enable batch commands with full functionality
     batch_sequence_t batch;
-    if (batch_parse_commands(input, &batch) > 0) {
+    int batch_count = batch_parse_commands(input, &batch);
+    if (batch_count < 0) {
+        return SHELL_ERROR_RANGE;       // Too long or too many; already reported
+    }
+    if (batch_count > 0) {
         // Input contains batch commands, execute the sequence
         return batch_execute_sequence(&batch);
     }
@@ -712,33 +1203,34 @@ int shell_parse_and_execute(const char* input)
     token_result_t tokens;
     int result = shell_tokenize(input, &tokens);
     if (result != 0) {
-        puts("Error: Failed to parse command");
+        shell_tokenize_error(result);
         return result;
     }
     
     if (tokens.argc == 0) return 0;  // No tokens, not an error
     
     // Day 20 Task 3: Check for alias expansion
-    const char* alias_expansion = alias_find(tokens.argv[0]);
-    if (alias_expansion) {
+    char alias_expansion[128];
+    if (alias_find(tokens.argv[0], alias_expansion, sizeof(alias_expansion))) {
         // Create expanded input by replacing first token with alias expansion
-        char expanded_input[256];
+        // (sized for the longest expansion and every other word, so it never cuts)
+        char expanded_input[sizeof(alias_expansion) + MAX_ARGS * MAX_TOKEN_SIZE];
         int pos = 0;
         
         // Copy alias expansion
         int exp_len = strlen(alias_expansion);
-        for (int i = 0; i < exp_len && pos < 255; i++) {
+        for (int i = 0; i < exp_len; i++) {
             expanded_input[pos++] = alias_expansion[i];
         }
         
         // Add remaining arguments if any
-        for (int i = 1; i < tokens.argc && pos < 255; i++) {
+        for (int i = 1; i < tokens.argc; i++) {
             // Add space
-            if (pos < 255) expanded_input[pos++] = ' ';
+            expanded_input[pos++] = ' ';
             
             // Add argument
             int arg_len = strlen(tokens.argv[i]);
-            for (int j = 0; j < arg_len && pos < 255; j++) {
+            for (int j = 0; j < arg_len; j++) {
                 expanded_input[pos++] = tokens.argv[i][j];
             }
         }
@@ -757,7 +1249,7 @@ int shell_parse_and_execute(const char* input)
     // Add to history if command executed successfully (or even if it failed - user might want to recall it)
     // Don't add "history" command itself to avoid cluttering history
     if (strcmp(tokens.argv[0], "history") != 0) {
-        history_add_command(input);
+        shell_history_add(input);
     }
     
     return exec_result;
@@ -890,76 +1382,6 @@ static void set_colors_enabled(int enabled)
 
 // Removed unused get_colors_enabled function
 
-// Day 19 Task 1: Command History Management Functions
-static void history_add_command(const char* command)
-{
-    if (!command || strlen(command) == 0) {
-        return;  // Don't store empty commands
-    }
-    
-    // Don't store duplicate consecutive commands
-    if (history.count > 0) {
-        int last_index = (history.write_index - 1 + HISTORY_SIZE) % HISTORY_SIZE;
-        if (strcmp(history.commands[last_index], command) == 0) {
-            return;
-        }
-    }
-    
-    // Copy command to history buffer
-    strncpy(history.commands[history.write_index], command, MAX_COMMAND_LENGTH - 1);
-    history.commands[history.write_index][MAX_COMMAND_LENGTH - 1] = '\0';
-    
-    // Update indices
-    history.write_index = (history.write_index + 1) % HISTORY_SIZE;
-    if (history.count < HISTORY_SIZE) {
-        history.count++;
-    }
-    
-    // Reset current pointer for navigation
-    history.current = history.write_index;
-}
-
-static const char* history_get_previous(void)
-{
-    if (history.count == 0) {
-        return NULL;
-    }
-    
-    // Move to previous command
-    history.current = (history.current - 1 + HISTORY_SIZE) % HISTORY_SIZE;
-    
-    // Don't go beyond the oldest command
-    int oldest_index = history.count < HISTORY_SIZE ? 0 : history.write_index;
-    if (history.current == oldest_index && history.count == HISTORY_SIZE) {
-        history.current = (history.current + 1) % HISTORY_SIZE;
-        return NULL;
-    }
-    
-    return history.commands[history.current];
-}
-
-static const char* history_get_next(void)
-{
-    if (history.count == 0) {
-        return NULL;
-    }
-    
-    // Move to next command
-    history.current = (history.current + 1) % HISTORY_SIZE;
-    
-    // If we've reached the write index, return empty (no "next" command)
-    if (history.current == history.write_index) {
-        return "";
-    }
-    
-    return history.commands[history.current];
-}
-
-static void history_reset_navigation(void)
-{
-    history.current = history.write_index;
-}
-
 // Day 20 Task 1: Error System Function Implementations
 
 /*
@@ -981,6 +1403,8 @@ static void shell_log_error(shell_error_t error_code, const char* command, const
     if (!command) command = "unknown";
     if (!context) context = "";
     
+    unsigned long flags = ticket_lock_irqsave(&error_log_lock);
+    
     error_log_entry_t* entry = &error_log.entries[error_log.current_index];
     entry->error_code = error_code;
     entry->timestamp = ++error_timestamp_counter;
@@ -998,6 +1422,8 @@ static void shell_log_error(shell_error_t error_code, const char* command, const
     if (error_log.count < ERROR_LOG_SIZE) {
         error_log.count++;
     }
+    
+    ticket_unlock_irqrestore(&error_log_lock, flags);
 }
 
 /*
@@ -1060,7 +1486,11 @@ static void shell_display_info(const char* message)
  */
 void shell_display_prompt(void)
 {
+    // No prompts while ingesting pasted or scripted input
+    if (ingest_mode != INGEST_OFF) return;
+    
     print_colored_prompt();
+    prompt_width = SHELL_PROMPT_WIDTH;
 }
 
 // Removed unused performance monitoring functions (perf_find_or_create_stats, perf_update_stats)
@@ -1104,12 +1534,17 @@ static int alias_add(const char* name, const char* expansion, int is_builtin) {
     if (!alias_validate_name(name)) return -1;
     if (strlen(expansion) >= 128) return -1;  // Expansion too long
     
+    mcs_node_t node;
+    unsigned long flags = mcs_lock_irqsave(&alias_lock, &node);
+    int result = -1;  // No space available
+    
     // Check if alias already exists
     for (int i = 0; i < alias_table.count; i++) {
         if (strcmp(alias_table.aliases[i].name, name) == 0) {
             // Update existing alias
             strcpy(alias_table.aliases[i].expansion, expansion);
             alias_table.aliases[i].is_builtin = is_builtin;
+            mcs_unlock_irqrestore(&alias_lock, &node, flags);
             return 0;
         }
     }
@@ -1121,45 +1556,71 @@ static int alias_add(const char* name, const char* expansion, int is_builtin) {
         strcpy(alias->expansion, expansion);
         alias->is_builtin = is_builtin;
         alias_table.count++;
-        return 0;
+        
+        // Make the new name completable
+        complete_insert(complete_commands, name);
+        complete_insert(complete_aliases, name);
+        result = 0;
     }
     
-    return -1;  // No space available
+    mcs_unlock_irqrestore(&alias_lock, &node, flags);
+    return result;
 }
 
-static const char* alias_find(const char* name) {
-    if (!name) return NULL;
+// Copy the expansion of 'name' into the caller's buffer; returns 1 if found
+static int alias_find(const char* name, char* expansion, int max_size) {
+    if (!name || !expansion || max_size <= 0) return 0;
+    
+    mcs_node_t node;
+    unsigned long flags = mcs_lock_irqsave(&alias_lock, &node);
+    int found = 0;
     
     for (int i = 0; i < alias_table.count; i++) {
         if (strcmp(alias_table.aliases[i].name, name) == 0) {
-            return alias_table.aliases[i].expansion;
+            strncpy(expansion, alias_table.aliases[i].expansion, max_size - 1);
+            expansion[max_size - 1] = '\0';
+            found = 1;
+            break;
         }
     }
     
-    return NULL;  // Not found
+    mcs_unlock_irqrestore(&alias_lock, &node, flags);
+    return found;
 }
 
 static int alias_remove(const char* name) {
     if (!name) return -1;
     
+    mcs_node_t node;
+    unsigned long flags = mcs_lock_irqsave(&alias_lock, &node);
+    int result = -1;  // Not found
+    
     for (int i = 0; i < alias_table.count; i++) {
         if (strcmp(alias_table.aliases[i].name, name) == 0) {
             // Don't allow removal of built-in aliases
-            if (alias_table.aliases[i].is_builtin) return -1;
+            if (alias_table.aliases[i].is_builtin) break;
+            
+            complete_remove(complete_commands, name);
+            complete_remove(complete_aliases, name);
             
             // Shift remaining aliases down
             for (int j = i; j < alias_table.count - 1; j++) {
                 alias_table.aliases[j] = alias_table.aliases[j + 1];
             }
             alias_table.count--;
-            return 0;
+            result = 0;
+            break;
         }
     }
     
-    return -1;  // Not found
+    mcs_unlock_irqrestore(&alias_lock, &node, flags);
+    return result;
 }
 
 static void alias_clear_user_aliases(void) {
+    mcs_node_t node;
+    unsigned long flags = mcs_lock_irqsave(&alias_lock, &node);
+    
     // Remove all user-defined aliases, keep built-ins
     int write_pos = 0;
     for (int read_pos = 0; read_pos < alias_table.count; read_pos++) {
@@ -1168,9 +1629,14 @@ static void alias_clear_user_aliases(void) {
                 alias_table.aliases[write_pos] = alias_table.aliases[read_pos];
             }
             write_pos++;
+        } else {
+            complete_remove(complete_commands, alias_table.aliases[read_pos].name);
+            complete_remove(complete_aliases, alias_table.aliases[read_pos].name);
         }
     }
     alias_table.count = write_pos;
+    
+    mcs_unlock_irqrestore(&alias_lock, &node, flags);
 }
 
 // Day 20 Task 4: Batch Commands Functions
@@ -1198,9 +1664,12 @@ static int batch_parse_commands(const char* input, batch_sequence_t* sequence) {
     }
     
     // Simple semicolon-only splitting for safety
-    char work_buffer[512];
+    static char work_buffer[SHELL_LINE_MAX];
     int input_len = strlen(input);
-    if (input_len >= sizeof(work_buffer)) return -1;  // Input too long
+    if (input_len >= sizeof(work_buffer)) {
+        printf("Error: Line longer than %d characters\n", (int)sizeof(work_buffer) - 1);
+        return -1;
+    }
     
     // Copy input to work buffer with bounds checking
     for (int i = 0; i <= input_len && i < sizeof(work_buffer) - 1; i++) {
@@ -1211,7 +1680,7 @@ static int batch_parse_commands(const char* input, batch_sequence_t* sequence) {
     // Split on semicolons only (no && or || for now - too complex)
     char* start = work_buffer;
     
-    while (*start && sequence->count < MAX_BATCH_COMMANDS) {
+    while (*start) {
         // Find next semicolon
         char* semicolon = start;
         while (*semicolon && *semicolon != ';') {
@@ -1219,7 +1688,7 @@ static int batch_parse_commands(const char* input, batch_sequence_t* sequence) {
         }
         
         // Extract command
-        char command[128];
+        char command[sizeof(sequence->commands[0].command)];
         int cmd_pos = 0;
         
         // Copy command with bounds checking and whitespace trimming
@@ -1234,20 +1703,27 @@ static int batch_parse_commands(const char* input, batch_sequence_t* sequence) {
         }
         
         // Copy trimmed command
-        for (char* p = cmd_start; p <= cmd_end && cmd_pos < sizeof(command) - 1; p++) {
+        if (cmd_end - cmd_start + 1 >= (long)sizeof(command)) {
+            printf("Error: A command in the sequence is longer than %d characters\n",
+                   (int)sizeof(command) - 1);
+            return -1;
+        }
+        for (char* p = cmd_start; p <= cmd_end; p++) {
             command[cmd_pos++] = *p;
         }
         command[cmd_pos] = '\0';
         
         // Add to sequence if non-empty
         if (cmd_pos > 0) {
-            if (cmd_pos < sizeof(sequence->commands[sequence->count].command)) {
-                for (int i = 0; i <= cmd_pos; i++) {
-                    sequence->commands[sequence->count].command[i] = command[i];
-                }
-                sequence->commands[sequence->count].next_op = BATCH_OP_SEMICOLON;
-                sequence->count++;
+            if (sequence->count == MAX_BATCH_COMMANDS) {
+                printf("Error: More than %d commands in the sequence\n", MAX_BATCH_COMMANDS);
+                return -1;
             }
+            for (int i = 0; i <= cmd_pos; i++) {
+                sequence->commands[sequence->count].command[i] = command[i];
+            }
+            sequence->commands[sequence->count].next_op = BATCH_OP_SEMICOLON;
+            sequence->count++;
         }
         
         // Move to next command
@@ -1271,7 +1747,7 @@ static int batch_execute_single_command(const char* command_str) {
     token_result_t tokens;
     int result = shell_tokenize(command_str, &tokens);
     if (result != 0) {
-        puts("Error: Failed to parse command");
+        shell_tokenize_error(result);
         return result;
     }
     
@@ -1286,7 +1762,7 @@ static int batch_execute_single_command(const char* command_str) {
     
     // Add to history if command executed successfully (or even if it failed)
     if (strcmp(tokens.argv[0], "history") != 0) {
-        history_add_command(command_str);
+        shell_history_add(command_str);
     }
     
     return exec_result;
@@ -1326,6 +1802,12 @@ static int batch_execute_sequence(const batch_sequence_t* sequence) {
         if (should_execute) {
             // Execute this command directly (avoiding recursion)
             last_result = batch_execute_single_command(sequence->commands[i].command);
+            
+            // Ctrl-C stops the whole sequence, not just the running command
+            if (cancel_requested() && i + 1 < sequence->count) {
+                puts("^C - remaining commands skipped");
+                return SHELL_ERROR_INTERRUPTED;
+            }
         }
     }
     
@@ -1365,6 +1847,148 @@ int cmd_help(int argc, char* argv[])
         } else if (strcmp(cmd->name, "meminfo") == 0) {
             puts("Usage: meminfo");
             puts("Example: meminfo");
+        } else if (strcmp(cmd->name, "batch-mode") == 0) {
+            puts("Usage: batch-mode [on|off|status]");
+            puts("In batch mode input lines run back to back without echo or prompt.");
+            puts("Leave with 'batch-mode off' or Ctrl-D. Terminal pastes use this path automatically.");
+        } else if (strcmp(cmd->name, "history") == 0) {
+            puts("Usage: history [-c | N]");
+            puts("  history      - Show all stored commands");
+            puts("  history 10   - Show the last 10 commands");
+            puts("  history -c   - Clear the history");
+            puts("Press Ctrl-R at the prompt for incremental reverse search.");
+        } else if (strcmp(cmd->name, "memmap") == 0) {
+            puts("Usage: memmap");
+            puts("Lists RAM, device, kernel, heap and stack regions with access rights");
+        } else if (strcmp(cmd->name, "ps") == 0) {
+            puts("Usage: ps");
+            puts("Lists kernel threads with state, context switches, CPU time and stack size");
+        } else if (strcmp(cmd->name, "bench") == 0) {
+            puts("Usage: bench switch [iterations] | bench sched [threads] [work] |");
+            puts("       bench locks [threads] [iterations] | bench alloc [threads] [ops] |");
+            puts("       bench ring [items] | bench ipi [calls]");
+            puts("  bench switch         - Context switch latency (10000 yields per thread)");
+            puts("  bench switch 100000  - Same with more iterations");
+            puts("  bench sched          - Speedup of 8 CPU-bound threads over 1");
+            puts("  bench sched 4 500000 - 4 threads, 500000 iterations each");
+            puts("  bench locks          - 4 threads contending for a TAS, ticket and MCS lock");
+            puts("  bench alloc          - kmalloc/kfree churn, depot lock vs per-CPU magazines");
+            puts("  bench ring           - SPSC/MPMC queue throughput and round trip per CPU pair");
+            puts("  bench ipi            - Remote call round trip and async rate, CPU 0 to each CPU");
+        } else if (strcmp(cmd->name, "cpus") == 0) {
+            puts("Usage: cpus [reset | pin <thread-id> <cpu-mask>]");
+            puts("  cpus              - Utilization, switches, preemptions and steals per CPU");
+            puts("  cpus reset        - Zero the per-CPU counters");
+            puts("  cpus pin 3 0x2    - Run thread 3 on CPU 1 only (0xFF = any CPU)");
+        } else if (strcmp(cmd->name, "locks") == 0) {
+            puts("Usage: locks [count | reset]");
+            puts("  locks             - The 10 most contended locks");
+            puts("  locks 30          - The 30 most contended locks");
+            puts("  locks reset       - Zero every lock's counters");
+        } else if (strcmp(cmd->name, "pmem") == 0) {
+            puts("Usage: pmem fill <addr> <len> <byte> | pmem zero <addr> <len> |");
+            puts("       pmem copy <dst> <src> <len> | pmem cmp <a> <b> <len> |");
+            puts("       pmem crc <addr> <len> | pmem bench [KB]  (each takes [-j N])");
+            puts("  pmem fill 0x44000000 0x100000 0xAA - Fill 1MB on every online CPU");
+            puts("  pmem crc 0x44000000 0x100000 -j 2  - CRC-32 of 1MB using 2 CPUs");
+            puts("  pmem bench                         - MB/s and speedup on 1..N CPUs (16MB)");
+        } else if (strcmp(cmd->name, "work") == 0) {
+            puts("Usage: work [reset | bench [items]]");
+            puts("  work              - Pending/executed counts and latency per worker, timer wheel");
+            puts("  work reset        - Zero the counters");
+            puts("  work bench        - Queue 100000 items across workers, then 16 delayed items");
+        } else if (strcmp(cmd->name, "virtio") == 0) {
+            puts("Usage: virtio [reset]");
+            puts("  virtio            - Devices, negotiated features, per-queue doorbells and completions");
+            puts("  virtio reset      - Zero the interrupt and queue counters");
+        } else if (strcmp(cmd->name, "blkbench") == 0) {
+            puts("Usage: blkbench [read | write] [KB per I/O] [-m irq|poll|adaptive] | blkbench stats | reset");
+            puts("  blkbench          - Random 4KB reads at queue depths 1..64, 250ms each");
+            puts("  blkbench read 64  - Same with 64KB reads");
+            puts("  blkbench -m poll  - Switch to polled completion, then run the read test");
+            puts("  blkbench write    - Random writes: overwrites the disk image!");
+            puts("  blkbench stats    - Disk size, request counts, polled vs interrupt completions");
+        } else if (strcmp(cmd->name, "cache") == 0) {
+            puts("Usage: cache [sync | drop | reset | read <block> <count>]");
+            puts("  cache             - Hit rate, hot/cold blocks, readahead use, write-back counts");
+            puts("  cache sync        - Write every dirty block and flush the disk");
+            puts("  cache drop        - Sync, then empty the cache");
+            puts("  cache read 0 4096 - Read 16MB sequentially through the cache (MB/s, hits)");
+        } else if (strcmp(cmd->name, "iosched") == 0) {
+            puts("Usage: iosched [reset]");
+            puts("  iosched           - Merges, I/Os per device request, deadline dispatches, latency histograms");
+            puts("  iosched reset     - Zero the counters and histograms");
+        } else if (strcmp(cmd->name, "ls") == 0) {
+            puts("Usage: ls [/initrd]");
+            puts("  ls                - The disk's root directory: size in bytes, blocks allocated, extents");
+            puts("  ls /initrd        - Files in the initrd archive (./run.sh -initrd <archive.cpio>)");
+        } else if (strcmp(cmd->name, "cat") == 0) {
+            puts("Usage: cat <file>");
+            puts("  cat notes.txt     - Print the file, streamed a block at a time; Ctrl-C stops");
+            puts("  cat /initrd/a.sh  - Print a file from the initrd, straight from the archive");
+        } else if (strcmp(cmd->name, "write") == 0) {
+            puts("Usage: write [-a] <file> <text...>");
+            puts("  write notes.txt hello   - Replace the file's contents with the line 'hello'");
+            puts("  write -a notes.txt more - Append a line, creating the file if needed");
+            puts("Changes reach the disk within 5 seconds, or at once with 'cache sync'");
+        } else if (strcmp(cmd->name, "rm") == 0) {
+            puts("Usage: rm <file>");
+            puts("  rm notes.txt      - Remove the file and free its blocks");
+        } else if (strcmp(cmd->name, "stat") == 0) {
+            puts("Usage: stat [file]");
+            puts("  stat              - Filesystem layout, free blocks and inodes, root directory buckets");
+            puts("  stat notes.txt    - Size, inode, modification time and every extent of the file");
+            puts("  stat /initrd/a.sh - Size and address of an initrd file");
+        } else if (strcmp(cmd->name, "kv") == 0) {
+            puts("Usage: kv [put <key> <value...> | get <key> | del <key> | scan [start] [count] |");
+            puts("          sync | compact | reset | bench [ops] [value bytes]]");
+            puts("  kv                - Memtables, levels, runs, counters and write amplification");
+            puts("  kv put user1 Ada  - Store a value (the rest of the line)");
+            puts("  kv get user1      - Print a value");
+            puts("  kv scan user 10   - The first 10 keys from 'user' on, in order");
+            puts("  kv compact        - Write the memtable out and compact every level to size");
+            puts("  kv bench          - 10000 random puts of 100 bytes, then gets, misses and a scan");
+            puts("Keys are 1-64 bytes and values up to 1024; the store lives in kv-* files");
+        } else if (strcmp(cmd->name, "fwcfg") == 0) {
+            puts("Usage: fwcfg [load | cat | free | bench <name>]");
+            puts("  fwcfg             - fw_cfg files: selector, size, where each is loaded");
+            puts("  fwcfg load a.sh   - Copy opt/a.sh into its own pages by DMA (time and MB/s)");
+            puts("  fwcfg cat a.sh    - Load if needed, then print it");
+            puts("  fwcfg free a.sh   - Give its pages back");
+            puts("  fwcfg bench a.sh  - Time a DMA read against data register reads");
+            puts("Files come from ./run.sh -fw_cfg name=opt/a.sh,file=a.sh; 'opt/' may be left out");
+        } else if (strcmp(cmd->name, "config") == 0) {
+            puts("Usage: config [keys | sync | compact | clear]");
+            puts("  config          - Store segments, batching and compaction counters");
+            puts("  config keys     - ... and every saved key and value");
+            puts("  config sync     - Write waiting changes to the flash now");
+            puts("  config compact  - Empty the segment with the least live data");
+            puts("  config clear    - Erase every saved setting (current ones stay until reboot)");
+            puts("User aliases, the last 100 history lines and 'color on|off' are saved automatically");
+            puts("Keep them across QEMU runs with a flash image: truncate -s 64M flash.img, then");
+            puts("  ./run.sh -drive if=pflash,unit=1,file=flash.img,format=raw");
+        } else if (strcmp(cmd->name, "export") == 0) {
+            puts("Usage: export [-a] <host file> <command> [args...]");
+            puts("  export bench.txt bench switch   - Run 'bench switch', its output going to bench.txt");
+            puts("  export -a log.txt cpus          - Append to log.txt instead of replacing it");
+            puts("The file is on the host, relative to where QEMU was started (./run.sh -semihosting)");
+        } else if (strcmp(cmd->name, "exit") == 0) {
+            puts("Usage: exit [status]");
+            puts("  exit      - Write back cached blocks, then stop QEMU with status 0");
+            puts("  exit 3    - ... with status 3, for scripts that check it");
+            puts("Needs ./run.sh -semihosting; otherwise use Ctrl+A, X");
+        } else if (strcmp(cmd->name, "jobs") == 0) {
+            puts("Usage: jobs");
+            puts("Lists background jobs started with 'command &': state, run time, buffered output");
+            puts("  pmem bench &      - Run a benchmark as job 1 and return to the prompt at once");
+        } else if (strcmp(cmd->name, "fg") == 0) {
+            puts("Usage: fg [%n]");
+            puts("  fg                - Print the latest job's output, follow it until it ends");
+            puts("  fg %2             - Same for job 2; Ctrl-C cancels the job");
+        } else if (strcmp(cmd->name, "wait") == 0) {
+            puts("Usage: wait [%n]");
+            puts("  wait              - Print each job's output as it finishes, until none are left");
+            puts("  wait %2           - Only job 2; Ctrl-C stops waiting, the jobs keep running");
         } else if (strcmp(cmd->name, "about") == 0) {
             puts("Usage: about");
             puts("Example: about");
@@ -1389,7 +2013,7 @@ int cmd_help(int argc, char* argv[])
     puts("=== ARM64 OS Shell - Available Commands ===");
     puts("");
     
-    for (int i = 0; i < 17 && command_table[i].name != NULL; i++) {
+    for (int i = 0; i < SHELL_COMMAND_COUNT && command_table[i].name != NULL; i++) {
         printf("%s - %s\n", command_table[i].name, command_table[i].description);
     }
     
@@ -1466,6 +2090,21 @@ int cmd_meminfo(int argc, char* argv[])
     
     // Use the existing memory_info function which displays comprehensive stats
     memory_info();
+    puts("");
+    kmalloc_print();
+    return 0;
+}
+
+int cmd_memmap(int argc, char* argv[])
+{
+    if (argc > 1) {
+        puts("Usage: memmap");
+        puts("The memmap command takes no arguments.");
+        return -1;
+    }
+    
+    // Region table is built at boot from linker symbols and the device tree
+    memmap_print();
     return 0;
 }
 
@@ -1494,7 +2133,7 @@ int cmd_about(int argc, char* argv[])
     puts("- Command parsing and execution");
     puts("");
     printf("Build target: %s\n", "aarch64-elf");
-    puts("No filesystem, no virtual memory, no interrupts");
+    puts("No virtual memory; files live in one flat directory on the disk");
     puts("Designed for educational purposes");
     
     return 0;
@@ -1508,9 +2147,12 @@ int cmd_uptime(int argc, char* argv[])
         return -1;
     }
     
-    // Simple uptime placeholder - no real timer implemented
-    puts("System uptime: Unknown (timer not implemented)");
-    puts("Note: This is a minimal OS without timer hardware support");
+    // Generic timer counts from boot
+    unsigned long ms = (unsigned long)timer_uptime_ms();
+    unsigned long seconds = ms / 1000;
+    printf("System uptime: %lu h %lu min %lu s (%lu ms since boot)\n",
+           seconds / 3600, (seconds / 60) % 60, seconds % 60, ms);
+    printf("Timer frequency: %lu Hz\n", (unsigned long)timer_frequency());
     
     return 0;
 }
@@ -1674,66 +2316,18 @@ static unsigned long parse_address(const char* str, int* valid)
     return addr;
 }
 
-// Phase 3 Day 15: Check if address is safe to read (word-aligned)
-static int is_address_safe(unsigned long addr)
+// Check that a whole span is readable according to the memory map
+// One O(log n) lookup per span instead of hard-coded checks per access
+static int is_range_readable(unsigned long addr, unsigned long len)
 {
-    // Basic safety checks for ARM64 QEMU environment
-    
-    // Null pointer
-    if (addr == 0) {
-        return 0;
-    }
-    
-    // Extremely low addresses (likely kernel structures)
-    if (addr < 0x1000) {
-        return 0;
-    }
-    
-    // UART hardware registers (0x09000000 range)
-    if (addr >= 0x09000000 && addr <= 0x09001000) {
-        return 0;
-    }
-    
-    // Very high addresses (kernel/hardware regions)
-    if (addr >= 0xFFFF0000) {
-        return 0;
-    }
-    
-    // Address should be aligned for safety (required for word access)
-    if (addr % 4 != 0) {
-        return 0;
-    }
-    
-    return 1;
+    return memmap_check_range(addr, len, MEMMAP_ACCESS_READ);
 }
 
-// Phase 3 Day 16: Check if address is safe for byte-level reading (dump/peek bytes)
-static int is_address_safe_byte(unsigned long addr)
+// Check that a whole span is writable (stricter than read: no kernel text,
+// stack, firmware or device registers)
+static int is_range_writable(unsigned long addr, unsigned long len)
 {
-    // Basic safety checks without alignment requirement
-    
-    // Null pointer
-    if (addr == 0) {
-        return 0;
-    }
-    
-    // Extremely low addresses (likely kernel structures)
-    if (addr < 0x1000) {
-        return 0;
-    }
-    
-    // UART hardware registers (0x09000000 range)
-    if (addr >= 0x09000000 && addr <= 0x09001000) {
-        return 0;
-    }
-    
-    // Very high addresses (kernel/hardware regions)
-    if (addr >= 0xFFFF0000) {
-        return 0;
-    }
-    
-    // No alignment requirement for byte access
-    return 1;
+    return memmap_check_range(addr, len, MEMMAP_ACCESS_WRITE);
 }
 
 // Phase 3 Day 15: Display character as printable ASCII or '.'
@@ -1793,10 +2387,16 @@ int cmd_peek(int argc, char* argv[])
         return -1;
     }
     
-    // Check if address is safe to read
-    if (!is_address_safe(addr)) {
+    // Address should be aligned for safety (required for word access)
+    if (addr % 4 != 0) {
+        printf("Error: Address %x is not 4-byte aligned\n", addr);
+        return -1;
+    }
+    
+    // Check if the whole value is inside a readable region
+    if (!is_range_readable(addr, sizeof(unsigned long))) {
         printf("Error: Address %x is outside safe memory range\n", addr);
-        puts("Safe range: 0x40000000 to 0x40FFFFFF (kernel + heap area)");
+        puts("Use 'memmap' to list readable regions");
         return -1;
     }
     
@@ -1807,28 +2407,6 @@ int cmd_peek(int argc, char* argv[])
     return 0;
 }
 
-// Phase 3 Day 16: Check if address is safe to write (stricter than read)
-static int is_address_safe_write(unsigned long addr)
-{
-    // Use same basic safety checks as read, but be more restrictive
-    if (!is_address_safe(addr)) {
-        return 0;
-    }
-    
-    // Additional write-specific restrictions
-    // Don't allow writing to low kernel area (more restrictive than read)
-    if (addr < 0x40000000) {
-        return 0;
-    }
-    
-    // Don't allow writing to the main kernel code area
-    if (addr >= 0x40000000 && addr < 0x40010000) {
-        return 0; 
-    }
-    
-    return 1;
-}
-
 // Phase 3 Day 16: Poke command implementation
 int cmd_poke(int argc, char* argv[])
 {
@@ -1890,10 +2468,10 @@ int cmd_poke(int argc, char* argv[])
     }
     
     // Safety check for write
-    if (!is_address_safe_write(addr)) {
+    if (!is_range_writable(addr, write_size)) {
         printf("Error: Unsafe write address: %x\n", (unsigned int)addr);
         puts("Refusing to write to potentially dangerous memory location");
-        puts("Safe write area: 0x40010000 and above, aligned properly");
+        puts("Use 'memmap' to list writable (rw) regions");
         return -1;
     }
     
@@ -1957,6 +2535,8 @@ int cmd_poke(int argc, char* argv[])
 }
 
 // Phase 3 Day 16: Dump command implementation
+#define DUMP_MAX_LENGTH 0x100000    // 1MB
+
 int cmd_dump(int argc, char* argv[])
 {
     if (argc != 3) {
@@ -1986,25 +2566,24 @@ int cmd_dump(int argc, char* argv[])
         return -1;
     }
     
-    // Reasonable length limits
-    if (length > 1024) {
-        printf("Error: Length %x too large (max: 1024 bytes)\n", (unsigned int)length);
+    // Reasonable length limits (Ctrl-C stops a long dump)
+    if (length > DUMP_MAX_LENGTH) {
+        printf("Error: Length %x too large (max: %x bytes)\n", (unsigned int)length, DUMP_MAX_LENGTH);
         puts("Use smaller chunks for large memory regions");
         return -1;
     }
     
-    // Check if start address is safe to read (byte level)
-    if (!is_address_safe_byte(start_addr)) {
-        printf("Error: Unsafe start address: %x\n", (unsigned int)start_addr);
-        puts("Cannot dump from potentially dangerous memory location");
-        return -1;
-    }
-    
-    // Check if end address is safe to read (byte level)
-    unsigned long end_addr = start_addr + length - 1;
-    if (!is_address_safe_byte(end_addr)) {
-        printf("Error: Dump range extends to unsafe address: %x\n", (unsigned int)end_addr);
-        puts("Reduce length or choose different start address");
+    // Check the whole requested range once against the memory map
+    if (!is_range_readable(start_addr, length)) {
+        const memmap_region_t* region = memmap_lookup(start_addr);
+        if (!region || !(region->access & MEMMAP_ACCESS_READ)) {
+            printf("Error: Unsafe start address: %x\n", (unsigned int)start_addr);
+            puts("Cannot dump from potentially dangerous memory location");
+        } else {
+            printf("Error: Dump range extends past readable region ending at %x\n",
+                   (unsigned long)(region->end - 1));
+            puts("Reduce length or choose different start address");
+        }
         return -1;
     }
     
@@ -2023,7 +2602,11 @@ int cmd_dump(int argc, char* argv[])
     // Display memory in 16-byte lines
     unsigned char* ptr = (unsigned char*)aligned_start;
     
-    for (unsigned long offset = 0; offset < total_length; offset += 16) {
+    unsigned long offset;
+    for (offset = 0; offset < total_length; offset += 16) {
+        // Check for Ctrl-C once per line
+        if (cancel_requested()) break;
+        
         unsigned long line_addr = aligned_start + offset;
         
         // Display address column (8 hex digits)
@@ -2034,13 +2617,9 @@ int cmd_dump(int argc, char* argv[])
             unsigned long byte_addr = line_addr + i;
             
             // Check if this byte is within our requested range
+            // (the whole range was validated above)
             if (byte_addr >= start_addr && byte_addr < start_addr + length) {
-                // Check if safe to read this specific byte
-                if (is_address_safe_byte(byte_addr)) {
-                    printf("%x ", (unsigned int)ptr[offset + i]);
-                } else {
-                    puts("?? ");
-                }
+                printf("%x ", (unsigned int)ptr[offset + i]);
             } else {
                 // Outside requested range, show padding
                 puts("   ");
@@ -2058,11 +2637,7 @@ int cmd_dump(int argc, char* argv[])
             unsigned long byte_addr = line_addr + i;
             
             if (byte_addr >= start_addr && byte_addr < start_addr + length) {
-                if (is_address_safe_byte(byte_addr)) {
-                    putchar(to_printable_char(ptr[offset + i]));
-                } else {
-                    putchar('?');
-                }
+                putchar(to_printable_char(ptr[offset + i]));
             } else {
                 putchar(' ');
             }
@@ -2071,6 +2646,12 @@ int cmd_dump(int argc, char* argv[])
     }
     
     puts("");
+    if (offset < total_length) {
+        // Bytes of the requested range on the lines shown
+        unsigned long shown = aligned_start + offset > start_addr ? aligned_start + offset - start_addr : 0;
+        printf("Dump interrupted after %x of %x bytes\n", (unsigned int)shown, (unsigned int)length);
+        return SHELL_ERROR_INTERRUPTED;
+    }
     printf("Dumped %x bytes from ", (unsigned int)length);
     print_address_hex(start_addr);
     puts("");
@@ -2100,10 +2681,12 @@ int cmd_color(int argc, char* argv[])
         
         if (strcmp(option, "on") == 0 || strcmp(option, "enable") == 0) {
             set_colors_enabled(1);
+            settings_save_colors();
             print_success("Colors enabled\n");
             return 0;
         } else if (strcmp(option, "off") == 0 || strcmp(option, "disable") == 0) {
             set_colors_enabled(0);
+            settings_save_colors();
             puts("Colors disabled");
             return 0;
         } else if (strcmp(option, "test") == 0) {
@@ -2177,6 +2760,7 @@ int cmd_reboot(int argc, char* argv[])
     
     // Clean up before reboot
     puts("Cleaning up system state...");
+    cfgstore_sync();
     
     // Display shutdown message
     if (colors_enabled) {
@@ -2309,9 +2893,37 @@ int cmd_sysinfo(int argc, char* argv[])
 }
 
 // Day 19 Task 1: Command History Display Implementation
+// history [-c | N]: show all entries, clear, or show the last N
 int cmd_history(int argc, char* argv[])
 {
-    if (history.count == 0) {
+    static char entry[HISTORY_ENTRY_MAX];
+    int show = history_count();
+    
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: history [-c | N]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (argc == 2) {
+        if (strcmp(argv[1], "-c") == 0) {
+            history_clear();
+            settings_clear_history();
+            shell_display_success("Command history cleared");
+            return SHELL_SUCCESS;
+        }
+        
+        int valid;
+        unsigned long n = parse_address(argv[1], &valid);
+        if (!valid) {
+            shell_display_error(SHELL_ERROR_SYNTAX, "Usage: history [-c | N]");
+            return SHELL_ERROR_SYNTAX;
+        }
+        if (n < (unsigned long)show) {
+            show = (int)n;
+        }
+    }
+    
+    if (history_count() == 0) {
         puts("No commands in history.");
         return 0;
     }
@@ -2324,35 +2936,21 @@ int cmd_history(int argc, char* argv[])
     }
     puts("");
     
-    // Calculate starting index for display
-    int start_index;
-    int display_count = history.count;
-    
-    if (history.count < HISTORY_SIZE) {
-        // Haven't wrapped around yet
-        start_index = 0;
-    } else {
-        // Wrapped around, start from oldest
-        start_index = history.write_index;
-    }
-    
-    // Display commands with numbering
-    for (int i = 0; i < display_count; i++) {
-        int index = (start_index + i) % HISTORY_SIZE;
-        int command_number = i + 1;
+    // Display the newest 'show' commands, oldest first, numbered by sequence
+    for (uint32_t seq = history_end() - show; seq != history_end(); seq++) {
+        history_get(seq, entry, sizeof(entry));
         
         if (colors_enabled) {
-            printf("[%x] %s\n", command_number, history.commands[index]);
+            printf("[%x] %s\n", (unsigned long)(seq + 1), entry);
         } else {
-            printf("%2x  %s\n", command_number, history.commands[index]);
+            printf("%x  %s\n", (unsigned long)(seq + 1), entry);
         }
     }
     
     puts("");
-    printf("Total commands: %x\n", history.count);
-    if (history.count == HISTORY_SIZE) {
-        puts("(History buffer is full - oldest commands are being overwritten)");
-    }
+    printf("Total commands: %x (%x bytes of %x)\n", (unsigned long)history_count(),
+           history_bytes_used(), (unsigned long)HISTORY_RING_SIZE);
+    puts("Press Ctrl-R at the prompt to search history");
     
     return 0;
 }
@@ -2360,7 +2958,13 @@ int cmd_history(int argc, char* argv[])
 // Day 20 Task 1: Error log display command
 int cmd_errors(int argc, char* argv[])
 {
-    if (error_log.count == 0) {
+    // Copy the log so other threads can keep logging while we print
+    error_log_t log;
+    unsigned long flags = ticket_lock_irqsave(&error_log_lock);
+    log = error_log;
+    ticket_unlock_irqrestore(&error_log_lock, flags);
+    
+    if (log.count == 0) {
         shell_display_info("No errors logged yet.");
         return SHELL_SUCCESS;
     }
@@ -2374,20 +2978,20 @@ int cmd_errors(int argc, char* argv[])
     
     // Calculate starting index for display (oldest first)
     int start_index;
-    int display_count = error_log.count;
+    int display_count = log.count;
     
-    if (error_log.count < ERROR_LOG_SIZE) {
+    if (log.count < ERROR_LOG_SIZE) {
         // Haven't wrapped around yet
         start_index = 0;
     } else {
         // Wrapped around, start from oldest
-        start_index = error_log.current_index;
+        start_index = log.current_index;
     }
     
     // Display errors
     for (int i = 0; i < display_count; i++) {
         int index = (start_index + i) % ERROR_LOG_SIZE;
-        error_log_entry_t* entry = &error_log.entries[index];
+        error_log_entry_t* entry = &log.entries[index];
         
         // Format timestamp
         printf("[%u] ", entry->timestamp);
@@ -2415,8 +3019,8 @@ int cmd_errors(int argc, char* argv[])
         printf("\n");
     }
     
-    printf("\nTotal errors logged: %d\n", error_log.count);
-    if (error_log.count == ERROR_LOG_SIZE) {
+    printf("\nTotal errors logged: %d\n", log.count);
+    if (log.count == ERROR_LOG_SIZE) {
         puts("(Error log is full - oldest errors are being overwritten)");
     }
     
@@ -2431,6 +3035,12 @@ int cmd_stats(int argc, char* argv[])
         return SHELL_ERROR_INVALID_ARGS;
     }
     
+    // Snapshot the counters before printing
+    performance_monitor_t monitor;
+    unsigned long flags = ticket_lock_irqsave(&perf_monitor_lock);
+    monitor = perf_monitor;
+    ticket_unlock_irqrestore(&perf_monitor_lock, flags);
+    
     // Display performance monitoring header
     if (colors_enabled) {
         printf(ANSI_FG_CYAN "=== Performance Statistics ===" ANSI_COLOR_RESET "\n\n");
@@ -2439,11 +3049,11 @@ int cmd_stats(int argc, char* argv[])
     }
     
     // Display global statistics (printf doesn't support %u or %d, use %x)
-    printf("Total commands executed: %x\n", perf_monitor.total_commands);
-    printf("Commands tracked: %x/%x\n", perf_monitor.tracked_count, MAX_TRACKED_COMMANDS);
-    printf("Performance counter: %x\n\n", perf_monitor.performance_counter);
+    printf("Total commands executed: %x\n", monitor.total_commands);
+    printf("Commands tracked: %x/%x\n", monitor.tracked_count, MAX_TRACKED_COMMANDS);
+    printf("Performance counter: %x\n\n", monitor.performance_counter);
     
-    if (perf_monitor.tracked_count == 0) {
+    if (monitor.tracked_count == 0) {
         puts("No command statistics available yet.");
         puts("Execute some commands and run 'stats' again to see performance data.");
         return SHELL_SUCCESS;
@@ -2461,8 +3071,8 @@ int cmd_stats(int argc, char* argv[])
     puts("--------------------------------------------------");
     
     // Display statistics for each tracked command
-    for (int i = 0; i < perf_monitor.tracked_count; i++) {
-        command_stats_t* stats = &perf_monitor.commands[i];
+    for (int i = 0; i < monitor.tracked_count; i++) {
+        command_stats_t* stats = &monitor.commands[i];
         
         if (colors_enabled) {
             printf(ANSI_FG_GREEN "%-12s" ANSI_COLOR_RESET " %8u %8u %8u %8u\n",
@@ -2484,11 +3094,11 @@ int cmd_stats(int argc, char* argv[])
     puts("");
     
     // Find most used command
-    if (perf_monitor.tracked_count > 0) {
-        command_stats_t* most_used = &perf_monitor.commands[0];
-        for (int i = 1; i < perf_monitor.tracked_count; i++) {
-            if (perf_monitor.commands[i].call_count > most_used->call_count) {
-                most_used = &perf_monitor.commands[i];
+    if (monitor.tracked_count > 0) {
+        command_stats_t* most_used = &monitor.commands[0];
+        for (int i = 1; i < monitor.tracked_count; i++) {
+            if (monitor.commands[i].call_count > most_used->call_count) {
+                most_used = &monitor.commands[i];
             }
         }
         
@@ -2511,21 +3121,28 @@ int cmd_alias(int argc, char* argv[])
 {
     // No arguments - list all aliases
     if (argc == 1) {
+        // Snapshot the table before printing
+        alias_table_t table;
+        mcs_node_t node;
+        unsigned long flags = mcs_lock_irqsave(&alias_lock, &node);
+        table = alias_table;
+        mcs_unlock_irqrestore(&alias_lock, &node, flags);
+        
         if (colors_enabled) {
             printf(ANSI_FG_CYAN "=== Command Aliases ===" ANSI_COLOR_RESET "\n\n");
         } else {
             puts("=== Command Aliases ===\n");
         }
         
-        if (alias_table.count == 0) {
+        if (table.count == 0) {
             puts("No aliases defined.");
             return SHELL_SUCCESS;
         }
         
         // Display built-in aliases first
         int builtin_count = 0;
-        for (int i = 0; i < alias_table.count; i++) {
-            if (alias_table.aliases[i].is_builtin) {
+        for (int i = 0; i < table.count; i++) {
+            if (table.aliases[i].is_builtin) {
                 if (builtin_count == 0) {
                     if (colors_enabled) {
                         printf(ANSI_FG_YELLOW "Built-in aliases:" ANSI_COLOR_RESET "\n");
@@ -2537,10 +3154,10 @@ int cmd_alias(int argc, char* argv[])
                 if (colors_enabled) {
                     printf("  " ANSI_FG_GREEN "%s" ANSI_COLOR_RESET " -> " 
                            ANSI_FG_BRIGHT_BLUE "%s" ANSI_COLOR_RESET "\n",
-                           alias_table.aliases[i].name, alias_table.aliases[i].expansion);
+                           table.aliases[i].name, table.aliases[i].expansion);
                 } else {
                     printf("  %s -> %s\n", 
-                           alias_table.aliases[i].name, alias_table.aliases[i].expansion);
+                           table.aliases[i].name, table.aliases[i].expansion);
                 }
                 builtin_count++;
             }
@@ -2548,8 +3165,8 @@ int cmd_alias(int argc, char* argv[])
         
         // Display user-defined aliases
         int user_count = 0;
-        for (int i = 0; i < alias_table.count; i++) {
-            if (!alias_table.aliases[i].is_builtin) {
+        for (int i = 0; i < table.count; i++) {
+            if (!table.aliases[i].is_builtin) {
                 if (user_count == 0) {
                     if (builtin_count > 0) puts("");
                     if (colors_enabled) {
@@ -2562,10 +3179,10 @@ int cmd_alias(int argc, char* argv[])
                 if (colors_enabled) {
                     printf("  " ANSI_FG_CYAN "%s" ANSI_COLOR_RESET " -> " 
                            ANSI_FG_BRIGHT_CYAN "%s" ANSI_COLOR_RESET "\n",
-                           alias_table.aliases[i].name, alias_table.aliases[i].expansion);
+                           table.aliases[i].name, table.aliases[i].expansion);
                 } else {
                     printf("  %s -> %s\n", 
-                           alias_table.aliases[i].name, alias_table.aliases[i].expansion);
+                           table.aliases[i].name, table.aliases[i].expansion);
                 }
                 user_count++;
             }
@@ -2575,7 +3192,7 @@ int cmd_alias(int argc, char* argv[])
             puts("\nNo user-defined aliases. Use 'alias <name> <command>' to create one.");
         }
         
-        printf("\nTotal aliases: %x/%x\n", alias_table.count, MAX_ALIASES);
+        printf("\nTotal aliases: %x/%x\n", table.count, MAX_ALIASES);
         return SHELL_SUCCESS;
     }
     
@@ -2590,6 +3207,7 @@ int cmd_alias(int argc, char* argv[])
             
             int result = alias_remove(argv[2]);
             if (result == 0) {
+                settings_save_alias(argv[2], NULL);
                 shell_display_success("Alias removed successfully");
                 return SHELL_SUCCESS;
             } else {
@@ -2605,6 +3223,7 @@ int cmd_alias(int argc, char* argv[])
                 return SHELL_ERROR_INVALID_ARGS;
             }
             
+            settings_clear_aliases();
             alias_clear_user_aliases();
             shell_display_success("All user-defined aliases cleared");
             return SHELL_SUCCESS;
@@ -2638,6 +3257,7 @@ int cmd_alias(int argc, char* argv[])
             
             int result = alias_add(argv[1], expansion, 0);  // User-defined alias
             if (result == 0) {
+                settings_save_alias(argv[1], expansion);
                 if (colors_enabled) {
                     printf(ANSI_FG_GREEN "Alias created: " ANSI_COLOR_RESET 
                            ANSI_FG_CYAN "%s" ANSI_COLOR_RESET " -> " 
@@ -2659,4 +3279,1467 @@ int cmd_alias(int argc, char* argv[])
     }
     
     return SHELL_SUCCESS;
-}
\ No newline at end of file
+}
+
+// Fast paste / batch ingestion control
+int cmd_batch_mode(int argc, char* argv[])
+{
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: batch-mode [on|off|status]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "on") == 0) {
+        ingest_mode = INGEST_BATCH;
+        shell_display_info("Batch mode on: no echo or prompt; 'batch-mode off' or Ctrl-D to leave");
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        if (ingest_mode == INGEST_BATCH) {
+            ingest_mode = INGEST_OFF;
+        }
+        shell_display_info("Batch mode off");
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "status") != 0) {
+        shell_display_error(SHELL_ERROR_SYNTAX, "Usage: batch-mode [on|off|status]");
+        return SHELL_ERROR_SYNTAX;
+    }
+    
+    const char* mode = "interactive";
+    if (ingest_mode == INGEST_BATCH) mode = "batch";
+    if (ingest_mode == INGEST_PASTE) mode = "paste";
+    
+    printf("Input mode: %s\n", mode);
+    printf("Lines ingested: %x\n", ingest_lines);
+    printf("RX bytes buffered: %x\n", (unsigned long)uart_rx_available());
+    printf("RX bytes dropped: %x\n", uart_rx_dropped());
+    return SHELL_SUCCESS;
+}
+
+// Kernel thread listing
+int cmd_ps(int argc, char* argv[])
+{
+    if (argc > 1) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: ps");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    thread_print();
+    return SHELL_SUCCESS;
+}
+
+// Kernel benchmarks
+#define BENCH_SWITCH_DEFAULT 10000
+#define BENCH_SWITCH_MAX     10000000
+#define BENCH_SCHED_THREADS      8
+#define BENCH_SCHED_MAX_THREADS  16
+#define BENCH_SCHED_WORK         2000000
+#define BENCH_SCHED_MAX_WORK     100000000
+#define BENCH_LOCK_THREADS       4
+#define BENCH_LOCK_ITERATIONS    100000
+#define BENCH_ALLOC_THREADS      4
+#define BENCH_ALLOC_OPS          200000
+#define BENCH_RING_ITEMS         1000000
+#define BENCH_IPI_CALLS          10000
+
+int cmd_bench(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: bench switch|sched|locks [args]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (strcmp(argv[1], "switch") == 0) {
+        unsigned long iterations = BENCH_SWITCH_DEFAULT;
+        if (argc == 3) {
+            int valid;
+            iterations = parse_address(argv[2], &valid);
+            if (!valid || iterations == 0 || iterations > BENCH_SWITCH_MAX) {
+                shell_display_error(SHELL_ERROR_RANGE, "Iterations must be 1-10000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        thread_bench_switch(iterations);
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "sched") == 0) {
+        if (argc > 4) {
+            shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: bench sched [threads] [work]");
+            return SHELL_ERROR_INVALID_ARGS;
+        }
+        
+        unsigned long threads = BENCH_SCHED_THREADS;
+        unsigned long work = BENCH_SCHED_WORK;
+        int valid = 1;
+        if (argc >= 3) {
+            threads = parse_address(argv[2], &valid);
+            if (!valid || threads == 0 || threads > BENCH_SCHED_MAX_THREADS) {
+                shell_display_error(SHELL_ERROR_RANGE, "Threads must be 1-16");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        if (argc == 4) {
+            work = parse_address(argv[3], &valid);
+            if (!valid || work == 0 || work > BENCH_SCHED_MAX_WORK) {
+                shell_display_error(SHELL_ERROR_RANGE, "Work must be 1-100000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        thread_bench_sched((int)threads, work);
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "locks") == 0) {
+        if (argc > 4) {
+            shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: bench locks [threads] [iterations]");
+            return SHELL_ERROR_INVALID_ARGS;
+        }
+        
+        unsigned long threads = BENCH_LOCK_THREADS;
+        unsigned long iterations = BENCH_LOCK_ITERATIONS;
+        int valid = 1;
+        if (argc >= 3) {
+            threads = parse_address(argv[2], &valid);
+            if (!valid || threads == 0 || threads > BENCH_SCHED_MAX_THREADS) {
+                shell_display_error(SHELL_ERROR_RANGE, "Threads must be 1-16");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        if (argc == 4) {
+            iterations = parse_address(argv[3], &valid);
+            if (!valid || iterations == 0 || iterations > BENCH_SWITCH_MAX) {
+                shell_display_error(SHELL_ERROR_RANGE, "Iterations must be 1-10000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        lock_bench((int)threads, iterations);
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "alloc") == 0) {
+        if (argc > 4) {
+            shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: bench alloc [threads] [ops]");
+            return SHELL_ERROR_INVALID_ARGS;
+        }
+        
+        unsigned long threads = BENCH_ALLOC_THREADS;
+        unsigned long ops = BENCH_ALLOC_OPS;
+        int valid = 1;
+        if (argc >= 3) {
+            threads = parse_address(argv[2], &valid);
+            if (!valid || threads == 0 || threads > BENCH_SCHED_MAX_THREADS) {
+                shell_display_error(SHELL_ERROR_RANGE, "Threads must be 1-16");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        if (argc == 4) {
+            ops = parse_address(argv[3], &valid);
+            if (!valid || ops == 0 || ops > BENCH_SWITCH_MAX) {
+                shell_display_error(SHELL_ERROR_RANGE, "Ops must be 1-10000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        kmalloc_bench((int)threads, ops);
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "ring") == 0) {
+        unsigned long items = BENCH_RING_ITEMS;
+        if (argc == 3) {
+            int valid;
+            items = parse_address(argv[2], &valid);
+            if (!valid || items == 0 || items > BENCH_SWITCH_MAX) {
+                shell_display_error(SHELL_ERROR_RANGE, "Items must be 1-10000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        ring_bench(items);
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "ipi") == 0) {
+        unsigned long calls = BENCH_IPI_CALLS;
+        if (argc == 3) {
+            int valid;
+            calls = parse_address(argv[2], &valid);
+            if (!valid || calls == 0 || calls > BENCH_SWITCH_MAX) {
+                shell_display_error(SHELL_ERROR_RANGE, "Calls must be 1-10000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        ipi_bench(calls);
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_NOT_FOUND, "Unknown benchmark (available: switch, sched, locks, alloc, ring, ipi)");
+    return SHELL_ERROR_NOT_FOUND;
+}
+
+// Per-CPU scheduler statistics and thread pinning
+int cmd_cpus(int argc, char* argv[])
+{
+    if (argc == 1) {
+        thread_print_cpus();
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        thread_reset_cpu_stats();
+        puts("CPU statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 4 && strcmp(argv[1], "pin") == 0) {
+        int valid_id, valid_mask;
+        unsigned long id = parse_address(argv[2], &valid_id);
+        unsigned long mask = parse_address(argv[3], &valid_mask);
+        if (!valid_id || !valid_mask || mask == 0 || mask > 0xFF) {
+            shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: cpus pin <thread-id> <cpu-mask 0x1-0xFF>");
+            return SHELL_ERROR_INVALID_ARGS;
+        }
+        if (thread_set_affinity((int)id, mask == 0xFF ? THREAD_AFFINITY_ALL : (uint32_t)mask) != 0) {
+            shell_display_error(SHELL_ERROR_NOT_FOUND, "No such thread, idle thread, or no online CPU in mask");
+            return SHELL_ERROR_NOT_FOUND;
+        }
+        printf("Thread %lu affinity set to %x\n", id, mask);
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: cpus [reset | pin <thread-id> <cpu-mask>]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+// Lock contention statistics
+#define LOCKS_DEFAULT_SHOWN 10
+
+int cmd_locks(int argc, char* argv[])
+{
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: locks [count | reset]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        lock_reset_stats();
+        puts("Lock statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    unsigned long shown = LOCKS_DEFAULT_SHOWN;
+    if (argc == 2) {
+        int valid;
+        shown = parse_address(argv[1], &valid);
+        if (!valid || shown == 0 || shown > 64) {
+            shell_display_error(SHELL_ERROR_RANGE, "Count must be 1-64");
+            return SHELL_ERROR_RANGE;
+        }
+    }
+    
+    lock_print((int)shown);
+    return SHELL_SUCCESS;
+}
+
+// Parallel memory kernels: a trailing "-j N" limits the CPUs used
+#define MEM_BENCH_DEFAULT_KB 16384
+#define MEM_BENCH_MAX_KB     32768
+
+// Parse an address and length and check them against the memory map;
+// returns 0 with an error shown on failure
+static int mem_parse_range(const char* addr_str, const char* len_str, unsigned long* addr,
+                           unsigned long* len, int writable)
+{
+    int addr_valid, len_valid;
+    *addr = parse_address(addr_str, &addr_valid);
+    *len = parse_address(len_str, &len_valid);
+    
+    if (!addr_valid || !len_valid || *len == 0) {
+        shell_display_error(SHELL_ERROR_PARSE, "Address and length must be numbers (length > 0)");
+        return 0;
+    }
+    if (writable ? !is_range_writable(*addr, *len) : !is_range_readable(*addr, *len)) {
+        shell_display_error(SHELL_ERROR_PERMISSION, writable ? "Range is not writable RAM (see memmap)"
+                                                             : "Range is not readable (see memmap)");
+        return 0;
+    }
+    return 1;
+}
+
+// Elapsed time and throughput for one kernel run; 'done' of 'len' bytes
+// were processed. Returns the shell status for the command.
+static int mem_report(const char* what, unsigned long done, unsigned long len, int cpus, uint64_t start)
+{
+    uint64_t ns = timer_ticks_to_ns(timer_ticks() - start);
+    if (ns == 0) ns = 1;
+    printf("%s %lu bytes in %lu us on %d CPU%s (%lu MB/s)\n", what, done, (unsigned long)(ns / 1000),
+           cpus, cpus == 1 ? "" : "s", (unsigned long)((done * 1000000000UL / ns) >> 20));
+    
+    if (done < len) {
+        printf("Stopped early: %lu of %lu bytes not processed\n", len - done, len);
+        shell_display_error(SHELL_ERROR_INTERRUPTED, what);
+        return SHELL_ERROR_INTERRUPTED;
+    }
+    return SHELL_SUCCESS;
+}
+
+int cmd_pmem(int argc, char* argv[])
+{
+    // Strip the optional trailing -j N
+    int jobs = 0;
+    if (argc >= 3 && strcmp(argv[argc - 2], "-j") == 0) {
+        int valid;
+        unsigned long j = parse_address(argv[argc - 1], &valid);
+        if (!valid || j == 0 || j > 8) {
+            shell_display_error(SHELL_ERROR_RANGE, "-j takes 1-8 CPUs");
+            return SHELL_ERROR_RANGE;
+        }
+        jobs = (int)j;
+        argc -= 2;
+    }
+    
+    if (argc < 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: pmem fill|zero|copy|cmp|crc|bench [args] [-j N]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    unsigned long addr, len;
+    uint64_t start;
+    
+    if (strcmp(argv[1], "fill") == 0 && argc == 5) {
+        int valid;
+        unsigned long value = parse_address(argv[4], &valid);
+        if (!valid || value > 0xFF) {
+            shell_display_error(SHELL_ERROR_RANGE, "Fill value must be a byte (0-0xFF)");
+            return SHELL_ERROR_RANGE;
+        }
+        if (!mem_parse_range(argv[2], argv[3], &addr, &len, 1)) return SHELL_ERROR_PERMISSION;
+        start = timer_ticks();
+        size_t done = parallel_fill((void*)addr, (uint8_t)value, len, jobs);
+        return mem_report("Filled", done, len, parallel_cpus(len, jobs), start);
+    }
+    
+    if (strcmp(argv[1], "zero") == 0 && argc == 4) {
+        if (!mem_parse_range(argv[2], argv[3], &addr, &len, 1)) return SHELL_ERROR_PERMISSION;
+        start = timer_ticks();
+        size_t done = parallel_zero((void*)addr, len, jobs);
+        return mem_report("Zeroed", done, len, parallel_cpus(len, jobs), start);
+    }
+    
+    if ((strcmp(argv[1], "copy") == 0 || strcmp(argv[1], "cmp") == 0) && argc == 5) {
+        int is_copy = strcmp(argv[1], "copy") == 0;
+        unsigned long second;
+        
+        // argv[2] is the destination of a copy
+        if (!mem_parse_range(argv[2], argv[4], &addr, &len, is_copy)) return SHELL_ERROR_PERMISSION;
+        if (!mem_parse_range(argv[3], argv[4], &second, &len, 0)) return SHELL_ERROR_PERMISSION;
+        
+        if (is_copy) {
+            if (addr < second + len && second < addr + len) {
+                shell_display_error(SHELL_ERROR_RANGE, "Source and destination overlap");
+                return SHELL_ERROR_RANGE;
+            }
+            start = timer_ticks();
+            size_t done = parallel_copy((void*)addr, (const void*)second, len, jobs);
+            return mem_report("Copied", done, len, parallel_cpus(len, jobs), start);
+        }
+        
+        start = timer_ticks();
+        long diff = parallel_compare((const void*)addr, (const void*)second, len, jobs);
+        if (diff == PARALLEL_CANCELLED) {
+            puts("No difference found before the comparison was stopped");
+            shell_display_error(SHELL_ERROR_INTERRUPTED, "Compared");
+            return SHELL_ERROR_INTERRUPTED;
+        }
+        mem_report("Compared", len, len, parallel_cpus(len, jobs), start);
+        if (diff < 0) {
+            puts("Ranges are identical");
+        } else {
+            printf("First difference at offset %lu: %x vs %x\n", (unsigned long)diff,
+                   (unsigned long)((uint8_t*)addr)[diff], (unsigned long)((uint8_t*)second)[diff]);
+        }
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "crc") == 0 && argc == 4) {
+        if (!mem_parse_range(argv[2], argv[3], &addr, &len, 0)) return SHELL_ERROR_PERMISSION;
+        start = timer_ticks();
+        uint32_t crc;
+        size_t covered = parallel_crc32((const void*)addr, len, jobs, &crc);
+        if (covered < len) {
+            printf("CRC-32 of the first %lu bytes: %x\n", (unsigned long)covered, (unsigned long)crc);
+        } else {
+            printf("CRC-32: %x\n", (unsigned long)crc);
+        }
+        return mem_report("Checksummed", covered, len, parallel_cpus(len, jobs), start);
+    }
+    
+    if (strcmp(argv[1], "bench") == 0 && argc <= 3) {
+        unsigned long kb = MEM_BENCH_DEFAULT_KB;
+        if (argc == 3) {
+            int valid;
+            kb = parse_address(argv[2], &valid);
+            if (!valid || kb < 64 || kb > MEM_BENCH_MAX_KB) {
+                shell_display_error(SHELL_ERROR_RANGE, "Size must be 64-32768 KB");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        parallel_bench(kb * 1024, jobs);
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: pmem fill|zero|copy|cmp|crc|bench [args] [-j N]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+// Work queue and timer wheel statistics
+#define WORK_BENCH_ITEMS 100000
+
+int cmd_work(int argc, char* argv[])
+{
+    if (argc == 1) {
+        workqueue_print();
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        workqueue_reset_stats();
+        puts("Work queue statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "bench") == 0) {
+        unsigned long items = WORK_BENCH_ITEMS;
+        if (argc == 3) {
+            int valid;
+            items = parse_address(argv[2], &valid);
+            if (!valid || items == 0 || items > BENCH_SWITCH_MAX) {
+                shell_display_error(SHELL_ERROR_RANGE, "Items must be 1-10000000");
+                return SHELL_ERROR_RANGE;
+            }
+        }
+        workqueue_bench(items);
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: work [reset | bench [items]]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+int cmd_virtio(int argc, char* argv[])
+{
+    if (argc == 1) {
+        virtio_print();
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        virtio_reset_stats();
+        puts("Virtio statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: virtio [reset]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+int cmd_blkbench(int argc, char* argv[])
+{
+    if (!blk_present()) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND,
+                            "No disk; start with ./run.sh -drive file=disk.img,if=none,format=raw,id=hd0 -device virtio-blk-device,drive=hd0");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "stats") == 0) {
+        blk_print();
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        blk_reset_stats();
+        puts("Block statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    // Strip the optional trailing -m mode (stays in effect afterwards)
+    if (argc >= 3 && strcmp(argv[argc - 2], "-m") == 0) {
+        const char* name = argv[argc - 1];
+        blk_mode_t mode;
+        if (strcmp(name, "irq") == 0) {
+            mode = BLK_MODE_IRQ;
+        } else if (strcmp(name, "poll") == 0) {
+            mode = BLK_MODE_POLL;
+        } else if (strcmp(name, "adaptive") == 0) {
+            mode = BLK_MODE_ADAPTIVE;
+        } else {
+            shell_display_error(SHELL_ERROR_INVALID_ARGS, "Mode must be irq, poll or adaptive");
+            return SHELL_ERROR_INVALID_ARGS;
+        }
+        blk_set_mode(mode);
+        if (blk_get_mode() != mode) {
+            shell_display_error(SHELL_ERROR_SYSTEM, "The disk has no interrupt; only polling works");
+            return SHELL_ERROR_SYSTEM;
+        }
+        argc -= 2;
+    }
+    
+    int write = 0;
+    int arg = 1;
+    if (arg < argc && (strcmp(argv[arg], "read") == 0 || strcmp(argv[arg], "write") == 0)) {
+        write = strcmp(argv[arg], "write") == 0;
+        arg++;
+    }
+    
+    unsigned long kb = 4;
+    if (arg < argc) {
+        int valid;
+        kb = parse_address(argv[arg], &valid);
+        if (!valid || kb == 0 || kb > 64 || (kb & (kb - 1))) {
+            shell_display_error(SHELL_ERROR_RANGE, "KB per I/O must be a power of two, 1-64");
+            return SHELL_ERROR_RANGE;
+        }
+        arg++;
+    }
+    
+    if (arg != argc) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: blkbench [read | write] [KB] [-m irq|poll|adaptive]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (write) {
+        if (blk_read_only()) {
+            shell_display_error(SHELL_ERROR_PERMISSION, "The disk is read-only");
+            return SHELL_ERROR_PERMISSION;
+        }
+        puts("Warning: writing random data over the disk image");
+    }
+    
+    blk_bench(write, kb * 1024, BLK_BENCH_MS);
+    return SHELL_SUCCESS;
+}
+
+int cmd_cache(int argc, char* argv[])
+{
+    if (bcache_blocks(BCACHE_DEV_DISK) == 0) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No buffer cache: there is no disk (see 'help blkbench')");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    
+    if (argc == 1) {
+        bcache_print();
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "sync") == 0) {
+        if (bcache_sync() != 0) {
+            shell_display_error(SHELL_ERROR_SYSTEM, "Write-back failed");
+            return SHELL_ERROR_SYSTEM;
+        }
+        puts("Dirty blocks written and disk flushed");
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "drop") == 0) {
+        bcache_drop();
+        puts("Buffer cache emptied");
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        bcache_reset_stats();
+        puts("Buffer cache statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 4 && strcmp(argv[1], "read") == 0) {
+        int valid1, valid2;
+        unsigned long first = parse_address(argv[2], &valid1);
+        unsigned long count = parse_address(argv[3], &valid2);
+        uint64_t blocks = bcache_blocks(BCACHE_DEV_DISK);
+        if (!valid1 || !valid2 || count == 0 || first >= blocks || count > blocks - first) {
+            printf("The disk has %lu blocks of 4 KB\n", (unsigned long)blocks);
+            shell_display_error(SHELL_ERROR_RANGE, "Block range outside the disk");
+            return SHELL_ERROR_RANGE;
+        }
+        
+        bcache_stats_t before = *bcache_stats();
+        uint64_t start = timer_ticks();
+        unsigned long done = 0;
+        for (; done < count && !cancel_requested(); done++) {
+            buf_t* buf = bcache_read(BCACHE_DEV_DISK, first + done);
+            if (!buf) {
+                shell_display_error(SHELL_ERROR_SYSTEM, "Read error");
+                return SHELL_ERROR_SYSTEM;
+            }
+            bcache_release(buf);
+        }
+        uint64_t us = timer_ticks_to_us(timer_ticks() - start);
+        if (us == 0) us = 1;
+        
+        const bcache_stats_t* after = bcache_stats();
+        printf("Read %lu blocks in %lu us (%lu MB/s): %lu hits, %lu misses, %lu blocks read ahead\n",
+               done, (unsigned long)us, (unsigned long)(done * BCACHE_BLOCK_SIZE / us),
+               after->hits - before.hits, after->misses - before.misses,
+               after->readahead - before.readahead);
+        if (done < count) {
+            shell_display_error(SHELL_ERROR_INTERRUPTED, "Cache read");
+            return SHELL_ERROR_INTERRUPTED;
+        }
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: cache [sync | drop | reset | read <block> <count>]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+int cmd_iosched(int argc, char* argv[])
+{
+    if (argc == 1) {
+        iosched_print();
+        return SHELL_SUCCESS;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        iosched_reset_stats();
+        puts("I/O scheduler statistics reset");
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: iosched [reset]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+/*
+ * Files: ls, cat, write, rm and stat
+ */
+
+// Report a filesystem error with the closest shell error code
+static int fs_shell_error(int err)
+{
+    shell_error_t code;
+    switch (err) {
+    case FS_ERR_NOT_FOUND:
+        code = SHELL_ERROR_NOT_FOUND;
+        break;
+    case FS_ERR_NOT_MOUNTED:
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No filesystem: format a disk image with build/mkfs");
+        return SHELL_ERROR_NOT_FOUND;
+    case FS_ERR_NAME:
+    case FS_ERR_IS_DIR:
+        code = SHELL_ERROR_INVALID_ARGS;
+        break;
+    case FS_ERR_NO_SPACE:
+    case FS_ERR_TOO_BIG:
+    case FS_ERR_NO_MEMORY:
+        code = SHELL_ERROR_MEMORY;
+        break;
+    default:
+        code = SHELL_ERROR_SYSTEM;
+        break;
+    }
+    shell_display_error(code, fs_error(err));
+    return code;
+}
+
+// Path within the initrd for "/initrd/<path>" ("" for "/initrd"), else NULL
+static const char* initrd_path(const char* path)
+{
+    int len = strlen(INITRD_PREFIX);
+    if (strncmp(path, INITRD_PREFIX, len) != 0) return NULL;
+    if (path[len] == '\0') return path + len;
+    if (path[len] == '/') return path + len + 1;
+    return NULL;
+}
+
+int cmd_ls(int argc, char* argv[])
+{
+    if (argc > 2 || (argc == 2 && !initrd_path(argv[1]) && strcmp(argv[1], "/") != 0)) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: ls [/initrd]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (argc == 2 && initrd_path(argv[1])) {
+        initrd_print();
+        return SHELL_SUCCESS;
+    }
+    
+    int count = fs_print_dir();
+    return count < 0 ? fs_shell_error(count) : SHELL_SUCCESS;
+}
+
+int cmd_cat(int argc, char* argv[])
+{
+    if (argc != 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: cat <file>");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    // Initrd files are written to the console straight from the archive
+    const char* rd = initrd_path(argv[1]);
+    if (rd) {
+        const initrd_file_t* f = initrd_lookup(rd);
+        if (!f || (f->mode & INITRD_MODE_TYPE) == INITRD_MODE_DIR) {
+            shell_display_error(f ? SHELL_ERROR_INVALID_ARGS : SHELL_ERROR_NOT_FOUND,
+                                f ? "is a directory" : "no such file in the initrd");
+            return f ? SHELL_ERROR_INVALID_ARGS : SHELL_ERROR_NOT_FOUND;
+        }
+        size_t offset = 0;
+        while (offset < f->size && !cancel_requested()) {
+            size_t n = f->size - offset < 4096 ? f->size - offset : 4096;
+            uart_write((const char*)f->data + offset, n);
+            offset += n;
+        }
+        if (f->size && f->data[f->size - 1] != '\n') {
+            putchar('\n');
+        }
+        if (offset < f->size) {
+            shell_display_error(SHELL_ERROR_INTERRUPTED, "cat");
+            return SHELL_ERROR_INTERRUPTED;
+        }
+        return SHELL_SUCCESS;
+    }
+    
+    // Stream the file: memory use does not grow with its size
+    char chunk[512];
+    uint64_t offset = 0;
+    char last = '\n';
+    while (!cancel_requested()) {
+        long n = fs_read(argv[1], offset, chunk, sizeof(chunk));
+        if (n < 0) {
+            return fs_shell_error(n);
+        }
+        if (n == 0) {
+            break;
+        }
+        uart_write(chunk, n);
+        last = chunk[n - 1];
+        offset += n;
+    }
+    
+    // Keep the prompt at the start of a line
+    if (last != '\n') {
+        putchar('\n');
+    }
+    if (cancel_requested()) {
+        shell_display_error(SHELL_ERROR_INTERRUPTED, "cat");
+        return SHELL_ERROR_INTERRUPTED;
+    }
+    return SHELL_SUCCESS;
+}
+
+int cmd_write(int argc, char* argv[])
+{
+    int append = argc > 1 && strcmp(argv[1], "-a") == 0;
+    int first = append ? 2 : 1;
+    if (argc <= first) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: write [-a] <file> <text...>");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    // Create or truncate, then append the words separated by spaces
+    const char* name = argv[first];
+    long result = fs_write(name, 0, "", 0, FS_CREATE | (append ? FS_APPEND : FS_TRUNCATE));
+    for (int i = first + 1; i < argc && result >= 0; i++) {
+        if (i > first + 1) {
+            result = fs_write(name, 0, " ", 1, FS_APPEND);
+        }
+        if (result >= 0) {
+            result = fs_write(name, 0, argv[i], strlen(argv[i]), FS_APPEND);
+        }
+    }
+    if (result >= 0 && argc > first + 1) {
+        result = fs_write(name, 0, "\n", 1, FS_APPEND);
+    }
+    if (result < 0) {
+        return fs_shell_error(result);
+    }
+    
+    complete_insert(complete_files, name[0] == '/' ? name + 1 : name);
+    return SHELL_SUCCESS;
+}
+
+int cmd_rm(int argc, char* argv[])
+{
+    if (argc != 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: rm <file>");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    int err = fs_remove(argv[1]);
+    if (err != FS_OK) {
+        return fs_shell_error(err);
+    }
+    complete_remove(complete_files, argv[1][0] == '/' ? argv[1] + 1 : argv[1]);
+    return SHELL_SUCCESS;
+}
+
+int cmd_stat(int argc, char* argv[])
+{
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: stat [file]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    if (argc == 1) {
+        if (!fs_mounted()) {
+            return fs_shell_error(FS_ERR_NOT_MOUNTED);
+        }
+        fs_print();
+        return SHELL_SUCCESS;
+    }
+    
+    const char* rd = initrd_path(argv[1]);
+    if (rd) {
+        if (*rd == '\0') {
+            initrd_print();
+            return SHELL_SUCCESS;
+        }
+        const initrd_file_t* f = initrd_lookup(rd);
+        if (!f) {
+            shell_display_error(SHELL_ERROR_NOT_FOUND, "no such file in the initrd");
+            return SHELL_ERROR_NOT_FOUND;
+        }
+        printf("%s: %s in the initrd, %lu bytes at %x (read in place), mode %x\n",
+               argv[1], (f->mode & INITRD_MODE_TYPE) == INITRD_MODE_DIR ? "directory" : "file",
+               (unsigned long)f->size, (unsigned long)(uintptr_t)f->data, (unsigned long)f->mode);
+        return SHELL_SUCCESS;
+    }
+    
+    int err = fs_print_file(argv[1]);
+    return err != FS_OK ? fs_shell_error(err) : SHELL_SUCCESS;
+}
+
+/*
+ * Host files through QEMU fw_cfg
+ */
+
+// Time one read of an fw_cfg file by DMA or the data register; 0 on error
+static uint64_t fwcfg_time_read(const fwcfg_file_t* f, void* buf, int dma)
+{
+    uint64_t start = timer_ticks();
+    if (fwcfg_read(f->select, buf, f->size, dma) != 0) return 0;
+    uint64_t us = timer_ticks_to_us(timer_ticks() - start);
+    return us ? us : 1;
+}
+
+int cmd_fwcfg(int argc, char* argv[])
+{
+    if (!fwcfg_present()) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No fw_cfg device");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    
+    if (argc == 1) {
+        fwcfg_print();
+        return SHELL_SUCCESS;
+    }
+    if (argc != 3) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: fwcfg [load | cat | free | bench <name>]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    const fwcfg_file_t* f = fwcfg_find(argv[2]);
+    if (!f) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No such fw_cfg file (see 'fwcfg')");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    
+    if (strcmp(argv[1], "load") == 0) {
+        if (f->data) {
+            printf("%s: already loaded at %x\n", f->name, (unsigned long)(uintptr_t)f->data);
+            return SHELL_SUCCESS;
+        }
+        uint64_t start = timer_ticks();
+        if (!fwcfg_load(argv[2])) {
+            shell_display_error(SHELL_ERROR_MEMORY, "Could not load the file");
+            return SHELL_ERROR_MEMORY;
+        }
+        uint64_t us = timer_ticks_to_us(timer_ticks() - start);
+        if (us == 0) us = 1;
+        printf("%s: %lu bytes at %x in %lu us (%lu MB/s, %s)\n", f->name, (unsigned long)f->size,
+               (unsigned long)(uintptr_t)f->data, (unsigned long)us,
+               (unsigned long)(f->size / us), fwcfg_has_dma() ? "DMA" : "data register");
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "cat") == 0) {
+        if (!fwcfg_load(argv[2])) {
+            shell_display_error(SHELL_ERROR_MEMORY, "Could not load the file");
+            return SHELL_ERROR_MEMORY;
+        }
+        const char* data = f->data;
+        size_t offset = 0;
+        while (offset < f->size && !cancel_requested()) {
+            size_t n = f->size - offset < 4096 ? f->size - offset : 4096;
+            uart_write(data + offset, n);
+            offset += n;
+        }
+        if (f->size && data[f->size - 1] != '\n') {
+            putchar('\n');
+        }
+        if (offset < f->size) {
+            shell_display_error(SHELL_ERROR_INTERRUPTED, "fwcfg cat");
+            return SHELL_ERROR_INTERRUPTED;
+        }
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "free") == 0) {
+        fwcfg_unload(argv[2]);
+        printf("%s: unloaded\n", f->name);
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "bench") == 0) {
+        size_t pages = f->size ? (f->size + PAGE_SIZE - 1) / PAGE_SIZE : 1;
+        void* buf = page_alloc(pages);
+        if (!buf) {
+            shell_display_error(SHELL_ERROR_MEMORY, "No pages for the file");
+            return SHELL_ERROR_MEMORY;
+        }
+        uint64_t pio_us = fwcfg_time_read(f, buf, 0);
+        uint64_t dma_us = fwcfg_has_dma() ? fwcfg_time_read(f, buf, 1) : 0;
+        page_free(buf, pages);
+        
+        printf("%s, %lu bytes:\n", f->name, (unsigned long)f->size);
+        printf("  Data register: %lu us (%lu MB/s)\n", (unsigned long)pio_us,
+               (unsigned long)(pio_us ? f->size / pio_us : 0));
+        if (dma_us) {
+            printf("  DMA:           %lu us (%lu MB/s), %lux faster\n", (unsigned long)dma_us,
+                   (unsigned long)(f->size / dma_us), (unsigned long)(pio_us / dma_us));
+        } else {
+            puts("  DMA:           not offered by this device");
+        }
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: fwcfg [load | cat | free | bench <name>]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+/*
+ * Persistent settings: config
+ * User aliases ("alias/<name>"), the newest SETTINGS_HISTORY_KEEP history
+ * lines ("history/<slot>", valued "<number> <line>") and colors ("color")
+ * are saved in the flash config store, which batches the writes
+ */
+
+#define SETTINGS_HISTORY_KEEP 100
+
+static uint32_t history_saved = 0;      // Number of the next history line saved
+
+// "<prefix><n>" into 'out'
+static void settings_key(char* out, const char* prefix, unsigned long n)
+{
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    
+    strcpy(out, prefix);
+    out += strlen(prefix);
+    while (len > 0) {
+        *out++ = digits[--len];
+    }
+    *out = '\0';
+}
+
+// Number at the start of a saved history line; '*text' is where the line starts
+static unsigned long settings_history_number(const char* value, size_t len, size_t* text)
+{
+    unsigned long n = 0;
+    size_t i = 0;
+    while (i < len && value[i] >= '0' && value[i] <= '9') {
+        n = n * 10 + (value[i++] - '0');
+    }
+    *text = i < len ? i + 1 : len;
+    return n;
+}
+
+static void settings_alias_loaded(const char* key, const char* value, size_t len, void* arg)
+{
+    char expansion[128];
+    (void)arg;
+    if (len >= sizeof(expansion)) return;
+    
+    memcpy(expansion, value, len);
+    expansion[len] = '\0';
+    alias_add(key + strlen("alias/"), expansion, 0);
+}
+
+static void settings_history_newest(const char* key, const char* value, size_t len, void* arg)
+{
+    uint32_t* next = arg;
+    size_t text;
+    (void)key;
+    
+    unsigned long n = settings_history_number(value, len, &text);
+    if (n + 1 > *next) *next = n + 1;
+}
+
+static void settings_load(void)
+{
+    if (!cfgstore_ready()) return;
+    
+    char color[4];
+    if (cfgstore_get("color", color, sizeof(color)) == 3 && strncmp(color, "off", 3) == 0) {
+        set_colors_enabled(0);
+    }
+    cfgstore_list("alias/", settings_alias_loaded, NULL);
+    
+    // History oldest first: find the newest number, then read the slots back
+    static char line[CFGSTORE_VALUE_MAX + 1];
+    cfgstore_list("history/", settings_history_newest, &history_saved);
+    uint32_t first = history_saved > SETTINGS_HISTORY_KEEP ? history_saved - SETTINGS_HISTORY_KEEP : 0;
+    for (uint32_t n = first; n < history_saved; n++) {
+        char key[32];
+        settings_key(key, "history/", n % SETTINGS_HISTORY_KEEP);
+        int len = cfgstore_get(key, line, CFGSTORE_VALUE_MAX);
+        size_t text;
+        if (len < 0 || settings_history_number(line, len, &text) != n) continue;
+        line[len] = '\0';
+        history_add_command(line + text);
+    }
+}
+
+// NULL 'expansion' forgets the alias
+static void settings_save_alias(const char* name, const char* expansion)
+{
+    char key[48];
+    strcpy(key, "alias/");
+    strcpy(key + strlen("alias/"), name);
+    if (expansion) {
+        cfgstore_put(key, expansion, strlen(expansion));
+    } else {
+        cfgstore_delete(key);
+    }
+}
+
+static void settings_clear_aliases(void)
+{
+    alias_table_t table;
+    mcs_node_t node;
+    unsigned long flags = mcs_lock_irqsave(&alias_lock, &node);
+    table = alias_table;
+    mcs_unlock_irqrestore(&alias_lock, &node, flags);
+    
+    for (int i = 0; i < table.count; i++) {
+        if (!table.aliases[i].is_builtin) {
+            settings_save_alias(table.aliases[i].name, NULL);
+        }
+    }
+}
+
+static void settings_save_colors(void)
+{
+    cfgstore_put("color", colors_enabled ? "on" : "off", colors_enabled ? 2 : 3);
+}
+
+// Record a command line in the history and, when it was added, save it
+static void shell_history_add(const char* line)
+{
+    uint32_t before = history_end();
+    history_add_command(line);
+    if (history_end() == before || !cfgstore_ready()) return;   // Empty or a repeat
+    
+    char value[CFGSTORE_VALUE_MAX];
+    settings_key(value, "", history_saved);
+    size_t prefix = strlen(value);
+    size_t len = strlen(line);
+    if (prefix + 1 + len > sizeof(value)) return;               // Too long to keep
+    value[prefix] = ' ';
+    memcpy(value + prefix + 1, line, len);
+    
+    char key[32];
+    settings_key(key, "history/", history_saved % SETTINGS_HISTORY_KEEP);
+    if (cfgstore_put(key, value, prefix + 1 + len) == 0) {
+        history_saved++;
+    }
+}
+
+static void settings_clear_history(void)
+{
+    for (int slot = 0; slot < SETTINGS_HISTORY_KEEP; slot++) {
+        char key[32];
+        settings_key(key, "history/", slot);
+        cfgstore_delete(key);
+    }
+    history_saved = 0;
+}
+
+int cmd_config(int argc, char* argv[])
+{
+    if (!cfgstore_ready()) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No config store (no pflash bank)");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    
+    if (argc == 1) {
+        cfgstore_print(0);
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "keys") == 0) {
+        cfgstore_print(1);
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "sync") == 0) {
+        if (cfgstore_sync() != 0) {
+            shell_display_error(SHELL_ERROR_SYSTEM, "Flash write failed (see 'config')");
+            return SHELL_ERROR_SYSTEM;
+        }
+        puts("Settings written to flash");
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "compact") == 0) {
+        if (cfgstore_compact() != 0) {
+            puts("Nothing to compact");
+            return SHELL_SUCCESS;
+        }
+        puts("Compacted one segment");
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        if (cfgstore_clear() != 0) {
+            shell_display_error(SHELL_ERROR_SYSTEM, "Flash erase failed");
+            return SHELL_ERROR_SYSTEM;
+        }
+        history_saved = 0;
+        puts("Saved settings erased; the current ones stay until reboot");
+        return SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: config [keys | sync | compact | clear]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+/*
+ * Host files and exit through semihosting: export and exit
+ */
+
+#define EXPORT_BUFFER_SIZE 4096
+
+// A command's output on its way to a host file, written a buffer at a time
+typedef struct {
+    long handle;
+    size_t used;
+    unsigned long bytes;
+    int failed;
+    char buffer[EXPORT_BUFFER_SIZE];
+} export_t;
+
+// Threads an exported command starts share its buffer (static: locks are
+// registered for 'locks' on first use and must not be freed)
+static spinlock_t export_lock;
+
+static void export_init(void)
+{
+    spin_lock_init(&export_lock, "export");
+}
+
+// Called with export_lock held
+static void export_flush(export_t* e)
+{
+    if (e->used && !e->failed && semihost_write(e->handle, e->buffer, e->used) != 0) {
+        e->failed = 1;
+    }
+    e->bytes += e->used;
+    e->used = 0;
+}
+
+// Output sink while an exported command runs
+static void export_output(void* arg, char c)
+{
+    export_t* e = arg;
+    
+    unsigned long flags = spin_lock_irqsave(&export_lock);
+    e->buffer[e->used++] = c;
+    if (e->used == EXPORT_BUFFER_SIZE) {
+        export_flush(e);
+    }
+    spin_unlock_irqrestore(&export_lock, flags);
+}
+
+int cmd_export(int argc, char* argv[])
+{
+    int append = argc > 1 && strcmp(argv[1], "-a") == 0;
+    int first = append ? 2 : 1;
+    if (argc < first + 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: export [-a] <host file> <command> [args...]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    if (!semihost_present()) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No semihosting (start with ./run.sh -semihosting)");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    
+    shell_command_t* cmd = shell_find_command(argv[first + 1]);
+    if (!cmd) {
+        printf("Unknown command: '%s'\n", argv[first + 1]);
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    if (shell_foreground_only(cmd->name)) {
+        printf("'%s' waits on the console and cannot be exported\n", cmd->name);
+        return SHELL_ERROR_PERMISSION;
+    }
+    
+    size_t pages = (sizeof(export_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    export_t* e = page_alloc(pages);
+    if (!e) {
+        shell_display_error(SHELL_ERROR_MEMORY, "No pages for the export buffer");
+        return SHELL_ERROR_MEMORY;
+    }
+    e->handle = semihost_open(argv[first], append);
+    if (e->handle < 0) {
+        page_free(e, pages);
+        printf("export: cannot open '%s' on the host\n", argv[first]);
+        return SHELL_ERROR_SYSTEM;
+    }
+    e->used = 0;
+    e->bytes = 0;
+    e->failed = 0;
+    
+    // Redirect only this thread (and those it starts); the cancel flag stays
+    void* prev_arg;
+    thread_output_t prev = thread_output_sink(&prev_arg);
+    volatile uint32_t* cancel = thread_cancel_flag();
+    thread_redirect(export_output, e, cancel);
+    int result = cmd->handler(argc - first - 1, argv + first + 1);
+    thread_redirect(prev, prev_arg, cancel);
+    
+    unsigned long flags = spin_lock_irqsave(&export_lock);
+    export_flush(e);
+    spin_unlock_irqrestore(&export_lock, flags);
+    int failed = e->failed || semihost_close(e->handle) != 0;
+    unsigned long bytes = e->bytes;
+    page_free(e, pages);
+    
+    if (failed) {
+        printf("export: writing '%s' on the host failed\n", argv[first]);
+        return SHELL_ERROR_SYSTEM;
+    }
+    printf("export: %lu bytes of '%s' output to %s (status %d)\n", bytes, cmd->name, argv[first], result);
+    return result;
+}
+
+int cmd_exit(int argc, char* argv[])
+{
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: exit [status]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    if (!semihost_present()) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No semihosting (start with ./run.sh -semihosting, or use Ctrl+A, X)");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    int status = argc == 2 ? (int)parse_decimal(argv[1]) : 0;
+    
+    // Dirty cached blocks and unsaved settings would be lost with QEMU
+    bcache_sync();
+    cfgstore_sync();
+    printf("Exiting QEMU with status %d\n", status);
+    semihost_exit(status);
+    
+    shell_display_error(SHELL_ERROR_SYSTEM, "The host did not exit");
+    return SHELL_ERROR_SYSTEM;
+}
+
+/*
+ * Key-value store: kv
+ */
+
+#define KV_SCAN_DEFAULT     20
+#define KV_BENCH_OPS        10000
+#define KV_BENCH_OPS_MAX    1000000
+#define KV_BENCH_VALUE      100
+
+// Report a key-value store error with the closest shell error code
+static int kv_shell_error(int err)
+{
+    shell_error_t code;
+    switch (err) {
+    case KV_ERR_NOT_FOUND:
+        code = SHELL_ERROR_NOT_FOUND;
+        break;
+    case KV_ERR_NOT_READY:
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No filesystem: format a disk image with build/mkfs");
+        return SHELL_ERROR_NOT_FOUND;
+    case KV_ERR_INVALID:
+        code = SHELL_ERROR_RANGE;
+        break;
+    case KV_ERR_NO_MEMORY:
+        code = SHELL_ERROR_MEMORY;
+        break;
+    default:
+        code = SHELL_ERROR_SYSTEM;
+        break;
+    }
+    shell_display_error(code, kv_error(err));
+    return code;
+}
+
+static void kv_print_pair(const char* key, const void* value, size_t len, void* arg)
+{
+    (void)arg;
+    printf("%s = ", key);
+    uart_write(value, len);
+    putchar('\n');
+}
+
+int cmd_kv(int argc, char* argv[])
+{
+    if (!kv_ready()) {
+        return kv_shell_error(KV_ERR_NOT_READY);
+    }
+    if (argc == 1) {
+        kv_print();
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "put") == 0 && argc >= 4) {
+        // The value is the rest of the line, words joined by spaces
+        char value[KV_VALUE_MAX];
+        size_t len = 0;
+        for (int i = 3; i < argc; i++) {
+            size_t n = strlen(argv[i]);
+            if (len + n + (i > 3) > sizeof(value)) {
+                return kv_shell_error(KV_ERR_INVALID);
+            }
+            if (i > 3) value[len++] = ' ';
+            memcpy(value + len, argv[i], n);
+            len += n;
+        }
+        int err = kv_put(argv[2], value, len);
+        return err == KV_OK ? SHELL_SUCCESS : kv_shell_error(err);
+    }
+    if (strcmp(argv[1], "get") == 0 && argc == 3) {
+        char value[KV_VALUE_MAX];
+        int len = kv_get(argv[2], value, sizeof(value));
+        if (len < 0) {
+            return kv_shell_error(len);
+        }
+        uart_write(value, len);
+        putchar('\n');
+        return SHELL_SUCCESS;
+    }
+    if (strcmp(argv[1], "del") == 0 && argc == 3) {
+        int err = kv_delete(argv[2]);
+        return err == KV_OK ? SHELL_SUCCESS : kv_shell_error(err);
+    }
+    if (strcmp(argv[1], "scan") == 0 && argc <= 4) {
+        int limit = argc == 4 ? (int)parse_decimal(argv[3]) : KV_SCAN_DEFAULT;
+        if (limit <= 0) {
+            shell_display_error(SHELL_ERROR_RANGE, "Count must be a positive number");
+            return SHELL_ERROR_RANGE;
+        }
+        int count = kv_scan(argc >= 3 ? argv[2] : NULL, limit, kv_print_pair, NULL);
+        if (count < 0) {
+            return kv_shell_error(count);
+        }
+        printf("(%d keys)\n", count);
+        return cancel_requested() ? SHELL_ERROR_INTERRUPTED : SHELL_SUCCESS;
+    }
+    if (argc == 2 && (strcmp(argv[1], "sync") == 0 || strcmp(argv[1], "compact") == 0)) {
+        uint64_t start = timer_ticks();
+        int err = argv[1][0] == 's' ? kv_sync() : kv_compact();
+        if (err != KV_OK) {
+            return kv_shell_error(err);
+        }
+        printf("Done in %lu ms\n", (unsigned long)(timer_ticks_to_us(timer_ticks() - start) / 1000));
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        kv_reset_stats();
+        puts("Key-value store counters reset");
+        return SHELL_SUCCESS;
+    }
+    if (strcmp(argv[1], "bench") == 0 && argc <= 4) {
+        unsigned long ops = argc >= 3 ? parse_decimal(argv[2]) : KV_BENCH_OPS;
+        unsigned long value_size = argc == 4 ? parse_decimal(argv[3]) : KV_BENCH_VALUE;
+        if (ops == 0 || ops > KV_BENCH_OPS_MAX || value_size > KV_VALUE_MAX ||
+            (argc == 4 && value_size == 0 && strcmp(argv[3], "0") != 0)) {
+            shell_display_error(SHELL_ERROR_RANGE, "Usage: kv bench [1-1000000 ops] [0-1024 value bytes]");
+            return SHELL_ERROR_RANGE;
+        }
+        kv_bench(ops, value_size);
+        return cancel_requested() ? SHELL_ERROR_INTERRUPTED : SHELL_SUCCESS;
+    }
+    
+    shell_display_error(SHELL_ERROR_INVALID_ARGS,
+                        "Usage: kv [put <key> <value...> | get | del <key> | scan [start] [count] | sync | compact | reset | bench]");
+    return SHELL_ERROR_INVALID_ARGS;
+}
+
+/*
+ * Background jobs: jobs, fg and wait
+ */
+
+// "%n" or "n" to a job number; 0 if malformed
+static int parse_job_number(const char* str)
+{
+    if (*str == '%') str++;
+    int valid;
+    unsigned long number = parse_address(str, &valid);
+    if (!valid || number == 0 || number > JOB_MAX) return 0;
+    return (int)number;
+}
+
+int cmd_jobs(int argc, char* argv[])
+{
+    if (argc != 1) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: jobs");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    jobs_print();
+    return SHELL_SUCCESS;
+}
+
+int cmd_fg(int argc, char* argv[])
+{
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: fg [%n]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    int number = argc == 2 ? parse_job_number(argv[1]) : job_latest();
+    int status;
+    if (number == 0 || job_follow(number, 1, &status) < 0) {
+        shell_display_error(SHELL_ERROR_NOT_FOUND, "No such job (see 'jobs')");
+        return SHELL_ERROR_NOT_FOUND;
+    }
+    return status;
+}
+
+int cmd_wait(int argc, char* argv[])
+{
+    if (argc > 2) {
+        shell_display_error(SHELL_ERROR_INVALID_ARGS, "Usage: wait [%n]");
+        return SHELL_ERROR_INVALID_ARGS;
+    }
+    
+    int status = SHELL_SUCCESS;
+    if (argc == 2) {
+        int number = parse_job_number(argv[1]);
+        int followed = number ? job_follow(number, 0, &status) : -1;
+        if (followed < 0) {
+            shell_display_error(SHELL_ERROR_NOT_FOUND, "No such job (see 'jobs')");
+            return SHELL_ERROR_NOT_FOUND;
+        }
+        return followed ? status : SHELL_ERROR_INTERRUPTED;
+    }
+    
+    // Oldest first, until none are left
+    int number;
+    while ((number = job_oldest()) != 0) {
+        if (job_follow(number, 0, &status) == 0) {
+            puts("^C - jobs left running");
+            return SHELL_ERROR_INTERRUPTED;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,183 @@
+/*
+ * SMP Bring-up Implementation
+ * Secondary CPUs sit powered off until PSCI CPU_ON releases them at
+ * secondary_entry (boot/boot.S) with their boot stack in x0
+ */
+
+#include "smp.h"
+#include "atomic.h"
+#include "fdt.h"
+#include "gic.h"
+#include "ipi.h"
+#include "irq.h"
+#include "page.h"
+#include "percpu.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+// PSCI 0.2+ function IDs (SMC64 calling convention)
+#define PSCI_CPU_ON_64      0xC4000003UL
+#define PSCI_SUCCESS        0
+#define PSCI_ALREADY_ON     (-4)
+
+// How long to wait for a secondary to report in
+#define SMP_ONLINE_TIMEOUT_MS 100
+
+extern uint8_t secondary_entry[];
+
+typedef struct {
+    uint64_t mpidr;
+    int present;
+    volatile uint32_t online;
+} smp_cpu_t;
+
+static smp_cpu_t cpus[SMP_MAX_CPUS];
+static int use_smc = 0;
+static uint64_t cpu_on_fn = PSCI_CPU_ON_64;
+
+static int64_t psci_call(uint64_t fn, uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    register uint64_t x0 __asm__("x0") = fn;
+    register uint64_t x1 __asm__("x1") = arg0;
+    register uint64_t x2 __asm__("x2") = arg1;
+    register uint64_t x3 __asm__("x3") = arg2;
+
+    if (use_smc) {
+        __asm__ volatile("smc #0" : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3) :
+                         : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                           "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+    } else {
+        __asm__ volatile("hvc #0" : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3) :
+                         : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                           "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+    }
+    return (int64_t)x0;
+}
+
+// Read the /psci node: conduit and (for PSCI 0.1) the CPU_ON function ID
+static int psci_probe(void)
+{
+    int node = fdt_path_offset("/psci");
+    if (node < 0) return -1;
+
+    const char* method = fdt_getprop(node, "method", NULL);
+    if (!method) return -1;
+    use_smc = (strcmp(method, "smc") == 0);
+
+    int len;
+    const uint32_t* cpu_on = fdt_getprop(node, "cpu_on", &len);
+    if (cpu_on && len == 4 && !fdt_node_is_compatible(node, "arm,psci-0.2")) {
+        cpu_on_fn = fdt32_to_cpu(*cpu_on);
+    }
+    return 0;
+}
+
+// Record every CPU listed under /cpus
+static void smp_discover(void)
+{
+    int cpus_node = fdt_path_offset("/cpus");
+    if (cpus_node < 0) return;
+
+    int len;
+    const uint32_t* prop = fdt_getprop(cpus_node, "#address-cells", &len);
+    int cells = (prop && len == 4) ? (int)fdt32_to_cpu(*prop) : 1;
+
+    int depth = 0;
+    int node = fdt_next_node(cpus_node, &depth);
+    while (node >= 0) {
+        const char* type = fdt_getprop(node, "device_type", NULL);
+        const void* reg = fdt_getprop(node, "reg", &len);
+        if (depth == 1 && type && strcmp(type, "cpu") == 0 && reg && len >= cells * 4) {
+            uint64_t mpidr = fdt_read_cells(reg, cells);
+            int cpu = (int)(mpidr & 0xFF);
+            if ((mpidr & 0xFF00FFFF00UL) == 0 && cpu < SMP_MAX_CPUS) {
+                cpus[cpu].mpidr = mpidr;
+                cpus[cpu].present = 1;
+            }
+        }
+        node = fdt_next_node(node, &depth);
+    }
+}
+
+/*
+ * C entry for secondary CPUs (from secondary_entry, IRQs masked)
+ */
+void smp_secondary_main(void)
+{
+    int cpu = smp_cpu_id();
+
+    percpu_init();
+    irq_init();
+    gic_cpu_init();
+    ipi_cpu_init();
+    thread_init_cpu();
+
+    atomic_store_release(&cpus[cpu].online, 1);
+
+    timer_tick_start();
+    irq_enable();
+    thread_idle();
+}
+
+void smp_init(void)
+{
+    int self = smp_cpu_id();
+    cpus[self].present = 1;
+    cpus[self].online = 1;
+
+    if (!fdt_present() || psci_probe() != 0) {
+        puts("SMP: no PSCI in device tree, running on the boot CPU only");
+        return;
+    }
+    smp_discover();
+
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!cpus[cpu].present || cpu == self) continue;
+
+        void* stack = page_alloc(SMP_BOOT_STACK_PAGES);
+        if (!stack) break;
+        uintptr_t stack_top = (uintptr_t)stack + SMP_BOOT_STACK_PAGES * PAGE_SIZE;
+
+        int64_t ret = psci_call(cpu_on_fn, cpus[cpu].mpidr, (uint64_t)secondary_entry, stack_top);
+        if (ret != PSCI_SUCCESS && ret != PSCI_ALREADY_ON) {
+            printf("SMP: CPU %d failed to start (PSCI error %d)\n", cpu, (int)ret);
+            page_free(stack, SMP_BOOT_STACK_PAGES);
+            continue;
+        }
+
+        uint64_t deadline = timer_ticks() + timer_ms_to_ticks(SMP_ONLINE_TIMEOUT_MS);
+        while (!atomic_load_acquire(&cpus[cpu].online) && timer_ticks() < deadline) {
+        }
+        if (!cpus[cpu].online) {
+            printf("SMP: CPU %d did not come online\n", cpu);
+        }
+    }
+
+    printf("SMP: %d of %d CPUs online (PSCI via %s)\n", smp_cpus_online(),
+           smp_cpus_present(), use_smc ? "smc" : "hvc");
+}
+
+int smp_cpu_online(int cpu)
+{
+    return cpu >= 0 && cpu < SMP_MAX_CPUS && atomic_load_acquire(&cpus[cpu].online);
+}
+
+int smp_cpus_online(void)
+{
+    int count = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (smp_cpu_online(cpu)) count++;
+    }
+    return count;
+}
+
+int smp_cpus_present(void)
+{
+    int count = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpus[cpu].present) count++;
+    }
+    return count;
+}
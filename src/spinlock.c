@@ -0,0 +1,310 @@
+/*
+ * Spinlocks Implementation
+ * MCS queue lock slow paths, the lock statistics registry and the lock
+ * benchmark. The test-and-set and ticket locks are inline in spinlock.h.
+ */
+
+#include "spinlock.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+// Most locks the locks command will sort
+#define LOCK_MAX_LISTED 64
+
+// Registry of every lock acquired at least once (push-only)
+static lock_stats_t* volatile lock_list = NULL;
+
+void lock_stats_register(lock_stats_t* stats)
+{
+    stats->registered = 1;
+
+    lock_stats_t* head;
+    do {
+        head = lock_list;
+        stats->next = head;
+    } while (!atomic_cas64((volatile uint64_t*)&lock_list, (uint64_t)head, (uint64_t)stats));
+}
+
+/*
+ * Name a lock and zero its counters; 'index' >= 0 is appended as
+ * "/index". A lock already in the registry stays there.
+ */
+static void lock_stats_init(lock_stats_t* stats, const char* name, int index, int kind)
+{
+    int len = 0;
+    while (name[len] && len < LOCK_NAME_MAX - 1) {
+        stats->name[len] = name[len];
+        len++;
+    }
+    if (index >= 0 && len < LOCK_NAME_MAX - 1) {
+        char digits[12];
+        int n = 0;
+        do {
+            digits[n++] = '0' + index % 10;
+            index /= 10;
+        } while (index > 0);
+
+        stats->name[len++] = '/';
+        while (n > 0 && len < LOCK_NAME_MAX - 1) {
+            stats->name[len++] = digits[--n];
+        }
+    }
+    stats->name[len] = '\0';
+
+    stats->kind = kind;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->wait_ticks = 0;
+    stats->max_wait_ticks = 0;
+}
+
+void spin_lock_init(spinlock_t* lock, const char* name)
+{
+    lock->locked = 0;
+    lock_stats_init(&lock->stats, name, -1, LOCK_KIND_TAS);
+}
+
+void spin_lock_init_indexed(spinlock_t* lock, const char* prefix, int index)
+{
+    lock->locked = 0;
+    lock_stats_init(&lock->stats, prefix, index, LOCK_KIND_TAS);
+}
+
+void ticket_lock_init(ticket_lock_t* lock, const char* name)
+{
+    lock->next = 0;
+    lock->serving = 0;
+    lock_stats_init(&lock->stats, name, -1, LOCK_KIND_TICKET);
+}
+
+void mcs_lock_init(mcs_lock_t* lock, const char* name)
+{
+    lock->tail = NULL;
+    lock_stats_init(&lock->stats, name, -1, LOCK_KIND_MCS);
+}
+
+void mcs_lock(mcs_lock_t* lock, mcs_node_t* node)
+{
+    node->next = NULL;
+    node->waiting = 1;
+
+    mcs_node_t* prev = (mcs_node_t*)atomic_swap64((volatile uint64_t*)&lock->tail, (uint64_t)node);
+    uint64_t wait_start = 0;
+
+    if (prev) {
+        // Queue behind the previous holder and spin on our own node
+        wait_start = lock_clock();
+        atomic_store_release(&prev->next, node);
+        while (atomic_load_acquire(&node->waiting)) {
+            atomic_wait32(&node->waiting, 1);
+        }
+    }
+    lock_account(&lock->stats, wait_start);
+}
+
+void mcs_unlock(mcs_lock_t* lock, mcs_node_t* node)
+{
+    mcs_node_t* next = atomic_load_acquire(&node->next);
+
+    if (!next) {
+        // No known successor - try to swing the tail back to empty
+        if (atomic_cas64((volatile uint64_t*)&lock->tail, (uint64_t)node, 0)) return;
+
+        // A successor is between its swap and linking itself in
+        while ((next = atomic_load_acquire(&node->next)) == NULL) {
+        }
+    }
+    atomic_store_release(&next->waiting, 0);
+}
+
+static void print_str_padded(const char* s, int width)
+{
+    int len = 0;
+    while (s[len]) len++;
+
+    printf("%s", s);
+    for (int i = len; i < width; i++) {
+        putchar(' ');
+    }
+}
+
+static const char* lock_kind_name(int kind)
+{
+    switch (kind) {
+    case LOCK_KIND_TAS:     return "tas";
+    case LOCK_KIND_TICKET:  return "ticket";
+    case LOCK_KIND_MCS:     return "mcs";
+    default:                return "?";
+    }
+}
+
+// Most contended first; ties broken by acquisitions
+static int lock_ranks_before(const lock_stats_t* a, const lock_stats_t* b)
+{
+    if (a->contended != b->contended) return a->contended > b->contended;
+    return a->acquisitions > b->acquisitions;
+}
+
+/*
+ * Show the 'max' most contended locks - used by the locks command
+ */
+void lock_print(int max)
+{
+    lock_stats_t* sorted[LOCK_MAX_LISTED];
+    int count = 0;
+    int total = 0;
+
+    for (lock_stats_t* s = lock_list; s; s = s->next) {
+        total++;
+        if (count == LOCK_MAX_LISTED) continue;
+
+        // Insertion sort - the registry is small
+        int i = count++;
+        while (i > 0 && lock_ranks_before(s, sorted[i - 1])) {
+            sorted[i] = sorted[i - 1];
+            i--;
+        }
+        sorted[i] = s;
+    }
+
+    printf("Atomics: %s\n\n", atomic_lse ? "ARMv8.1 LSE (CAS/LDADD/SWP)" : "LDAXR/STLXR (no LSE)");
+    puts("NAME            KIND    ACQUIRED    CONTENDED   CONT%   WAIT(us)    MAX(us)");
+
+    if (max > count) max = count;
+    for (int i = 0; i < max; i++) {
+        lock_stats_t* s = sorted[i];
+        unsigned long pct_x10 = s->acquisitions ? (s->contended * 1000) / s->acquisitions : 0;
+
+        print_str_padded(s->name[0] ? s->name : "?", 16);
+        print_str_padded(lock_kind_name(s->kind), 8);
+        print_uint_padded(s->acquisitions, 12);
+        print_uint_padded(s->contended, 12);
+        printf("%lu.%lu", pct_x10 / 10, pct_x10 % 10);
+        int digits = 3;
+        for (unsigned long v = pct_x10 / 100; v; v /= 10) digits++;
+        for (int pad = digits; pad < 8; pad++) putchar(' ');
+        print_uint_padded((unsigned long)timer_ticks_to_us(s->wait_ticks), 12);
+        printf("%lu\n", (unsigned long)timer_ticks_to_us(s->max_wait_ticks));
+    }
+
+    puts("");
+    printf("Locks registered: %d (showing %d)\n", total, max);
+}
+
+void lock_reset_stats(void)
+{
+    for (lock_stats_t* s = lock_list; s; s = s->next) {
+        s->acquisitions = 0;
+        s->contended = 0;
+        s->wait_ticks = 0;
+        s->max_wait_ticks = 0;
+    }
+}
+
+// --- Benchmark: N threads hammering one lock of each kind ---
+
+enum { BENCH_TAS, BENCH_TICKET, BENCH_MCS, BENCH_KINDS };
+
+static volatile uint32_t bench_busy;    // A run is in progress
+static spinlock_t bench_tas;
+static ticket_lock_t bench_ticket;
+static mcs_lock_t bench_mcs;
+
+static int bench_kind;
+static unsigned long bench_iterations;
+static volatile unsigned long bench_counter;
+
+static void bench_lock_loop(void* arg)
+{
+    (void)arg;
+
+    for (unsigned long i = 0; i < bench_iterations; i++) {
+        unsigned long flags;
+        mcs_node_t node;
+
+        switch (bench_kind) {
+        case BENCH_TAS:
+            flags = spin_lock_irqsave(&bench_tas);
+            bench_counter++;
+            spin_unlock_irqrestore(&bench_tas, flags);
+            break;
+        case BENCH_TICKET:
+            flags = ticket_lock_irqsave(&bench_ticket);
+            bench_counter++;
+            ticket_unlock_irqrestore(&bench_ticket, flags);
+            break;
+        default:
+            flags = mcs_lock_irqsave(&bench_mcs, &node);
+            bench_counter++;
+            mcs_unlock_irqrestore(&bench_mcs, &node, flags);
+            break;
+        }
+    }
+}
+
+/*
+ * Lock throughput under contention: 'threads' threads each take and
+ * release the same lock 'iterations' times, once per lock kind
+ */
+static void lock_bench_run(int threads, unsigned long iterations)
+{
+    int ids[THREAD_MAX];
+
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    puts("=== Lock Benchmark ===");
+    printf("Threads: %d, acquisitions per thread: %lu, atomics: %s\n\n", threads, iterations,
+           atomic_lse ? "LSE" : "LL/SC");
+    puts("KIND     TIME(us)    NS/ACQUIRE  CONTENDED%  RESULT");
+
+    spin_lock_init(&bench_tas, "bench-tas");
+    ticket_lock_init(&bench_ticket, "bench-ticket");
+    mcs_lock_init(&bench_mcs, "bench-mcs");
+
+    for (int kind = 0; kind < BENCH_KINDS; kind++) {
+        lock_stats_t* stats = kind == BENCH_TAS ? &bench_tas.stats :
+                              kind == BENCH_TICKET ? &bench_ticket.stats : &bench_mcs.stats;
+        unsigned long acquisitions_before = stats->acquisitions;
+        unsigned long contended_before = stats->contended;
+
+        bench_kind = kind;
+        bench_iterations = iterations;
+        bench_counter = 0;
+
+        uint64_t start = timer_ticks();
+        int created = 0;
+        for (int i = 0; i < threads; i++) {
+            ids[i] = thread_create("lockbench", bench_lock_loop, NULL, 1);
+            if (ids[i] >= 0) created++;
+        }
+        for (int i = 0; i < threads; i++) {
+            if (ids[i] >= 0) thread_join(ids[i]);
+        }
+        uint64_t ns = timer_ticks_to_ns(timer_ticks() - start);
+
+        unsigned long acquisitions = stats->acquisitions - acquisitions_before;
+        unsigned long contended = stats->contended - contended_before;
+        unsigned long expected = (unsigned long)created * iterations;
+
+        print_str_padded(lock_kind_name(stats->kind), 9);
+        print_uint_padded((unsigned long)(ns / 1000), 12);
+        print_uint_padded(acquisitions ? (unsigned long)(ns / acquisitions) : 0, 12);
+        print_uint_padded(acquisitions ? contended * 100 / acquisitions : 0, 12);
+        printf("%s\n", bench_counter == expected ? "ok" : "COUNT MISMATCH");
+    }
+}
+
+void lock_bench(int threads, unsigned long iterations)
+{
+    // It re-initializes the shared bench locks: one run at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("Lock benchmark already running");
+        return;
+    }
+    lock_bench_run(threads, iterations);
+    atomic_store_release(&bench_busy, 0);
+}
@@ -0,0 +1,1009 @@
+/*
+ * Kernel Threads Implementation
+ * Each CPU owns a Chase-Lev deque of READY threads. The owner pushes at
+ * the bottom and takes from the top (FIFO, so yields round-robin);
+ * other CPUs that run dry steal from the same top. Threads woken or
+ * created for a CPU other than the caller's go through that CPU's
+ * locked inbox, which the owner drains into its deque, so the deque
+ * keeps a single producer.
+ *
+ * The virtual timer tick (TIMER_TICK_HZ) marks the running thread for
+ * preemption; the switch happens on the way out of irq_handle(). A
+ * thread stays 'on_cpu' until the CPU that switched it out has saved
+ * its registers, and nobody else switches into it before then.
+ */
+
+#include "thread.h"
+#include "atomic.h"
+#include "ipi.h"
+#include "irq.h"
+#include "percpu.h"
+#include "page.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+#include "timer.h"
+#include "uart.h"
+#include "wsdeque.h"
+
+// Assembly helpers in boot/switch.S
+extern void context_switch(thread_context_t* from, thread_context_t* to);
+extern void thread_trampoline(void);
+
+// Per-CPU scheduler state (cache line aligned - each CPU writes its own)
+typedef struct {
+    wsdeque_t runq;                 // READY threads for this CPU
+    spinlock_t inbox_lock;          // Threads handed over by other CPUs
+    thread_t* inbox_head;
+    thread_t* inbox_tail;
+    volatile uint32_t inbox_count;
+    thread_t* current;
+    thread_t* idle;
+    thread_t* switch_prev;          // Outgoing thread of the switch in progress
+    thread_t* reap_pending;         // Exited thread whose stack to free
+    volatile uint32_t need_resched; // Set by the tick, acted on at IRQ exit
+    int started;
+
+    // Statistics since the last reset
+    uint64_t stats_start;
+    uint64_t idle_ticks;
+    unsigned long switches;
+    unsigned long preemptions;
+    unsigned long ticks;
+    unsigned long steal_attempts;
+    unsigned long steals;
+    unsigned long handoffs;         // Threads passed to another CPU's inbox
+} __attribute__((aligned(64))) cpu_sched_t;
+
+static cpu_sched_t sched[SMP_MAX_CPUS];
+static thread_t threads[THREAD_MAX];
+
+// Thread table and join/exit handshake
+static spinlock_t thread_lock;
+
+// SLEEPING threads sorted by wake_tick
+static spinlock_t sleep_lock;
+static thread_t* sleep_head = NULL;
+
+static int next_id = 0;
+static volatile uint64_t total_switches = 0;
+
+static inline cpu_sched_t* this_cpu(void)
+{
+    return &sched[smp_cpu_id()];
+}
+
+static int cpu_allowed(const thread_t* t, int cpu)
+{
+    return (t->affinity >> cpu) & 1;
+}
+
+// Queue length used for placement decisions (racy but only a hint)
+static int cpu_load(int cpu)
+{
+    cpu_sched_t* c = &sched[cpu];
+    return wsdeque_size(&c->runq) + (int)c->inbox_count +
+           (c->current && c->current != c->idle ? 1 : 0);
+}
+
+static void inbox_push(int cpu, thread_t* t)
+{
+    cpu_sched_t* c = &sched[cpu];
+
+    spin_lock(&c->inbox_lock);
+    t->next = NULL;
+    if (c->inbox_tail) {
+        c->inbox_tail->next = t;
+    } else {
+        c->inbox_head = t;
+    }
+    c->inbox_tail = t;
+    c->inbox_count++;
+    spin_unlock(&c->inbox_lock);
+}
+
+// Move handed-over threads onto our own deque
+static void inbox_drain(cpu_sched_t* c)
+{
+    if (atomic_load_relaxed(&c->inbox_count) == 0) return;
+
+    spin_lock(&c->inbox_lock);
+    thread_t* t = c->inbox_head;
+    c->inbox_head = NULL;
+    c->inbox_tail = NULL;
+    c->inbox_count = 0;
+    spin_unlock(&c->inbox_lock);
+
+    while (t) {
+        thread_t* next = t->next;
+        wsdeque_push(&c->runq, t);
+        t = next;
+    }
+}
+
+/*
+ * Make a thread READY (IRQs must be masked)
+ * 'balance' places it on the least loaded allowed CPU; otherwise it stays
+ * on the calling CPU whenever its affinity allows
+ */
+static void enqueue(thread_t* t, int balance)
+{
+    int self = smp_cpu_id();
+    int target = -1;
+
+    t->state = THREAD_READY;
+
+    if (!balance && cpu_allowed(t, self)) {
+        target = self;
+    } else {
+        int best_load = 0;
+        for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if (!sched[cpu].started || !cpu_allowed(t, cpu)) continue;
+            int load = cpu_load(cpu);
+            if (target < 0 || load < best_load || (load == best_load && cpu == self)) {
+                target = cpu;
+                best_load = load;
+            }
+        }
+        if (target < 0) {
+            // No allowed CPU is online - drop the restriction rather than strand it
+            t->affinity = THREAD_AFFINITY_ALL;
+            target = self;
+        }
+    }
+
+    if (target == self) {
+        wsdeque_push(&sched[self].runq, t);
+    } else {
+        inbox_push(target, t);
+        sched[self].handoffs++;
+
+        // Wake it from WFI now rather than at its next tick
+        ipi_send(target, IPI_RESCHEDULE);
+    }
+}
+
+// Take a thread from a deque, retrying lost races
+static thread_t* take(wsdeque_t* q)
+{
+    void* item;
+    int result;
+
+    while ((result = wsdeque_steal(q, &item)) == WSDEQUE_ABORT) {
+    }
+    return result == WSDEQUE_OK ? (thread_t*)item : NULL;
+}
+
+/*
+ * Choose what the calling CPU runs next: its own queue first, then a
+ * steal from the other CPUs in round-robin order, then its idle thread
+ */
+static thread_t* pick_next(cpu_sched_t* c, int self)
+{
+    inbox_drain(c);
+
+    thread_t* t;
+    while ((t = take(&c->runq)) != NULL) {
+        if (cpu_allowed(t, self)) return t;
+        enqueue(t, 1);      // Affinity changed while queued
+    }
+
+    for (int i = 1; i < SMP_MAX_CPUS; i++) {
+        int victim = (self + i) % SMP_MAX_CPUS;
+        if (!sched[victim].started || wsdeque_size(&sched[victim].runq) == 0) continue;
+
+        c->steal_attempts++;
+        t = take(&sched[victim].runq);
+        if (!t) continue;
+
+        if (cpu_allowed(t, self)) {
+            c->steals++;
+            t->migrations++;
+            return t;
+        }
+        enqueue(t, 1);      // Pinned elsewhere - pass it on
+    }
+
+    return c->idle;
+}
+
+// Second half of a switch, run by whichever thread was switched in
+static void finish_switch(void)
+{
+    cpu_sched_t* c = this_cpu();
+    thread_t* prev = c->switch_prev;
+
+    if (c->reap_pending) {
+        page_free(c->reap_pending->stack, c->reap_pending->stack_pages);
+        c->reap_pending->stack = NULL;
+        c->reap_pending = NULL;
+    }
+    if (prev) {
+        c->switch_prev = NULL;
+        atomic_store_release(&prev->on_cpu, 0);
+    }
+}
+
+/*
+ * Switch to the next thread (IRQs must be masked)
+ * The caller has already queued, parked or retired the current thread.
+ * Returns 1 if another thread ran before this one resumed.
+ */
+static int schedule(void)
+{
+    int self = smp_cpu_id();
+    cpu_sched_t* c = &sched[self];
+    thread_t* prev = c->current;
+    thread_t* next = pick_next(c, self);
+
+    if (next == prev) {
+        prev->state = THREAD_RUNNING;
+        return 0;
+    }
+
+    // It may still be saving its registers on the CPU that last ran it
+    while (atomic_load_acquire(&next->on_cpu)) {
+    }
+
+    uint64_t now = timer_ticks();
+    prev->run_ticks += now - prev->last_start;
+    if (prev == c->idle) {
+        c->idle_ticks += now - prev->last_start;
+        prev->state = THREAD_READY;
+    }
+
+    next->on_cpu = 1;
+    next->cpu = self;
+    next->state = THREAD_RUNNING;
+    next->last_start = now;
+    next->switches++;
+    c->switches++;
+    atomic_fetch_add64(&total_switches, 1);
+
+    c->current = next;
+    c->switch_prev = prev;
+    context_switch(&prev->context, &next->context);
+
+    // Back on prev's stack, possibly on another CPU
+    finish_switch();
+    return 1;
+}
+
+// Set up a slot as the idle thread running on the calling boot stack
+static void thread_adopt_idle(int cpu, const char* name)
+{
+    spin_lock_init_indexed(&sched[cpu].inbox_lock, "inbox", cpu);
+
+    unsigned long flags = spin_lock_irqsave(&thread_lock);
+    thread_t* t = NULL;
+    for (int i = 0; i < THREAD_MAX; i++) {
+        if (threads[i].state == THREAD_UNUSED) {
+            t = &threads[i];
+            break;
+        }
+    }
+    if (t) {
+        t->id = next_id++;
+        t->state = THREAD_RUNNING;
+    }
+    spin_unlock_irqrestore(&thread_lock, flags);
+    if (!t) return;
+
+    strcpy(t->name, name);
+    t->stack = NULL;
+    t->stack_pages = 0;
+    t->affinity = 1U << cpu;
+    t->cpu = cpu;
+    t->on_cpu = 1;
+    t->is_idle = 1;
+    t->parked = 0;
+    t->joiner = NULL;
+    t->switches = 1;
+    t->migrations = 0;
+    t->run_ticks = 0;
+    t->last_start = timer_ticks();
+
+    cpu_sched_t* c = &sched[cpu];
+    wsdeque_init(&c->runq);
+    c->current = t;
+    c->idle = t;
+    c->stats_start = t->last_start;
+    atomic_store_release(&c->started, 1);
+}
+
+void thread_init(void)
+{
+    spin_lock_init(&thread_lock, "thread");
+    spin_lock_init(&sleep_lock, "sleep");
+
+    for (int i = 0; i < THREAD_MAX; i++) {
+        threads[i].state = THREAD_UNUSED;
+    }
+
+    // The boot stack becomes thread 0
+    thread_adopt_idle(smp_cpu_id(), "idle");
+}
+
+void thread_init_cpu(void)
+{
+    static const char* idle_names[SMP_MAX_CPUS] = {
+        "idle", "idle/1", "idle/2", "idle/3", "idle/4", "idle/5", "idle/6", "idle/7"
+    };
+    int cpu = smp_cpu_id();
+    thread_adopt_idle(cpu, idle_names[cpu]);
+}
+
+/*
+ * C entry for new threads (called from thread_trampoline, IRQs masked)
+ */
+void thread_start(thread_entry_t entry, void* arg)
+{
+    finish_switch();
+    irq_enable();
+    entry(arg);
+    thread_exit();
+}
+
+int thread_create(const char* name, thread_entry_t entry, void* arg, size_t stack_pages)
+{
+    if (!thread_scheduler_running() || !entry) return -1;
+    if (stack_pages == 0) stack_pages = THREAD_STACK_PAGES;
+
+    void* stack = page_alloc(stack_pages);
+    if (!stack) return -1;
+
+    // Claim a slot
+    unsigned long flags = spin_lock_irqsave(&thread_lock);
+    thread_t* t = NULL;
+    for (int i = 0; i < THREAD_MAX; i++) {
+        if (threads[i].state == THREAD_UNUSED) {
+            t = &threads[i];
+            break;
+        }
+    }
+    if (t) {
+        t->id = next_id++;
+        t->state = THREAD_READY;
+    }
+    spin_unlock_irqrestore(&thread_lock, flags);
+
+    if (!t) {
+        page_free(stack, stack_pages);
+        return -1;
+    }
+
+    memset(&t->context, 0, sizeof(t->context));
+    t->context.x19 = (uint64_t)entry;
+    t->context.x20 = (uint64_t)arg;
+    t->context.lr = (uint64_t)thread_trampoline;
+    t->context.sp = (uint64_t)stack + stack_pages * PAGE_SIZE;
+
+    strncpy(t->name, name ? name : "thread", THREAD_NAME_MAX - 1);
+    t->name[THREAD_NAME_MAX - 1] = '\0';
+    t->stack = stack;
+    t->stack_pages = stack_pages;
+    t->affinity = THREAD_AFFINITY_ALL;
+    t->cpu = -1;
+    t->on_cpu = 0;
+    t->is_idle = 0;
+    t->parked = 0;
+    t->joiner = NULL;
+    t->switches = 0;
+    t->migrations = 0;
+    t->run_ticks = 0;
+    t->last_start = 0;
+
+    // Output and cancellation follow the creator (a job's helper threads)
+    flags = irq_save();
+    thread_t* self = this_cpu()->current;
+    t->output = self->output;
+    t->output_arg = self->output_arg;
+    t->cancel = self->cancel;
+    irq_restore(flags);
+
+    int id = t->id;
+    flags = irq_save();
+    enqueue(t, 1);
+    irq_restore(flags);
+    return id;
+}
+
+void thread_yield(void)
+{
+    if (!thread_scheduler_running()) return;   // Scheduler not started yet
+
+    unsigned long flags = irq_save();
+    cpu_sched_t* c = this_cpu();
+    if (c->current != c->idle) {
+        enqueue(c->current, 0);
+    }
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_sleep(unsigned int ms)
+{
+    if (!thread_scheduler_running()) return;
+    if (ms == 0) {
+        thread_yield();
+        return;
+    }
+
+    unsigned long flags = irq_save();
+    thread_t* self = this_cpu()->current;
+    if (self->is_idle) {
+        irq_restore(flags);
+        return;     // Idle threads must stay runnable
+    }
+
+    self->wake_tick = timer_ticks() + timer_ms_to_ticks(ms);
+
+    spin_lock(&sleep_lock);
+    self->state = THREAD_SLEEPING;
+    thread_t** link = &sleep_head;
+    while (*link && (*link)->wake_tick <= self->wake_tick) {
+        link = &(*link)->next;
+    }
+    self->next = *link;
+    *link = self;
+    spin_unlock(&sleep_lock);
+
+    schedule();
+    irq_restore(flags);
+}
+
+// Move sleepers whose deadline has passed onto run queues
+static void wake_sleepers(void)
+{
+    if (!atomic_load_relaxed(&sleep_head)) return;
+
+    // One CPU at a time is enough - skip if another CPU is already at it
+    if (!spin_trylock(&sleep_lock)) return;
+
+    uint64_t now = timer_ticks();
+    thread_t* woken = NULL;
+    while (sleep_head && sleep_head->wake_tick <= now) {
+        thread_t* t = sleep_head;
+        sleep_head = t->next;
+        t->next = woken;
+        woken = t;
+    }
+    spin_unlock(&sleep_lock);
+
+    while (woken) {
+        thread_t* t = woken;
+        woken = t->next;
+        enqueue(t, 0);
+    }
+}
+
+static thread_t* thread_find(int id)
+{
+    for (int i = 0; i < THREAD_MAX; i++) {
+        if (threads[i].state != THREAD_UNUSED && threads[i].id == id) {
+            return &threads[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Wait for a thread to exit and release its slot
+ * Returns 0 on success, -1 if the id is unknown, is the caller, is an
+ * idle thread, or already has a joiner
+ */
+int thread_join(int id)
+{
+    if (!thread_scheduler_running()) return -1;
+
+    unsigned long flags = irq_save();
+    thread_t* self = this_cpu()->current;
+
+    spin_lock(&thread_lock);
+    thread_t* t = thread_find(id);
+    if (!t || t == self || t->is_idle || t->joiner) {
+        spin_unlock(&thread_lock);
+        irq_restore(flags);
+        return -1;
+    }
+
+    if (t->state != THREAD_EXITED) {
+        t->joiner = self;
+        self->state = THREAD_BLOCKED;
+        spin_unlock(&thread_lock);
+        schedule();
+    } else {
+        spin_unlock(&thread_lock);
+    }
+
+    // Its last switch out (and stack release) must be complete
+    while (atomic_load_acquire(&t->on_cpu)) {
+    }
+
+    spin_lock(&thread_lock);
+    t->state = THREAD_UNUSED;
+    spin_unlock(&thread_lock);
+    irq_restore(flags);
+    return 0;
+}
+
+/*
+ * Park the calling thread until thread_wake() (IRQs masked, 'lock' held)
+ * The lock is dropped only once the thread is marked blocked, so a waker
+ * that checks its condition under the same lock cannot miss it. Returns
+ * with IRQs still masked and the lock released.
+ */
+void thread_block(spinlock_t* lock)
+{
+    thread_t* self = this_cpu()->current;
+    if (self->is_idle) {
+        spin_unlock(lock);
+        return;     // Idle threads must stay runnable
+    }
+
+    self->parked = 1;
+    self->state = THREAD_BLOCKED;
+    spin_unlock(lock);
+    schedule();
+}
+
+// Make a thread parked in thread_block() runnable (any context)
+void thread_wake(int id)
+{
+    unsigned long flags = spin_lock_irqsave(&thread_lock);
+    thread_t* t = thread_find(id);
+    int wake = t && t->state == THREAD_BLOCKED && t->parked;
+    if (wake) {
+        t->parked = 0;
+        t->state = THREAD_READY;
+    }
+    spin_unlock(&thread_lock);
+
+    if (wake) enqueue(t, 0);
+    irq_restore(flags);
+}
+
+void thread_exit(void)
+{
+    if (!thread_scheduler_running()) return;
+
+    irq_disable();
+    cpu_sched_t* c = this_cpu();
+    thread_t* self = c->current;
+    if (self->is_idle) {
+        irq_enable();
+        return;     // Idle threads never exit
+    }
+
+    spin_lock(&thread_lock);
+    self->state = THREAD_EXITED;
+    thread_t* joiner = self->joiner;
+    spin_unlock(&thread_lock);
+
+    if (joiner) {
+        enqueue(joiner, 0);
+    }
+
+    // The stack is still in use until the switch completes
+    c->reap_pending = self;
+    schedule();
+
+    // Not reached - nothing switches back to an exited thread
+    while (1) {
+    }
+}
+
+int thread_set_affinity(int id, uint32_t mask)
+{
+    uint32_t online = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (sched[cpu].started) online |= 1U << cpu;
+    }
+    if ((mask & online) == 0) return -1;
+
+    unsigned long flags = spin_lock_irqsave(&thread_lock);
+    thread_t* t = thread_find(id);
+    int result = -1;
+    if (t && !t->is_idle && t->state != THREAD_EXITED) {
+        // Takes effect at its next switch: a queued thread is moved by
+        // whichever CPU takes it, a running one at its next preemption
+        t->affinity = mask;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&thread_lock, flags);
+    return result;
+}
+
+/*
+ * Timer tick (IRQ context): wake sleepers and ask for a reschedule when
+ * there is other work this CPU could run
+ */
+void thread_tick(void)
+{
+    if (!thread_scheduler_running()) return;
+
+    cpu_sched_t* c = this_cpu();
+    c->ticks++;
+    wake_sleepers();
+
+    if (c->current == c->idle || wsdeque_size(&c->runq) > 0 ||
+        atomic_load_relaxed(&c->inbox_count) > 0) {
+        c->need_resched = 1;
+    }
+}
+
+// Reschedule IPI: another CPU queued work here
+void thread_need_resched(void)
+{
+    if (!thread_scheduler_running()) return;
+    this_cpu()->need_resched = 1;
+}
+
+/*
+ * Last step of irq_handle(): preempt the interrupted thread if asked
+ */
+void thread_irq_exit(void)
+{
+    if (!thread_scheduler_running()) return;
+
+    cpu_sched_t* c = this_cpu();
+    if (!c->need_resched) return;
+    c->need_resched = 0;
+
+    thread_t* prev = c->current;
+    if (prev != c->idle) {
+        enqueue(prev, 0);
+    }
+    if (schedule() && prev != c->idle) {
+        this_cpu()->preemptions++;
+    }
+}
+
+void thread_redirect(thread_output_t fn, void* arg, volatile uint32_t* cancel)
+{
+    if (!thread_scheduler_running()) return;
+
+    unsigned long flags = irq_save();
+    thread_t* self = this_cpu()->current;
+    self->output = fn;
+    self->output_arg = arg;
+    self->cancel = cancel;
+    irq_restore(flags);
+}
+
+thread_output_t thread_output_sink(void** arg)
+{
+    *arg = NULL;
+    if (!thread_scheduler_running()) return NULL;
+
+    unsigned long flags = irq_save();
+    thread_t* self = this_cpu()->current;
+    thread_output_t fn = self->output;
+    *arg = self->output_arg;
+    irq_restore(flags);
+    return fn;
+}
+
+int thread_output(char c)
+{
+    if (!thread_scheduler_running()) return 0;
+
+    unsigned long flags = irq_save();
+    thread_t* self = this_cpu()->current;
+    thread_output_t fn = self->output;
+    void* arg = self->output_arg;
+    irq_restore(flags);
+
+    if (!fn) return 0;
+    fn(arg, c);
+    return 1;
+}
+
+volatile uint32_t* thread_cancel_flag(void)
+{
+    if (!thread_scheduler_running()) return NULL;
+
+    unsigned long flags = irq_save();
+    volatile uint32_t* cancel = this_cpu()->current->cancel;
+    irq_restore(flags);
+    return cancel;
+}
+
+int thread_self(void)
+{
+    if (!thread_scheduler_running()) return -1;
+
+    unsigned long flags = irq_save();
+    int id = this_cpu()->current->id;
+    irq_restore(flags);
+    return id;
+}
+
+int thread_scheduler_running(void)
+{
+    return sched[smp_cpu_id()].started;
+}
+
+unsigned long thread_switch_count(void)
+{
+    return total_switches;
+}
+
+/*
+ * Idle loop: run or steal whatever is ready, otherwise wait for the next
+ * interrupt (only when the tick is running to end the wait)
+ */
+void thread_idle(void)
+{
+    while (1) {
+        irq_disable();
+        int ran = schedule();
+        irq_enable();
+
+        if (!ran && timer_tick_running()) {
+            __asm__ volatile("wfi");
+        }
+    }
+}
+
+static const char* state_names[] = {
+    "unused  ", "ready   ", "running ", "sleeping", "blocked ", "exited  "
+};
+
+/*
+ * Thread table - used by the ps command
+ */
+void thread_print(void)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    // Charge the calling thread up to now
+    unsigned long flags = irq_save();
+    thread_t* self = this_cpu()->current;
+    uint64_t now = timer_ticks();
+    self->run_ticks += now - self->last_start;
+    self->last_start = now;
+    irq_restore(flags);
+
+    puts("ID   STATE     CPU  AFFINITY    SWITCHES    MIGRATED  CPU(ms)   STACK(KB)  NAME");
+    int count = 0;
+    for (int i = 0; i < THREAD_MAX; i++) {
+        thread_t* t = &threads[i];
+        if (t->state == THREAD_UNUSED) continue;
+
+        print_uint_padded(t->id, 5);
+        printf("%s  ", state_names[t->state]);
+        if (t->cpu >= 0) {
+            print_uint_padded(t->cpu, 5);
+        } else {
+            printf("-    ");
+        }
+        if (t->affinity == THREAD_AFFINITY_ALL) {
+            printf("all         ");
+        } else {
+            printf("%x", (unsigned long)t->affinity);
+            int digits = 1;
+            for (uint32_t v = t->affinity >> 4; v; v >>= 4) digits++;
+            for (int pad = 2 + digits; pad < 12; pad++) putchar(' ');
+        }
+        print_uint_padded(t->switches, 12);
+        print_uint_padded(t->migrations, 10);
+        print_uint_padded(timer_ticks_to_us(t->run_ticks) / 1000, 10);
+        if (t->stack) {
+            print_uint_padded(t->stack_pages * PAGE_SIZE / 1024, 11);
+        } else {
+            printf("boot       ");
+        }
+        printf("%s\n", t->name);
+        count++;
+    }
+
+    puts("");
+    printf("Threads: %d/%d, context switches: %lu\n", count, THREAD_MAX,
+           (unsigned long)total_switches);
+}
+
+/*
+ * Per-CPU utilization and scheduler counters - used by the cpus command
+ */
+void thread_print_cpus(void)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    uint64_t now = timer_ticks();
+
+    puts("CPU  UTIL%   SWITCHES    PREEMPT     STEALS      ATTEMPTS    HANDOFFS    IPIS        RUNQ  CURRENT");
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpu_sched_t* c = &sched[cpu];
+        if (!c->started) continue;
+
+        // Idle time so far, including an idle period still in progress
+        uint64_t idle = c->idle_ticks;
+        thread_t* cur = c->current;
+        if (cur == c->idle && now > cur->last_start) {
+            idle += now - cur->last_start;
+        }
+        uint64_t window = now - c->stats_start;
+        unsigned long util_x10 = 0;
+        if (window > 0 && idle < window) {
+            util_x10 = (unsigned long)(((window - idle) * 1000) / window);
+        }
+
+        print_uint_padded(cpu, 5);
+        printf("%lu.%lu", util_x10 / 10, util_x10 % 10);
+        int digits = 3;
+        for (unsigned long v = util_x10 / 100; v; v /= 10) digits++;
+        for (int pad = digits; pad < 8; pad++) putchar(' ');
+        print_uint_padded(c->switches, 12);
+        print_uint_padded(c->preemptions, 12);
+        print_uint_padded(c->steals, 12);
+        print_uint_padded(c->steal_attempts, 12);
+        print_uint_padded(c->handoffs, 12);
+
+        percpu_t* area = percpu_of(cpu);
+        unsigned long ipis = 0;
+        for (int ipi = 0; ipi < IPI_COUNT; ipi++) ipis += area->ipi_received[ipi];
+        print_uint_padded(ipis, 12);
+        print_uint_padded(wsdeque_size(&c->runq) + c->inbox_count, 6);
+        printf("%s\n", cur ? cur->name : "-");
+    }
+
+    puts("");
+    printf("CPUs online: %d, tick: %s\n", smp_cpus_online(),
+           timer_tick_running() ? "100 Hz (preemptive)" : "off (cooperative only)");
+}
+
+void thread_reset_cpu_stats(void)
+{
+    uint64_t now = timer_ticks();
+
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpu_sched_t* c = &sched[cpu];
+        if (!c->started) continue;
+
+        c->stats_start = now;
+        c->idle_ticks = 0;
+        if (c->current == c->idle) {
+            c->idle->last_start = now;
+        }
+        c->switches = 0;
+        c->preemptions = 0;
+        c->ticks = 0;
+        c->steal_attempts = 0;
+        c->steals = 0;
+        c->handoffs = 0;
+    }
+}
+
+// Benchmark body: yield back and forth a fixed number of times
+static void bench_yield_loop(void* arg)
+{
+    unsigned long iterations = (unsigned long)arg;
+    for (unsigned long i = 0; i < iterations; i++) {
+        thread_yield();
+    }
+}
+
+/*
+ * Context switch latency: two threads pinned to the calling CPU yield to
+ * each other 'iterations' times each; the time per switch includes the
+ * scheduler and the register save/restore
+ */
+void thread_bench_switch(unsigned long iterations)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    unsigned long flags = irq_save();
+    int cpu = smp_cpu_id();
+    unsigned long start_switches = sched[cpu].switches;
+    irq_restore(flags);
+
+    uint64_t start = timer_ticks();
+
+    int a = thread_create("bench-a", bench_yield_loop, (void*)iterations, 1);
+    int b = thread_create("bench-b", bench_yield_loop, (void*)iterations, 1);
+    if (a < 0 || b < 0) {
+        puts("Error: could not create benchmark threads");
+        if (a >= 0) thread_join(a);
+        if (b >= 0) thread_join(b);
+        return;
+    }
+    thread_set_affinity(a, 1U << cpu);
+    thread_set_affinity(b, 1U << cpu);
+    thread_join(a);
+    thread_join(b);
+
+    uint64_t elapsed = timer_ticks() - start;
+    unsigned long switches = sched[cpu].switches - start_switches;
+    uint64_t ns = timer_ticks_to_ns(elapsed);
+
+    puts("=== Context Switch Benchmark ===");
+    printf("CPU:                   %d\n", cpu);
+    printf("Iterations per thread: %lu\n", iterations);
+    printf("Context switches:      %lu\n", switches);
+    printf("Elapsed:               %lu us\n", (unsigned long)(ns / 1000));
+    if (switches > 0) {
+        printf("Latency:               %lu ns per switch\n", (unsigned long)(ns / switches));
+        printf("Rate:                  %lu switches/s\n",
+               (unsigned long)(ns > 0 ? switches * 1000000000UL / ns : 0));
+    }
+}
+
+// Benchmark body: fixed amount of CPU-bound work
+static void bench_spin_loop(void* arg)
+{
+    unsigned long work = (unsigned long)arg;
+    uint64_t x = 88172645463325252UL;
+    for (unsigned long i = 0; i < work; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    // Keep the loop from being optimized away
+    __asm__ volatile("" :: "r"(x));
+}
+
+// Run 'threads' spinners and return the wall time in counter ticks
+static uint64_t bench_sched_run(int threads, unsigned long work)
+{
+    int ids[THREAD_MAX];
+    int created = 0;
+    uint64_t start = timer_ticks();
+
+    for (int i = 0; i < threads; i++) {
+        ids[i] = thread_create("spin", bench_spin_loop, (void*)work, 1);
+        if (ids[i] >= 0) created++;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (ids[i] >= 0) thread_join(ids[i]);
+    }
+
+    return created == threads ? timer_ticks() - start : 0;
+}
+
+/*
+ * Scheduler scaling: the same per-thread work with 1 and with 'threads'
+ * spinners; speedup = threads * T(1) / T(threads)
+ */
+void thread_bench_sched(int threads, unsigned long work)
+{
+    if (!thread_scheduler_running()) {
+        puts("Threads not initialized");
+        return;
+    }
+
+    unsigned long steals_before = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) steals_before += sched[cpu].steals;
+
+    uint64_t t1 = bench_sched_run(1, work);
+    uint64_t tn = bench_sched_run(threads, work);
+    if (t1 == 0 || tn == 0) {
+        puts("Error: could not create benchmark threads");
+        return;
+    }
+
+    unsigned long steals = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) steals += sched[cpu].steals;
+
+    unsigned long us1 = (unsigned long)timer_ticks_to_us(t1);
+    unsigned long usn = (unsigned long)timer_ticks_to_us(tn);
+    unsigned long speedup_x100 = (unsigned long)((threads * t1 * 100) / tn);
+
+    puts("=== Scheduler Scaling Benchmark ===");
+    printf("CPUs online:        %d\n", smp_cpus_online());
+    printf("Work per thread:    %lu iterations\n", work);
+    printf("1 thread:           %lu us\n", us1);
+    printf("%d threads:%s        %lu us\n", threads, threads < 10 ? " " : "", usn);
+    printf("Speedup:            %lu.%lu%lux\n", speedup_x100 / 100,
+           (speedup_x100 / 10) % 10, speedup_x100 % 10);
+    printf("Steals during run:  %lu\n", steals - steals_before);
+}
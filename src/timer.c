@@ -0,0 +1,124 @@
+/*
+ * ARM Generic Timer Implementation
+ * Reads CNTVCT_EL0, which ticks at CNTFRQ_EL0 Hz (62.5MHz on QEMU virt)
+ */
+
+#include "timer.h"
+#include "fdt.h"
+#include "gic.h"
+#include "irq.h"
+#include "ktimer.h"
+#include "thread.h"
+
+// Fallback if firmware left CNTFRQ_EL0 unset
+#define TIMER_DEFAULT_FREQUENCY 62500000UL
+
+// Virtual timer PPI on QEMU virt (PPI 11)
+#define TIMER_DEFAULT_VIRT_IRQ 27
+
+static uint64_t frequency = TIMER_DEFAULT_FREQUENCY;
+static uint64_t boot_ticks = 0;
+static unsigned int tick_irq = 0;
+static uint64_t tick_interval = 0;
+
+void timer_init(void)
+{
+    uint64_t freq;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    if (freq != 0) {
+        frequency = freq;
+    }
+    boot_ticks = timer_ticks();
+}
+
+uint64_t timer_ticks(void)
+{
+    uint64_t ticks;
+    // isb keeps the read from being hoisted above earlier instructions
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(ticks) :: "memory");
+    return ticks;
+}
+
+uint64_t timer_frequency(void)
+{
+    return frequency;
+}
+
+uint64_t timer_ticks_to_ns(uint64_t ticks)
+{
+    // Split to avoid overflowing ticks * 10^9 on long intervals
+    uint64_t seconds = ticks / frequency;
+    uint64_t rest = ticks % frequency;
+    return seconds * 1000000000UL + (rest * 1000000000UL) / frequency;
+}
+
+uint64_t timer_ticks_to_us(uint64_t ticks)
+{
+    uint64_t seconds = ticks / frequency;
+    uint64_t rest = ticks % frequency;
+    return seconds * 1000000UL + (rest * 1000000UL) / frequency;
+}
+
+uint64_t timer_ms_to_ticks(uint64_t ms)
+{
+    return (ms / 1000) * frequency + ((ms % 1000) * frequency) / 1000;
+}
+
+uint64_t timer_uptime_ms(void)
+{
+    return timer_ticks_to_us(timer_ticks() - boot_ticks) / 1000;
+}
+
+// Program the next tick on the calling CPU
+static void timer_tick_arm(void)
+{
+    __asm__ volatile("msr cntv_tval_el0, %0" :: "r"(tick_interval));
+    __asm__ volatile("msr cntv_ctl_el0, %0\n isb" :: "r"(1UL));    // ENABLE, not masked
+}
+
+static void timer_tick_handler(unsigned int irq)
+{
+    (void)irq;
+    timer_tick_arm();
+    ktimer_tick();
+    thread_tick();
+}
+
+// Virtual timer interrupt ID from the "arm,armv8-timer" node
+static unsigned int timer_find_irq(void)
+{
+    int node = fdt_find_compatible(-1, "arm,armv8-timer");
+    if (node < 0) return TIMER_DEFAULT_VIRT_IRQ;
+
+    // Four <type number flags> triples: secure, non-secure, virtual, hyp
+    int len;
+    const uint32_t* cells = fdt_getprop(node, "interrupts", &len);
+    if (!cells || len < 9 * 4) return TIMER_DEFAULT_VIRT_IRQ;
+
+    uint32_t type = fdt32_to_cpu(cells[6]);
+    uint32_t number = fdt32_to_cpu(cells[7]);
+    return type == 1 ? GIC_PPI_BASE + number : GIC_SPI_BASE + number;
+}
+
+int timer_tick_init(void)
+{
+    if (!gic_present()) return -1;
+
+    tick_irq = timer_find_irq();
+    tick_interval = frequency / TIMER_TICK_HZ;
+    irq_register(tick_irq, timer_tick_handler);
+    return 0;
+}
+
+void timer_tick_start(void)
+{
+    if (tick_interval == 0) return;
+
+    gic_enable(tick_irq);
+    timer_tick_arm();
+}
+
+int timer_tick_running(void)
+{
+    return tick_interval != 0;
+}
@@ -3,6 +3,13 @@
  * Phase 1: Serial output implementation
  */
 
+#include "thread.h"
+#include "atomic.h"
+#include "cancel.h"
+#include "fdt.h"
+#include "gic.h"
+#include "irq.h"
+
 // UART base address for QEMU virt machine
 #define UART_BASE    0x09000000
 
@@ -13,6 +20,8 @@
 #define UARTFBRD     0x028  // Fractional baud rate divisor
 #define UARTLCR_H    0x02C  // Line control register
 #define UARTCR       0x030  // Control register
+#define UARTIMSC     0x038  // Interrupt mask set/clear
+#define UARTICR      0x044  // Interrupt clear
 
 // Flag register bits
 #define UART_FR_TXFF (1 << 5)  // Transmit FIFO full
@@ -23,10 +32,33 @@
 #define UART_CR_TXE    (1 << 8)  // Transmit enable
 #define UART_CR_RXE    (1 << 9)  // Receive enable
 
+// Interrupt bits (IMSC/ICR)
+#define UART_INT_RX    (1 << 4)  // Receive FIFO reached its trigger level
+#define UART_INT_RT    (1 << 6)  // Receive timeout (data waiting, line idle)
+
+// Interrupt ID when the device tree does not say (SPI 1 on QEMU virt)
+#define UART_DEFAULT_IRQ (GIC_SPI_BASE + 1)
+
+#define ASCII_CTRL_C 0x03
+
 // Line control register bits (8N1 configuration)
 #define UART_LCR_H_WLEN_8 (3 << 5)  // 8 data bits
 #define UART_LCR_H_FEN    (1 << 4)   // Enable FIFOs
 
+// Software RX ring (power of two) - absorbs input while the CPU is busy
+// transmitting so the small hardware FIFO does not overrun
+#define UART_RX_RING_SIZE 16384
+#define UART_RX_RING_MASK (UART_RX_RING_SIZE - 1)
+
+static char rx_ring[UART_RX_RING_SIZE];
+static volatile unsigned int rx_head = 0;     // Next write position
+static volatile unsigned int rx_tail = 0;     // Next read position
+static unsigned long rx_dropped = 0;          // Bytes lost to a full ring
+static int rx_irq_enabled = 0;
+
+// The interrupt handler and polling readers on any CPU both fill the ring
+static spinlock_t rx_lock;
+
 // Memory-mapped I/O functions
 static inline void mmio_write(unsigned long addr, unsigned int value)
 {
@@ -44,6 +76,8 @@ static inline unsigned int mmio_read(unsigned long addr)
  */
 void uart_init(void)
 {
+    spin_lock_init(&rx_lock, "uart-rx");
+    
     // Disable UART during configuration
     mmio_write(UART_BASE + UARTCR, 0);
     
@@ -60,15 +94,84 @@ void uart_init(void)
     mmio_write(UART_BASE + UARTCR, UART_CR_UARTEN | UART_CR_TXE | UART_CR_RXE);
 }
 
+/*
+ * Move everything waiting in the hardware RX FIFO into the software ring
+ */
+static void uart_rx_drain(void)
+{
+    unsigned long flags = spin_lock_irqsave(&rx_lock);
+    while (!(mmio_read(UART_BASE + UARTFR) & UART_FR_RXFE)) {
+        char c = (char)mmio_read(UART_BASE + UARTDR);
+        
+        // Ctrl-C during a command cancels it rather than becoming input
+        if (c == ASCII_CTRL_C && cancel_armed()) {
+            cancel_request();
+            continue;
+        }
+        
+        if (rx_head - rx_tail >= UART_RX_RING_SIZE) {
+            rx_dropped++;  // Ring full - drop newest byte
+            continue;
+        }
+        rx_ring[rx_head & UART_RX_RING_MASK] = c;
+        atomic_store_release(&rx_head, rx_head + 1);
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+}
+
+static void uart_rx_irq(unsigned int irq)
+{
+    (void)irq;
+    uart_rx_drain();
+    mmio_write(UART_BASE + UARTICR, UART_INT_RX | UART_INT_RT);
+}
+
+// Receive interrupt ID from the "arm,pl011" node
+static unsigned int uart_find_irq(void)
+{
+    int node = fdt_find_compatible(-1, "arm,pl011");
+    if (node < 0) return UART_DEFAULT_IRQ;
+
+    // One <type number flags> triple
+    int len;
+    const uint32_t* cells = fdt_getprop(node, "interrupts", &len);
+    if (!cells || len < 3 * 4) return UART_DEFAULT_IRQ;
+
+    uint32_t type = fdt32_to_cpu(cells[0]);
+    uint32_t number = fdt32_to_cpu(cells[1]);
+    return type == 1 ? GIC_PPI_BASE + number : GIC_SPI_BASE + number;
+}
+
+void uart_irq_init(void)
+{
+    if (!gic_present()) return;
+
+    unsigned int irq = uart_find_irq();
+    if (irq_register(irq, uart_rx_irq) != 0) return;
+
+    mmio_write(UART_BASE + UARTICR, UART_INT_RX | UART_INT_RT);
+    mmio_write(UART_BASE + UARTIMSC, UART_INT_RX | UART_INT_RT);
+    gic_enable(irq);
+    rx_irq_enabled = 1;
+}
+
+int uart_rx_irq_enabled(void)
+{
+    return rx_irq_enabled;
+}
+
 /*
  * Send a single character
- * Wait if transmit FIFO is full (polling)
+ * Wait if transmit FIFO is full (polling), draining RX meanwhile;
+ * background jobs write to their own buffer instead
  */
 void putchar(char c)
 {
+    if (thread_output(c)) return;
+    
     // Wait while transmit FIFO is full
     while (mmio_read(UART_BASE + UARTFR) & UART_FR_TXFF) {
-        // Polling - do nothing
+        uart_rx_drain();
     }
     
     // Send character
@@ -77,7 +180,7 @@ void putchar(char c)
     // Handle newline: send carriage return too
     if (c == '\n') {
         while (mmio_read(UART_BASE + UARTFR) & UART_FR_TXFF) {
-            // Wait again
+            uart_rx_drain();
         }
         mmio_write(UART_BASE + UARTDR, '\r');
     }
@@ -99,6 +202,17 @@ void puts(const char* str)
     putchar('\n');
 }
 
+/*
+ * Send a buffer of 'len' bytes as is (no terminator, no added newline)
+ * Lets callers stream data from where it lies without staging a copy
+ */
+void uart_write(const char* buf, unsigned long len)
+{
+    for (unsigned long i = 0; i < len; i++) {
+        putchar(buf[i]);
+    }
+}
+
 /*
  * Helper function: convert number to hex string
  */
@@ -139,9 +253,28 @@ static void put_hex(unsigned long value)
     }
 }
 
+/*
+ * Helper function: print an unsigned number in decimal
+ */
+static void put_decimal(unsigned long value)
+{
+    char buffer[20];  // 2^64 has 20 digits
+    int i = 0;
+    
+    do {
+        buffer[i++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    while (i > 0) {
+        putchar(buffer[--i]);
+    }
+}
+
 /*
  * Simple printf implementation
- * Supports %s (string) and %x (hexadecimal)
+ * Supports %s (string), %x (hexadecimal), %d/%u (int decimal) and
+ * %ld/%lu (long decimal)
  */
 void printf(const char* format, ...)
 {
@@ -155,6 +288,13 @@ void printf(const char* format, ...)
         if (*p == '%' && *(p + 1)) {
             p++; // Skip '%'
             
+            // 'l' length modifier for decimal conversions
+            int is_long = 0;
+            if (*p == 'l' && (*(p + 1) == 'd' || *(p + 1) == 'u')) {
+                is_long = 1;
+                p++;
+            }
+            
             switch (*p) {
                 case 's': {
                     const char* str = __builtin_va_arg(args, const char*);
@@ -178,6 +318,23 @@ void printf(const char* format, ...)
                     put_hex(value);
                     break;
                 }
+                case 'd': {
+                    long value = is_long ? __builtin_va_arg(args, long)
+                                         : __builtin_va_arg(args, int);
+                    if (value < 0) {
+                        putchar('-');
+                        put_decimal(-(unsigned long)value);
+                    } else {
+                        put_decimal((unsigned long)value);
+                    }
+                    break;
+                }
+                case 'u': {
+                    unsigned long value = is_long ? __builtin_va_arg(args, unsigned long)
+                                                  : __builtin_va_arg(args, unsigned int);
+                    put_decimal(value);
+                    break;
+                }
                 case '%':
                     putchar('%');
                     break;
@@ -196,19 +353,75 @@ void printf(const char* format, ...)
     __builtin_va_end(args);
 }
 
+/*
+ * Print an unsigned number followed by spaces up to 'width' columns
+ * (printf has no field widths; used for aligned tables)
+ */
+void print_uint_padded(unsigned long value, int width)
+{
+    int digits = 1;
+    for (unsigned long v = value / 10; v; v /= 10) digits++;
+    
+    printf("%lu", value);
+    for (int i = digits; i < width; i++) {
+        putchar(' ');
+    }
+}
+
 /*
  * Receive a single character
- * Wait if receive FIFO is empty (polling)
+ * Wait until the RX ring has data (polling the hardware FIFO), letting
+ * other threads run in between polls
  */
 char getchar(void)
 {
-    // Wait while receive FIFO is empty
-    while (mmio_read(UART_BASE + UARTFR) & UART_FR_RXFE) {
-        // Polling - do nothing
+    uart_rx_drain();
+    while (atomic_load_acquire(&rx_head) == rx_tail) {
+        thread_yield();
+        uart_rx_drain();
     }
     
-    // Read character from data register
-    return (char)mmio_read(UART_BASE + UARTDR);
+    char c = rx_ring[rx_tail & UART_RX_RING_MASK];
+    rx_tail++;
+    return c;
+}
+
+/*
+ * Number of received bytes waiting in the RX ring
+ */
+int uart_rx_available(void)
+{
+    uart_rx_drain();
+    return (int)(atomic_load_acquire(&rx_head) - rx_tail);
+}
+
+/*
+ * Bulk receive: block until at least one byte is available, then copy
+ * out everything buffered (up to max) in one pass
+ */
+int uart_read_bulk(char* buffer, int max)
+{
+    if (!buffer || max <= 0) return 0;
+    
+    while (uart_rx_available() == 0) {
+        // Polling - uart_rx_available() drains the FIFO
+        thread_yield();
+    }
+    
+    int count = 0;
+    while (count < max && rx_tail != rx_head) {
+        buffer[count++] = rx_ring[rx_tail & UART_RX_RING_MASK];
+        rx_tail++;
+    }
+    return count;
+}
+
+/*
+ * Number of received bytes dropped because the RX ring was full
+ */
+unsigned long uart_rx_dropped(void)
+{
+    return rx_dropped;
 }
 
 /*
@@ -0,0 +1,426 @@
+/*
+ * Virtio over MMIO Implementation
+ * Slots come from the device tree ("virtio,mmio" nodes), or the QEMU
+ * virt layout when there is none. Empty slots report device ID 0 and
+ * are skipped; the rest are reset and wait for a driver to claim them.
+ */
+
+#include "virtio.h"
+#include "fdt.h"
+#include "gic.h"
+#include "irq.h"
+#include "uart.h"
+
+// QEMU virt defaults
+#define VIRTIO_DEFAULT_BASE     0x0a000000UL
+#define VIRTIO_DEFAULT_STRIDE   0x200
+#define VIRTIO_DEFAULT_SPI      16
+
+#define VIRTIO_MMIO_MAGIC_VALUE 0x74726976      // "virt"
+
+// Registers (version 2 unless marked legacy)
+#define VIRTIO_MMIO_MAGIC               0x000
+#define VIRTIO_MMIO_VERSION             0x004
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_VENDOR_ID           0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE     0x028   // Legacy
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN         0x03c   // Legacy
+#define VIRTIO_MMIO_QUEUE_PFN           0x040   // Legacy
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW    0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH   0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW    0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH   0x0a4
+#define VIRTIO_MMIO_CONFIG_GENERATION   0x0fc
+#define VIRTIO_MMIO_CONFIG              0x100
+
+#define LEGACY_PAGE_SIZE 4096
+
+static virtio_device_t devices[VIRTIO_MAX_DEVICES];
+static int device_count = 0;
+static int slot_count = 0;
+
+static inline void vm_write(virtio_device_t* dev, unsigned int reg, uint32_t value)
+{
+    *(volatile uint32_t*)(dev->base + reg) = value;
+}
+
+static inline uint32_t vm_read(virtio_device_t* dev, unsigned int reg)
+{
+    return *(volatile uint32_t*)(dev->base + reg);
+}
+
+static void vm_set_status(virtio_device_t* dev, uint32_t bits)
+{
+    vm_write(dev, VIRTIO_MMIO_STATUS, vm_read(dev, VIRTIO_MMIO_STATUS) | bits);
+}
+
+static void vm_reset(virtio_device_t* dev)
+{
+    vm_write(dev, VIRTIO_MMIO_STATUS, 0);
+
+    // A modern device may finish the reset asynchronously
+    if (dev->version >= 2) {
+        while (vm_read(dev, VIRTIO_MMIO_STATUS) != 0) {
+        }
+    }
+}
+
+const char* virtio_device_name(uint32_t device_id)
+{
+    switch (device_id) {
+    case VIRTIO_ID_NET:     return "net";
+    case VIRTIO_ID_BLOCK:   return "block";
+    case VIRTIO_ID_CONSOLE: return "console";
+    case VIRTIO_ID_RNG:     return "rng";
+    case 9:                 return "9p";
+    case 16:                return "gpu";
+    case 18:                return "input";
+    case 19:                return "vsock";
+    default:                return "other";
+    }
+}
+
+// Look at one slot; keeps it if a device sits behind it
+static void virtio_probe_slot(uintptr_t base, unsigned int irq)
+{
+    slot_count++;
+    if (device_count >= VIRTIO_MAX_DEVICES) return;
+
+    virtio_device_t* dev = &devices[device_count];
+    dev->base = base;
+    if (vm_read(dev, VIRTIO_MMIO_MAGIC) != VIRTIO_MMIO_MAGIC_VALUE) return;
+
+    dev->version = vm_read(dev, VIRTIO_MMIO_VERSION);
+    dev->device_id = vm_read(dev, VIRTIO_MMIO_DEVICE_ID);
+    if (dev->device_id == 0) return;            // Empty slot
+    if (dev->version < 1 || dev->version > 2) {
+        printf("Virtio: unsupported transport version %d at %x\n", dev->version, base);
+        return;
+    }
+
+    dev->vendor_id = vm_read(dev, VIRTIO_MMIO_VENDOR_ID);
+    dev->irq = irq;
+    dev->driver = NULL;
+    dev->queue_count = 0;
+    dev->handler = NULL;
+    dev->interrupts = 0;
+
+    vm_reset(dev);
+    if (dev->version == 1) {
+        vm_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, LEGACY_PAGE_SIZE);
+    }
+
+    // Offered features, for display before any driver negotiates
+    vm_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    dev->device_features = vm_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
+    if (dev->version >= 2) {
+        vm_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+        dev->device_features |= (uint64_t)vm_read(dev, VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+    }
+    dev->features = 0;
+
+    device_count++;
+}
+
+// Interrupt ID from a node's <type number flags> triple
+static unsigned int virtio_node_irq(int node)
+{
+    int len;
+    const uint32_t* cells = fdt_getprop(node, "interrupts", &len);
+    if (!cells || len < 3 * 4) return 0;
+
+    uint32_t type = fdt32_to_cpu(cells[0]);
+    uint32_t number = fdt32_to_cpu(cells[1]);
+    return type == 1 ? GIC_PPI_BASE + number : GIC_SPI_BASE + number;
+}
+
+void virtio_init(void)
+{
+    device_count = 0;
+    slot_count = 0;
+
+    if (fdt_present()) {
+        for (int node = fdt_find_compatible(-1, "virtio,mmio"); node >= 0;
+             node = fdt_find_compatible(node, "virtio,mmio")) {
+            uint64_t base, size;
+            if (fdt_get_reg(node, 0, &base, &size) != 0) continue;
+            virtio_probe_slot((uintptr_t)base, virtio_node_irq(node));
+        }
+    } else {
+        for (int i = 0; i < VIRTIO_MAX_DEVICES; i++) {
+            virtio_probe_slot(VIRTIO_DEFAULT_BASE + i * VIRTIO_DEFAULT_STRIDE,
+                              GIC_SPI_BASE + VIRTIO_DEFAULT_SPI + i);
+        }
+    }
+
+    // The tree lists slots from the top down; keep them in address order
+    for (int i = 1; i < device_count; i++) {
+        virtio_device_t dev = devices[i];
+        int j = i;
+        while (j > 0 && devices[j - 1].base > dev.base) {
+            devices[j] = devices[j - 1];
+            j--;
+        }
+        devices[j] = dev;
+    }
+
+    printf("Virtio: %d device(s) in %d MMIO slots\n", device_count, slot_count);
+}
+
+int virtio_device_count(void)
+{
+    return device_count;
+}
+
+virtio_device_t* virtio_device(int index)
+{
+    return index >= 0 && index < device_count ? &devices[index] : NULL;
+}
+
+virtio_device_t* virtio_claim(uint32_t device_id, const char* driver)
+{
+    for (int i = 0; i < device_count; i++) {
+        virtio_device_t* dev = &devices[i];
+        if (dev->device_id == device_id && !dev->driver) {
+            dev->driver = driver;
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+int virtio_negotiate(virtio_device_t* dev, uint64_t wanted)
+{
+    vm_reset(dev);
+    if (dev->version == 1) {
+        vm_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, LEGACY_PAGE_SIZE);
+    }
+    vm_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+    vm_set_status(dev, VIRTIO_STATUS_DRIVER);
+
+    uint64_t accepted = dev->device_features & wanted;
+    if (dev->version >= 2) {
+        // Modern devices insist on VERSION_1; legacy ones cannot offer it
+        if (!(dev->device_features & VIRTIO_FEATURE(VIRTIO_F_VERSION_1))) {
+            virtio_fail(dev);
+            return -1;
+        }
+        accepted |= VIRTIO_FEATURE(VIRTIO_F_VERSION_1);
+    } else {
+        accepted &= 0xFFFFFFFFUL;
+    }
+
+    vm_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    vm_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)accepted);
+    if (dev->version >= 2) {
+        vm_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+        vm_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)(accepted >> 32));
+
+        vm_set_status(dev, VIRTIO_STATUS_FEATURES_OK);
+        if (!(vm_read(dev, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+            virtio_fail(dev);
+            return -1;
+        }
+    }
+
+    dev->features = accepted;
+    return 0;
+}
+
+static void virtio_notify(virtqueue_t* vq)
+{
+    virtio_device_t* dev = vq->priv;
+    vm_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, (uint32_t)vq->index);
+}
+
+virtqueue_t* virtio_queue_setup(virtio_device_t* dev, int index, uint16_t size)
+{
+    if (index < 0 || index >= VIRTIO_MAX_QUEUES || dev->queues[index]) return NULL;
+
+    vm_write(dev, VIRTIO_MMIO_QUEUE_SEL, (uint32_t)index);
+    if (dev->version >= 2 && vm_read(dev, VIRTIO_MMIO_QUEUE_READY) != 0) return NULL;
+    if (dev->version == 1 && vm_read(dev, VIRTIO_MMIO_QUEUE_PFN) != 0) return NULL;
+
+    uint32_t max = vm_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (max == 0) return NULL;                  // No such queue
+    if (size > max) size = max;
+    if (size > VIRTQUEUE_MAX_SIZE) size = VIRTQUEUE_MAX_SIZE;
+    while (size & (size - 1)) size &= size - 1;
+
+    int packed = virtio_has_feature(dev, VIRTIO_F_RING_PACKED);
+    int event_idx = virtio_has_feature(dev, VIRTIO_F_EVENT_IDX);
+    virtqueue_t* vq = virtqueue_create(index, size, packed, event_idx, dev->version == 1,
+                                       virtio_notify, dev);
+    if (!vq) return NULL;
+
+    vm_write(dev, VIRTIO_MMIO_QUEUE_NUM, size);
+    if (dev->version >= 2) {
+        vm_write(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)vq->desc_addr);
+        vm_write(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)((uint64_t)vq->desc_addr >> 32));
+        vm_write(dev, VIRTIO_MMIO_QUEUE_DRIVER_LOW, (uint32_t)vq->driver_addr);
+        vm_write(dev, VIRTIO_MMIO_QUEUE_DRIVER_HIGH, (uint32_t)((uint64_t)vq->driver_addr >> 32));
+        vm_write(dev, VIRTIO_MMIO_QUEUE_DEVICE_LOW, (uint32_t)vq->device_addr);
+        vm_write(dev, VIRTIO_MMIO_QUEUE_DEVICE_HIGH, (uint32_t)((uint64_t)vq->device_addr >> 32));
+        vm_write(dev, VIRTIO_MMIO_QUEUE_READY, 1);
+    } else {
+        vm_write(dev, VIRTIO_MMIO_QUEUE_ALIGN, LEGACY_PAGE_SIZE);
+        vm_write(dev, VIRTIO_MMIO_QUEUE_PFN, (uint32_t)(vq->desc_addr / LEGACY_PAGE_SIZE));
+    }
+
+    dev->queues[index] = vq;
+    if (index >= dev->queue_count) dev->queue_count = index + 1;
+    return vq;
+}
+
+static void virtio_irq(unsigned int irq)
+{
+    for (int i = 0; i < device_count; i++) {
+        virtio_device_t* dev = &devices[i];
+        if (dev->irq != irq) continue;
+
+        uint32_t status = vm_read(dev, VIRTIO_MMIO_INTERRUPT_STATUS);
+        if (!status) continue;
+        vm_write(dev, VIRTIO_MMIO_INTERRUPT_ACK, status);
+        dev->interrupts++;
+        if (dev->handler) dev->handler(dev, status);
+    }
+}
+
+int virtio_set_handler(virtio_device_t* dev, virtio_irq_fn_t fn)
+{
+    if (!gic_present() || dev->irq == 0) return -1;
+    if (irq_register(dev->irq, virtio_irq) != 0) return -1;
+
+    dev->handler = fn;
+    gic_enable(dev->irq);
+    return 0;
+}
+
+void virtio_driver_ok(virtio_device_t* dev)
+{
+    vm_set_status(dev, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_device_t* dev)
+{
+    vm_set_status(dev, VIRTIO_STATUS_FAILED);
+}
+
+// Read until the generation is stable, so multi-word fields are consistent
+#define CONFIG_READ(type, dev, offset) ({                                       \
+    type _value;                                                                \
+    uint32_t _gen;                                                              \
+    do {                                                                        \
+        _gen = (dev)->version >= 2 ? vm_read(dev, VIRTIO_MMIO_CONFIG_GENERATION) : 0; \
+        _value = *(volatile type*)((dev)->base + VIRTIO_MMIO_CONFIG + (offset)); \
+    } while ((dev)->version >= 2 && _gen != vm_read(dev, VIRTIO_MMIO_CONFIG_GENERATION)); \
+    _value;                                                                     \
+})
+
+uint8_t virtio_config_read8(virtio_device_t* dev, unsigned int offset)
+{
+    return CONFIG_READ(uint8_t, dev, offset);
+}
+
+uint16_t virtio_config_read16(virtio_device_t* dev, unsigned int offset)
+{
+    return CONFIG_READ(uint16_t, dev, offset);
+}
+
+uint32_t virtio_config_read32(virtio_device_t* dev, unsigned int offset)
+{
+    return CONFIG_READ(uint32_t, dev, offset);
+}
+
+uint64_t virtio_config_read64(virtio_device_t* dev, unsigned int offset)
+{
+    // Two 32-bit reads: the transport only promises naturally sized access
+    uint32_t gen;
+    uint64_t value;
+    do {
+        gen = dev->version >= 2 ? vm_read(dev, VIRTIO_MMIO_CONFIG_GENERATION) : 0;
+        uint32_t low = *(volatile uint32_t*)(dev->base + VIRTIO_MMIO_CONFIG + offset);
+        uint32_t high = *(volatile uint32_t*)(dev->base + VIRTIO_MMIO_CONFIG + offset + 4);
+        value = ((uint64_t)high << 32) | low;
+    } while (dev->version >= 2 && gen != vm_read(dev, VIRTIO_MMIO_CONFIG_GENERATION));
+    return value;
+}
+
+static void print_padded(const char* text, int width)
+{
+    int len = 0;
+    for (; text[len]; len++) putchar(text[len]);
+    for (; len < width; len++) putchar(' ');
+}
+
+void virtio_print(void)
+{
+    printf("Virtio-MMIO: %d device(s) in %d slots\n", device_count, slot_count);
+    if (device_count == 0) {
+        puts("  (start QEMU with -device virtio-...-device to add one)");
+        return;
+    }
+
+    puts("  DEV  BASE       IRQ  VER  TYPE     DRIVER     INTS");
+    for (int i = 0; i < device_count; i++) {
+        virtio_device_t* dev = &devices[i];
+
+        printf("  ");
+        print_uint_padded(i, 5);
+        printf("%x  ", (unsigned long)dev->base);
+        print_uint_padded(dev->irq, 5);
+        print_uint_padded(dev->version, 5);
+        print_padded(virtio_device_name(dev->device_id), 9);
+        print_padded(dev->driver ? dev->driver : "-", 11);
+        printf("%lu\n", dev->interrupts);
+
+        if (!dev->driver) {
+            printf("       offered %x\n", (unsigned long)dev->device_features);
+            continue;
+        }
+        printf("       features %x:%s%s%s%s\n", (unsigned long)dev->features,
+               virtio_has_feature(dev, VIRTIO_F_VERSION_1) ? " VERSION_1" : " legacy",
+               virtio_has_feature(dev, VIRTIO_F_RING_PACKED) ? " RING_PACKED" : "",
+               virtio_has_feature(dev, VIRTIO_F_EVENT_IDX) ? " EVENT_IDX" : "",
+               virtio_has_feature(dev, VIRTIO_F_INDIRECT_DESC) ? " INDIRECT_DESC" : "");
+
+        for (int q = 0; q < dev->queue_count; q++) {
+            virtqueue_t* vq = dev->queues[q];
+            if (!vq) continue;
+            vq_stats_t* s = &vq->stats;
+            printf("       queue %d: %s, %d entries, %d free\n", q,
+                   vq->packed ? "packed" : "split", vq->size, vq->num_free);
+            printf("         chains %lu  kicks %lu  doorbells %lu  suppressed %lu  used %lu  full %lu\n",
+                   s->chains, s->kicks, s->notifies, s->suppressed, s->used, s->full);
+        }
+    }
+}
+
+void virtio_reset_stats(void)
+{
+    for (int i = 0; i < device_count; i++) {
+        virtio_device_t* dev = &devices[i];
+        dev->interrupts = 0;
+        for (int q = 0; q < dev->queue_count; q++) {
+            virtqueue_t* vq = dev->queues[q];
+            if (!vq) continue;
+            unsigned long flags = spin_lock_irqsave(&vq->lock);
+            memset(&vq->stats, 0, sizeof(vq->stats));
+            spin_unlock_irqrestore(&vq->lock, flags);
+        }
+    }
+}
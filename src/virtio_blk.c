@@ -0,0 +1,663 @@
+/*
+ * Virtio Block Driver Implementation
+ * One request is a chain of header, data segments and status byte. The
+ * queue lock covers adding, kicking and reaping; whoever reaps wakes the
+ * sleeping waiters once completion callbacks have run, and each rechecks
+ * what it waits for (thread_lock nests inside the queue lock).
+ */
+
+#include "virtio_blk.h"
+#include "cancel.h"
+#include "page.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+#include "virtio.h"
+
+// Device features
+#define VIRTIO_BLK_F_SIZE_MAX   1
+#define VIRTIO_BLK_F_SEG_MAX    2
+#define VIRTIO_BLK_F_RO         5
+#define VIRTIO_BLK_F_BLK_SIZE   6
+#define VIRTIO_BLK_F_FLUSH      9
+
+// Configuration space
+#define VIRTIO_BLK_CFG_CAPACITY 0
+#define VIRTIO_BLK_CFG_SIZE_MAX 8
+#define VIRTIO_BLK_CFG_SEG_MAX  12
+#define VIRTIO_BLK_CFG_BLK_SIZE 20
+
+// Device status byte
+#define VIRTIO_BLK_S_OK         0
+#define VIRTIO_BLK_S_IOERR      1
+#define VIRTIO_BLK_S_UNSUPP     2
+
+#define BLK_DEFAULT_SEGMENT     (64 * 1024)     // Without SIZE_MAX
+#define BLK_POLL_MAX_US         200             // Adaptive: never spin longer
+#define BLK_BENCH_MAX_DEPTH     64
+#define BLK_MAX_SLEEPERS        16              // More waiters poll instead
+
+static virtio_device_t* blk_dev = NULL;
+static virtqueue_t* blk_vq = NULL;
+static uint64_t capacity = 0;
+static uint32_t segment_max_bytes = BLK_DEFAULT_SEGMENT;
+static int segment_max = BLK_MAX_SEGMENTS;
+static int read_only = 0;
+static int can_flush = 0;
+static blk_mode_t mode = BLK_MODE_POLL;
+
+static int sleepers = 0;                // Waiters relying on the interrupt
+static int sleeping[BLK_MAX_SLEEPERS];  // Their threads, while blocked
+static int sleeping_count = 0;
+static uint64_t latency_ewma = 0;       // Ticks, 1/8 weight per completion
+static blk_stats_t stats;
+
+// Reap completions (queue lock held); 'polled' says who is reaping
+static int blk_reap_locked(int polled)
+{
+    int reaped = 0;
+    blk_request_t* done_list = NULL;
+    uint32_t len;
+    blk_request_t* req;
+
+    while ((req = virtqueue_get(blk_vq, &len)) != NULL) {
+        uint64_t now = timer_ticks();
+        req->completed = now;
+
+        uint64_t latency = now - req->submitted;
+        stats.latency_ticks += latency;
+        latency_ewma = latency_ewma - latency_ewma / 8 + latency / 8;
+
+        int status;
+        switch (req->device_status) {
+        case VIRTIO_BLK_S_OK:     status = BLK_OK; break;
+        case VIRTIO_BLK_S_UNSUPP: status = BLK_UNSUPPORTED; break;
+        default:                  status = BLK_ERROR; break;
+        }
+        if (status != BLK_OK) stats.errors++;
+        if (polled) {
+            stats.polled++;
+        } else {
+            stats.interrupt_reaped++;
+        }
+
+        if (req->done) {
+            req->next = done_list;
+            done_list = req;
+        }
+        req->status = status;               // Request may be reused from here
+        reaped++;
+    }
+
+    // Callbacks next: they may resubmit, which takes the lock again
+    while (done_list) {
+        req = done_list;
+        done_list = req->next;
+        spin_unlock(&blk_vq->lock);
+        req->done(req);
+        spin_lock(&blk_vq->lock);
+    }
+
+    // Last, so waiters see what the callbacks completed
+    if (reaped > 0) {
+        for (int i = 0; i < sleeping_count; i++) {
+            thread_wake(sleeping[i]);
+        }
+        sleeping_count = 0;
+    }
+    return reaped;
+}
+
+static void blk_irq(virtio_device_t* dev, uint32_t status)
+{
+    (void)dev;
+    if (!(status & VIRTIO_INT_USED)) return;
+
+    spin_lock(&blk_vq->lock);
+    blk_reap_locked(0);
+    spin_unlock(&blk_vq->lock);
+}
+
+void blk_init(void)
+{
+    virtio_device_t* dev = virtio_claim(VIRTIO_ID_BLOCK, "virtio-blk");
+    if (!dev) return;
+
+    uint64_t wanted = VIRTIO_FEATURE(VIRTIO_BLK_F_SIZE_MAX) | VIRTIO_FEATURE(VIRTIO_BLK_F_SEG_MAX) |
+                      VIRTIO_FEATURE(VIRTIO_BLK_F_RO) | VIRTIO_FEATURE(VIRTIO_BLK_F_BLK_SIZE) |
+                      VIRTIO_FEATURE(VIRTIO_BLK_F_FLUSH) | VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX) |
+                      VIRTIO_FEATURE(VIRTIO_F_RING_PACKED);
+    if (virtio_negotiate(dev, wanted) != 0) {
+        puts("virtio-blk: feature negotiation failed");
+        return;
+    }
+
+    capacity = virtio_config_read64(dev, VIRTIO_BLK_CFG_CAPACITY);
+    if (virtio_has_feature(dev, VIRTIO_BLK_F_SIZE_MAX)) {
+        uint32_t size_max = virtio_config_read32(dev, VIRTIO_BLK_CFG_SIZE_MAX);
+        if (size_max >= BLK_SECTOR_SIZE && size_max < segment_max_bytes) {
+            segment_max_bytes = size_max & ~(BLK_SECTOR_SIZE - 1);
+        }
+    }
+    if (virtio_has_feature(dev, VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = virtio_config_read32(dev, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max >= 1 && seg_max < (uint32_t)segment_max) segment_max = seg_max;
+    }
+    read_only = virtio_has_feature(dev, VIRTIO_BLK_F_RO);
+    can_flush = virtio_has_feature(dev, VIRTIO_BLK_F_FLUSH);
+
+    virtqueue_t* vq = virtio_queue_setup(dev, 0, BLK_QUEUE_SIZE);
+    if (!vq) {
+        puts("virtio-blk: could not set up the request queue");
+        virtio_fail(dev);
+        return;
+    }
+
+    blk_dev = dev;
+    blk_vq = vq;
+
+    // Without an interrupt only polling can complete requests
+    mode = virtio_set_handler(dev, blk_irq) == 0 ? BLK_MODE_ADAPTIVE : BLK_MODE_POLL;
+    virtqueue_disable_cb(vq);
+    virtio_driver_ok(dev);
+
+    printf("virtio-blk: %lu MB%s, %s ring, queue %d, %s completion\n",
+           (unsigned long)(capacity / 2048), read_only ? " (read-only)" : "",
+           vq->packed ? "packed" : "split", vq->size, blk_mode_name(mode));
+}
+
+int blk_present(void)
+{
+    return blk_vq != NULL;
+}
+
+uint64_t blk_capacity(void)
+{
+    return capacity;
+}
+
+int blk_read_only(void)
+{
+    return read_only;
+}
+
+int blk_max_depth(int segments)
+{
+    if (!blk_vq) return 0;
+    return blk_vq->size / (segments + 2);
+}
+
+int blk_max_segments(void)
+{
+    return segment_max;
+}
+
+uint32_t blk_max_segment_size(void)
+{
+    return segment_max_bytes;
+}
+
+const char* blk_mode_name(blk_mode_t m)
+{
+    switch (m) {
+    case BLK_MODE_IRQ:      return "interrupt";
+    case BLK_MODE_POLL:     return "polled";
+    case BLK_MODE_ADAPTIVE: return "adaptive";
+    default:                return "?";
+    }
+}
+
+blk_mode_t blk_get_mode(void)
+{
+    return mode;
+}
+
+void blk_set_mode(blk_mode_t m)
+{
+    if (!blk_vq) return;
+    if (m != BLK_MODE_POLL && !blk_dev->handler) return;   // No interrupt
+
+    unsigned long flags = spin_lock_irqsave(&blk_vq->lock);
+    mode = m;
+    if (mode == BLK_MODE_IRQ || sleepers > 0) {
+        if (virtqueue_enable_cb(blk_vq)) blk_reap_locked(1);
+    } else {
+        virtqueue_disable_cb(blk_vq);
+    }
+    spin_unlock_irqrestore(&blk_vq->lock, flags);
+}
+
+int blk_submit(blk_request_t** reqs, int count)
+{
+    if (!blk_vq) return -1;
+
+    // Validate first so a batch is either queued or rejected whole
+    for (int i = 0; i < count; i++) {
+        blk_request_t* req = reqs[i];
+        if (req->type == BLK_FLUSH) {
+            if (req->segment_count != 0) return -1;
+            continue;
+        }
+        if (req->type != BLK_READ && req->type != BLK_WRITE) return -1;
+        if (req->type == BLK_WRITE && read_only) return -1;
+        if (req->segment_count < 1 || req->segment_count > segment_max) return -1;
+
+        uint64_t bytes = 0;
+        for (int s = 0; s < req->segment_count; s++) {
+            uint32_t len = req->segments[s].len;
+            if (len == 0 || len % BLK_SECTOR_SIZE || len > segment_max_bytes) return -1;
+            bytes += len;
+        }
+        if (req->sector + bytes / BLK_SECTOR_SIZE > capacity) return -1;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&blk_vq->lock);
+    uint64_t now = timer_ticks();
+    int queued = 0;
+    for (; queued < count; queued++) {
+        blk_request_t* req = reqs[queued];
+        vq_buf_t bufs[BLK_MAX_SEGMENTS + 2];
+        int n = 0;
+
+        req->header.type = req->type;
+        req->header.reserved = 0;
+        req->header.sector = req->sector;
+        req->device_status = 0xFF;
+        req->status = BLK_PENDING;
+        req->submitted = now;
+
+        bufs[n].addr = &req->header;
+        bufs[n++].len = sizeof(req->header);
+        for (int s = 0; s < req->segment_count; s++) {
+            bufs[n++] = req->segments[s];
+        }
+        bufs[n].addr = (void*)&req->device_status;
+        bufs[n++].len = 1;
+
+        // Reads hand the data buffers to the device as writable
+        int out = req->type == BLK_READ ? 1 : n - 1;
+        if (virtqueue_add(blk_vq, bufs, out, n - out, req) != 0) break;
+
+        unsigned long sectors = 0;
+        for (int s = 0; s < req->segment_count; s++) {
+            sectors += req->segments[s].len / BLK_SECTOR_SIZE;
+        }
+        if (req->type == BLK_READ) stats.sectors_read += sectors;
+        if (req->type == BLK_WRITE) stats.sectors_written += sectors;
+        stats.requests++;
+    }
+
+    // One doorbell for the whole batch
+    if (queued > 0) {
+        stats.batches++;
+        virtqueue_kick(blk_vq);
+    }
+    spin_unlock_irqrestore(&blk_vq->lock, flags);
+    return queued;
+}
+
+int blk_poll(void)
+{
+    if (!blk_vq) return 0;
+
+    unsigned long flags = spin_lock_irqsave(&blk_vq->lock);
+    int reaped = blk_reap_locked(1);
+    spin_unlock_irqrestore(&blk_vq->lock, flags);
+    return reaped;
+}
+
+// Spin reaping until done(arg) or 'budget' ticks pass (0 = forever)
+static int blk_spin(blk_cond_fn_t done, void* arg, uint64_t budget)
+{
+    uint64_t start = timer_ticks();
+
+    while (!done(arg)) {
+        if (virtqueue_has_used(blk_vq)) {
+            blk_poll();
+            continue;
+        }
+        if (budget && timer_ticks() - start >= budget) return 0;
+    }
+    return 1;
+}
+
+// Sleep until a completion (reaped by the interrupt or another waiter) makes done(arg) true
+static void blk_sleep(blk_cond_fn_t done, void* arg)
+{
+    unsigned long flags = spin_lock_irqsave(&blk_vq->lock);
+    sleepers++;
+    if (sleepers == 1 && mode != BLK_MODE_IRQ) {
+        virtqueue_enable_cb(blk_vq);
+    }
+
+    for (;;) {
+        // Completions that raced with enabling the interrupt, or that
+        // arrive while a thread that cannot sleep keeps looping here
+        blk_reap_locked(1);
+        if (done(arg)) break;
+
+        if (sleeping_count == BLK_MAX_SLEEPERS) {
+            spin_unlock_irqrestore(&blk_vq->lock, flags);
+            thread_yield();
+            flags = spin_lock_irqsave(&blk_vq->lock);
+            continue;
+        }
+        sleeping[sleeping_count++] = thread_self();
+        stats.sleeps++;
+        thread_block(&blk_vq->lock);
+        spin_lock(&blk_vq->lock);
+    }
+
+    sleepers--;
+    if (sleepers == 0 && mode != BLK_MODE_IRQ) {
+        virtqueue_disable_cb(blk_vq);
+    }
+    spin_unlock_irqrestore(&blk_vq->lock, flags);
+}
+
+void blk_wait_event(blk_cond_fn_t done, void* arg)
+{
+    if (!blk_vq) return;
+
+    // Threads that cannot sleep (boot, idle) always poll
+    if (mode == BLK_MODE_POLL || thread_self() < 0 || !thread_scheduler_running()) {
+        blk_spin(done, arg, 0);
+        return;
+    }
+
+    if (mode == BLK_MODE_ADAPTIVE) {
+        // Spinning only pays when the device usually answers quickly
+        uint64_t limit = timer_ms_to_ticks(1) * BLK_POLL_MAX_US / 1000;
+        uint64_t budget = latency_ewma * 2;
+        if (latency_ewma < limit) {
+            if (budget == 0) budget = 1;
+            if (blk_spin(done, arg, budget)) return;
+        }
+    }
+
+    blk_sleep(done, arg);
+}
+
+static int request_done(void* arg)
+{
+    return ((blk_request_t*)arg)->status != BLK_PENDING;
+}
+
+int blk_wait(blk_request_t* req)
+{
+    if (!blk_vq) return BLK_ERROR;
+
+    blk_wait_event(request_done, req);
+    return req->status;
+}
+
+// Read or write any number of sectors as a series of maximal requests
+static int blk_rw(int type, uint64_t sector, uint8_t* buf, size_t sectors)
+{
+    if (!blk_vq) return -1;
+
+    while (sectors > 0) {
+        blk_request_t req;
+        req.type = type;
+        req.sector = sector;
+        req.segment_count = 0;
+        req.done = NULL;
+        req.priv = NULL;
+
+        size_t segment_sectors = segment_max_bytes / BLK_SECTOR_SIZE;
+        while (sectors > 0 && req.segment_count < segment_max) {
+            size_t n = sectors < segment_sectors ? sectors : segment_sectors;
+            req.segments[req.segment_count].addr = buf;
+            req.segments[req.segment_count].len = (uint32_t)(n * BLK_SECTOR_SIZE);
+            req.segment_count++;
+            buf += n * BLK_SECTOR_SIZE;
+            sector += n;
+            sectors -= n;
+        }
+
+        blk_request_t* batch = &req;
+        int queued;
+        while ((queued = blk_submit(&batch, 1)) == 0) {
+            blk_poll();                     // Queue full: make room
+            thread_yield();
+        }
+        if (queued < 0) return -1;          // Rejected: req.status never set
+        if (blk_wait(&req) != BLK_OK) return -1;
+    }
+    return 0;
+}
+
+int blk_read(uint64_t sector, void* buf, size_t sectors)
+{
+    return blk_rw(BLK_READ, sector, buf, sectors);
+}
+
+int blk_write(uint64_t sector, const void* buf, size_t sectors)
+{
+    return blk_rw(BLK_WRITE, sector, (uint8_t*)buf, sectors);
+}
+
+int blk_flush(void)
+{
+    if (!blk_vq) return -1;
+    if (!can_flush) return 0;           // Write-through device
+
+    blk_request_t req;
+    req.type = BLK_FLUSH;
+    req.sector = 0;
+    req.segment_count = 0;
+    req.done = NULL;
+    req.priv = NULL;
+
+    blk_request_t* batch = &req;
+    int queued;
+    while ((queued = blk_submit(&batch, 1)) == 0) {
+        blk_poll();
+        thread_yield();
+    }
+    if (queued < 0) return -1;
+    return blk_wait(&req) == BLK_OK ? 0 : -1;
+}
+
+const blk_stats_t* blk_stats(void)
+{
+    return &stats;
+}
+
+void blk_print(void)
+{
+    if (!blk_vq) {
+        puts("No virtio-blk disk (start QEMU with -drive ... -device virtio-blk-device)");
+        return;
+    }
+
+    printf("Disk: %lu sectors (%lu MB)%s, %s ring of %d, %s completion\n",
+           (unsigned long)capacity, (unsigned long)(capacity / 2048),
+           read_only ? ", read-only" : "", blk_vq->packed ? "packed" : "split",
+           blk_vq->size, blk_mode_name(mode));
+    printf("  Requests %lu in %lu batches, %lu sectors read, %lu written, %lu errors\n",
+           stats.requests, stats.batches, stats.sectors_read, stats.sectors_written, stats.errors);
+
+    unsigned long completed = stats.polled + stats.interrupt_reaped;
+    printf("  Completions: %lu polled, %lu by interrupt, %lu sleeps, avg latency %lu us\n",
+           stats.polled, stats.interrupt_reaped, stats.sleeps,
+           completed ? (unsigned long)timer_ticks_to_us(stats.latency_ticks / completed) : 0);
+}
+
+void blk_reset_stats(void)
+{
+    if (!blk_vq) return;
+
+    unsigned long flags = spin_lock_irqsave(&blk_vq->lock);
+    memset(&stats, 0, sizeof(stats));
+    spin_unlock_irqrestore(&blk_vq->lock, flags);
+}
+
+// --- Benchmark ---
+
+static volatile uint32_t bench_busy;    // A run is in progress
+
+static uint64_t bench_seed = 0x9E3779B97F4A7C15UL;
+
+static uint64_t bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+// Point a request at a random aligned block of the disk
+static void bench_prepare(blk_request_t* req, int type, uint8_t* buf, size_t io_bytes)
+{
+    uint64_t blocks = capacity / (io_bytes / BLK_SECTOR_SIZE);
+
+    req->type = type;
+    req->sector = (bench_random() % blocks) * (io_bytes / BLK_SECTOR_SIZE);
+    req->segments[0].addr = buf;
+    req->segments[0].len = (uint32_t)io_bytes;
+    req->segment_count = 1;
+    req->done = NULL;
+    req->priv = NULL;
+}
+
+/*
+ * Keep 'depth' requests in flight for 'duration' ticks. Requests form a
+ * ring: wait for the oldest, then resubmit it together with any others
+ * that finished behind it, as one batch.
+ */
+static unsigned long bench_depth(blk_request_t* reqs, uint8_t* buffers, int depth, int type,
+                                 size_t io_bytes, uint64_t duration, uint64_t* latency_sum)
+{
+    blk_request_t* batch[BLK_BENCH_MAX_DEPTH];
+    unsigned long completed = 0;
+    *latency_sum = 0;
+
+    for (int i = 0; i < depth; i++) {
+        bench_prepare(&reqs[i], type, buffers + i * io_bytes, io_bytes);
+        batch[i] = &reqs[i];
+    }
+    uint64_t start = timer_ticks();
+    int outstanding = blk_submit(batch, depth);
+    if (outstanding < depth) return 0;
+
+    int head = 0;
+    int stopping = 0;
+    while (outstanding > 0) {
+        blk_wait(&reqs[head]);
+
+        int count = 0;
+        while (count < outstanding && reqs[(head + count) % depth].status != BLK_PENDING) {
+            blk_request_t* req = &reqs[(head + count) % depth];
+            *latency_sum += req->completed - req->submitted;
+            completed++;
+            count++;
+        }
+
+        if (!stopping && (timer_ticks() - start >= duration || cancel_requested())) {
+            stopping = 1;
+        }
+        if (stopping) {
+            outstanding -= count;
+        } else {
+            for (int i = 0; i < count; i++) {
+                int slot = (head + i) % depth;
+                bench_prepare(&reqs[slot], type, buffers + slot * io_bytes, io_bytes);
+                batch[i] = &reqs[slot];
+            }
+            // Always fits: these requests just left the queue
+            blk_submit(batch, count);
+        }
+        head = (head + count) % depth;
+    }
+    return completed;
+}
+
+static void blk_bench_run(int write, size_t io_bytes, unsigned int ms_per_depth)
+{
+    static const int depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+    if (!blk_vq) {
+        blk_print();
+        return;
+    }
+    if (write && read_only) {
+        puts("Disk is read-only");
+        return;
+    }
+    if (capacity < io_bytes / BLK_SECTOR_SIZE) {
+        puts("Disk is smaller than one I/O");
+        return;
+    }
+
+    int type = write ? BLK_WRITE : BLK_READ;
+    size_t request_pages = (BLK_BENCH_MAX_DEPTH * sizeof(blk_request_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t buffer_pages = (BLK_BENCH_MAX_DEPTH * io_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    blk_request_t* reqs = page_alloc(request_pages);
+    uint8_t* buffers = page_alloc(buffer_pages);
+    if (!reqs || !buffers) {
+        puts("Error: not enough memory for the benchmark buffers");
+        if (reqs) page_free(reqs, request_pages);
+        if (buffers) page_free(buffers, buffer_pages);
+        return;
+    }
+    if (write) memset(buffers, 0xA5, buffer_pages * PAGE_SIZE);
+
+    puts("=== Block Device Benchmark ===");
+    printf("Random %lu KB %s, %s completion, %d ms per queue depth\n\n",
+           (unsigned long)(io_bytes / 1024), write ? "writes" : "reads", blk_mode_name(mode),
+           ms_per_depth);
+    puts("QD   IOPS      MB/S      AVG LAT(us)  IRQS      SLEEPS    DOORBELLS");
+
+    uint64_t duration = timer_ms_to_ticks(ms_per_depth);
+    for (int d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++) {
+        int depth = depths[d];
+        if (depth > blk_max_depth(1)) break;
+        if (cancel_requested()) {
+            puts("Interrupted");
+            break;
+        }
+
+        unsigned long irqs_before = blk_dev->interrupts;
+        unsigned long sleeps_before = stats.sleeps;
+        unsigned long bells_before = blk_vq->stats.notifies;
+        uint64_t start = timer_ticks();
+        uint64_t latency_sum;
+        unsigned long ios = bench_depth(reqs, buffers, depth, type, io_bytes, duration, &latency_sum);
+        uint64_t us = timer_ticks_to_us(timer_ticks() - start);
+        if (ios == 0) {
+            puts("Error: requests were rejected");
+            break;
+        }
+        if (us == 0) us = 1;
+
+        unsigned long iops = (unsigned long)(ios * 1000000UL / us);
+        unsigned long kb_per_s = (unsigned long)(ios * (io_bytes / 1024) * 1000000UL / us);
+        unsigned long tenths = kb_per_s * 10 / 1024;
+
+        print_uint_padded(depth, 5);
+        print_uint_padded(iops, 10);
+        printf("%lu.%lu", tenths / 10, tenths % 10);
+        int digits = 3;
+        for (unsigned long v = tenths / 100; v; v /= 10) digits++;
+        for (; digits < 10; digits++) putchar(' ');
+        print_uint_padded((unsigned long)timer_ticks_to_us(latency_sum / ios), 13);
+        print_uint_padded(blk_dev->interrupts - irqs_before, 10);
+        print_uint_padded(stats.sleeps - sleeps_before, 10);
+        printf("%lu\n", blk_vq->stats.notifies - bells_before);
+    }
+
+    page_free(reqs, request_pages);
+    page_free(buffers, buffer_pages);
+}
+
+void blk_bench(int write, size_t io_bytes, unsigned int ms_per_depth)
+{
+    // Two runs would share the queue and skew each other: one at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("Disk benchmark already running");
+        return;
+    }
+    blk_bench_run(write, io_bytes, ms_per_depth);
+    atomic_store_release(&bench_busy, 0);
+}
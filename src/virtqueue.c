@@ -0,0 +1,492 @@
+/*
+ * Virtqueues Implementation
+ * Ring layouts follow the virtio 1.x specification. The MMU is off, so
+ * ring memory is identity mapped and uncached: barriers only have to
+ * order the accesses, and every shared field is read and written once
+ * through a volatile pointer at its natural alignment.
+ */
+
+#include "virtqueue.h"
+#include "kmalloc.h"
+#include "page.h"
+
+// Split descriptor flags
+#define VRING_DESC_F_NEXT       1
+#define VRING_DESC_F_WRITE      2
+
+// Split avail/used ring flags (without EVENT_IDX)
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+
+// Packed descriptor flags: AVAIL and USED against the wrap counters
+#define VRING_PACKED_DESC_F_AVAIL   (1 << 7)
+#define VRING_PACKED_DESC_F_USED    (1 << 15)
+
+// Packed event suppression
+#define VRING_PACKED_EVENT_ENABLE   0
+#define VRING_PACKED_EVENT_DISABLE  1
+#define VRING_PACKED_EVENT_DESC     2
+#define VRING_PACKED_WRAP_SHIFT     15
+
+#define LEGACY_ALIGN 4096               // Version 1 used ring alignment
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];                    // Then used_event
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];           // Then avail_event
+} vring_used_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} vring_packed_desc_t;
+
+typedef struct {
+    uint16_t off_wrap;
+    uint16_t flags;
+} vring_packed_event_t;
+
+#define vq_mb()  __asm__ volatile("dmb sy" ::: "memory")
+#define vq_wmb() __asm__ volatile("dmb st" ::: "memory")
+#define vq_rmb() __asm__ volatile("dmb ld" ::: "memory")
+
+static inline volatile vring_desc_t* split_desc(virtqueue_t* vq)
+{
+    return (volatile vring_desc_t*)vq->desc_addr;
+}
+
+static inline volatile vring_avail_t* split_avail(virtqueue_t* vq)
+{
+    return (volatile vring_avail_t*)vq->driver_addr;
+}
+
+static inline volatile vring_used_t* split_used(virtqueue_t* vq)
+{
+    return (volatile vring_used_t*)vq->device_addr;
+}
+
+static inline volatile uint16_t* split_used_event(virtqueue_t* vq)
+{
+    return &split_avail(vq)->ring[vq->size];
+}
+
+static inline volatile uint16_t* split_avail_event(virtqueue_t* vq)
+{
+    return (volatile uint16_t*)&split_used(vq)->ring[vq->size];
+}
+
+static inline volatile vring_packed_desc_t* packed_desc(virtqueue_t* vq)
+{
+    return (volatile vring_packed_desc_t*)vq->desc_addr;
+}
+
+static inline volatile vring_packed_event_t* packed_driver_event(virtqueue_t* vq)
+{
+    return (volatile vring_packed_event_t*)vq->driver_addr;
+}
+
+static inline volatile vring_packed_event_t* packed_device_event(virtqueue_t* vq)
+{
+    return (volatile vring_packed_event_t*)vq->device_addr;
+}
+
+// Has the index moved past 'event' in the step from 'old' to 'new'?
+static inline int vring_need_event(uint16_t event, uint16_t new, uint16_t old)
+{
+    return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+static uintptr_t align_up(uintptr_t value, uintptr_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+virtqueue_t* virtqueue_create(int index, uint16_t size, int packed, int event_idx, int legacy,
+                              vq_notify_fn_t notify, void* priv)
+{
+    if (size == 0 || size > VIRTQUEUE_MAX_SIZE || (size & (size - 1))) return NULL;
+    if (packed && legacy) return NULL;
+
+    // Ring areas, then the driver's bookkeeping, in one page run
+    size_t desc_bytes = (size_t)size * 16;
+    size_t driver_off = desc_bytes;
+    size_t device_off;
+    size_t ring_end;
+    if (packed) {
+        device_off = driver_off + sizeof(vring_packed_event_t);
+        ring_end = device_off + sizeof(vring_packed_event_t);
+    } else {
+        size_t avail_bytes = 6 + 2 * (size_t)size;
+        device_off = align_up(driver_off + avail_bytes, legacy ? LEGACY_ALIGN : 4);
+        ring_end = device_off + 6 + 8 * (size_t)size;
+    }
+    size_t tokens_off = align_up(ring_end, 8);
+    size_t ids_off = tokens_off + (size_t)size * sizeof(void*);
+    size_t total = ids_off + (packed ? 4 * (size_t)size : 0);
+    size_t page_count = (total + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    virtqueue_t* vq = kmalloc(sizeof(virtqueue_t));
+    if (!vq) return NULL;
+    void* pages = page_alloc(page_count);
+    if (!pages) {
+        kfree(vq);
+        return NULL;
+    }
+    memset(pages, 0, page_count * PAGE_SIZE);
+    memset(vq, 0, sizeof(*vq));
+
+    uintptr_t base = (uintptr_t)pages;
+    spin_lock_init(&vq->lock, "virtqueue");
+    vq->index = index;
+    vq->size = size;
+    vq->packed = packed;
+    vq->event_idx = event_idx;
+    vq->num_free = size;
+    vq->pages = pages;
+    vq->page_count = page_count;
+    vq->desc_addr = base;
+    vq->driver_addr = base + driver_off;
+    vq->device_addr = base + device_off;
+    vq->tokens = (void**)(base + tokens_off);
+    vq->notify = notify;
+    vq->priv = priv;
+
+    if (packed) {
+        vq->id_next = (uint16_t*)(base + ids_off);
+        vq->id_count = vq->id_next + size;
+        for (uint16_t i = 0; i < size; i++) {
+            vq->id_next[i] = i + 1;
+        }
+        vq->avail_wrap = 1;
+        vq->used_wrap = 1;
+        vq->avail_flags = VRING_PACKED_DESC_F_AVAIL;
+    } else {
+        volatile vring_desc_t* desc = split_desc(vq);
+        for (uint16_t i = 0; i + 1 < size; i++) {
+            desc[i].next = i + 1;
+        }
+    }
+    return vq;
+}
+
+void virtqueue_destroy(virtqueue_t* vq)
+{
+    if (!vq) return;
+    page_free(vq->pages, vq->page_count);
+    kfree(vq);
+}
+
+// --- Split ring ---
+
+static int split_add(virtqueue_t* vq, const vq_buf_t* bufs, int out, int in, void* token)
+{
+    volatile vring_desc_t* desc = split_desc(vq);
+    int total = out + in;
+    uint16_t head = vq->free_head;
+    uint16_t i = head;
+
+    // The free list is linked through 'next', so the chain follows it
+    for (int n = 0; n < total; n++) {
+        desc[i].addr = (uintptr_t)bufs[n].addr;
+        desc[i].len = bufs[n].len;
+        desc[i].flags = (n >= out ? VRING_DESC_F_WRITE : 0) |
+                        (n + 1 < total ? VRING_DESC_F_NEXT : 0);
+        i = desc[i].next;
+    }
+    vq->free_head = i;
+    vq->num_free -= total;
+    vq->tokens[head] = token;
+
+    // Entry is written now, the index only at the kick
+    split_avail(vq)->ring[vq->avail_idx & (vq->size - 1)] = head;
+    vq->avail_idx++;
+    vq->num_added++;
+    return 0;
+}
+
+static int split_kick(virtqueue_t* vq)
+{
+    uint16_t new = vq->avail_idx;
+    uint16_t old = new - vq->num_added;
+
+    vq_wmb();                           // Descriptors and entries before the index
+    split_avail(vq)->idx = new;
+    vq_mb();                            // Index before reading the device's wishes
+
+    if (vq->event_idx) {
+        return vring_need_event(*split_avail_event(vq), new, old);
+    }
+    return !(split_used(vq)->flags & VRING_USED_F_NO_NOTIFY);
+}
+
+static int split_has_used(virtqueue_t* vq)
+{
+    return vq->last_used != split_used(vq)->idx;
+}
+
+static void* split_get(virtqueue_t* vq, uint32_t* len)
+{
+    if (!split_has_used(vq)) return NULL;
+    vq_rmb();                           // Entry after the index that exposed it
+
+    volatile vring_used_elem_t* elem = &split_used(vq)->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = (uint16_t)elem->id;
+    if (len) *len = elem->len;
+    void* token = vq->tokens[head];
+
+    // Return the chain to the free list
+    volatile vring_desc_t* desc = split_desc(vq);
+    uint16_t i = head;
+    uint16_t count = 1;
+    while (desc[i].flags & VRING_DESC_F_NEXT) {
+        i = desc[i].next;
+        count++;
+    }
+    desc[i].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+    vq->last_used++;
+
+    // Interrupt again on the very next completion
+    if (vq->event_idx && !vq->cb_disabled) {
+        *split_used_event(vq) = vq->last_used;
+    }
+    return token;
+}
+
+// --- Packed ring ---
+
+static int packed_add(virtqueue_t* vq, const vq_buf_t* bufs, int out, int in, void* token)
+{
+    volatile vring_packed_desc_t* desc = packed_desc(vq);
+    int total = out + in;
+
+    uint16_t id = vq->free_id;
+    vq->free_id = vq->id_next[id];
+    vq->id_count[id] = total;
+    vq->tokens[id] = token;
+
+    uint16_t head = vq->next_avail;
+    uint16_t head_flags = 0;
+    uint16_t i = head;
+    for (int n = 0; n < total; n++) {
+        uint16_t flags = vq->avail_flags |
+                         (n >= out ? VRING_DESC_F_WRITE : 0) |
+                         (n + 1 < total ? VRING_DESC_F_NEXT : 0);
+        desc[i].addr = (uintptr_t)bufs[n].addr;
+        desc[i].len = bufs[n].len;
+        desc[i].id = id;
+        if (n == 0) {
+            head_flags = flags;
+        } else {
+            desc[i].flags = flags;
+        }
+
+        if (++i == vq->size) {
+            i = 0;
+            vq->avail_wrap ^= 1;
+            vq->avail_flags ^= VRING_PACKED_DESC_F_AVAIL | VRING_PACKED_DESC_F_USED;
+        }
+    }
+    vq->next_avail = i;
+    vq->num_free -= total;
+    vq->num_added += total;
+
+    // The head's flags hand the whole chain over, so they go last
+    vq_wmb();
+    desc[head].flags = head_flags;
+    return 0;
+}
+
+static int packed_kick(virtqueue_t* vq)
+{
+    uint16_t new = vq->next_avail;
+    uint16_t old = new - vq->num_added;
+
+    vq_mb();                            // Descriptors before reading the device's wishes
+    volatile vring_packed_event_t* event = packed_device_event(vq);
+    uint16_t flags = event->flags;
+    uint16_t off_wrap = event->off_wrap;
+
+    if (flags != VRING_PACKED_EVENT_DESC) {
+        return flags != VRING_PACKED_EVENT_DISABLE;
+    }
+
+    // Event index in the current lap's numbering
+    uint16_t event_idx = off_wrap & ~(1 << VRING_PACKED_WRAP_SHIFT);
+    if ((off_wrap >> VRING_PACKED_WRAP_SHIFT) != vq->avail_wrap) {
+        event_idx -= vq->size;
+    }
+    return vring_need_event(event_idx, new, old);
+}
+
+// Has the device written back the descriptor at 'index' in lap 'wrap'?
+static int packed_desc_used(virtqueue_t* vq, uint16_t index, int wrap)
+{
+    uint16_t flags = packed_desc(vq)[index].flags;
+    int avail = (flags & VRING_PACKED_DESC_F_AVAIL) != 0;
+    int used = (flags & VRING_PACKED_DESC_F_USED) != 0;
+    return avail == used && used == wrap;
+}
+
+static int packed_has_used(virtqueue_t* vq)
+{
+    return packed_desc_used(vq, vq->next_used, vq->used_wrap);
+}
+
+static void packed_set_used_event(virtqueue_t* vq, uint16_t index, int wrap)
+{
+    packed_driver_event(vq)->off_wrap = index | (uint16_t)(wrap << VRING_PACKED_WRAP_SHIFT);
+}
+
+static void* packed_get(virtqueue_t* vq, uint32_t* len)
+{
+    if (!packed_has_used(vq)) return NULL;
+    vq_rmb();                           // Id and length after the flags
+
+    volatile vring_packed_desc_t* desc = &packed_desc(vq)[vq->next_used];
+    uint16_t id = desc->id;
+    if (len) *len = desc->len;
+    void* token = vq->tokens[id];
+
+    uint16_t count = vq->id_count[id];
+    vq->id_next[id] = vq->free_id;
+    vq->free_id = id;
+    vq->num_free += count;
+
+    vq->next_used += count;
+    if (vq->next_used >= vq->size) {
+        vq->next_used -= vq->size;
+        vq->used_wrap ^= 1;
+    }
+
+    if (vq->event_idx && !vq->cb_disabled) {
+        packed_set_used_event(vq, vq->next_used, vq->used_wrap);
+    }
+    return token;
+}
+
+// --- Common interface ---
+
+int virtqueue_add(virtqueue_t* vq, const vq_buf_t* bufs, int out, int in, void* token)
+{
+    int total = out + in;
+    if (total == 0 || total > vq->num_free) {
+        vq->stats.full++;
+        return -1;
+    }
+
+    vq->stats.chains++;
+    return vq->packed ? packed_add(vq, bufs, out, in, token) : split_add(vq, bufs, out, in, token);
+}
+
+int virtqueue_kick(virtqueue_t* vq)
+{
+    if (vq->num_added == 0) return 0;
+
+    int needed = vq->packed ? packed_kick(vq) : split_kick(vq);
+    vq->num_added = 0;
+    vq->stats.kicks++;
+
+    if (!needed) {
+        vq->stats.suppressed++;
+        return 0;
+    }
+    vq->stats.notifies++;
+    vq->notify(vq);
+    return 1;
+}
+
+int virtqueue_has_used(virtqueue_t* vq)
+{
+    return vq->packed ? packed_has_used(vq) : split_has_used(vq);
+}
+
+void* virtqueue_get(virtqueue_t* vq, uint32_t* len)
+{
+    void* token = vq->packed ? packed_get(vq, len) : split_get(vq, len);
+    if (token) vq->stats.used++;
+    return token;
+}
+
+void virtqueue_disable_cb(virtqueue_t* vq)
+{
+    vq->cb_disabled = 1;
+
+    // With EVENT_IDX a stale used_event already keeps the split device quiet
+    if (vq->packed) {
+        packed_driver_event(vq)->flags = VRING_PACKED_EVENT_DISABLE;
+    } else if (!vq->event_idx) {
+        split_avail(vq)->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+int virtqueue_enable_cb(virtqueue_t* vq)
+{
+    vq->cb_disabled = 0;
+
+    if (vq->packed) {
+        if (vq->event_idx) {
+            packed_set_used_event(vq, vq->next_used, vq->used_wrap);
+            vq_wmb();
+            packed_driver_event(vq)->flags = VRING_PACKED_EVENT_DESC;
+        } else {
+            packed_driver_event(vq)->flags = VRING_PACKED_EVENT_ENABLE;
+        }
+    } else if (vq->event_idx) {
+        *split_used_event(vq) = vq->last_used;
+    } else {
+        split_avail(vq)->flags = 0;
+    }
+
+    // Completions that raced with re-enabling raise no interrupt
+    vq_mb();
+    return virtqueue_has_used(vq);
+}
+
+int virtqueue_enable_cb_delayed(virtqueue_t* vq)
+{
+    if (!vq->event_idx) return virtqueue_enable_cb(vq);
+
+    vq->cb_disabled = 0;
+    uint16_t pending = vq->size - vq->num_free;
+    uint16_t wait = (uint16_t)(pending * 3 / 4);
+
+    if (vq->packed) {
+        uint16_t index = vq->next_used + wait;
+        int wrap = vq->used_wrap;
+        if (index >= vq->size) {
+            index -= vq->size;
+            wrap ^= 1;
+        }
+        packed_set_used_event(vq, index, wrap);
+        vq_wmb();
+        packed_driver_event(vq)->flags = VRING_PACKED_EVENT_DESC;
+        vq_mb();
+        return packed_desc_used(vq, index, wrap);
+    }
+
+    *split_used_event(vq) = vq->last_used + wait;
+    vq_mb();
+    return (uint16_t)(split_used(vq)->idx - vq->last_used) > wait;
+}
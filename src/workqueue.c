@@ -0,0 +1,407 @@
+/*
+ * Work Queues Implementation
+ * Each CPU has a FIFO of work items under a lock and a worker thread
+ * pinned to it that parks in thread_block() when the FIFO is empty. The
+ * queuing side wakes it only when it has actually parked.
+ */
+
+#include "workqueue.h"
+#include "atomic.h"
+#include "cancel.h"
+#include "kmalloc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "timer.h"
+#include "uart.h"
+
+typedef struct {
+    spinlock_t lock;
+    work_t* head;
+    work_t* tail;
+    int worker;                 // Thread id, -1 if none
+    int parked;                 // Worker is waiting for work
+
+    // Statistics
+    unsigned long queued;
+    unsigned long executed;
+    unsigned long pending;
+    unsigned long cancelled;
+    uint64_t latency_ticks;     // Sum of queue-to-start times
+    uint64_t max_latency_ticks;
+    uint64_t run_ticks;         // Time spent in work functions
+} __attribute__((aligned(64))) work_pool_t;
+
+static work_pool_t pools[SMP_MAX_CPUS];
+
+static void worker_main(void* arg)
+{
+    work_pool_t* pool = arg;
+
+    while (1) {
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+        while (!pool->head) {
+            pool->parked = 1;
+            thread_block(&pool->lock);
+            spin_lock(&pool->lock);
+        }
+
+        work_t* work = pool->head;
+        pool->head = work->next;
+        if (!pool->head) pool->tail = NULL;
+        work->next = NULL;
+        pool->pending--;
+
+        uint64_t start = timer_ticks();
+        uint64_t latency = start - work->queued_at;
+        pool->latency_ticks += latency;
+        if (latency > pool->max_latency_ticks) pool->max_latency_ticks = latency;
+
+        // From here on it may be queued again, even by itself
+        work_fn_t fn = work->fn;
+        void* fn_arg = work->arg;
+        atomic_store_release(&work->pending, 0);
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        fn(fn_arg);
+
+        uint64_t ran = timer_ticks() - start;
+        flags = spin_lock_irqsave(&pool->lock);
+        pool->executed++;
+        pool->run_ticks += ran;
+        spin_unlock_irqrestore(&pool->lock, flags);
+    }
+}
+
+void workqueue_init(void)
+{
+    static const char* worker_names[SMP_MAX_CPUS] = {
+        "kworker/0", "kworker/1", "kworker/2", "kworker/3",
+        "kworker/4", "kworker/5", "kworker/6", "kworker/7"
+    };
+
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        work_pool_t* pool = &pools[cpu];
+        spin_lock_init_indexed(&pool->lock, "work", cpu);
+        pool->worker = -1;
+        if (!smp_cpu_online(cpu)) continue;
+
+        int id = thread_create(worker_names[cpu], worker_main, pool, 0);
+        if (id < 0) {
+            printf("Warning: no worker thread for CPU %d\n", cpu);
+            continue;
+        }
+        thread_set_affinity(id, 1U << cpu);
+        pool->worker = id;
+    }
+}
+
+void work_init(work_t* work, work_fn_t fn, void* arg)
+{
+    work->fn = fn;
+    work->arg = arg;
+    work->next = NULL;
+    work->pending = 0;
+    work->cpu = -1;
+    work->queued_at = 0;
+    ktimer_setup(&work->timer, NULL, NULL);
+}
+
+// Append an item already marked pending and wake the worker if parked
+static void pool_append(int cpu, work_t* work)
+{
+    work_pool_t* pool = &pools[cpu];
+
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+    work->cpu = cpu;
+    work->next = NULL;
+    work->queued_at = timer_ticks();
+    if (pool->tail) {
+        pool->tail->next = work;
+    } else {
+        pool->head = work;
+    }
+    pool->tail = work;
+    pool->queued++;
+    pool->pending++;
+
+    int wake = pool->parked;
+    pool->parked = 0;
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    if (wake) thread_wake(pool->worker);
+}
+
+static int cpu_has_worker(int cpu)
+{
+    return cpu >= 0 && cpu < SMP_MAX_CPUS && pools[cpu].worker >= 0;
+}
+
+int work_queue_on(int cpu, work_t* work)
+{
+    if (!work->fn || !cpu_has_worker(cpu)) return -1;
+    if (atomic_swap32(&work->pending, 1) != 0) return -1;
+
+    pool_append(cpu, work);
+    return 0;
+}
+
+int work_queue(work_t* work)
+{
+    unsigned long flags = irq_save();
+    int cpu = smp_cpu_id();
+    irq_restore(flags);
+    return work_queue_on(cpu, work);
+}
+
+// Timer callback (IRQ context) for delayed work
+static void delayed_fire(void* arg)
+{
+    work_t* work = arg;
+    pool_append(work->cpu, work);
+}
+
+int work_queue_delayed(work_t* work, unsigned int ms)
+{
+    unsigned long flags = irq_save();
+    int cpu = smp_cpu_id();
+
+    if (!work->fn || !cpu_has_worker(cpu) || atomic_swap32(&work->pending, 1) != 0) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    // Armed on this CPU, so it fires here and is queued to this CPU's worker
+    work->cpu = cpu;
+    ktimer_setup(&work->timer, delayed_fire, work);
+    if (ktimer_add(&work->timer, ms) != 0) {
+        atomic_store_release(&work->pending, 0);
+        irq_restore(flags);
+        return -1;
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+int work_cancel(work_t* work)
+{
+    if (!atomic_load_acquire(&work->pending)) return 0;
+
+    // Still waiting on its timer
+    if (ktimer_cancel(&work->timer)) {
+        atomic_store_release(&work->pending, 0);
+        return 1;
+    }
+
+    if (!cpu_has_worker(work->cpu)) return 0;
+    work_pool_t* pool = &pools[work->cpu];
+
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+    work_t* prev = NULL;
+    work_t* item = pool->head;
+    while (item && item != work) {
+        prev = item;
+        item = item->next;
+    }
+    if (item) {
+        if (prev) {
+            prev->next = item->next;
+        } else {
+            pool->head = item->next;
+        }
+        if (pool->tail == item) pool->tail = prev;
+        item->next = NULL;
+        pool->pending--;
+        pool->cancelled++;
+        atomic_store_release(&work->pending, 0);
+    }
+    spin_unlock_irqrestore(&pool->lock, flags);
+    return item != NULL;
+}
+
+void workqueue_print(void)
+{
+    puts("Work queues:");
+    puts("  CPU  WORKER  PENDING  QUEUED      EXECUTED    CANCELLED  AVG LAT(us) MAX LAT(us) RUN(ms)");
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        work_pool_t* pool = &pools[cpu];
+        if (pool->worker < 0) continue;
+
+        // Snapshot so the columns agree with each other
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+        work_pool_t snap = *pool;
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        unsigned long started = snap.queued - snap.pending - snap.cancelled;
+        printf("  ");
+        print_uint_padded(cpu, 5);
+        print_uint_padded(snap.worker, 8);
+        print_uint_padded(snap.pending, 9);
+        print_uint_padded(snap.queued, 12);
+        print_uint_padded(snap.executed, 12);
+        print_uint_padded(snap.cancelled, 11);
+        print_uint_padded(started ? (unsigned long)timer_ticks_to_us(snap.latency_ticks / started) : 0, 12);
+        print_uint_padded((unsigned long)timer_ticks_to_us(snap.max_latency_ticks), 12);
+        printf("%lu\n", (unsigned long)(timer_ticks_to_us(snap.run_ticks) / 1000));
+    }
+    puts("");
+    ktimer_print();
+}
+
+void workqueue_reset_stats(void)
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        work_pool_t* pool = &pools[cpu];
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+        pool->queued = pool->pending;   // Keep started = queued - pending - cancelled sane
+        pool->executed = 0;
+        pool->cancelled = 0;
+        pool->latency_ticks = 0;
+        pool->max_latency_ticks = 0;
+        pool->run_ticks = 0;
+        spin_unlock_irqrestore(&pool->lock, flags);
+    }
+    ktimer_reset_stats();
+}
+
+// --- Benchmark ---
+
+#define BENCH_SLOTS    64
+#define BENCH_DELAYED  16
+
+typedef struct {
+    work_t work;
+    uint64_t due;               // Counter value it was sent (or should fire)
+    volatile uint32_t busy;
+} bench_slot_t;
+
+static volatile uint32_t bench_busy;    // A run is in progress
+static volatile uint64_t bench_done;
+static volatile uint64_t bench_latency_sum;
+static volatile uint64_t bench_latency_max;
+
+static void bench_record(void* arg)
+{
+    bench_slot_t* slot = arg;
+    uint64_t now = timer_ticks();
+    uint64_t latency = now > slot->due ? now - slot->due : 0;
+
+    atomic_fetch_add64(&bench_latency_sum, latency);
+    uint64_t max = atomic_load_relaxed(&bench_latency_max);
+    while (latency > max && !atomic_cas64(&bench_latency_max, max, latency)) {
+        max = atomic_load_relaxed(&bench_latency_max);
+    }
+    atomic_fetch_add64(&bench_done, 1);
+    atomic_store_release(&slot->busy, 0);
+}
+
+static void bench_reset_counters(void)
+{
+    bench_done = 0;
+    bench_latency_sum = 0;
+    bench_latency_max = 0;
+}
+
+/*
+ * Immediate work: 'items' empty items sent round-robin to every worker
+ * from BENCH_SLOTS reusable slots. Delayed work: BENCH_DELAYED items at
+ * 10, 20, ... ms, measuring how late each one starts.
+ */
+static void workqueue_bench_run(unsigned long items)
+{
+    if (!cpu_has_worker(0)) {
+        puts("Work queues not running");
+        return;
+    }
+
+    bench_slot_t* slots = kmalloc(sizeof(bench_slot_t) * BENCH_SLOTS);
+    if (!slots) {
+        puts("Error: out of memory");
+        return;
+    }
+    for (int i = 0; i < BENCH_SLOTS; i++) {
+        work_init(&slots[i].work, bench_record, &slots[i]);
+        slots[i].busy = 0;
+    }
+
+    puts("=== Work Queue Benchmark ===");
+    printf("Workers: %d, immediate items: %lu\n\n", smp_cpus_online(), items);
+
+    bench_reset_counters();
+    int cpu = 0;
+    uint64_t start = timer_ticks();
+    unsigned long sent;
+    for (sent = 0; sent < items && !cancel_requested(); sent++) {
+        unsigned long i = sent;
+        bench_slot_t* slot = &slots[i % BENCH_SLOTS];
+        while (atomic_load_acquire(&slot->busy)) {
+            thread_yield();
+        }
+
+        do {
+            cpu = (cpu + 1) % SMP_MAX_CPUS;
+        } while (!cpu_has_worker(cpu));
+
+        slot->busy = 1;
+        slot->due = timer_ticks();
+        if (work_queue_on(cpu, &slot->work) != 0) {
+            slot->busy = 0;
+            bench_done++;
+        }
+    }
+    // Items already queued always finish; the slots must not be freed under them
+    while (atomic_load_acquire(&bench_done) < sent) {
+        thread_yield();
+    }
+    uint64_t ns = timer_ticks_to_ns(timer_ticks() - start);
+    if (ns == 0) ns = 1;
+
+    printf("Immediate: %lu items/s, queue-to-start latency avg %lu us, max %lu us\n",
+           (unsigned long)(sent * 1000000000UL / ns),
+           sent ? (unsigned long)timer_ticks_to_us(bench_latency_sum / sent) : 0,
+           (unsigned long)timer_ticks_to_us(bench_latency_max));
+    if (sent < items) {
+        printf("Interrupted after %lu of %lu items\n", sent, items);
+        kfree(slots);
+        return;
+    }
+
+    if (!timer_tick_running()) {
+        puts("Delayed:   skipped (no timer tick)");
+        kfree(slots);
+        return;
+    }
+
+    bench_reset_counters();
+    int armed = 0;
+    for (int i = 0; i < BENCH_DELAYED; i++) {
+        unsigned int ms = 10 * (i + 1);
+        slots[i].busy = 1;
+        slots[i].due = timer_ticks() + timer_ms_to_ticks(ms);
+        if (work_queue_delayed(&slots[i].work, ms) == 0) {
+            armed++;
+        } else {
+            slots[i].busy = 0;
+        }
+    }
+    while (atomic_load_acquire(&bench_done) < (uint64_t)armed) {
+        thread_sleep(10);
+    }
+
+    printf("Delayed:   %d items at 10-%d ms, start after deadline avg %lu us, max %lu us\n",
+           armed, 10 * BENCH_DELAYED,
+           armed ? (unsigned long)timer_ticks_to_us(bench_latency_sum / armed) : 0,
+           (unsigned long)timer_ticks_to_us(bench_latency_max));
+    kfree(slots);
+}
+
+void workqueue_bench(unsigned long items)
+{
+    // The slots and counters are file-level statics: one run at a time
+    if (atomic_swap32(&bench_busy, 1)) {
+        puts("Work queue benchmark already running");
+        return;
+    }
+    workqueue_bench_run(items);
+    atomic_store_release(&bench_busy, 0);
+}
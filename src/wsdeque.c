@@ -0,0 +1,91 @@
+/*
+ * Work-Stealing Deque Implementation
+ * Chase-Lev with the weak-memory-model orderings from Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP'13).
+ * The buffer never grows: each item (a thread) is in at most one deque.
+ */
+
+#include "wsdeque.h"
+#include "atomic.h"
+
+void wsdeque_init(wsdeque_t* q)
+{
+    q->top = 0;
+    q->bottom = 0;
+    for (int i = 0; i < WSDEQUE_SIZE; i++) {
+        q->items[i] = NULL;
+    }
+}
+
+/*
+ * Add an item at the bottom - returns -1 if full
+ */
+int wsdeque_push(wsdeque_t* q, void* item)
+{
+    uint64_t b = atomic_load_relaxed(&q->bottom);
+    uint64_t t = atomic_load_acquire(&q->top);
+    if (b - t >= WSDEQUE_SIZE) return -1;
+
+    q->items[b & WSDEQUE_MASK] = item;
+    // Publish the item before the new bottom
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    atomic_store_relaxed(&q->bottom, b + 1);
+    return 0;
+}
+
+/*
+ * Take the most recently pushed item (LIFO end) - NULL if empty
+ */
+void* wsdeque_pop(wsdeque_t* q)
+{
+    uint64_t b = atomic_load_relaxed(&q->bottom);
+    uint64_t t = atomic_load_relaxed(&q->top);
+    if (b == t) return NULL;
+
+    b--;
+    atomic_store_relaxed(&q->bottom, b);
+    atomic_fence();
+    t = atomic_load_relaxed(&q->top);
+
+    void* item = NULL;
+    if ((int64_t)(b - t) >= 0) {
+        item = q->items[b & WSDEQUE_MASK];
+        if (b == t) {
+            // Last item - race the thieves for it
+            if (!atomic_cas64(&q->top, t, t + 1)) {
+                item = NULL;
+            }
+            atomic_store_relaxed(&q->bottom, b + 1);
+        }
+    } else {
+        atomic_store_relaxed(&q->bottom, b + 1);
+    }
+    return item;
+}
+
+/*
+ * Take the oldest item (FIFO end)
+ */
+int wsdeque_steal(wsdeque_t* q, void** item)
+{
+    uint64_t t = atomic_load_acquire(&q->top);
+    atomic_fence();
+    uint64_t b = atomic_load_acquire(&q->bottom);
+
+    if ((int64_t)(b - t) <= 0) return WSDEQUE_EMPTY;
+
+    void* candidate = q->items[t & WSDEQUE_MASK];
+    if (!atomic_cas64(&q->top, t, t + 1)) return WSDEQUE_ABORT;
+
+    *item = candidate;
+    return WSDEQUE_OK;
+}
+
+/*
+ * Approximate number of items (exact only when quiescent)
+ */
+int wsdeque_size(const wsdeque_t* q)
+{
+    int64_t size = (int64_t)(atomic_load_relaxed(&q->bottom) - atomic_load_relaxed(&q->top));
+    return size > 0 ? (int)size : 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * lineedit_test - Line Editor Rendering Test (host tool)
+ * Runs src/lineedit.c against a model of a VT100-style terminal (80
+ * columns, deferred wrap at the last column, scrolling at the bottom) and
+ * checks after every refresh that the screen shows the prompt and the
+ * line wrapped at LINEEDIT_COLUMNS, with the cursor on the edit position.
+ *
+ * Usage: build/lineedit_test [seed] [edits]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lineedit.h"
+
+#define ROWS        24
+#define COLS        LINEEDIT_COLUMNS
+#define PROMPT      "OS> "
+#define TEXT_MAX    400             // Five rows: enough to wrap and to scroll
+
+// --- Terminal model ---
+
+static char screen[ROWS][COLS];
+static int cur_row, cur_col;
+static int wrap_pending;            // Last column written, next character wraps
+static int scrolled;                // Rows scrolled off the top so far
+
+static enum { TERM_TEXT, TERM_ESC, TERM_CSI } term_state;
+static int csi_param;
+
+static void term_clear(void)
+{
+    memset(screen, ' ', sizeof(screen));
+    cur_row = cur_col = wrap_pending = scrolled = 0;
+    term_state = TERM_TEXT;
+}
+
+static void term_line_feed(void)
+{
+    if (cur_row < ROWS - 1) {
+        cur_row++;
+        return;
+    }
+    memmove(screen[0], screen[1], (ROWS - 1) * COLS);
+    memset(screen[ROWS - 1], ' ', COLS);
+    scrolled++;
+}
+
+static void term_csi(char final)
+{
+    int n = csi_param > 0 ? csi_param : 1;
+
+    wrap_pending = 0;
+    switch (final) {
+    case 'A': cur_row = cur_row - n < 0 ? 0 : cur_row - n; break;
+    case 'B': cur_row = cur_row + n > ROWS - 1 ? ROWS - 1 : cur_row + n; break;
+    case 'C': cur_col = cur_col + n > COLS - 1 ? COLS - 1 : cur_col + n; break;
+    case 'D': cur_col = cur_col - n < 0 ? 0 : cur_col - n; break;
+    case '@':                       // ICH: cells shifted past the edge are lost
+        if (n > COLS - cur_col) n = COLS - cur_col;
+        memmove(&screen[cur_row][cur_col + n], &screen[cur_row][cur_col], COLS - cur_col - n);
+        memset(&screen[cur_row][cur_col], ' ', n);
+        break;
+    case 'P':                       // DCH: blanks come in from the edge
+        if (n > COLS - cur_col) n = COLS - cur_col;
+        memmove(&screen[cur_row][cur_col], &screen[cur_row][cur_col + n], COLS - cur_col - n);
+        memset(&screen[cur_row][COLS - n], ' ', n);
+        break;
+    case 'K':                       // EL 0
+        memset(&screen[cur_row][cur_col], ' ', COLS - cur_col);
+        break;
+    case 'J':                       // ED 0
+        memset(&screen[cur_row][cur_col], ' ', COLS - cur_col);
+        for (int r = cur_row + 1; r < ROWS; r++) memset(screen[r], ' ', COLS);
+        break;
+    default:
+        printf("unexpected CSI final '%c'\n", final);
+        exit(1);
+    }
+}
+
+static void term_byte(char c)
+{
+    if (term_state == TERM_ESC) {
+        term_state = c == '[' ? TERM_CSI : TERM_TEXT;
+        csi_param = 0;
+        return;
+    }
+    if (term_state == TERM_CSI) {
+        if (c >= '0' && c <= '9') {
+            csi_param = csi_param * 10 + (c - '0');
+        } else {
+            term_state = TERM_TEXT;
+            term_csi(c);
+        }
+        return;
+    }
+
+    switch (c) {
+    case '\x1b': term_state = TERM_ESC; break;
+    case '\r': cur_col = 0; wrap_pending = 0; break;
+    case '\n': term_line_feed(); wrap_pending = 0; break;
+    case '\b': if (cur_col > 0) cur_col--; wrap_pending = 0; break;
+    case '\x07': break;
+    default:
+        if (wrap_pending) {
+            cur_col = 0;
+            term_line_feed();
+            wrap_pending = 0;
+        }
+        screen[cur_row][cur_col] = c;
+        if (cur_col == COLS - 1) {
+            wrap_pending = 1;
+        } else {
+            cur_col++;
+        }
+    }
+}
+
+static unsigned long bytes_sent;
+
+// The editor's putchar; like the UART driver, '\n' goes out as "\n\r"
+void term_putchar(char c)
+{
+    bytes_sent++;
+    term_byte(c);
+    if (c == '\n') term_byte('\r');
+}
+
+static void term_print(const char* s)
+{
+    while (*s) term_putchar(*s++);
+}
+
+// --- Checks ---
+
+static line_editor_t editor;
+static char model[TEXT_MAX + 1];    // What the line should hold
+static int model_len, model_cursor;
+static int prompt_row;              // Screen row of the prompt before any scrolling
+static int origin;
+static unsigned long checks;
+
+static void fail(const char* what, int step)
+{
+    printf("FAIL at edit %d: %s\n", step, what);
+    printf("line (%d chars, cursor %d): %s\n", model_len, model_cursor, model);
+    printf("cursor at row %d col %d%s, screen:\n", cur_row, cur_col, wrap_pending ? " (wrap pending)" : "");
+    for (int r = 0; r < ROWS; r++) printf("|%.*s|\n", COLS, screen[r]);
+    exit(1);
+}
+
+static void check_screen(int step)
+{
+    int top = prompt_row - scrolled;
+    if (top < 0) fail("prompt scrolled off the screen", step);
+
+    // Prompt, line, then blanks to the bottom of the screen
+    char expect[ROWS * COLS];
+    memset(expect, ' ', sizeof(expect));
+    memcpy(expect, PROMPT, origin);
+    memcpy(expect + origin, model, model_len);
+    if (memcmp(screen[top], expect, (ROWS - top) * COLS) != 0) fail("screen differs from the line", step);
+
+    int pos = origin + model_cursor;
+    if (wrap_pending) fail("cursor left with a wrap pending", step);
+    if (cur_row != top + pos / COLS || cur_col != pos % COLS) fail("cursor not at the edit position", step);
+
+    if (lineedit_length(&editor) != model_len || lineedit_cursor(&editor) != model_cursor) {
+        fail("editor state differs from the model", step);
+    }
+    checks++;
+}
+
+static void start_line(int row)
+{
+    term_clear();
+    for (int r = 0; r < row; r++) term_print("\n");
+    prompt_row = row;
+    term_print(PROMPT);
+    origin = (int)strlen(PROMPT);
+    lineedit_begin(&editor, TEXT_MAX, origin);
+    model_len = model_cursor = 0;
+    model[0] = '\0';
+}
+
+static void model_insert(char c)
+{
+    if (model_len >= TEXT_MAX) return;
+    memmove(model + model_cursor + 1, model + model_cursor, model_len - model_cursor + 1);
+    model[model_cursor++] = c;
+    model_len++;
+}
+
+static void model_remove(int at)
+{
+    memmove(model + at, model + at + 1, model_len - at);
+    model_len--;
+}
+
+// One random edit applied to both the editor and the model
+static void random_edit(void)
+{
+    int op = rand() % 100;
+
+    if (op < 45) {
+        char c = 'a' + rand() % 26;
+        lineedit_insert(&editor, c);
+        model_insert(c);
+    } else if (op < 55) {
+        if (lineedit_backspace(&editor) == 0) model_remove(--model_cursor);
+    } else if (op < 65) {
+        if (lineedit_delete(&editor) == 0) model_remove(model_cursor);
+    } else if (op < 85) {
+        // Mostly short hops, sometimes across rows or to either end
+        int target = rand() % 4 == 0 ? rand() % (model_len + 1)
+                                     : model_cursor + rand() % 5 - 2;
+        if (target < 0) target = 0;
+        if (target > model_len) target = model_len;
+        lineedit_move_to(&editor, target);
+        model_cursor = target;
+    } else if (op < 90) {
+        // History recall: a whole new line, often across a row boundary
+        int len = rand() % 3 == 0 ? rand() % 12 : rand() % (TEXT_MAX - 100);
+        for (int i = 0; i < len; i++) model[i] = 'A' + rand() % 26;
+        model[len] = '\0';
+        lineedit_set_text(&editor, model);
+        model_len = model_cursor = len;
+    } else if (op < 95) {
+        // Paste-like burst of text at the cursor
+        char burst[32];
+        int len = 1 + rand() % 30;
+        for (int i = 0; i < len; i++) burst[i] = '0' + rand() % 10;
+        burst[len] = '\0';
+        lineedit_insert_string(&editor, burst);
+        for (int i = 0; i < len; i++) model_insert(burst[i]);
+    } else {
+        // Completion listing: output below the line, then a fresh prompt
+        lineedit_finish(&editor);
+        if (cur_row != prompt_row - scrolled + (origin + model_len) / COLS) {
+            fail("finish left the cursor above the end of the line", -1);
+        }
+        term_print("\n");
+        prompt_row = cur_row + scrolled;
+        term_print(PROMPT);
+        lineedit_invalidate(&editor);
+    }
+}
+
+// Typing past column 80, then editing on both sides of the row boundary
+static void wrap_scenario(void)
+{
+    start_line(0);
+    for (int i = 0; i < 100; i++) {
+        char c = 'a' + i % 26;
+        lineedit_insert(&editor, c);
+        model_insert(c);
+        lineedit_refresh(&editor);
+        check_screen(i);
+    }
+
+    // Left across the boundary, insert and delete there, then back right
+    for (int step = 0; step < 40; step++) {
+        lineedit_move_to(&editor, --model_cursor);
+        lineedit_refresh(&editor);
+        check_screen(100 + step);
+    }
+    lineedit_insert(&editor, 'X');
+    model_insert('X');
+    lineedit_refresh(&editor);
+    check_screen(140);
+    lineedit_backspace(&editor);
+    model_remove(--model_cursor);
+    lineedit_refresh(&editor);
+    check_screen(141);
+    lineedit_delete(&editor);
+    model_remove(model_cursor);
+    lineedit_refresh(&editor);
+    check_screen(142);
+    lineedit_move_to(&editor, model_len);
+    model_cursor = model_len;
+    lineedit_refresh(&editor);
+    check_screen(143);
+
+    // Shrink back onto the prompt row: the second row must be erased
+    lineedit_set_text(&editor, "short");
+    strcpy(model, "short");
+    model_len = model_cursor = 5;
+    lineedit_refresh(&editor);
+    check_screen(144);
+
+    // Exactly fill the prompt row, so the cursor sits at the start of the next
+    lineedit_set_text(&editor, "");
+    model_len = model_cursor = 0;
+    model[0] = '\0';
+    for (int i = 0; i < COLS - origin; i++) {
+        lineedit_insert(&editor, '#');
+        model_insert('#');
+    }
+    lineedit_refresh(&editor);
+    check_screen(145);
+
+    lineedit_erase(&editor);
+    for (int r = 0; r < ROWS; r++) {
+        for (int c = 0; c < COLS; c++) {
+            if (screen[r][c] != ' ') fail("erase left text on the screen", 146);
+        }
+    }
+    if (cur_row != 0 || cur_col != 0) fail("erase did not return to the prompt row", 146);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned seed = argc > 1 ? (unsigned)atoi(argv[1]) : 1;
+    int edits = argc > 2 ? atoi(argv[2]) : 20000;
+
+    wrap_scenario();
+
+    // Random edits, starting near the bottom so long lines scroll the screen
+    srand(seed);
+    start_line(ROWS - 6);
+    for (int step = 0; step < edits; step++) {
+        if (prompt_row - scrolled > ROWS - 6) {
+            // Keep room for a full-length line below the prompt
+            start_line(ROWS - 6);
+        }
+        random_edit();
+        lineedit_refresh(&editor);
+        check_screen(step);
+    }
+
+    printf("lineedit: %lu screens checked, %lu bytes sent, OK\n", checks, bytes_sent);
+    return 0;
+}
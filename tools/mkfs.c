@@ -0,0 +1,217 @@
+/*
+ * mkfs - Format a Disk Image (host tool)
+ * Creates an empty filesystem image, optionally with files copied into
+ * the root directory, each in one contiguous extent.
+ *
+ * Usage: build/mkfs <image> <size MB> [files...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_format.h"
+
+static uint8_t* image;
+static uint64_t total_blocks;
+static fs_super_t* super;
+
+static uint8_t* block_at(uint64_t block)
+{
+    return image + block * FS_BLOCK_SIZE;
+}
+
+static void mark_used(uint64_t start, uint64_t count)
+{
+    for (uint64_t b = start; b < start + count; b++) {
+        uint8_t* bitmap = block_at(super->bitmap_start);
+        bitmap[b / 8] |= 1 << (b % 8);
+    }
+    super->free_blocks -= count;
+}
+
+static fs_inode_t* inode_at(uint32_t ino)
+{
+    return (fs_inode_t*)(block_at(super->inode_start + ino / FS_INODES_PER_BLOCK) +
+                         (ino % FS_INODES_PER_BLOCK) * FS_INODE_SIZE);
+}
+
+// Same probing as the kernel: the name's bucket, then onwards
+static int dir_place(fs_inode_t* dir, const char* name, uint32_t ino)
+{
+    int len = strlen(name);
+    uint32_t hash = fs_name_hash(name, len);
+    for (uint32_t i = 0; i < dir->blocks; i++) {
+        uint8_t* block = block_at(dir->extents[0].start + ((hash + i) & (dir->blocks - 1)));
+        fs_dirhead_t* head = (fs_dirhead_t*)block;
+        if (head->count == FS_DIRENTS_PER_BLOCK) {
+            head->overflow = 1;
+            continue;
+        }
+        fs_dirent_t* slots = (fs_dirent_t*)block;
+        for (int s = 1; s <= FS_DIRENTS_PER_BLOCK; s++) {
+            if (slots[s].inode == 0) {
+                slots[s].inode = ino;
+                slots[s].hash = hash;
+                slots[s].type = FS_TYPE_FILE;
+                slots[s].name_len = len;
+                memcpy(slots[s].name, name, len);
+                head->count++;
+                dir->entries++;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+static int add_file(const char* path, uint32_t ino, uint64_t* next_block)
+{
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (strlen(name) == 0 || strlen(name) > FS_NAME_MAX) {
+        fprintf(stderr, "mkfs: %s: bad name\n", path);
+        return -1;
+    }
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint64_t blocks = (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    if (*next_block + blocks > total_blocks) {
+        fprintf(stderr, "mkfs: %s: image is full\n", path);
+        fclose(f);
+        return -1;
+    }
+    if (size > 0 && fread(block_at(*next_block), 1, size, f) != (size_t)size) {
+        perror(path);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    fs_inode_t* inode = inode_at(ino);
+    inode->type = FS_TYPE_FILE;
+    inode->links = 1;
+    inode->size = size;
+    inode->blocks = blocks;
+    if (blocks) {
+        inode->extent_count = 1;
+        inode->extents[0].start = *next_block;
+        inode->extents[0].length = blocks;
+        mark_used(*next_block, blocks);
+        *next_block += blocks;
+    }
+    if (dir_place(inode_at(FS_ROOT_INODE), name, ino) != 0) {
+        fprintf(stderr, "mkfs: %s: root directory is full\n", path);
+        return -1;
+    }
+    super->free_inodes--;
+    printf("  %s: %ld bytes\n", name, size);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <image> <size MB> [files...]\n", argv[0]);
+        return 1;
+    }
+    long mb = atol(argv[2]);
+    if (mb < 1 || mb > 65536) {
+        fprintf(stderr, "mkfs: size must be 1-65536 MB\n");
+        return 1;
+    }
+    int files = argc - 3;
+
+    total_blocks = (uint64_t)mb * 1024 * 1024 / FS_BLOCK_SIZE;
+    image = calloc(total_blocks, FS_BLOCK_SIZE);
+    if (!image) {
+        fprintf(stderr, "mkfs: out of memory\n");
+        return 1;
+    }
+
+    // Layout: superblock, bitmap, inode table, data
+    uint32_t bitmap_blocks = (total_blocks + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+    uint32_t inodes = total_blocks / 4;
+    if (inodes < 64) {
+        inodes = 64;
+    }
+    if (inodes < (uint32_t)files + 2) {
+        inodes = files + 2;
+    }
+    inodes = (inodes + FS_INODES_PER_BLOCK - 1) / FS_INODES_PER_BLOCK * FS_INODES_PER_BLOCK;
+    uint32_t inode_blocks = inodes / FS_INODES_PER_BLOCK;
+
+    // Root directory buckets: a power of two, at most three quarters full
+    uint32_t buckets = 1;
+    while ((uint64_t)files * 4 > (uint64_t)buckets * FS_DIRENTS_PER_BLOCK * 3) {
+        buckets *= 2;
+    }
+
+    super = (fs_super_t*)block_at(0);
+    super->magic = FS_MAGIC;
+    super->version = FS_VERSION;
+    super->block_size = FS_BLOCK_SIZE;
+    super->blocks = total_blocks;
+    super->free_blocks = total_blocks;
+    super->inodes = inodes;
+    super->free_inodes = inodes - 2;        // Inode 0 and the root
+    super->bitmap_start = 1;
+    super->bitmap_blocks = bitmap_blocks;
+    super->inode_start = 1 + bitmap_blocks;
+    super->inode_blocks = inode_blocks;
+    super->data_start = super->inode_start + inode_blocks;
+    super->root = FS_ROOT_INODE;
+    if (super->data_start + buckets > total_blocks) {
+        fprintf(stderr, "mkfs: image too small\n");
+        return 1;
+    }
+
+    // Bits past the end of the disk count as used
+    uint8_t* bitmap = block_at(super->bitmap_start);
+    for (uint64_t b = total_blocks; b < (uint64_t)bitmap_blocks * FS_BITS_PER_BLOCK; b++) {
+        bitmap[b / 8] |= 1 << (b % 8);
+    }
+    mark_used(0, super->data_start);
+
+    fs_inode_t* root = inode_at(FS_ROOT_INODE);
+    root->type = FS_TYPE_DIR;
+    root->links = 1;
+    root->blocks = buckets;
+    root->size = (uint64_t)buckets * FS_BLOCK_SIZE;
+    root->extent_count = 1;
+    root->extents[0].start = super->data_start;
+    root->extents[0].length = buckets;
+    mark_used(super->data_start, buckets);
+
+    uint64_t next_block = super->data_start + buckets;
+    for (int i = 0; i < files; i++) {
+        if (add_file(argv[3 + i], FS_ROOT_INODE + 1 + i, &next_block) != 0) {
+            return 1;
+        }
+    }
+
+    FILE* out = fopen(argv[1], "wb");
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fwrite(image, FS_BLOCK_SIZE, total_blocks, out) != total_blocks) {
+        perror(argv[1]);
+        fclose(out);
+        return 1;
+    }
+    fclose(out);
+
+    printf("%s: %ld MB, %lu blocks, %u inodes, %d files, %lu KB free\n",
+           argv[1], mb, (unsigned long)total_blocks, inodes, files,
+           (unsigned long)super->free_blocks * (FS_BLOCK_SIZE / 1024));
+    return 0;
+}